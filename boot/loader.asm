@@ -146,7 +146,8 @@ Read_Disk:
     push ax
     push cx
 
-    mov cx, 2
+    ;每次读 0x70 个扇区，内核最大 4 * 0x70 = 448 扇区，加载到 0x20000 ~ 0x58000
+    mov cx, 4
     reread:
         mov si,DiskAddressPacket
         mov ah,0x42
@@ -0,0 +1,524 @@
+#include <rdix/syscall.h>
+#include <rdix/hardware.h>
+#include <common/stdio.h>
+#include <common/string.h>
+#include <common/stdlib.h>
+#include <rdix/kernel.h>
+#include <rdix/ulock.h>
+#include <rdix/vdso.h>
+#include <rdix/uring.h>
+#include <fs/fs.h>
+
+#define BENCH_LOOPS 10000
+#define LOCK_THREADS 4
+#define SPAWN_LOOPS 100
+#define PIPE_CHUNK 1024
+#define PIPE_KBYTES 1024
+#define SHM_LOOPS 1000
+#define SHM_BENCH_SIZE (64 * 1024)
+#define URING_DEPTH 8
+
+/* 空系统调用 getpid 的往返延迟，单位为 tsc 周期 */
+static void bench_syscall(int loops)
+{
+    u64 start;
+    u32 cycles;
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+        syscall_int80(SYS_NR_GETPID, 0, 0, 0);
+    cycles = (u32)(rdtsc() - start);
+    printf("getpid int 0x80: %u cycles/call\n", cycles / loops);
+
+    if (!sysenter_supported())
+    {
+        printf("getpid sysenter: not supported\n");
+        return;
+    }
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+        syscall_sysenter(SYS_NR_GETPID, 0, 0, 0);
+    cycles = (u32)(rdtsc() - start);
+    printf("getpid sysenter: %u cycles/call\n", cycles / loops);
+}
+
+/* 锁竞争测试的共享数据放在 shell 的栈上，由线程通过参数访问 */
+typedef struct lock_bench_t
+{
+    umutex_t mutex;
+    usem_t done;
+    volatile u32 counter;
+    int loops;
+} lock_bench_t;
+
+static void *lock_worker(void *arg)
+{
+    lock_bench_t *lb = (lock_bench_t *)arg;
+
+    for (int i = 0; i < lb->loops; ++i)
+    {
+        umutex_lock(&lb->mutex);
+        ++lb->counter;
+        /* 单处理器上只有持锁时被切换才会产生竞争，这里主动制造 */
+        if ((i & 63) == 0)
+            yield();
+        umutex_unlock(&lb->mutex);
+    }
+
+    usem_post(&lb->done);
+    return NULL;
+}
+
+/* 无竞争时加解锁不陷入内核，有竞争时通过 futex 睡眠和唤醒 */
+static void bench_lock(int loops)
+{
+    lock_bench_t lb;
+    u64 start;
+    u32 cycles;
+    int threads = 0;
+
+    umutex_init(&lb.mutex);
+    usem_init(&lb.done, 0);
+    lb.counter = 0;
+    lb.loops = loops;
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+    {
+        umutex_lock(&lb.mutex);
+        umutex_unlock(&lb.mutex);
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("uncontended lock/unlock: %u cycles/pair\n", cycles / loops);
+
+    start = rdtsc();
+    for (int i = 0; i < LOCK_THREADS; ++i)
+    {
+        if (clone(lock_worker, &lb) == EOF)
+            break;
+        ++threads;
+    }
+    for (int i = 0; i < threads; ++i)
+        usem_wait(&lb.done);
+    cycles = (u32)(rdtsc() - start);
+
+    if (threads == 0)
+    {
+        printf("contended: clone failed\n");
+        return;
+    }
+    printf("contended %d threads: %u cycles/pair, counter %u/%u\n",
+           threads, cycles / (threads * loops), lb.counter, threads * loops);
+}
+
+/* 创建运行 path 的子进程并回收，比较三种创建方式的完整开销 */
+static void bench_spawn(int argc, char *argv[])
+{
+    char *args[] = {NULL, NULL};
+    int loops = SPAWN_LOOPS;
+    u64 start;
+    u32 cycles;
+    pid_t pid;
+
+    if (argc < 3)
+    {
+        printf("usage: bench spawn program [loops]\n");
+        return;
+    }
+    args[0] = argv[2];
+    if (argc > 3 && atoi(argv[3]) > 0)
+        loops = atoi(argv[3]);
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            execve(args[0], args);
+            exit(EOF);
+        }
+        waitpid(pid, NULL);
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("fork+execve+waitpid: %u cycles\n", cycles / loops);
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+    {
+        pid = vfork();
+        if (pid == 0)
+        {
+            execve(args[0], args);
+            exit(EOF);
+        }
+        waitpid(pid, NULL);
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("vfork+execve+waitpid: %u cycles\n", cycles / loops);
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+    {
+        pid = spawn(args[0], args);
+        if (pid == EOF)
+        {
+            printf("bench: can not spawn %s\n", args[0]);
+            return;
+        }
+        waitpid(pid, NULL);
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("spawn+waitpid: %u cycles\n", cycles / loops);
+}
+
+static char pipe_buf[PIPE_CHUNK];
+
+/* 吞吐量，单位 KiB/s，tsc 尚未标定时为 0 */
+static u32 kbytes_per_sec(u32 kbytes, u64 cycles)
+{
+    u32 khz = ((vdso_data_t *)VDSO_DATA_ADDR)->tsc_khz >> 10;
+    u32 ms;
+
+    if (khz == 0)
+        return 0;
+    ms = (u32)(cycles >> 10) / khz;
+    return ms ? kbytes * 1000 / ms : 0;
+}
+
+/* 读端把管道中的数据读完并丢弃，返回读到的字节数 */
+static u32 pipe_drain(fd_t fd)
+{
+    u32 total = 0;
+    int n;
+
+    while ((n = read(fd, pipe_buf, PIPE_CHUNK)) > 0)
+        total += n;
+    return total;
+}
+
+/* 子进程写入 kbytes KiB，父进程读出 */
+static void bench_pipe(int kbytes)
+{
+    fd_t fds[2];
+    u64 start;
+    u32 cycles;
+    u32 total;
+    pid_t pid;
+
+    if (pipe(fds) == EOF)
+    {
+        printf("pipe failed\n");
+        return;
+    }
+
+    start = rdtsc();
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        for (int i = 0; i < kbytes; ++i)
+            write(fds[1], pipe_buf, PIPE_CHUNK);
+        close(fds[1]);
+        exit(0);
+    }
+    close(fds[1]);
+
+    total = pipe_drain(fds[0]);
+    close(fds[0]);
+    waitpid(pid, NULL);
+    cycles = (u32)(rdtsc() - start);
+
+    total >>= 10;
+    if (total == 0)
+    {
+        printf("pipe: no data\n");
+        return;
+    }
+    printf("pipe %u KiB: %u cycles/KiB, %u KiB/s\n",
+           total, cycles / total, kbytes_per_sec(total, cycles));
+}
+
+/* 文件经管道送给子进程，比较 read + write 与 splice */
+static void bench_splice_one(char *path, bool use_splice)
+{
+    fd_t fds[2];
+    fd_t fd;
+    u64 start;
+    u32 total;
+    pid_t pid;
+    int n;
+
+    fd = open(path, O_RDONLY, 0);
+    if (fd == EOF)
+    {
+        printf("bench: can not open %s\n", path);
+        return;
+    }
+    if (pipe(fds) == EOF)
+    {
+        close(fd);
+        printf("pipe failed\n");
+        return;
+    }
+
+    start = rdtsc();
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fds[1]);
+        pipe_drain(fds[0]);
+        exit(0);
+    }
+    close(fds[0]);
+
+    total = 0;
+    while (true)
+    {
+        if (use_splice)
+            n = splice(fd, fds[1], PIPE_CHUNK * 4);
+        else if ((n = read(fd, pipe_buf, PIPE_CHUNK)) > 0)
+            n = write(fds[1], pipe_buf, n);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    close(fds[1]);
+    close(fd);
+    waitpid(pid, NULL);
+
+    u32 cycles = (u32)(rdtsc() - start);
+    u32 kbytes = total >> 10;
+    printf("%s %u bytes: %u cycles, %u KiB/s\n", use_splice ? "splice" : "read+write",
+           total, cycles, kbytes ? kbytes_per_sec(kbytes, cycles) : 0);
+}
+
+static void bench_splice(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: bench splice file\n");
+        return;
+    }
+    bench_splice_one(argv[2], false);
+    bench_splice_one(argv[2], true);
+}
+
+/* 映射和解除映射 64K 共享内存的开销，以及父子进程通过共享内存传递数据 */
+static void bench_shm(int loops)
+{
+    u64 start;
+    u32 cycles;
+    int32 id;
+    u32 *mem;
+    pid_t pid;
+
+    id = shmget(0, SHM_BENCH_SIZE);
+    if (id == EOF)
+    {
+        printf("shmget failed\n");
+        return;
+    }
+
+    start = rdtsc();
+    for (int i = 0; i < loops; ++i)
+    {
+        mem = (u32 *)shmat(id);
+        shmdt(mem);
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("shmat+shmdt %u KiB: %u cycles\n", SHM_BENCH_SIZE >> 10, cycles / loops);
+
+    mem = (u32 *)shmat(id);
+    if (mem == NULL)
+    {
+        shmrm(id);
+        printf("shmat failed\n");
+        return;
+    }
+
+    /* fork 后映射仍然共享，子进程写入的内容父进程直接可见 */
+    start = rdtsc();
+    pid = fork();
+    if (pid == 0)
+    {
+        for (u32 i = 0; i < SHM_BENCH_SIZE / sizeof(u32); ++i)
+            mem[i] = i;
+        exit(0);
+    }
+    waitpid(pid, NULL);
+    cycles = (u32)(rdtsc() - start);
+
+    u32 bad = 0;
+    for (u32 i = 0; i < SHM_BENCH_SIZE / sizeof(u32); ++i)
+        bad += mem[i] != i;
+    printf("fork+fill+waitpid %u KiB: %u cycles, %u mismatch\n",
+           SHM_BENCH_SIZE >> 10, cycles, bad);
+
+    shmdt(mem);
+    shmrm(id);
+}
+
+static char uring_buf[URING_DEPTH][PIPE_CHUNK];
+
+/* 保持 URING_DEPTH 个读请求在执行中，off 为下一个要读的偏移，done 为已完成的字节数
+ * 返回新填入 sq 的个数 */
+static u32 uring_fill_reads(uring_ring_t *ring, fd_t fd, u32 *off, u32 done, u32 size)
+{
+    uring_sqe_t *sqes = URING_SQES(ring);
+    u32 n = 0;
+
+    while (*off < size && *off - done < URING_DEPTH * PIPE_CHUNK)
+    {
+        uring_sqe_t *sqe = &sqes[ring->sq_tail & ring->sq_mask];
+        u32 slot = (*off / PIPE_CHUNK) % URING_DEPTH;
+
+        memset(sqe, 0, sizeof(uring_sqe_t));
+        sqe->opcode = URING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (u32)uring_buf[slot];
+        sqe->len = PIPE_CHUNK;
+        sqe->off = *off;
+        sqe->user_data = *off;
+        ++ring->sq_tail;
+
+        *off += PIPE_CHUNK;
+        ++n;
+    }
+    return n;
+}
+
+/* 同一个文件按 1K 读完，比较逐个 read 与 uring 同时提交 URING_DEPTH 个读请求
+ * 以及空请求在 uring 中的往返开销 */
+static void bench_uring(int argc, char *argv[])
+{
+    uring_ring_t *ring;
+    u64 start;
+    u32 cycles;
+    u32 size, off, done, total;
+    fd_t fd;
+
+    if (argc < 3)
+    {
+        printf("usage: bench uring file\n");
+        return;
+    }
+
+    fd = open(argv[2], O_RDONLY, 0);
+    if (fd == EOF)
+    {
+        printf("bench: can not open %s\n", argv[2]);
+        return;
+    }
+    size = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+
+    start = rdtsc();
+    total = 0;
+    for (off = 0; off < size; off += PIPE_CHUNK)
+        total += read(fd, pipe_buf, PIPE_CHUNK);
+    cycles = (u32)(rdtsc() - start);
+    printf("read %u bytes: %u cycles, %u KiB/s\n", total, cycles,
+           kbytes_per_sec(total >> 10, cycles));
+
+    /* 每个进程只能有一个 uring，运行在 shell 中时要在子进程里测 */
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        waitpid(pid, NULL);
+        close(fd);
+        return;
+    }
+
+    ring = uring_setup(URING_DEPTH, 0);
+    if (ring == NULL)
+    {
+        printf("uring_setup failed\n");
+        exit(0);
+    }
+
+    uring_cqe_t *cqes = URING_CQES(ring);
+
+    start = rdtsc();
+    for (int i = 0; i < BENCH_LOOPS; ++i)
+    {
+        URING_SQES(ring)[ring->sq_tail & ring->sq_mask].opcode = URING_OP_NOP;
+        ++ring->sq_tail;
+        uring_enter(1, 1, URING_ENTER_GETEVENTS);
+        ++ring->cq_head;
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("uring nop: %u cycles/op\n", cycles / BENCH_LOOPS);
+
+    start = rdtsc();
+    off = 0;
+    done = 0;
+    total = 0;
+    while (done < size)
+    {
+        u32 n = uring_fill_reads(ring, fd, &off, done, size);
+
+        uring_enter(n, 1, URING_ENTER_GETEVENTS);
+        while (ring->cq_head != ring->cq_tail)
+        {
+            uring_cqe_t *cqe = &cqes[ring->cq_head & ring->cq_mask];
+
+            if (cqe->res > 0)
+                total += cqe->res;
+            ++ring->cq_head;
+            done += PIPE_CHUNK;
+        }
+    }
+    cycles = (u32)(rdtsc() - start);
+    printf("uring read depth %d, %u bytes: %u cycles, %u KiB/s\n", URING_DEPTH, total, cycles,
+           kbytes_per_sec(total >> 10, cycles));
+
+    exit(0);
+}
+
+void builtin_bench(int argc, char *argv[])
+{
+    int loops = BENCH_LOOPS;
+
+    if (argc < 2)
+    {
+        printf("usage: bench syscall|lock|pipe|shm [loops], bench splice|uring file, bench spawn program [loops]\n");
+        return;
+    }
+    if (strcmp(argv[1], "splice", 10))
+    {
+        return bench_splice(argc, argv);
+    }
+    if (strcmp(argv[1], "uring", 10))
+    {
+        return bench_uring(argc, argv);
+    }
+    if (strcmp(argv[1], "spawn", 10))
+    {
+        return bench_spawn(argc, argv);
+    }
+    if (argc > 2)
+        loops = atoi(argv[2]);
+    if (loops <= 0)
+        loops = BENCH_LOOPS;
+
+    if (strcmp(argv[1], "syscall", 10))
+    {
+        return bench_syscall(loops);
+    }
+    if (strcmp(argv[1], "lock", 10))
+    {
+        return bench_lock(loops);
+    }
+    if (strcmp(argv[1], "pipe", 10))
+    {
+        /* 次数为传输的 KiB 数 */
+        return bench_pipe(argc > 2 ? loops : PIPE_KBYTES);
+    }
+    if (strcmp(argv[1], "shm", 10))
+    {
+        return bench_shm(argc > 2 ? loops : SHM_LOOPS);
+    }
+    printf("bench: unknown test %s\n", argv[1]);
+}
@@ -4,11 +4,20 @@
 #include <common/assert.h>
 #include <fs/fs.h>
 #include <rdix/kernel.h>
+#include <rdix/task.h>
+#include <rdix/vdso.h>
+#include <rdix/hardware.h>
+#include <rdix/device.h>
+#include <rdix/uring.h>
+#include <common/console.h>
 
 #define MAX_CMD_LEN 256
 #define MAX_ARG_NR 16
 #define MAX_PATH_LEN 1024
 #define BUFLEN 1024
+#define TOP_TASK_MAX 64
+#define TOP_INTERVAL 1000
+#define EXEC_NOT_FOUND 127
 
 static char cwd[MAX_PATH_LEN];
 static char cmd[MAX_CMD_LEN];
@@ -23,6 +32,7 @@ static char onix_logo[][52] = {
 };
 
 extern char *strsep(const char *str);
+extern void builtin_bench(int argc, char *argv[]);
 extern char *strrsep(const char *str);
 
 void print_prompt()
@@ -50,7 +60,7 @@ void builtin_pwd()
 
 void builtin_clear()
 {
-    //clear();
+    printf(CONSOLE_CLEAR);
 }
 
 void builtin_ls()
@@ -131,6 +141,182 @@ void builtin_rm(int argc, char *argv[])
     unlink(argv[1]);
 }
 
+void builtin_lockstat(int argc, char *argv[])
+{
+    lockstat(argc > 1 && strcmp(argv[1], "reset", 10));
+}
+
+/* elevator hda 输出可用的调度器，当前的在方括号中；elevator hda deadline 切换调度器 */
+void builtin_elevator(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: elevator <disk> [sweep|deadline]\n");
+        return;
+    }
+    if (elevator(argv[1], argc > 2 ? argv[2] : NULL) == EOF)
+    {
+        printf("elevator: %s: no such disk or scheduler\n", argv[1]);
+    }
+}
+
+/* iostat [-h] [-r] [-s] [disk]
+ * -h 输出延迟直方图，-r 输出后清零，-s 同时写到串口 */
+void builtin_iostat(int argc, char *argv[])
+{
+    char *devname = NULL;
+    u32 flags = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-h", 3))
+            flags |= IOSTAT_HIST;
+        else if (strcmp(argv[i], "-r", 3))
+            flags |= IOSTAT_RESET;
+        else if (strcmp(argv[i], "-s", 3))
+            flags |= IOSTAT_SERIAL;
+        else
+            devname = argv[i];
+    }
+
+    if (iostat(devname, flags) == EOF)
+    {
+        printf("iostat: %s: no such block device\n", devname);
+    }
+}
+
+static char *task_state_name(task_state_t state)
+{
+    switch (state)
+    {
+    case TASK_INIT:
+        return "init";
+    case TASK_RUNNING:
+        return "run";
+    case TASK_READY:
+        return "ready";
+    case TASK_BLOCKED:
+        return "block";
+    case TASK_SLEEPING:
+        return "sleep";
+    case TASK_WAITING:
+        return "wait";
+    case TASK_DIED:
+        return "died";
+    default:
+        return "?";
+    }
+}
+
+/* tsc 周期换算成毫秒，两边同时右移避免 64 位除法 */
+static u32 cycles_to_ms(u64 cycles)
+{
+    u32 khz = ((vdso_data_t *)VDSO_DATA_ADDR)->tsc_khz >> 10;
+
+    if (khz == 0)
+        return 0;
+    return (u32)(cycles >> 10) / khz;
+}
+
+static task_info_t top_prev[TOP_TASK_MAX];
+static task_info_t top_curr[TOP_TASK_MAX];
+
+/* 每隔 TOP_INTERVAL 毫秒清屏并重新输出各任务在这段时间内的 cpu 占用率，按任意键退出
+ * 每个进程只能有一个 uring，在子进程中通过 uring 异步读键盘，不阻塞刷新 */
+void builtin_top(int argc, char *argv[])
+{
+    pid_t pid = fork();
+
+    if (pid != 0)
+    {
+        waitpid(pid, NULL);
+        return;
+    }
+
+    uring_ring_t *ring = uring_setup(1, 0);
+    char key;
+
+    if (ring == NULL)
+    {
+        printf("top: uring_setup failed\n");
+        exit(0);
+    }
+
+    uring_sqe_t *sqe = URING_SQES(ring);
+
+    memset(sqe, 0, sizeof(uring_sqe_t));
+    sqe->opcode = URING_OP_READ;
+    sqe->fd = stdin;
+    sqe->addr = (u32)&key;
+    sqe->len = 1;
+    ++ring->sq_tail;
+    uring_enter(1, 0, 0);
+
+    int nprev = task_info(top_prev, TOP_TASK_MAX);
+    u64 stamp = rdtsc();
+
+    while (ring->cq_head == ring->cq_tail)
+    {
+        sleep(TOP_INTERVAL);
+
+        int ncurr = task_info(top_curr, TOP_TASK_MAX);
+        u64 now = rdtsc();
+        u32 total = (u32)((now - stamp) >> 8);
+
+        printf(CONSOLE_CLEAR "press any key to quit\n");
+        printf("%5s %5s %-6s %4s %10s %10s %6s %6s %6s %s\n",
+               "PID", "PPID", "STATE", "CPU%", "USER(ms)", "SYS(ms)", "CSW", "ICSW", "PF", "NAME");
+
+        for (int i = 0; i < ncurr; ++i)
+        {
+            task_info_t *ti = &top_curr[i];
+            u64 used = ti->utime + ti->stime;
+
+            for (int j = 0; j < nprev; ++j)
+            {
+                if (top_prev[j].pid == ti->pid)
+                {
+                    used -= top_prev[j].utime + top_prev[j].stime;
+                    break;
+                }
+            }
+
+            printf("%5d %5d %-6s %3u%% %10u %10u %6u %6u %6u %s\n",
+                   ti->pid, ti->ppid, task_state_name(ti->state),
+                   total ? (u32)(used >> 8) * 100 / total : 0,
+                   cycles_to_ms(ti->utime), cycles_to_ms(ti->stime),
+                   ti->nvcsw, ti->nivcsw, ti->page_faults, ti->name);
+        }
+
+        memcpy(top_prev, top_curr, sizeof(task_info_t) * ncurr);
+        nprev = ncurr;
+        stamp = now;
+    }
+    exit(0);
+}
+
+/* 不是内建命令时从文件系统中加载程序运行 */
+static void builtin_exec(int argc, char *argv[])
+{
+    int32 status = 0;
+    pid_t pid = vfork();
+
+    if (pid == 0)
+    {
+        execve(argv[0], argv);
+        exit(EXEC_NOT_FOUND);
+    }
+    if (pid == EOF)
+    {
+        printf("osh: vfork failed\n");
+        return;
+    }
+
+    waitpid(pid, &status);
+    if (status == EXEC_NOT_FOUND)
+        printf("osh: command not found: %s\n", argv[0]);
+}
+
 static void execute(int argc, char *argv[])
 {
     char *line = argv[0];
@@ -183,7 +369,27 @@ static void execute(int argc, char *argv[])
     {
         return builtin_rm(argc, argv);
     }
-    printf("osh: command not found: %s\n", argv[0]);
+    if (strcmp(line, "bench", 10))
+    {
+        return builtin_bench(argc, argv);
+    }
+    if (strcmp(line, "lockstat", 10))
+    {
+        return builtin_lockstat(argc, argv);
+    }
+    if (strcmp(line, "elevator", 10))
+    {
+        return builtin_elevator(argc, argv);
+    }
+    if (strcmp(line, "top", 10))
+    {
+        return builtin_top(argc, argv);
+    }
+    if (strcmp(line, "iostat", 10))
+    {
+        return builtin_iostat(argc, argv);
+    }
+    builtin_exec(argc, argv);
 }
 
 void readline(char *buf, u32 count)
@@ -0,0 +1,124 @@
+#include <rdix/ulock.h>
+#include <rdix/futex.h>
+#include <rdix/syscall.h>
+
+#define UINT32_MAX 0xffffffff
+
+static _inline u32 atomic_xchg(volatile u32 *ptr, u32 val){
+    asm volatile(
+        "xchgl %0, %1\n"
+        :"+r"(val), "+m"(*ptr)
+        :
+        :"memory"
+    );
+    return val;
+}
+
+/* *ptr == old 时写入 val，返回 *ptr 原来的值 */
+static _inline u32 atomic_cmpxchg(volatile u32 *ptr, u32 old, u32 val){
+    u32 prev;
+    asm volatile(
+        "lock cmpxchgl %2, %1\n"
+        :"=a"(prev), "+m"(*ptr)
+        :"r"(val), "0"(old)
+        :"memory"
+    );
+    return prev;
+}
+
+/* 返回加之前的值 */
+static _inline u32 atomic_add(volatile u32 *ptr, u32 val){
+    asm volatile(
+        "lock xaddl %0, %1\n"
+        :"+r"(val), "+m"(*ptr)
+        :
+        :"memory"
+    );
+    return val;
+}
+
+void umutex_init(umutex_t *mutex){
+    mutex->value = 0;
+}
+
+bool umutex_trylock(umutex_t *mutex){
+    return atomic_cmpxchg(&mutex->value, 0, 1) == 0;
+}
+
+void umutex_lock(umutex_t *mutex){
+    u32 c = atomic_cmpxchg(&mutex->value, 0, 1);
+
+    if (c == 0)
+        return;
+
+    /* 有竞争，标记为有等待者后睡眠，被唤醒后仍以 2 上锁，保证解锁时会唤醒其他等待者 */
+    if (c != 2)
+        c = atomic_xchg(&mutex->value, 2);
+    while (c != 0){
+        futex((u32 *)&mutex->value, FUTEX_WAIT, 2);
+        c = atomic_xchg(&mutex->value, 2);
+    }
+}
+
+void umutex_unlock(umutex_t *mutex){
+    if (atomic_xchg(&mutex->value, 0) == 2)
+        futex((u32 *)&mutex->value, FUTEX_WAKE, 1);
+}
+
+void ucond_init(ucond_t *cond){
+    cond->seq = 0;
+}
+
+/* 可能被虚假唤醒，调用者需要在循环中重新检查条件 */
+void ucond_wait(ucond_t *cond, umutex_t *mutex){
+    u32 seq = cond->seq;
+
+    umutex_unlock(mutex);
+    futex((u32 *)&cond->seq, FUTEX_WAIT, seq);
+
+    /* 不知道还有没有其他等待者，按有竞争的方式上锁 */
+    while (atomic_xchg(&mutex->value, 2) != 0)
+        futex((u32 *)&mutex->value, FUTEX_WAIT, 2);
+}
+
+void ucond_signal(ucond_t *cond){
+    atomic_add(&cond->seq, 1);
+    futex((u32 *)&cond->seq, FUTEX_WAKE, 1);
+}
+
+void ucond_broadcast(ucond_t *cond){
+    atomic_add(&cond->seq, 1);
+    futex((u32 *)&cond->seq, FUTEX_WAKE, UINT32_MAX);
+}
+
+void usem_init(usem_t *sem, u32 value){
+    sem->value = value;
+    sem->waiters = 0;
+}
+
+bool usem_trywait(usem_t *sem){
+    u32 v = sem->value;
+
+    while (v != 0){
+        u32 prev = atomic_cmpxchg(&sem->value, v, v - 1);
+
+        if (prev == v)
+            return true;
+        v = prev;
+    }
+    return false;
+}
+
+void usem_wait(usem_t *sem){
+    while (!usem_trywait(sem)){
+        atomic_add(&sem->waiters, 1);
+        futex((u32 *)&sem->value, FUTEX_WAIT, 0);
+        atomic_add(&sem->waiters, -1);
+    }
+}
+
+void usem_post(usem_t *sem){
+    atomic_add(&sem->value, 1);
+    if (sem->waiters)
+        futex((u32 *)&sem->value, FUTEX_WAKE, 1);
+}
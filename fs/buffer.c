@@ -3,9 +3,12 @@
 #include <rdix/memory.h>
 #include <rdix/task.h>
 #include <common/interrupt.h>
+#include <rdix/kernel.h>
 
 #define HASH_CNT 31
 
+#define BUFFER_WARNING_INFO __WARNING("[buffer warning]")
+
 static List_t *wait_list;
 
 /* 缓存块释放链表 */
@@ -64,8 +67,12 @@ static buffer_t *get_new_buffer(){
         bf->b_count = 0;
         bf->b_dirty = false;
         mutex_init(&bf->b_lock);
+        mutex_set_name(&bf->b_lock, "b_lock");
         bf->b_vaild = false;
         bf->waiter = NULL;
+        bf->b_io = false;
+        bf->b_error = false;
+        wait_queue_init(&bf->b_wait);
 
         /* 这里只需要初始化节点
          * 两个节点的压入应当时同时进行的 */
@@ -118,6 +125,8 @@ _retry:
             continue;
         if (tmp->waiter)
             continue;
+        if (tmp->b_io) /* 异步请求还没有完成 */
+            continue;
         if (!bf)
             bf = tmp;
         if (!_SCORE(bf)) /* 找到的缓冲既没有锁住也没有脏，直接返回 */
@@ -184,6 +193,13 @@ void buffer_unlock(buffer_t *bf){
         unblock(bf->waiter);
 }
 
+/* 读出错时释放缓冲块，由调用者决定让系统调用失败还是结束任务 */
+static buffer_t *buffer_io_error(buffer_t *bf){
+    printk(BUFFER_WARNING_INFO "read error on dev %d block %d\n", bf->b_dev, bf->b_blknr);
+    brelse(bf);
+    return NULL;
+}
+
 buffer_t *bread(dev_t dev, u32 blknr){
     buffer_t *bf = NULL;
 
@@ -194,25 +210,85 @@ buffer_t *bread(dev_t dev, u32 blknr){
     if (bf->b_vaild)
         return bf;
 
-    /* 这里有可能另一个进程也指向这个缓冲块
-     * 本进程由于 device_request 后调度到其他任务时，另一个任务读到的 b_vaild 是 false
-     * 然后又进行一次 device_request */
-    device_request(bf, SECS_PER_BLOCK, bf->b_blknr * SECS_PER_BLOCK, 0, REQ_READ);
+    /* 另一个任务可能已经提交了同一个块的读请求，这时只需要等它完成 */
+    ll_rw_block(REQ_READ, bf);
+    wait_on_buffer(bf);
 
-    ATOMIC_OPS(bf->b_vaild = true;
-            bf->b_dirty = false;)
+    if (!bf->b_vaild)
+        return buffer_io_error(bf);
 
     return bf;
 }
 
-void bwrite(buffer_t *bf){
+/* 成功返回 0，出错返回 EOF，缓冲块仍然是脏的，以后还会再写 */
+int bwrite(buffer_t *bf){
     assert(bf);
 
-    if (!bf->b_dirty)
+    /* 写的过程中不允许修改缓冲块的内容 */
+    buffer_lock(bf);
+
+    /* 正在进行的写请求完成后缓冲块可能又被写脏，等它完成后再提交一次 */
+    wait_on_buffer(bf);
+    ll_rw_block(REQ_WRITE, bf);
+    wait_on_buffer(bf);
+
+    buffer_unlock(bf);
+
+    if (bf->b_error){
+        printk(BUFFER_WARNING_INFO "write error on dev %d block %d\n", bf->b_dev, bf->b_blknr);
+        return EOF;
+    }
+    return 0;
+}
+
+/* bio 完成时在关中断下调用 */
+static void end_buffer_io(bio_t *bio){
+    buffer_t *bf = (buffer_t *)bio->private;
+
+    bf->b_error = bio->status == EOF;
+    if (!bf->b_error && bio->type == REQ_READ)
+        bf->b_vaild = true;
+    /* 写失败时保留脏位，以后再写 */
+    if (bf->b_error && bio->type == REQ_WRITE)
+        bf->b_dirty = true;
+
+    bf->b_io = false;
+    wake_up_all(&bf->b_wait);
+
+    free(bio);
+}
+
+void ll_rw_block(u32 type, buffer_t *bf){
+    assert(bf);
+
+    bool IF_stat = get_and_disable_IF();
+
+    /* 已经有请求在进行，或者不需要读写 */
+    if (bf->b_io || (type == REQ_READ && bf->b_vaild) || (type == REQ_WRITE && !bf->b_dirty)){
+        set_IF(IF_stat);
         return;
-    device_request(bf, SECS_PER_BLOCK, bf->b_blknr * SECS_PER_BLOCK, 0, REQ_WRITE);
+    }
+
+    bio_t *bio = (bio_t *)malloc(sizeof(bio_t));
+
+    bio_init(bio, bf->b_dev, type, bf->b_blknr * SECS_PER_BLOCK, SECS_PER_BLOCK, bf->b_data);
+    bio->end_io = end_buffer_io;
+    bio->private = bf;
+
+    bf->b_io = true;
+    bf->b_error = false;
+    if (type == REQ_WRITE)
+        bf->b_dirty = false;
+
+    submit_bio(bio);
+
+    set_IF(IF_stat);
+}
 
-    ATOMIC_OPS(bf->b_dirty = false;)
+void wait_on_buffer(buffer_t *bf){
+    /* 请求可能还在自己的蓄流链表中 */
+    blk_flush_plug();
+    wait_event(&bf->b_wait, !bf->b_io);
 }
 
 void brelse(buffer_t *bf){
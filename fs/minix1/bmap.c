@@ -135,8 +135,15 @@ reckon:
         {
             array[index] = balloc(inode->dev);
 
-            /* 索引块创建后必须清零 */
+            /* 索引块创建后必须清零，读出错时返回 0 */
             buffer_t *tmp = bread(inode->dev, array[index]);
+            if (!tmp){
+                bfree(inode->dev, array[index]);
+                array[index] = 0;
+                brelse(buf_1);
+                brelse(buf_2);
+                return 0;
+            }
 
             buffer_lock(tmp);
             memset(tmp->b_data, 0, BLOCK_SIZE);
@@ -168,11 +175,17 @@ reckon:
 
         if (level == 2){
             buf_2 = bread(inode->dev, array[index]);
+            if (!buf_2)
+                return 0;
             array = (u16 *)buf_2->b_data;
             buf = buf_2;
         }
         if (level == 1){
             buf_1 = bread(inode->dev, array[index]);
+            if (!buf_1){
+                brelse(buf_2);
+                return 0;
+            }
             array = (u16 *)buf_1->b_data;
             buf = buf_1;
         }
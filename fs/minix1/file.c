@@ -1,4 +1,5 @@
 #include <fs/fs.h>
+#include <fs/pipe.h>
 #include <common/assert.h>
 #include <rdix/kernel.h>
 
@@ -8,7 +9,7 @@ fd_t sys_open(char *filename, int flags, int mode)
     if (!inode)
         return EOF;
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     fd_t fd = 3; // 0 1 2，分别是标准输入输出和错误流
 
     for (; fd < TASK_FILE_NR; ++fd){
@@ -26,8 +27,9 @@ fd_t sys_open(char *filename, int flags, int mode)
     file_t *file = task->files[fd];
 
     file->inode = inode;
+    file->pipe = NULL;
     file->flags = flags;
-    //file->count = 1;
+    file->count = 1;
     file->mode = inode->desc->mode;
     file->offset = 0;
 
@@ -46,17 +48,28 @@ fd_t sys_create(char *filename, int mode)
 void sys_close(fd_t fd)
 {
     assert(fd < TASK_FILE_NR && fd > 2);
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     file_t *file = task->files[fd];
     if (!file)
         return;
 
-    assert(file->inode);
-    iput(file->inode);
-    free(file);
+    file_put(file);
     task->files[fd] = NULL;
 }
 
+void file_put(file_t *file)
+{
+    assert(file->count > 0);
+    if (--file->count)
+        return;
+
+    if (file->pipe)
+        pipe_release(file);
+    else
+        iput(file->inode);
+    free(file);
+}
+
 int sys_read(fd_t fd, char *buf, int count)
 {
     if (fd == stdin)
@@ -65,13 +78,16 @@ int sys_read(fd_t fd, char *buf, int count)
         return device_read(device->dev, buf, count, 0, 0);
     }
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     file_t *file = task->files[fd];
     assert(file);
 
     if ((file->flags & O_ACCMODE) == O_WRONLY)
         return EOF;
 
+    if (file->pipe)
+        return pipe_read(file->pipe, buf, count);
+
     m_inode *inode = file->inode;
     int len = inode_read(inode, buf, count, file->offset);
     if (len != EOF)
@@ -89,13 +105,16 @@ int sys_write(fd_t fd, char *buf, int count)
         return device_write(device->dev, buf, count, 0, 0);
     }
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     file_t *file = task->files[fd];
     assert(file);
 
     if ((file->flags & O_ACCMODE) == O_RDONLY)
         return EOF;
 
+    if (file->pipe)
+        return pipe_write(file->pipe, buf, count);
+
     m_inode *inode = file->inode;
     int len = inode_write(inode, buf, count, file->offset);
     if (len != EOF)
@@ -110,10 +129,15 @@ int sys_lseek(fd_t fd, idx_t offset, whence_t whence)
 {
     assert(fd < TASK_FILE_NR);
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     file_t *file = task->files[fd];
 
     assert(file);
+
+    /* 管道不能定位 */
+    if (file->pipe)
+        return EOF;
+
     assert(file->inode);
 
     switch (whence)
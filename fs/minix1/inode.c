@@ -6,6 +6,7 @@
 #define INODE_NR 64
 #define BLOCK_INODES (BLOCK_SIZE / sizeof(d_inode))
 #define asd sizeof(d_inode)
+#define READ_AHEAD_BLOCKS 32 // 一次读取最多预读的块数
 
 static m_inode inode_table[INODE_NR];
 
@@ -71,6 +72,15 @@ m_inode *iget(dev_t dev, inode_t nr)
     u32 block = inode_block(sb, inode->nr);
     buffer_t *buf = bread(inode->dev, block);
 
+    /* 读不出 inode 所在的块时释放 inode，由调用者让系统调用失败 */
+    if (!buf){
+        ATOMIC_OPS(
+            inode->count = 0;
+            inode->dev = EOF;
+        );
+        return NULL;
+    }
+
     inode->buf = buf;
 
     // 将缓冲视为一个 inode 描述符数组，获取对应的指针；
@@ -83,6 +93,9 @@ m_inode *iget(dev_t dev, inode_t nr)
 }
 
 void iput(m_inode *inode){
+    if (!inode)
+        return;
+
     assert(inode->count > 0);
 
     if (inode->count > 1){
@@ -98,19 +111,53 @@ void iput(m_inode *inode){
     );
 }
 
+// 蓄流后一起提交 [offset, offset + len) 内的块，磁盘上相邻的块会合并成一个请求
+static void inode_read_ahead(m_inode *inode, idx_t offset, u32 len){
+    u32 end = inode->desc->size - offset < len ? inode->desc->size : offset + len;
+    u32 first = offset / BLOCK_SIZE;
+    u32 last = (end - 1) / BLOCK_SIZE;
+    blk_plug_t plug;
+
+    if (len == 0 || last == first)
+        return;
+    if (last - first >= READ_AHEAD_BLOCKS)
+        last = first + READ_AHEAD_BLOCKS - 1;
+
+    blk_start_plug(&plug);
+
+    for (u32 i = first; i <= last; ++i){
+        idx_t block = bmap(inode, i, false);
+        buffer_t *bf;
+
+        if (!block)
+            break;
+
+        ATOMIC_OPS(bf = getblk(inode->dev, block););
+        ll_rw_block(REQ_READ, bf);
+        brelse(bf);
+    }
+
+    blk_finish_plug(&plug);
+}
+
 // 从 inode 的 offset 处，读 len 个字节到 buf
+// 读出错时返回已经读到的字节数，一个字节都没有读到时返回 EOF
 int inode_read(m_inode *inode, char *buf, u32 len, idx_t offset){
     assert(ISFILE(inode->desc->mode) || ISDIR(inode->desc->mode));
 
     if (offset >= inode->desc->size)
         return EOF;
     
+    inode_read_ahead(inode, offset, len);
+
     size_t total_size = 0;
     u32 ptr = offset;
     while(len && (ptr + total_size) < inode->desc->size){
         idx_t block = bmap(inode, offset / BLOCK_SIZE, false);
-        assert(block);  // 可以在 buf 中填充 0
-        buffer_t *bf = bread(inode->dev, block);
+        buffer_t *bf = block ? bread(inode->dev, block) : NULL;
+
+        if (!bf)
+            return total_size ? total_size : EOF;
 
         size_t size = 0;
         if (inode->desc->size - (ptr + total_size) < len)
@@ -134,7 +181,7 @@ int inode_read(m_inode *inode, char *buf, u32 len, idx_t offset){
     return total_size;
 }
 
-// 从 inode 的 offset 处，将 buf 的 len 个字节写入磁盘
+// 从 inode 的 offset 处，将 buf 的 len 个字节写入磁盘，出错时返回 EOF
 int inode_write(m_inode *inode, char *buf, u32 len, idx_t offset){
     assert(!ISDIR(inode->desc->mode));
 
@@ -142,8 +189,10 @@ int inode_write(m_inode *inode, char *buf, u32 len, idx_t offset){
         inode->desc->size = len + offset;
     while (len){
         idx_t block = bmap(inode, offset / BLOCK_SIZE, true);
+        buffer_t *bf = block ? bread(inode->dev, block) : NULL;
 
-        buffer_t *bf = bread(inode->dev, block);
+        if (!bf)
+            return EOF;
 
         size_t size = 0;
         if (BLOCK_SIZE - offset % BLOCK_SIZE < len)
@@ -178,8 +227,9 @@ static void inode_bfree(m_inode *inode, u16 *array, int index, int level)
         return;
     }
 
+    /* 读不出索引块时只能放弃它下面的块 */
     buffer_t *buf = bread(inode->dev, array[index]);
-    for (size_t i = 0; i < ZONES_IDX_PER_BLOCK; i++)
+    for (size_t i = 0; buf && i < ZONES_IDX_PER_BLOCK; i++)
     {
         inode_bfree(inode, (u16 *)buf->b_data, i, level - 1);
     }
@@ -49,12 +49,14 @@ buffer_t *find_entry(m_inode *dir, const char *name, dir_entry **res){
         if (block == 0)
             block = bmap(dir, i / BLOCK_DENTRYS, false);
         
-        assert(block);
+        if (!block)
+            goto _fail;
         
         if (buf == NULL)
             buf = bread(dir->dev, block);
         
-        assert(buf);
+        if (!buf)
+            goto _fail;
 
         dentry = (dir_entry *)buf->b_data;
 
@@ -105,7 +107,11 @@ buffer_t *add_entry(m_inode *dir, const char *name, dir_entry **res){
 
         if (zone_idx <= i / ZONES_IDX_PER_BLOCK){
             block = bmap(dir, i / ZONES_IDX_PER_BLOCK, create);
-            bf = bread(dir->dev, block);
+            bf = block ? bread(dir->dev, block) : NULL;
+            if (!bf){
+                *res = NULL;
+                return NULL;
+            }
             zone_idx += 1;
             dentry = (dir_entry *)bf->b_data;
         }
@@ -146,7 +152,7 @@ static char *next_name(const char *path){
 static m_inode *_namei(const char *pathname, bool dorc){
     const char* ptr = pathname;
     m_inode *node = NULL;
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
 
     if (IS_SEPARATOR(ptr[0])){
         node = task->i_root;
@@ -179,6 +185,9 @@ static m_inode *_namei(const char *pathname, bool dorc){
         iput(node);
         node = iget(dev, dentry->inode);
         brelse(bf);
+
+        if (!node)
+            return NULL;
     }
 
     return node;
@@ -221,11 +230,22 @@ int sys_mkdir(const char *pathname, int mode){
         PANIC("file or directory is existing\n");
     
     bf = add_entry(dir, childname, &res);
+    if (!bf){
+        iput(dir);
+        return EOF;
+    }
     res->inode = ialloc(dir->dev);
     bf->b_dirty = true;
 
     m_inode *childnode = iget(dir->dev, res->inode);
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    if (!childnode){
+        ifree(dir->dev, res->inode);
+        res->inode = 0;
+        brelse(bf);
+        iput(dir);
+        return EOF;
+    }
+    TCB_t *task = current_leader();
 
     childnode->buf->b_dirty = true;
     childnode->desc->gid = task->gid;
@@ -239,7 +259,13 @@ int sys_mkdir(const char *pathname, int mode){
 
     brelse(bf);
 
-    bf = bread(childnode->dev, bmap(childnode, 0, true));
+    idx_t block = bmap(childnode, 0, true);
+    bf = block ? bread(childnode->dev, block) : NULL;
+    if (!bf){
+        iput(dir);
+        iput(childnode);
+        return EOF;
+    }
     bf->b_dirty = true;
 
     res = (dir_entry *)bf->b_data;
@@ -283,8 +309,10 @@ bool dir_is_empty(m_inode *dir){
             if (bf)
                 brelse(bf);
             
-            bf = bread(dir->dev, block);
-            assert(bf);
+            /* 读不出目录块时当作非空，不允许删除 */
+            bf = block ? bread(dir->dev, block) : NULL;
+            if (!bf)
+                return false;
             entry = (dir_entry *)bf->b_data;
         }
 
@@ -322,12 +350,13 @@ int sys_rmdir(const char *pathname){
         return EOF;
     
     node = iget(dir->dev, res->inode);
-    assert(node);
+    if (!node)
+        return EOF;
 
     if (!ISDIR(node->desc->mode))
         return EOF;
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     if((dir->desc->mode & ISVTX) && task->uid != node->desc->uid)
         return EOF;
     
@@ -395,6 +424,8 @@ int sys_link(char *oldname, char *newname){
         goto rollback;
 
     buf = add_entry(dir, fname, &entry);
+    if (!buf)
+        goto rollback;
     entry->inode = inode->nr;
     buf->b_dirty = true;
 
@@ -428,10 +459,10 @@ int sys_unlink(char *pathname){
         goto rollback;
 
     inode = iget(dir->dev, entry->inode);
-    if (ISDIR(inode->desc->mode))
+    if (!inode || ISDIR(inode->desc->mode))
         goto rollback;
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     if ((inode->desc->mode & ISVTX) && task->uid != inode->desc->uid)
         goto rollback;
 
@@ -484,6 +515,8 @@ m_inode *inode_open(char *pathname, int flag, int mode)
     if (buf)
     {
         inode = iget(dir->dev, entry->inode);
+        if (!inode)
+            goto rollback;
         goto makeup;
     }
 
@@ -494,11 +527,18 @@ m_inode *inode_open(char *pathname, int flag, int mode)
         goto rollback; */
 
     buf = add_entry(dir, fname, &entry);
+    if (!buf)
+        goto rollback;
     entry->inode = ialloc(dir->dev);
     inode = iget(dir->dev, entry->inode);
     buf->b_dirty = true;
+    if (!inode){
+        ifree(dir->dev, entry->inode);
+        entry->inode = 0;
+        goto rollback;
+    }
 
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
 
     mode &= (0777 & ~task->umask);
     mode |= IFREG;
@@ -605,7 +645,7 @@ void abspath(char *oldpath, char *newpath){
 
 int sys_chdir(char *pathname)
 {
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     m_inode *inode = namei(pathname);
     if (!inode)
         return EOF;
@@ -624,7 +664,7 @@ rollback:
 }
 
 void sys_getpwd(char *buf, size_t len){
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
 
     strncpy(buf, task->pwd, len);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <rdix/kernel.h>
 #include <common/assert.h>
 #include <common/string.h>
+#include <common/interrupt.h>
 
 #define SUPER_NR 32
 
@@ -24,6 +25,7 @@ super_block_t *read_super(dev_t dev){
 
     sb->dev = dev;
     sb->buf = bread(dev, 1);
+    assert(sb->buf);    // 挂载时读不出超级块没有办法继续
     sb->desc = (d_super_block *)sb->buf->b_data;
     
     assert(sb->desc->magic == MINIX1_MAGIC);
@@ -34,10 +36,25 @@ super_block_t *read_super(dev_t dev){
     // 读取 inode 位图
     int idx = 2; // 位图从第 2 块开始，第 0 块 引导块，第 1 块 超级块
 
+    // 先一起提交所有位图块的读请求，下面的 bread 只需要等待完成
+    blk_plug_t plug;
+
+    blk_start_plug(&plug);
+    for (int i = 0; i < sb->desc->imap_blocks + sb->desc->zmap_blocks; i++)
+    {
+        buffer_t *bf;
+
+        ATOMIC_OPS(bf = getblk(dev, idx + i););
+        ll_rw_block(REQ_READ, bf);
+        brelse(bf);
+    }
+    blk_finish_plug(&plug);
+
     for (int i = 0; i < sb->desc->imap_blocks; i++)
     {
         assert(i < IMAP_NR);
         sb->imaps[i] = bread(dev, idx);
+        assert(sb->imaps[i]);
         idx++;
     }
 
@@ -45,6 +62,7 @@ super_block_t *read_super(dev_t dev){
     {
         assert(i < ZMAP_NR);
         sb->zmaps[i] = bread(dev, idx);
+        assert(sb->zmaps[i]);
         idx++;
     }
 
@@ -0,0 +1,272 @@
+#include <fs/fs.h>
+#include <fs/pipe.h>
+#include <rdix/task.h>
+#include <rdix/memory.h>
+#include <rdix/kernel.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define PIPE_LOG_INFO __LOG("[pipe]")
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static _inline u32 pipe_size(pipe_t *pipe){
+    return pipe->head - pipe->tail;
+}
+
+static _inline u32 pipe_space(pipe_t *pipe){
+    return PIPE_SIZE - pipe_size(pipe);
+}
+
+/* 从环形缓冲区中取出 count 个字节，调用前确保有足够的数据 */
+static void pipe_copy_out(pipe_t *pipe, char *buf, u32 count){
+    u32 idx = pipe->tail % PIPE_SIZE;
+    u32 first = MIN(count, PIPE_SIZE - idx);
+
+    memcpy(buf, pipe->buf + idx, first);
+    memcpy(buf + first, pipe->buf, count - first);
+    pipe->tail += count;
+
+    wake_up_all(&pipe->wwait);
+}
+
+/* 向环形缓冲区中放入 count 个字节，调用前确保有足够的空间 */
+static void pipe_copy_in(pipe_t *pipe, const char *buf, u32 count){
+    u32 idx = pipe->head % PIPE_SIZE;
+    u32 first = MIN(count, PIPE_SIZE - idx);
+
+    memcpy(pipe->buf + idx, buf, first);
+    memcpy(pipe->buf, buf + first, count - first);
+    pipe->head += count;
+
+    wake_up_all(&pipe->rwait);
+}
+
+/* 等待到有数据可读，写端全部关闭时返回 0 */
+static u32 pipe_wait_data(pipe_t *pipe){
+    wait_event(&pipe->rwait, pipe_size(pipe) || !pipe->writers);
+    return pipe_size(pipe);
+}
+
+/* 等待到有空间可写，读端全部关闭时返回 0 */
+static u32 pipe_wait_space(pipe_t *pipe){
+    wait_event(&pipe->wwait, pipe_space(pipe) || !pipe->readers);
+    return pipe->readers ? pipe_space(pipe) : 0;
+}
+
+int pipe_read(pipe_t *pipe, char *buf, u32 count){
+    if (count == 0)
+        return 0;
+
+    u32 size = pipe_wait_data(pipe);
+    if (size == 0)
+        return 0;
+
+    count = MIN(count, size);
+    pipe_copy_out(pipe, buf, count);
+
+    return count;
+}
+
+int pipe_write(pipe_t *pipe, const char *buf, u32 count){
+    u32 written = 0;
+
+    while (written < count){
+        u32 space = pipe_wait_space(pipe);
+        if (space == 0)
+            return written ? written : EOF;
+
+        space = MIN(space, count - written);
+        pipe_copy_in(pipe, buf + written, space);
+        written += space;
+    }
+
+    return written;
+}
+
+/* file 的引用计数已经为 0，关闭管道的一端 */
+void pipe_release(file_t *file){
+    pipe_t *pipe = file->pipe;
+
+    if ((file->flags & O_ACCMODE) == O_WRONLY){
+        --pipe->writers;
+        wake_up_all(&pipe->rwait);
+    }
+    else{
+        --pipe->readers;
+        wake_up_all(&pipe->wwait);
+    }
+
+    if (pipe->readers == 0 && pipe->writers == 0){
+        free_kpage(pipe->buf, 1);
+        free(pipe);
+    }
+}
+
+static file_t *pipe_file(pipe_t *pipe, int flags){
+    file_t *file = (file_t *)malloc(sizeof(file_t));
+
+    file->inode = NULL;
+    file->pipe = pipe;
+    file->count = 1;
+    file->offset = 0;
+    file->flags = flags;
+    file->mode = IFIFO;
+
+    return file;
+}
+
+/* fds[0] 为读端，fds[1] 为写端 */
+int32 sys_pipe(fd_t fds[2]){
+    TCB_t *task = current_leader();
+    fd_t rfd, wfd;
+
+    for (rfd = 3; rfd < TASK_FILE_NR && task->files[rfd]; ++rfd);
+    for (wfd = rfd + 1; wfd < TASK_FILE_NR && task->files[wfd]; ++wfd);
+
+    if (wfd >= TASK_FILE_NR)
+        return EOF;
+
+    pipe_t *pipe = (pipe_t *)malloc(sizeof(pipe_t));
+
+    pipe->buf = (char *)alloc_kpage(1);
+    pipe->head = 0;
+    pipe->tail = 0;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    wait_queue_init(&pipe->rwait);
+    wait_queue_init(&pipe->wwait);
+
+    task->files[rfd] = pipe_file(pipe, O_RDONLY);
+    task->files[wfd] = pipe_file(pipe, O_WRONLY);
+
+    fds[0] = rfd;
+    fds[1] = wfd;
+
+    return 0;
+}
+
+/* 文件到管道：数据直接从缓冲块复制到环形缓冲区 */
+static int splice_to_pipe(file_t *in, pipe_t *pipe, u32 count){
+    m_inode *inode = in->inode;
+    u32 moved = 0;
+
+    while (moved < count && in->offset < inode->desc->size){
+        /* 先等到有空间再读缓冲块，避免持有缓冲块睡眠 */
+        u32 space = pipe_wait_space(pipe);
+        if (space == 0)
+            break;
+
+        u32 off = in->offset % BLOCK_SIZE;
+        u32 n = MIN(count - moved, BLOCK_SIZE - off);
+        n = MIN(n, inode->desc->size - in->offset);
+        n = MIN(n, space);
+
+        idx_t block = bmap(inode, in->offset / BLOCK_SIZE, false);
+        buffer_t *bf = block ? bread(inode->dev, block) : NULL;
+        if (!bf)
+            break;
+
+        /* 读缓冲块时可能睡眠，其他写者可能已经占用了空间，需要重新计算 */
+        n = MIN(n, pipe_space(pipe));
+        if (n == 0 || !pipe->readers){
+            brelse(bf);
+            if (!pipe->readers)
+                break;
+            continue;
+        }
+
+        pipe_copy_in(pipe, bf->b_data + off, n);
+        brelse(bf);
+
+        in->offset += n;
+        moved += n;
+    }
+
+    return moved ? moved : EOF;
+}
+
+/* 管道到文件：数据直接从环形缓冲区复制到缓冲块
+ * 整块覆盖时不需要先从磁盘读出原来的内容 */
+static int splice_from_pipe(pipe_t *pipe, file_t *out, u32 count){
+    m_inode *inode = out->inode;
+    u32 moved = 0;
+
+    while (moved < count){
+        u32 size = pipe_wait_data(pipe);
+        if (size == 0)
+            break;
+
+        u32 off = out->offset % BLOCK_SIZE;
+        u32 n = MIN(count - moved, BLOCK_SIZE - off);
+        n = MIN(n, size);
+
+        idx_t block = bmap(inode, out->offset / BLOCK_SIZE, true);
+        buffer_t *bf;
+
+        if (!block)
+            break;
+        bool vaild = true;
+
+        if (n == BLOCK_SIZE){
+            ATOMIC_OPS(
+                bf = getblk(inode->dev, block);
+                vaild = bf->b_vaild;
+                bf->b_vaild = true;
+            );
+        }
+        else{
+            bf = bread(inode->dev, block);
+            if (!bf)
+                break;
+        }
+
+        buffer_lock(bf);
+
+        /* 取缓冲块和加锁时可能睡眠，其他读者可能已经取走了数据，需要重新计算
+         * 没有读出原内容的缓冲块必须整块写满 */
+        if (pipe_size(pipe) < n && (n == BLOCK_SIZE || pipe_size(pipe) == 0)){
+            bf->b_vaild = vaild;
+            buffer_unlock(bf);
+            brelse(bf);
+            continue;
+        }
+        n = MIN(n, pipe_size(pipe));
+
+        pipe_copy_out(pipe, bf->b_data + off, n);
+        bf->b_dirty = true;
+        buffer_unlock(bf);
+        brelse(bf);
+
+        out->offset += n;
+        moved += n;
+        if (out->offset > inode->desc->size)
+            inode->desc->size = out->offset;
+    }
+
+    return moved ? moved : EOF;
+}
+
+/* 在管道和普通文件之间移动最多 count 个字节，数据不经过用户空间
+ * 两端必须恰好有一端是管道，返回移动的字节数 */
+int32 sys_splice(fd_t fd_in, fd_t fd_out, u32 count){
+    TCB_t *task = current_leader();
+
+    if (fd_in < 3 || fd_in >= TASK_FILE_NR || fd_out < 3 || fd_out >= TASK_FILE_NR)
+        return EOF;
+
+    file_t *in = task->files[fd_in];
+    file_t *out = task->files[fd_out];
+
+    if (!in || !out || (in->flags & O_ACCMODE) == O_WRONLY || (out->flags & O_ACCMODE) == O_RDONLY)
+        return EOF;
+
+    if (!in->pipe && out->pipe && ISFILE(in->inode->desc->mode))
+        return splice_to_pipe(in, out->pipe, count);
+
+    if (in->pipe && !out->pipe && ISFILE(out->inode->desc->mode))
+        return splice_from_pipe(in->pipe, out, count);
+
+    return EOF;
+}
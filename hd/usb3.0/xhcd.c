@@ -6,6 +6,7 @@
 #include <common/string.h>
 #include <common/stdlib.h>
 #include <rdix/task.h>
+#include <rdix/workqueue.h>
 
 #define XHC_LOG_INFO __LOG("[xhc]")
 #define XHC_WARNING_INFO __WARNING("[xhc warning]")
@@ -108,6 +109,11 @@ void xhc_info(){
 }
 
 static void xhc_handler(u32 int_num);
+static void xhc_event_proc(void *data);
+
+/* 中断下半部，在工作线程中处理 event ring 上所有的事件 */
+static work_t xhc_work;
+
 void xhc_interrupt_init(){
     /* 配置 event ring */
     /* 初始化 Event Ring Segments */
@@ -140,6 +146,8 @@ void xhc_interrupt_init(){
     /* 配置 MSI-X */
     u8 vec_arr[1] = {MSI_INT_START + 1};
     size_t size = 1;
+    work_init(&xhc_work, xhc_event_proc, NULL);
+
     /* 启动 MSI */
     assert(install_MSI_int(xhc->pci_info, MSI_INT_START + XHC_INT_NUM, xhc_handler) == 0);
 
@@ -205,7 +213,7 @@ static void trb_error_proc(u32 *event_trb){
 }
 
 static u32 count = 0;
-static void xhc_handler(u32 int_num){
+static void xhc_event_proc(void *data){
     //printk(XHC_WARNING_INFO "xhc interrupt, count %d\n", ++count);
     /* 获取首个 event TRB 指针 */
     int_reg_set *int_set = (int_reg_set *)((u32)xhc->run_base + 0x20);
@@ -275,6 +283,16 @@ debug:
 
     int_set->ERDP_Lo = (u32)event_trb | 8;
     int_set->ERDP_Hi = 0;
+}
+
+/* 上半部只应答中断，下半部处理期间到来的事件由同一次处理一并消费 */
+static void xhc_handler(u32 int_num){
+    int_reg_set *int_set = (int_reg_set *)((u32)xhc->run_base + 0x20);
+
+    /* IMAN.IP 写 1 清零 */
+    int_set[0].IMAN |= 1;
+
+    schedule_work(&xhc_work);
 
     lapic_send_eoi();
 }
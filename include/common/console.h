@@ -48,6 +48,9 @@
 #define COLOR_TYPE_BACK_CYAN (0x3 << 4)
 #define COLOR_TYPE_BACK_WHITE (0x7 << 4)
 
+/* 输出该序列时清屏，并把光标移到左上角 */
+#define CONSOLE_CLEAR "\033[2J]"
+
 /* 一个 tab 所占的空格数 */
 #define TABLE_SIZE 4
 
@@ -63,6 +66,7 @@ typedef enum Arrow_t{
 } Arrow_t;
 
 void console_init();
+void console_clean();
 u16 get_cursor_position();
 void set_cursor_position(u16 cursor_position, bool clean);
 u16 get_screen_position();
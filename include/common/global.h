@@ -56,15 +56,18 @@
 /* 该段是否被访问过，A=1 访问过，=0 未访问过 */
 #define GDT_ENTRY_TYPE_A 0x100
 
+/* sysexit 要求用户代码段紧跟在内核数据段之后，用户数据段再紧随其后
+ * 即 USER_CODE_SEG == KERNEL_CODE_SEG + 2，USER_DATA_SEG == KERNEL_CODE_SEG + 3
+ * 所以 TSS 描述符放在最后 */
 typedef enum SEG_IDX{
     KERNEL_CODE_SEG = 1,
     KERNEL_DATA_SEG,
-    
+    USER_CODE_SEG,
+    USER_DATA_SEG,
+
     /* TSS 描述符中，S = 0，type = 10B1
      * B位表示 busy，B 位为 0 表示任务不繁忙 */
-    KERNEL_TSS_SEG,
-    USER_CODE_SEG,
-    USER_DATA_SEG
+    KERNEL_TSS_SEG
 } SEG_IDX;
 
 typedef struct descriptor{
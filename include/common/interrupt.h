@@ -36,6 +36,7 @@
 /* MSI or MSI-X 使用的中断向量，相对于 MSI_INT_START 的偏移 */
 #define HBA_INT_NUM 0
 #define XHC_INT_NUM 1
+#define VIRTIO_BLK_INT_NUM 2
 
 /* 原子操作 */
 #define ATOMIC_OPS(exp)                         \
@@ -63,6 +64,7 @@ typedef struct idt_pointer{
 
 void interrupt_init();
 void syscall_init();
+void sysenter_init();
 void keyboard_init();
 void set_int_mask(u32 irq, bool enable);
 
@@ -76,6 +78,9 @@ enum  IOREDTBLFlags{
 void lapic_send_eoi();
 void install_int(u8 old_irq, u8 dest, u32 flag, handler_t handler);
 int install_MSI_int(pci_device_t *pci_dev, u8 vector, handler_t handler);
+int install_INTx_int(pci_device_t *pci_dev, u8 dest, u32 flag, handler_t handler);
+int install_MSI_X_int(pci_device_t *dev, u8 used_bar, void *mapped_addr,
+                      u8 *vec_array, size_t arr_size, handler_t *handler_array);
 
 _inline bool get_IF(){
     u32 res = false;
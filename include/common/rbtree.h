@@ -0,0 +1,39 @@
+#ifndef __RBTREE_H__
+#define __RBTREE_H__
+
+#include <common/type.h>
+
+/* 侵入式红黑树，节点嵌在所有者的结构体中，按 value 从小到大排列
+ * value 相同的节点按插入顺序排在后面 */
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+typedef struct RBNode{
+    u32 value;
+    u8 color;
+    struct RBNode *parent;
+    struct RBNode *left;
+    struct RBNode *right;
+    void *owner;
+} RBNode_t;
+
+typedef struct RBTree{
+    u32 number_of_node;
+    RBNode_t *root;
+} RBTree_t;
+
+void rbtree_init(RBTree_t *tree);
+void rbnode_init(RBNode_t *node, void *owner, u32 value);
+void rb_insert(RBTree_t *tree, RBNode_t *node);
+void rb_erase(RBTree_t *tree, RBNode_t *node);
+
+RBNode_t *rb_first(RBTree_t *tree);
+RBNode_t *rb_last(RBTree_t *tree);
+RBNode_t *rb_next(RBNode_t *node);
+RBNode_t *rb_prev(RBNode_t *node);
+
+/* 第一个 value >= value 的节点，没有时返回 NULL */
+RBNode_t *rb_lower_bound(RBTree_t *tree, u32 value);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <common/type.h>
 
+int atoi(const char *str);
 u8 bcd2bin(u8 bcd);
 void mdebug(void *data, size_t count);
 void swap(void *a, void *b, size_t size);
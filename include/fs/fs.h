@@ -4,6 +4,7 @@
 #include <common/type.h>
 #include <common/list.h>
 #include <rdix/mutex.h>
+#include <rdix/wait.h>
 
 #define BLOCK_SIZE 1024
 #define SECTOR_SIZE 512
@@ -28,16 +29,27 @@ typedef struct buffer_head{
     u8 b_count;     /* 引用计数 */
     u8 b_vaild;     /* 是否需要更新，bread 通过这位判断是否需要重新从磁盘中读取数据，0代表需要从磁盘更新 */
     ListNode_t *waiter; /* 等待该缓冲块释放的进程 */
+    u8 b_io;        /* 已经提交给块设备、还没有完成的请求 */
+    u8 b_error;     /* 最近一次请求是否出错 */
+    wait_queue_t b_wait; /* 等待请求完成的任务 */
     ListNode_t b_hnode; /* hash node */
     ListNode_t b_fnode; /* free node */
 } buffer_t;
 
 void buffer_init();
 buffer_t *getblk(dev_t dev, u32 block);
+/* 读出错时返回 NULL，调用者不需要再 brelse */
 buffer_t *bread(dev_t dev, u32 block);
-void bwrite(buffer_t *bf);
+int bwrite(buffer_t *bf);
 void brelse(buffer_t *bf);
 
+/* 异步提交读写请求，不等待完成，调用者需要持有缓冲块的引用
+ * 读请求完成后缓冲块变为有效，写请求在提交时就清除脏位 */
+void ll_rw_block(u32 type, buffer_t *bf);
+
+/* 等待缓冲块上的请求完成 */
+void wait_on_buffer(buffer_t *bf);
+
 void buffer_lock(buffer_t *bf);
 void buffer_unlock(buffer_t *bf);
 
@@ -146,7 +146,8 @@ typedef struct mode_t{
 
 typedef struct file_t
 {
-    m_inode *inode; // 文件 inode
+    m_inode *inode; // 文件 inode，管道为 NULL
+    struct pipe_t *pipe; // 管道，普通文件为 NULL
     u32 count;      // 引用计数
     idx_t offset;   // 文件偏移
     int flags;      // 文件标记
@@ -175,6 +176,9 @@ void inode_truncate(m_inode *inode);
 m_inode *inode_open(char *pathname, int flag, int mode);
 m_inode *get_root();
 
+/* 打开的文件可能被 fork 出的多个进程共享，引用计数为 0 时才释放 */
+void file_put(file_t *file);
+
 int sys_mkdir(const char *pathname, int mode);
 int sys_rmdir(const char *pathname);
 int sys_link(char *oldname, char *newname);
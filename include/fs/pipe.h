@@ -0,0 +1,32 @@
+#ifndef __PIPE_H__
+#define __PIPE_H__
+
+#include <common/type.h>
+#include <rdix/wait.h>
+
+/* 管道的环形缓冲区占一页 */
+#define PIPE_SIZE 4096
+
+/* head 和 tail 只增不减，二者之差为缓冲区中的字节数，下标对 PIPE_SIZE 取模 */
+typedef struct pipe_t{
+    char *buf;
+    u32 head;           // 写入的字节总数
+    u32 tail;           // 读出的字节总数
+    u32 readers;        // 读端的文件个数
+    u32 writers;        // 写端的文件个数
+    wait_queue_t rwait; // 等待数据的读者
+    wait_queue_t wwait; // 等待空间的写者
+} pipe_t;
+
+struct file_t;
+
+/* 写端全部关闭且没有数据时 pipe_read 返回 0
+ * 读端全部关闭时 pipe_write 返回已经写入的字节数，一个字节都没写入时返回 EOF */
+int pipe_read(pipe_t *pipe, char *buf, u32 count);
+int pipe_write(pipe_t *pipe, const char *buf, u32 count);
+void pipe_release(struct file_t *file);
+
+int32 sys_pipe(fd_t fds[2]);
+int32 sys_splice(fd_t fd_in, fd_t fd_out, u32 count);
+
+#endif
@@ -4,6 +4,7 @@
 #include <common/type.h>
 
 #define SATA_LBA_48_ENABLE 1
+#define SATA_NCQ_ENABLE 2
 
 typedef enum ATA_CMD_TYPE{
 	ATA_CMD_IDENTIFY_DEVICE = 0xec,
@@ -11,6 +12,8 @@ typedef enum ATA_CMD_TYPE{
 	ATA_CMD_READ_DMA_EXT = 0x25,
 	ATA_CMD_WRITE_DMA = 0xca,
 	ATA_CMD_WRITE_DMA_EXT = 0x35,
+	ATA_CMD_READ_FPDMA_QUEUED = 0x60,
+	ATA_CMD_WRITE_FPDMA_QUEUED = 0x61,
 } SATA_CMD_TYPE;
 
 typedef struct tagFIS_REG_H2D
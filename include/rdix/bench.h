@@ -0,0 +1,31 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <common/type.h>
+
+/* 调度器基准测试，只有定义 RDIX_BENCH 时才编译（make bench）
+ * 结果以 "BENCH <测试> <指标> <数值>" 的格式通过串口输出，单位为 tsc 周期或微秒
+ * 测试结束后写 qemu 的 isa-debug-exit 端口退出虚拟机 */
+#define BENCH_EXIT_PORT 0xf4
+#define BENCH_EXIT_PASS 0x10 // qemu 的退出码为 (0x10 << 1) | 1 = 33
+
+#define BENCH_PRIORITY 3
+#define BENCH_SETTLE_MS 1000    // 等待 tsc 标定和其他任务初始化完成
+#define BENCH_YIELD_LOOPS 10000
+#define BENCH_CHAIN_LEN 4
+#define BENCH_CHAIN_LOOPS 5000
+#define BENCH_FORK_LOOPS 200
+#define BENCH_WAIT_CHILDREN 16
+#define BENCH_DISK_IOS 2048     // 每种队列深度下的随机读次数
+#define BENCH_DISK_SECS 8       // 每次读 4K
+#define BENCH_DISK_SPAN 0x20000 // 随机读的范围，64M
+#define BENCH_DISK_QD 32
+#define BENCH_DISK_SEQ_KB 8192    // 顺序读的总量
+#define BENCH_DISK_LARGE_KB 256   // 大块顺序读每条命令的大小
+#define BENCH_DISK_MERGE_BLKS 256 // 逐块提交的顺序读块数
+#define BENCH_DISK_CCC_CC 16      // 命令完成合并测试中每次中断合并的完成数
+#define BENCH_DISK_CCC_TV 1       // 命令完成合并的超时，单位毫秒
+
+void bench_init();
+
+#endif
@@ -4,7 +4,9 @@
 #include <common/type.h>
 #include <common/list.h>
 #include <rdix/task.h>
+#include <common/rbtree.h>
 #include <fs/fs.h>
+#include <rdix/elevator.h>
 
 #define NAMELEN 16
 
@@ -23,6 +25,9 @@ enum device_subtype_t
     DEV_KEYBOARD,    // 键盘
     DEV_SATA_DISK,    // SATA 磁盘
     DEV_DISK_PART,    // 磁盘磁盘分区
+    DEV_SERIAL,       // 串口
+    DEV_VIRTIO_DISK,  // virtio-blk 磁盘
+    DEV_RAMDISK,      // 内存盘
 };
 
 // 设备控制命令
@@ -31,15 +36,38 @@ enum device_cmd_t
     DEV_CMD_SECTOR_START = 1, // 获得设备扇区开始位置 lba
     DEV_CMD_SECTOR_COUNT,     // 获得设备扇区数量
     DEV_ERROR_REPORT,
+    DEV_CMD_QUEUE_DEPTH,      // 获得设备可以同时执行的请求数
+    DEV_CMD_COALESCE,         // 设置中断合并，args 低 16 位为完成数，高 16 位为超时毫秒
 };
 
 #define REQ_READ 0  // 块设备读
 #define REQ_WRITE 1 // 块设备写
 
-#define DIRECT_FORE 0
-#define DIRECT_BACK 1
+#define REQ_SECS_MAX 256       // 合并后一个请求最多的扇区数
+#define BLK_DISPATCH_PRIORITY 5 // 请求分发线程的优先级
 
-// 块设备请求
+struct bio_t;
+
+/* bio 完成时调用，此时中断关闭，可能在分发线程或驱动的中断下半部中 */
+typedef void (*bio_end_io_t)(struct bio_t *bio);
+
+// 一次块设备读写，一段连续的内存，提交后由块设备层合并成请求
+typedef struct bio_t
+{
+    dev_t dev;           // 设备号，可以是分区
+    u32 type;            // 请求类型
+    idx_t idx;           // 扇区位置，提交后换算为磁盘上的位置
+    u32 count;           // 扇区数量
+    int flags;           // 特殊标志
+    u8 *buf;             // 缓冲区
+    int status;          // 完成后为 0 或 EOF
+    bio_end_io_t end_io; // 完成回调
+    void *private;       // 回调使用的数据
+    struct bio_t *next;  // 所在请求中的下一段
+    u64 start;           // 提交时的 tsc，用于统计延迟
+} bio_t;
+
+// 块设备请求，相邻的同向请求会合并成一个，各段按扇区顺序排列
 typedef struct request_t
 {
     dev_t dev;           // 设备号
@@ -47,11 +75,45 @@ typedef struct request_t
     idx_t idx;             // 扇区位置
     u32 count;           // 扇区数量
     int flags;           // 特殊标志
-    u8 *buf;             // 缓冲区
-    ListNode_t *task;        // 请求进程
-    ListNode_t node;
+    u32 nr_segs;         // bio 个数
+    bio_t *bio;          // 第一段
+    bio_t *biotail;      // 最后一段
+    time_t expire;       // 最晚应当分发的时间片，deadline 调度器使用
+    ListNode_t node;     // 蓄流链表或调度器中的节点
+    RBNode_t rb;         // 调度器中按扇区排序的节点
 } request_t;
 
+// 蓄流，期间提交的请求先在任务自己的链表中合并，结束时再一起放入设备队列
+typedef struct blk_plug_t
+{
+    List_t list;         // 按扇区顺序排列的请求
+} blk_plug_t;
+
+// 延迟直方图的桶数，第 i 个桶统计用时在 [2^i, 2^(i+1)) 个 tsc 周期之间的 bio，最后一个桶不设上限
+#define BLK_LAT_BUCKETS 32
+
+// iostat 的选项
+#define IOSTAT_HIST 1        // 输出延迟直方图
+#define IOSTAT_RESET 2       // 输出后清零
+#define IOSTAT_SERIAL 4      // 同时写到串口
+
+// 块设备的统计，磁盘和分区各有一份，请求队列的部分只在磁盘上有意义
+typedef struct blk_stat_t
+{
+    u32 submitted;       // 提交的段数
+    u32 back_merges;     // 接在已有请求之后的次数
+    u32 front_merges;    // 接在已有请求之前的次数
+    u32 requests;        // 交给驱动的请求数
+    u32 sectors;         // 交给驱动的扇区数，除以 requests 为平均请求大小
+    u32 ios[2];          // 完成的 bio 数，以 REQ_READ 和 REQ_WRITE 为下标
+    u32 secs[2];         // 完成的扇区数
+    u32 errors;          // 失败的 bio 数
+    u32 in_flight;       // 已经提交还没有完成的 bio 数
+    u64 busy;            // in_flight 不为 0 的 tsc 周期数
+    u64 busy_start;      // in_flight 最近一次由 0 变为 1 时的 tsc
+    u32 lat_hist[2][BLK_LAT_BUCKETS]; // bio 从提交到完成的延迟直方图
+} blk_stat_t;
+
 typedef struct __device_t
 {
     char name[NAMELEN];  // 设备名
@@ -59,16 +121,23 @@ typedef struct __device_t
     int subtype;         // 设备子类型
     dev_t dev;           // 设备号
     dev_t parent;        // 父设备号
-    u8 do_request;      //正在执行请求的任务
-    u8 req_direct;      //请求处理方向
+    u8 do_request;      //已经交给驱动还没有完成的请求数
+    u8 queue_depth;     //设备可以同时执行的请求数
+    u8 dispatchers;     //分发线程数，第一次提交请求时创建
     void *ptr;           // 设备指针
-    List_t *request_list; // 块设备请求链表
+    elevator_t *elevator; // 请求调度器，只有磁盘设备才有
+    void *elv_data;      // 调度器的私有数据，保存还没有分发的请求
+    wait_queue_t dispatch_wait; // 空闲的分发线程
+    blk_stat_t stat;     // 读写和请求队列统计
     // 设备控制
     int (*ioctl)(void *dev, int cmd, void *args, int flags);
     // 读设备
     int (*read)(void *dev, void *buf, size_t count, idx_t idx, int flags);
     // 写设备
     int (*write)(void *dev, void *buf, size_t count, idx_t idx, int flags);
+    // 直接处理请求，可以为 NULL，返回后请求可以仍在进行，完成时驱动调用 blk_end_request
+    // 返回 EOF 表示无法开始，请求按失败结束
+    int (*request)(void *dev, request_t *req);
 } device_t;
 
 // 安装设备
@@ -80,6 +149,9 @@ dev_t device_install(
 // 根据子类型查找设备
 device_t *device_find(int subtype, idx_t idx);
 
+// 根据设备名查找设备
+device_t *device_find_name(char *name);
+
 // 根据设备号查找设备
 device_t *device_get(dev_t dev);
 
@@ -97,7 +169,31 @@ void device_init();
 /* 获取磁盘设备名 */
 void get_disk_name(char *name);
 
-/* 块设备请求 */
-void device_request(buffer_t *bf, u8 count, idx_t idx, int flags, u32 type);
+/* 设置驱动的请求处理函数，需要在第一次提交请求之前调用 */
+void device_set_request(dev_t dev, void *request);
+
+void bio_init(bio_t *bio, dev_t dev, u32 type, idx_t idx, u32 count, void *buf);
+
+/* 异步提交 bio，返回时 I/O 可能还在进行，完成后调用 bio->end_io */
+void submit_bio(bio_t *bio);
+
+/* 提交 bio 并等待完成，返回 bio->status */
+int submit_bio_wait(bio_t *bio);
+
+/* 驱动完成请求时调用，依次结束其中的 bio，调用前需要关中断 */
+void blk_end_request(request_t *req, int status);
+
+/* 开始和结束蓄流，两者之间提交的请求合并后才交给设备 */
+void blk_start_plug(blk_plug_t *plug);
+void blk_finish_plug(blk_plug_t *plug);
+
+/* 把当前任务蓄流中的请求放入设备队列，蓄流仍然继续，等待请求完成前调用 */
+void blk_flush_plug();
+
+/* 清零统计，还没有完成的 bio 仍然计入 in_flight */
+void blk_stat_reset(device_t *device);
+
+/* 输出 devname 的统计，为 NULL 时输出所有块设备，flags 为 IOSTAT_* 的组合 */
+int32 sys_iostat(char *devname, u32 flags);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef __ELEVATOR_H__
+#define __ELEVATOR_H__
+
+#include <common/type.h>
+#include <common/list.h>
+
+/* 可替换的请求调度器，设备中还没有分发的请求由调度器保存
+ * 分发线程通过 dispatch 取出下一个请求，所有操作都在关中断下调用 */
+
+#define ELEVATOR_DEFAULT (&elevator_deadline)
+
+/* deadline 调度器的参数 */
+#define DEADLINE_READ_EXPIRE 500    // 读请求最长等待时间，单位毫秒
+#define DEADLINE_WRITE_EXPIRE 5000  // 写请求最长等待时间，单位毫秒
+#define DEADLINE_FIFO_BATCH 16      // 按扇区顺序连续分发的最多请求数
+#define DEADLINE_WRITES_STARVED 2   // 有写请求等待时，读最多连续优先这么多批
+
+/* blk_try_merge 的返回值 */
+#define ELV_NO_MERGE 0
+#define ELV_BACK_MERGE 1    // 接在已有请求之后
+#define ELV_FRONT_MERGE 2   // 接在已有请求之前，已有请求的起始扇区改变
+
+struct __device_t;
+struct request_t;
+
+typedef struct elevator_t{
+    const char *name;
+    /* 返回调度器的私有数据，保存在 device->elv_data 中 */
+    void *(*init)(struct __device_t *device);
+    /* 队列已经为空，释放私有数据 */
+    void (*exit)(struct __device_t *device);
+    /* 尝试把 req 合并到队列中的请求上，成功时 req 已经被释放 */
+    bool (*merge)(struct __device_t *device, struct request_t *req);
+    void (*add)(struct __device_t *device, struct request_t *req);
+    /* 取出下一个要执行的请求，队列为空时返回 NULL */
+    struct request_t *(*dispatch)(struct __device_t *device);
+} elevator_t;
+
+extern elevator_t elevator_sweep;
+extern elevator_t elevator_deadline;
+
+elevator_t *elevator_find(const char *name);
+
+/* 为磁盘设备建立调度器 */
+void elevator_init(struct __device_t *device, elevator_t *elv);
+
+/* 更换调度器，队列中的请求按旧调度器的顺序交给新调度器 */
+void elevator_switch(struct __device_t *device, elevator_t *elv);
+
+/* 尝试把 req 接在 rq 之前或之后，成功时释放 req，返回合并方式 */
+int blk_try_merge(struct request_t *rq, struct request_t *req);
+
+/* 在按扇区排序的请求链表中找一个可以和 req 合并的请求，成功时 req 已经被释放 */
+bool blk_list_merge(List_t *list, struct request_t *req);
+
+/* name 为 NULL 时输出设备当前的调度器，否则切换到 name，失败返回 EOF */
+int32 sys_elevator(char *devname, char *name);
+
+#endif
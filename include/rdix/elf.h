@@ -0,0 +1,58 @@
+#ifndef __ELF_H__
+#define __ELF_H__
+
+#include <common/type.h>
+
+/* 只支持 i386 上静态链接的 ELF32 可执行文件 */
+#define EI_NIDENT 16
+
+#define ELFMAG0 0x7f
+#define ELFMAG1 'E'
+#define ELFMAG2 'L'
+#define ELFMAG3 'F'
+
+#define EI_CLASS 4
+#define EI_DATA 5
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+
+#define ET_EXEC 2 // 可执行文件
+#define EM_386 3  // Intel 80386
+#define EV_CURRENT 1
+
+#define PT_NULL 0
+#define PT_LOAD 1 // 需要装入内存的段
+
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+typedef struct elf32_ehdr_t{
+    u8 e_ident[EI_NIDENT]; // 魔数以及格式信息
+    u16 e_type;            // 文件类型
+    u16 e_machine;         // 体系结构
+    u32 e_version;
+    u32 e_entry;           // 程序入口地址
+    u32 e_phoff;           // 程序头表的文件偏移
+    u32 e_shoff;           // 节头表的文件偏移
+    u32 e_flags;
+    u16 e_ehsize;          // ELF 头大小
+    u16 e_phentsize;       // 程序头表项大小
+    u16 e_phnum;           // 程序头表项个数
+    u16 e_shentsize;
+    u16 e_shnum;
+    u16 e_shstrndx;
+} _packed elf32_ehdr_t;
+
+typedef struct elf32_phdr_t{
+    u32 p_type;   // 段类型
+    u32 p_offset; // 段在文件中的偏移
+    u32 p_vaddr;  // 段的虚拟地址
+    u32 p_paddr;
+    u32 p_filesz; // 段在文件中的大小
+    u32 p_memsz;  // 段在内存中的大小，超出 p_filesz 的部分为 bss，填 0
+    u32 p_flags;  // PF_R | PF_W | PF_X
+    u32 p_align;
+} _packed elf32_phdr_t;
+
+#endif
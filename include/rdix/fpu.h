@@ -0,0 +1,33 @@
+#ifndef __FPU_H__
+#define __FPU_H__
+
+#include <common/type.h>
+
+/* fxsave 需要 512 字节且 16 字节对齐，fnsave 只需要 108 字节 */
+#define FPU_STATE_SIZE 512
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+struct TCB_t;
+
+void fpu_init();
+
+/* 任务切换时调用，根据下一个任务是否拥有 fpu 设置 CR0.TS */
+void fpu_switch(struct TCB_t *next);
+
+/* fork 时复制 fpu 状态，任务退出时释放 fpu 状态 */
+void fpu_fork(struct TCB_t *parent, struct TCB_t *child);
+void fpu_release(struct TCB_t *task);
+
+/* 内核中使用 fpu/sse 指令必须包在这一对函数之间
+ * 期间中断是关闭的，返回值为进入前的 IF 状态 */
+bool kernel_fpu_begin();
+void kernel_fpu_end(bool state);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+#include <common/type.h>
+
+/* futex 操作码，用户态与内核共用 */
+#define FUTEX_WAIT 0    // *uaddr == val 时睡眠，直到被 FUTEX_WAKE 唤醒
+#define FUTEX_WAKE 1    // 最多唤醒 val 个等待在 uaddr 上的任务，返回唤醒的个数
+
+/* 等待队列的哈希桶数，必须是 2 的幂 */
+#define FUTEX_HASH_NR 64
+
+void futex_init();
+int32 sys_futex(u32 *uaddr, int op, u32 val);
+
+#endif
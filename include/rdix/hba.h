@@ -6,6 +6,8 @@
 #include <common/list.h>
 #include <rdix/ata.h>
 #include <rdix/part.h>
+#include <rdix/wait.h>
+#include <rdix/workqueue.h>
 
 #define HBA_CC 0x010601
 
@@ -21,6 +23,8 @@
 #define HBA_REG_IS 0x8
 #define HBA_REG_PI 0xc
 #define HBA_REG_VS 0x10
+#define HBA_REG_CCC_CTL 0x14
+#define HBA_REG_CCC_PORTS 0x18
 
 #define VENDOR_SPECIFIC 0xa0
 
@@ -39,8 +43,24 @@
 #define HBA_PORT_PxSIG 0x24
 #define HBA_PORT_PxSSTS 0x28
 #define HBA_PORT_PxSERR 0x30
+#define HBA_PORT_PxSACT 0x34
 #define HBA_PORT_PxCI 0x38
 
+/* hba 能力寄存器位选择子 */
+#define HBA_CAP_SNCQ (1 << 30)
+#define HBA_CAP_CCCS (1 << 7)
+
+/* 命令完成合并 (CCC) 控制寄存器
+ * 完成 CC 个命令或者距第一个未报告的完成超过 TV 毫秒后，产生一次 INT 号中断 */
+#define HBA_CCC_EN (1 << 0)
+#define HBA_CCC_INT(ctl) (((ctl) >> 3) & 0x1f)
+#define HBA_CCC_CC(cc) ((u32)(cc) << 8)
+#define HBA_CCC_TV(tv) ((u32)(tv) << 16)
+
+/* 启动时的合并设置，完成数为 0 表示不合并，每个命令完成都产生中断 */
+#define HBA_CCC_COMPLETIONS 0
+#define HBA_CCC_TIMEOUT 1
+
 /* hba 全局寄存器位选择子 */
 #define HBA_GHC_AE (1 << 31)
 #define HBA_GHC_IE (1 << 1)
@@ -52,8 +72,45 @@
 #define HBA_PORT_CMD_FR (1 << 14)
 #define HBA_PORT_CMD_CR (1 << 15)
 #define HBA_PORT_TFD_BSY (1 << 7)
+#define HBA_PORT_IE_DHRE (1 << 0)
+#define HBA_PORT_IE_SDBE (1 << 3)
 #define HBA_PORT_IE_DPE (1 << 5)
+#define HBA_PORT_IE_IFE (1 << 27)
+#define HBA_PORT_IE_HBDE (1 << 28)
+#define HBA_PORT_IE_HBFE (1 << 29)
+#define HBA_PORT_IE_TFEE (1 << 30)
+#define HBA_PORT_IS_DHRS (1 << 0)
+#define HBA_PORT_IS_SDBS (1 << 3)
 #define HBA_PORT_IS_DPS (1 << 5)
+#define HBA_PORT_IS_IFS (1 << 27)
+#define HBA_PORT_IS_HBDS (1 << 28)
+#define HBA_PORT_IS_HBFS (1 << 29)
+#define HBA_PORT_IS_TFES (1 << 30)
+
+/* 命令完成的中断：非队列命令由 D2H Register FIS 通知，NCQ 命令由 Set Device Bits FIS 通知
+ * 有的 hba（比如 qemu）在 DMA 命令完成时不会置 DPS，只使用 DPS 会收不到中断 */
+#define HBA_PORT_IE_DONE (HBA_PORT_IE_DHRE | HBA_PORT_IE_SDBE | HBA_PORT_IE_DPE)
+#define HBA_PORT_IS_DONE (HBA_PORT_IS_DHRS | HBA_PORT_IS_SDBS | HBA_PORT_IS_DPS)
+/* 致命错误，出现后端口需要重启，所有未完成的命令都失败 */
+#define HBA_PORT_IE_ERROR (HBA_PORT_IE_IFE | HBA_PORT_IE_HBDE | HBA_PORT_IE_HBFE | HBA_PORT_IE_TFEE)
+#define HBA_PORT_IS_ERROR (HBA_PORT_IS_IFS | HBA_PORT_IS_HBDS | HBA_PORT_IS_HBFS | HBA_PORT_IS_TFES)
+
+#define HBA_SLOT_NR 32
+#define HBA_PORT_NR 32
+#define HBA_CMD_TIMEOUT 1000    // 命令超时时间，单位毫秒
+#define HBA_WATCHDOG_INTERVAL (HBA_CMD_TIMEOUT / 2) // 检查异步命令超时的间隔，单位毫秒
+
+/* 每个槽位预先分配的命令表大小，命令表必须 128 字节对齐
+ * 能放下 HBA_PRDT_NR 个 PRD，需要更多 PRD 的命令临时分配更大的命令表 */
+#define HBA_CMD_TAB_SIZE 256
+#define HBA_PRDT_NR ((HBA_CMD_TAB_SIZE - sizeof(cmd_tab_t)) / sizeof(cmd_tab_item))
+
+/* PRDTL 为 16 位，一个 PRD 最多描述 4M 的物理连续内存 */
+#define HBA_PRDT_MAX 0xffff
+#define HBA_PRD_BYTES_MAX 0x400000
+
+/* 一条命令最多传输的扇区数，count 为 16 位 */
+#define HBA_SECS_MAX 0x8000
 
 /* fis 类型 */
 #define FIS_RH2D 0x27
@@ -82,6 +139,7 @@ typedef struct hba_dev_t{
     u64 wwn;        //全球唯一标识符
 
     u8 spd;
+    u8 queue_depth; // 同时发出的最大命令数，不支持 NCQ 时为 1
     void *data;
     
     struct hba_port_t *port;
@@ -118,6 +176,19 @@ typedef struct cmd_tab_t{
     cmd_tab_item item[0];
 } cmd_tab_t;
 
+/* 命令槽，槽号同时也是 NCQ 命令的 tag */
+typedef struct hba_slot_t{
+    cmd_tab_t *tab;             // 命令表，在端口初始化时分配
+    cmd_tab_t *large;           // 本次命令临时分配的大命令表，命令完成后释放
+    u32 large_pages;
+    u8 cmd;
+    volatile bool done;         // 命令已经完成或失败
+    send_status_t status;
+    wait_queue_t wait;          // 等待该命令完成的任务
+    struct request_t *req;      // 异步发送的块设备请求，命令完成时由回收者结束请求并释放槽位
+    time_t deadline;            // 异步请求超时的时间片，由 hba_watchdog 检查
+} hba_slot_t;
+
 /* hba 端口类型 */
 typedef struct hba_port_t{
     int32 port_num;
@@ -129,14 +200,21 @@ typedef struct hba_port_t{
     /* mmio 寄存器基地址 */
     u32 *reg_base;
 
-    /* 发送状态 */
+    /* 最近一次命令的发送状态 */
     send_status_t last_status;
 
-    List_t *waiting_list;
-    ListNode_t *sending;
+    hba_slot_t slots[HBA_SLOT_NR];
+    u32 slot_map;       // 已经分配的槽位，命令完成后由发送者释放
+    u32 issue_map;      // 已经发给 hba 还没有完成的槽位
+    u32 inflight;       // issue_map 中的命令数
+    u32 exclusive;      // 等待发送非队列命令的任务数，此时不再发出新的 NCQ 命令
+
+    /* 等待空闲槽位的任务 */
+    wait_queue_t waiting;
 
-    /* 超时定时线程 */
-    ListNode_t *timer;
+    /* 中断下半部，irq_stat 为上半部清除前的 PxIS，留给下半部判断错误 */
+    work_t work;
+    u32 irq_stat;
 } hba_port_t;
 
 /* hba 设备 */
@@ -146,11 +224,30 @@ typedef struct hba_t{
     /* hba 寄存器 mm 基地址 */
     u32 *io_base;
     List_t *devices;
+    /* 端口号索引的端口，中断中按 IS 的位直接找到端口 */
+    struct hba_port_t *ports[HBA_PORT_NR];
+    u32 port_map;
+
+    /* 参与命令完成合并的端口和合并中断在 IS 中的位，ccc_ports 为 0 表示没有启用 */
+    u32 ccc_ports;
+    u8 ccc_int;
 
     /* 每个端口命令列表中最多插槽 (slot) 数 */
     u8 per_port_slot_cnt;
+
+    /* 中断已经安装，之前发送的命令只能轮询 */
+    bool int_enabled;
+    /* 使用的中断方式，MSI 或者传统中断引脚 (INTx) */
+    u8 int_mode;
+    u32 int_count;
 } hba_t;
 
+enum HBA_INT_MODE{
+    HBA_INT_NONE,
+    HBA_INT_MSI,
+    HBA_INT_INTX,
+};
+
 /* 会被外部改变的值需要加上 volatile
  * 比如这个结构体里的值会被 device 改变，编译器可能不知道
  * 他可能会把值存在寄存器里，当要读取的时候去寄存器里读，而不是这个内存空间
@@ -182,5 +279,6 @@ typedef volatile struct tagHBA_FIS
 typedef u32 slot_num;
 
 void hba_init();
+bool hba_set_ccc(u8 completions, u16 timeout);
 
 #endif
\ No newline at end of file
@@ -6,7 +6,7 @@
 
 #define KERNEL_MEMERY_SIZE 0x1400000
 #define IO_MEM_START 0x1000000  /* io寄存器映射基地址，长度为 4M */
-#define RAMDISK_M_START 0x1000000 /* ramdisk 内存块尾部 */
+#define RAMDISK_M_END 0x1000000 /* ramdisk 内存块尾部 */
 #define RAMDISK_M_START 0xC00000 /* ramdisk 内存块首部 */
 #define BUFFER_M_END 0xC00000 /* buffer 内存块尾部 */
 #define BUFFER_M_START 0x800000 /* buffer 内存块首部 */
@@ -59,6 +59,10 @@ typedef struct page_entry_t
     page_idx_t index : 20;  // 页索引
 } _packed page_entry_t;
 
+/* 页表项 ignored 中留给系统使用的位 */
+#define PTE_SHARED 0x1   // 共享内存页，fork 时保持可写，不做写时复制
+#define PTE_SHM_LAST 0x2 // 共享内存段在该进程中映射的最后一页
+
 /* 缺页中断时传入的错误码 */
 typedef struct page_error_code_t
 {
@@ -102,11 +106,23 @@ u32 set_cr3(u32 pde);
 void link_page(u32 vaddr);
 void unlink_page(u32 vaddr);
 
+/* 直接管理物理页引用计数的接口，p_bit_map 中的值即为引用次数
+ * alloc_zero_page 返回的页引用计数为 1，page_unref 减到 0 时物理页被释放
+ * link_shared_page 把物理页 idx 映射到 vaddr，并增加一次引用，bits 写入页表项的 ignored 位 */
+phy_addr_t alloc_zero_page();
+void page_ref(page_idx_t idx);
+void page_unref(page_idx_t idx);
+void link_shared_page(u32 vaddr, page_idx_t idx, u32 bits);
+void free_user_range(u32 vaddr, u32 count);
+
 page_entry_t *copy_pde();
+page_entry_t *alloc_pde();
+void free_pde();
 page_entry_t *get_pte(u32 vaddr, bool exist);
 void entry_init(page_entry_t *entry, page_idx_t pg_idx);
 
 phy_addr_t get_phy_addr(vir_addr_t vaddr);
+phy_addr_t user_page_private(u32 vaddr);
 
 vir_addr_t link_nppage(phy_addr_t addr, size_t size);
 
@@ -5,6 +5,8 @@
 
 #define MULTIBOOT_OS_MAGIC 0x36d76289
 #define MULTIBOOT_INFO_TYPE_END 0
+#define MULTIBOOT_TAG_TYPE_CMDLINE 1
+#define MULTIBOOT_TAG_TYPE_MODULE 3
 #define MEM_MAP_TYPE 6
 
 /* grub 提供的 boot infomation 固定信息
@@ -35,4 +37,21 @@ typedef struct multiboot2_map_tag_t{
     MENTRY_t entry[0];
 } MAP_TAG_t;
 
+/* 内核命令行的 tag 格式，string 以 0 结尾 */
+typedef struct multiboot2_string_tag_t{
+    MTAG_t general;
+    char string[0];
+} STR_TAG_t;
+
+/* grub 载入的模块的 tag 格式，模块占用物理内存 [mod_start, mod_end) */
+typedef struct multiboot2_module_tag_t{
+    MTAG_t general;
+    u32 mod_start;
+    u32 mod_end;
+    char cmdline[0];    //模块的命令行
+} MOD_TAG_t;
+
+/* 在 boot infomation 中查找第一个类型为 type 的 tag，没有找到返回 NULL */
+MTAG_t *multiboot2_find_tag(u32 info, u32 type);
+
 #endif
\ No newline at end of file
@@ -4,15 +4,42 @@
 #include <common/type.h>
 #include <common/list.h>
 
+/* 统计每个锁的获取次数、竞争次数以及最长持有时间，只在基准测试构建（RDIX_BENCH）中打开 */
+#ifdef RDIX_BENCH
+#define MUTEX_STAT
+#endif
+
+/* 等待者自旋让出 cpu 的最大次数，只在持有者处于就绪态时让出 */
+#define MUTEX_YIELD_MAX 3
+
+typedef struct mutex_stat_t{
+    u32 acquired;       // 获取次数
+    u32 contended;      // 获取时锁已被占用的次数
+    u32 yielded;        // 通过让出 cpu 等到锁的次数，不需要阻塞
+    u32 max_hold;       // 最长持有时间，单位为 tsc 周期
+    u64 stamp;          // 最近一次获取时的 tsc
+} mutex_stat_t;
+
 typedef struct mutex_t{
     bool value;
     List_t *waiter;    
+    ListNode_t *owner;      // 持有者的任务节点，未上锁时为 NULL
+    ListNode_t held;        // 持有者 mutexes 链表中的节点，用于计算继承的优先级
+#ifdef MUTEX_STAT
+    const char *name;
+    ListNode_t all;         // 全局锁链表中的节点，用于输出统计
+    mutex_stat_t stat;
+#endif
 } mutex_t;
 
 mutex_t *new_mutex();
 void mutex_init(mutex_t *mutex);
+void mutex_set_name(mutex_t *mutex, const char *name);
 void mutex_lock(mutex_t *mutex);
 void mutex_unlock(mutex_t *mutex);
 bool test_lock(mutex_t *mutex);
 
-#endif
\ No newline at end of file
+/* 输出所有锁的统计信息，reset 为真时清零 */
+void sys_lockstat(bool reset);
+
+#endif
@@ -15,6 +15,7 @@
 /* 配置空间寄存器地址 */
 #define PCI_CONFIG_SPACE_CMD 0x4
 #define PCI_CONFIG_SPACE_CAP_PTR 0x34
+#define PCI_CONFIG_SPACE_INT 0x3c      // 低 8 位为中断线，次 8 位为中断引脚
 
 /* 能力链表中的能力id */
 #define PCI_CAP_ID_MSI 0x5
@@ -24,6 +25,7 @@
 #define PCI_CAP_END_PTR 0
 
 enum PCI_CS_CMD_FLAGS{
+    __PCI_CS_CMD_IO_ENABLE = (1 << 0),
     __PCI_CS_CMD_MMIO_ENABLE = (1 << 1),
     __PCI_CS_CMD_BUS_MASTER_ENABLE = (1 << 2),
     __PCI_CS_CMD_BUS_INT_DISABLE = (1 << 10),
@@ -70,12 +72,15 @@ u32 pci_dev_reg_read(pci_device_t *dev, u8 reg);
 void pci_dev_reg_write(pci_device_t *dev, u8 reg, u32 data);
 
 pci_device_t *get_device_info(u32 dev_cc);
+pci_device_t *get_device_by_id(u16 vendor, u16 device_id, u32 idx);
 
 typedef u8 cap_p_t;
 
 cap_p_t capability_search(pci_device_t *dev, u8 cap_id);
+cap_p_t capability_search_next(pci_device_t *dev, cap_p_t prev, u8 cap_id);
 
 int __device_MSI_init(pci_device_t *dev, u8 vector);
+int __device_INTx_init(pci_device_t *dev);
 MSI_X_TABLE_ENTRY *__device_MSI_X_init(pci_device_t *dev, u8 used_bar, void *mapped_addr, u8 *vec_array, size_t arr_size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef __RAMDISK_H__
+#define __RAMDISK_H__
+
+#include <common/type.h>
+
+#define RAMDISK_NAME "ram0"
+/* 内核命令行中设置 ramdisk 大小的参数，单位 KB，例如 ramdisk=2048，为 0 时不安装 ramdisk
+ * 大小不能超过 RAMDISK_M_START 到 RAMDISK_M_END 的内存块，值不是数字时忽略该参数 */
+#define RAMDISK_CMDLINE_ARG "ramdisk="
+
+/* 内存盘，数据放在内核恒等映射的 ramdisk 内存块中，物理地址和虚拟地址相同 */
+typedef struct ramdisk_t{
+    u8 *start;      // 内存块首地址
+    u32 sectors;    // 扇区数
+    u32 loaded;     // 从 multiboot2 模块复制来的字节数
+    u32 mod_size;   // 模块大小，模块放不下时不载入
+    u32 requested;  // 命令行要求的大小，单位 KB
+    bool bad_arg;   // 命令行参数不合法，使用默认大小
+} ramdisk_t;
+
+/* 开启分页之前调用，此时还能访问 grub 放在任意位置的模块
+ * 确定 ramdisk 的大小，并把第一个模块复制到 ramdisk 内存块中 */
+void ramdisk_boot(u32 magic, u32 info);
+
+/* 安装 ramdisk 设备以及其中的分区 */
+void ramdisk_init();
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __SERIAL_H__
+#define __SERIAL_H__
+
+#include <common/type.h>
+
+/* 第一个串口 COM1，固定为 115200 8N1，只用于输出 */
+#define COM1_PORT 0x3f8
+
+#define SERIAL_BAUD_BASE 115200
+#define SERIAL_BAUD 115200
+
+#define UART_THR 0 // 发送保持寄存器（DLAB = 0）
+#define UART_DLL 0 // 波特率除数低字节（DLAB = 1）
+#define UART_IER 1 // 中断使能寄存器（DLAB = 0）
+#define UART_DLH 1 // 波特率除数高字节（DLAB = 1）
+#define UART_FCR 2 // FIFO 控制寄存器
+#define UART_LCR 3 // 线路控制寄存器
+#define UART_MCR 4 // modem 控制寄存器
+#define UART_LSR 5 // 线路状态寄存器
+
+#define UART_LCR_8N1 0x03
+#define UART_LCR_DLAB 0x80
+#define UART_FCR_ENABLE 0xc7 // 开启并清空 FIFO，14 字节触发
+#define UART_MCR_NORMAL 0x0b // DTR | RTS | OUT2
+#define UART_MCR_LOOP 0x1e   // 回环模式，用于检测串口是否存在
+#define UART_LSR_THRE 0x20   // 发送保持寄存器为空
+
+void serial_init();
+
+/* 串口不存在时返回 false，写入的数据被丢弃 */
+bool serial_present();
+void serial_write(const char *buf, u32 count);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include <common/type.h>
+#include <rdix/memory.h>
+#include <rdix/task.h>
+
+#define SHM_NR 16          // 系统中最多的共享内存段个数
+#define SHM_PAGES_MAX 1024 // 单个共享内存段最大 4M
+#define SHM_PRIVATE 0      // key 为 0 时总是新建
+
+/* 共享内存映射在线程栈之下的 16M 区域中，exec 装入的程序段不能超过这里 */
+#define SHM_AREA_TOP (THREAD_STACK_BOTTOM(THREAD_NR_MAX - 1) - PAGE_SIZE)
+#define SHM_AREA_SIZE 0x1000000
+#define SHM_AREA_BOTTOM (SHM_AREA_TOP - SHM_AREA_SIZE)
+
+/* 共享内存段本身持有每个物理页的一次引用，每个映射再各持有一次
+ * 销毁时只放弃段本身的引用，物理页在最后一个进程解除映射后才释放 */
+typedef struct shm_t{
+    bool used;
+    bool destroyed;     // 已经销毁，不能再被 attach，等待所有映射解除
+    u32 key;
+    u32 pages;          // 页数
+    u32 nattach;        // 映射了该段的地址空间个数
+    page_idx_t *frames; // 物理页索引
+} shm_t;
+
+void shm_init();
+
+/* copy_pde 和 free_pde 遇到共享页时调用，只在段的最后一页上计数 */
+void shm_page_dup(page_entry_t *entry);
+void shm_page_release(page_entry_t *entry);
+
+/* 供内核其他模块与用户共享内存，映射的页不属于任何共享内存段，由调用者持有物理页的引用 */
+u32 shm_map(page_idx_t *frames, u32 pages, u32 last_bits);
+
+int32 sys_shmget(u32 key, u32 size);
+void *sys_shmat(int32 id);
+int32 sys_shmdt(void *addr);
+int32 sys_shmrm(int32 id);
+
+#endif
@@ -27,16 +27,48 @@ typedef enum syscall_t{
     SYS_NR_GETPWD,
     SYS_NR_LINK,
     SYS_NR_UNLINK,
+    SYS_NR_CLONE,
+    SYS_NR_THREAD_EXIT,
+    SYS_NR_GETTID,
+    SYS_NR_FUTEX,
+    SYS_NR_LOCKSTAT,
+    SYS_NR_TASK_INFO,
+    SYS_NR_VFORK,
+    SYS_NR_SPAWN,
+    SYS_NR_EXECVE,
+    SYS_NR_PIPE,
+    SYS_NR_SPLICE,
+    SYS_NR_SHMGET,
+    SYS_NR_SHMAT,
+    SYS_NR_SHMDT,
+    SYS_NR_SHMRM,
+    SYS_NR_URING_SETUP,
+    SYS_NR_URING_ENTER,
+    SYS_NR_ELEVATOR,
+    SYS_NR_IOSTAT,
+    SYS_NR_TIME,
+    SYS_NR_UPTIME,
 } syscall_t;
 
+/* 线程函数，返回值作为线程的退出码 */
+typedef void *(*thread_fn_t)(void *arg);
+
+/* 指定入口的系统调用，用于比较 int 0x80 与 sysenter 的开销 */
+u32 syscall_int80(u32 nr, u32 arg1, u32 arg2, u32 arg3);
+u32 syscall_sysenter(u32 nr, u32 arg1, u32 arg2, u32 arg3);
+bool sysenter_supported();
+
 u32 test();
 void sleep(time_t ms);
 int32 brk(void *vaddr);
 pid_t fork();
 pid_t getpid();
 pid_t getppid();
+time_t time();
+u32 uptime();
 pid_t exit(int status);
 pid_t waitpid(pid_t pid, int32 *status);
+void yield();
 fd_t open(char *filename, int flags, int mode);
 fd_t create(char *filename, int mode);
 void close(fd_t fd);
@@ -50,5 +82,25 @@ int chdir(char *pathname);
 void getpwd(char *buf, size_t len);
 int link(char *oldname, char *newname);
 int unlink(char *pathname);
+pid_t clone(thread_fn_t fn, void *arg);
+void thread_exit(int status);
+pid_t gettid();
+int32 futex(u32 *uaddr, int op, u32 val);
+void lockstat(bool reset);
+struct task_info_t;
+int32 task_info(struct task_info_t *info, u32 count);
+pid_t vfork();
+pid_t spawn(const char *path, char *const argv[]);
+int32 execve(const char *path, char *const argv[]);
+int32 pipe(fd_t fds[2]);
+int32 splice(fd_t fd_in, fd_t fd_out, u32 count);
+int32 shmget(u32 key, u32 size);
+void *shmat(int32 id);
+int32 shmdt(void *addr);
+int32 shmrm(int32 id);
+struct uring_ring_t *uring_setup(u32 entries, u32 flags);
+int32 uring_enter(u32 to_submit, u32 min_complete, u32 flags);
+int32 elevator(char *devname, char *name);
+int32 iostat(char *devname, u32 flags);
 
 #endif
\ No newline at end of file
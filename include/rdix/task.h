@@ -5,11 +5,29 @@
 #include <common/bitmap.h>
 #include <common/list.h>
 #include <rdix/memory.h>
+#include <rdix/vdso.h>
 #include <fs/fs.h>
 
 #define KERNEL_UID 0
 #define USER_UID 3
 
+/* 系统中同时存在的最大任务数，决定 pid 位图的大小
+ * 可以在编译时通过 -DTASK_NR_MAX=xxx 调整，必须是 8 的倍数 */
+#ifndef TASK_NR_MAX
+#define TASK_NR_MAX 4096
+#endif
+
+/* pid 哈希表的桶数，必须是 2 的幂 */
+#define PID_HASH_NR 256
+
+/* 一个线程组中除 leader 外最多的线程数，每个线程占用一个用户栈槽位 */
+#define THREAD_NR_MAX 32
+#define THREAD_STACK_SIZE 0x10000
+
+/* 线程栈槽位紧挨在主线程栈保护页的下面，每个槽位下方留一页不映射作为保护页 */
+#define THREAD_STACK_TOP(slot) (USER_STACK_BOTTOM - PAGE_SIZE - (slot) * (THREAD_STACK_SIZE + PAGE_SIZE))
+#define THREAD_STACK_BOTTOM(slot) (THREAD_STACK_TOP(slot) - THREAD_STACK_SIZE)
+
 #define TASK_NAME_LEN 16    //任务名长度
 #define TASK_PWD_LEN 1024
 
@@ -29,6 +47,17 @@ typedef enum task_state_t
     TASK_DIED,     // 死亡
 } task_state_t;
 
+/* 线程组，由 clone 创建的线程与 leader 共享页目录、虚拟内存位图、打开的文件以及当前目录
+ * 这些资源只保存在 leader 的 TCB 中，通过 TCB 中的 leader 访问 */
+typedef struct thread_group_t{
+    u32 count;              // 组内存活的线程数，包括 leader
+    u32 stack_map;          // 线程栈槽位的占用位图
+    bool exiting;           // 组内有线程调用了 exit，所有线程在返回用户态时退出
+    bool leader_waiting;    // leader 正在等待其他线程退出
+    int status;             // 线程组的退出码
+    List_t threads;         // 除 leader 外的所有线程
+} thread_group_t;
+
 /* TCB 数据结构 */
 typedef struct TCB_t{
     void *stack;             // 任务栈指针的指针
@@ -43,17 +72,54 @@ typedef struct TCB_t{
     pid_t pid;              // 当前任务id
     pid_t ppid;             // 父任务id
     pid_t waitpid;          // 等待进程号位 pid 的子进程释放
+    ListNode_t *node;       // 任务在状态链表中的节点
+    ListNode_t hash_node;   // pid 哈希表中的节点
+    ListNode_t sibling;     // 父进程 children 链表中的节点
+    List_t children;        // 子进程链表
     page_entry_t *pde;                 // 页目录物理地址
     bitmap_t *vmap;   // 进程虚拟内存管理位图
+    List_t *vmas;     // 按需装入的用户内存区域，与 vmap 一样由共享地址空间的任务共享
     m_inode *i_root;    //根目录，用于绝对路径寻址
     m_inode *i_pwd;     //当前目录，用于相对路径寻址
     char *pwd;
     file_t *files[TASK_FILE_NR];
     u32 brk;
     u16 umask;
+    vdso_task_t *vdso;      // 进程私有内核数据页的内核地址，内核线程为 NULL
+    void *fpu;              // fpu/sse 状态保存区，第一次使用 fpu 时才分配
+    struct TCB_t *leader;   // 所属线程组的 leader，普通进程指向自己
+    thread_group_t *group;  // 线程组，只在 leader 中有效，第一次 clone 时才分配
+    ListNode_t thread_node; // 线程组 threads 链表中的节点
+    u32 stack_slot;         // 线程栈槽位
+    u32 base_priority;      // 基础优先级，priority 可能因为优先级继承而被提升
+    List_t mutexes;         // 持有的内核锁
+    struct mutex_t *blocked_on; // 正在等待的内核锁
+    u64 utime;              // 用户态运行时间，单位为 tsc 周期
+    u64 stime;              // 内核态运行时间，单位为 tsc 周期
+    u64 acct_stamp;         // 上一次记账时的 tsc
+    u32 nvcsw;              // 主动让出 cpu 的次数
+    u32 nivcsw;             // 被抢占的次数
+    u32 page_faults;        // 缺页次数
+    struct TCB_t *vfork_parent; // vfork 出的子进程在 exec 或 exit 之前借用该父进程的地址空间
+    struct uring_t *uring;  // 异步 I/O 队列，只在 leader 中有效
+    struct blk_plug_t *plug; // 蓄流期间提交的块设备请求，见 blk_start_plug
     u32 magic;               // 内核魔数，用于检测栈溢出
 } TCB_t;
 
+/* sys_task_info 返回给用户态的任务信息 */
+typedef struct task_info_t{
+    pid_t pid;
+    pid_t ppid;
+    task_state_t state;
+    u32 priority;
+    char name[TASK_NAME_LEN];
+    u64 utime;
+    u64 stime;
+    u32 nvcsw;
+    u32 nivcsw;
+    u32 page_faults;
+} task_info_t;
+
 /* 进程切换时需要保存一系列寄存器。
  * 该数据结构是为了在首次切换到该进程时保持栈平衡。 */
 typedef struct task_stack_t{
@@ -97,6 +163,12 @@ typedef struct intr_frame_t
 
 void task_init(void);
 ListNode_t *current_task();
+ListNode_t *task_lookup(pid_t pid);
+TCB_t *current_leader();
+void task_enter_kernel();
+void task_return_user();
+void task_reap();
+u64 task_idle_time();
 void schedule();
 char *task_name();
 ListNode_t *task_create(task_program handle, void * param,  const char *name, u32 priority, u32 uid);
@@ -106,6 +178,10 @@ void task_sleep(time_t time);
 void weakup();
 void user_task_create(user_target_t target, const char *name, u32 priority);
 pid_t sys_waitpid(pid_t pid, int32 *status);
+void sys_exit(int status);
+void task_vfork_release(TCB_t *task);
+void task_inherit(TCB_t *leader, TCB_t *child);
+void task_to_user(u32 eip, u32 esp);
 
 ListNode_t *kernel_task_create(user_target_t target, const char *name, u32 priority);
 void user_task_create(user_target_t target, const char *name, u32 priority);
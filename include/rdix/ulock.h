@@ -0,0 +1,39 @@
+#ifndef __ULOCK_H__
+#define __ULOCK_H__
+
+#include <common/type.h>
+
+/* 基于 futex 的用户态同步原语，无竞争时不陷入内核 */
+
+/* 0 未上锁，1 已上锁且没有等待者，2 已上锁且可能有等待者 */
+typedef struct umutex_t{
+    volatile u32 value;
+} umutex_t;
+
+/* seq 每次 signal/broadcast 加一，等待者在 seq 上睡眠 */
+typedef struct ucond_t{
+    volatile u32 seq;
+} ucond_t;
+
+/* waiters 为正在等待的任务数，为 0 时 post 不需要陷入内核 */
+typedef struct usem_t{
+    volatile u32 value;
+    volatile u32 waiters;
+} usem_t;
+
+void umutex_init(umutex_t *mutex);
+void umutex_lock(umutex_t *mutex);
+bool umutex_trylock(umutex_t *mutex);
+void umutex_unlock(umutex_t *mutex);
+
+void ucond_init(ucond_t *cond);
+void ucond_wait(ucond_t *cond, umutex_t *mutex);
+void ucond_signal(ucond_t *cond);
+void ucond_broadcast(ucond_t *cond);
+
+void usem_init(usem_t *sem, u32 value);
+void usem_wait(usem_t *sem);
+bool usem_trywait(usem_t *sem);
+void usem_post(usem_t *sem);
+
+#endif
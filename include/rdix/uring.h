@@ -0,0 +1,108 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <common/type.h>
+#include <common/list.h>
+#include <rdix/wait.h>
+#include <rdix/memory.h>
+
+/* 用户态与内核共享的提交队列（sq）和完成队列（cq）
+ * 用户把请求写入 sqe 后推进 sq_tail，内核消费后推进 sq_head
+ * 内核把结果写入 cqe 后推进 cq_tail，用户读取后推进 cq_head
+ * 一次 uring_enter 可以提交多个请求，请求由内核工作线程异步完成 */
+
+#define URING_ENTRIES_MAX 128   // sq 最大项数，cq 为 sq 的两倍
+#define URING_WORKERS 4         // 每个 uring 的工作线程数，也就是同时进行的最大 I/O 数
+
+/* uring_setup 的 flags */
+#define URING_SETUP_SQPOLL 0x1      // 由内核线程轮询 sq，提交请求不需要陷入内核
+
+/* uring_enter 的 flags */
+#define URING_ENTER_GETEVENTS 0x1   // 等待至少 min_complete 个完成项
+#define URING_ENTER_SQ_WAKEUP 0x2   // 唤醒睡眠中的轮询线程
+
+/* sq_flags */
+#define URING_SQ_NEED_WAKEUP 0x1    // 轮询线程已经睡眠，提交后需要带 URING_ENTER_SQ_WAKEUP 调用 uring_enter
+
+/* 轮询线程空闲这么久（毫秒）之后睡眠 */
+#define URING_SQPOLL_IDLE 100
+
+/* 读写时 off 为该值表示使用并推进文件当前的偏移 */
+#define URING_OFF_CUR ((u32)-1)
+
+typedef enum uring_op_t{
+    URING_OP_NOP,
+    URING_OP_READ,      // fd, addr = buf, len, off
+    URING_OP_WRITE,     // fd, addr = buf, len, off
+    URING_OP_OPEN,      // addr = 路径, len = flags, off = mode，res 为 fd
+    URING_OP_FSYNC,     // fd，把文件所在设备的脏缓冲写回
+    URING_OP_NR,
+} uring_op_t;
+
+typedef struct uring_sqe_t{
+    u8 opcode;
+    u8 flags;
+    u16 reserved;
+    fd_t fd;
+    u32 addr;
+    u32 len;
+    u32 off;
+    u32 user_data;      // 原样带回到 cqe 中
+    u32 pad[2];
+} uring_sqe_t;
+
+typedef struct uring_cqe_t{
+    u32 user_data;
+    int32 res;          // 请求的返回值，与对应的同步系统调用相同
+} uring_cqe_t;
+
+/* 共享区域的第一页开头为 uring_ring_t，sqes_off 和 cqes_off 为两个数组相对于它的偏移 */
+typedef struct uring_ring_t{
+    volatile u32 sq_head;
+    volatile u32 sq_tail;
+    u32 sq_mask;
+    u32 sq_entries;
+    volatile u32 sq_flags;
+    volatile u32 cq_head;
+    volatile u32 cq_tail;
+    u32 cq_mask;
+    u32 cq_entries;
+    u32 sqes_off;
+    u32 cqes_off;
+} uring_ring_t;
+
+#define URING_SQES(ring) ((uring_sqe_t *)((u32)(ring) + (ring)->sqes_off))
+#define URING_CQES(ring) ((uring_cqe_t *)((u32)(ring) + (ring)->cqes_off))
+
+/* 内核中的 uring，保存在线程组 leader 中，工作线程与 leader 共享页目录和打开的文件 */
+typedef struct uring_t{
+    uring_ring_t *ring;     // 共享区域的用户地址
+    /* 共享区域中除了头尾索引以外的字段用户都可以改写，内核只使用自己保存的副本 */
+    uring_sqe_t *sqes;
+    uring_cqe_t *cqes;
+    u32 sq_mask;
+    u32 cq_mask;
+    u32 sq_entries;
+    u32 cq_entries;
+    page_idx_t *frames;     // 共享区域的物理页，uring 持有每页的一次引用
+    u32 pages;
+    u32 flags;
+    List_t pending;         // 已从 sq 取出、等待工作线程执行的请求
+    u32 inflight;           // 已从 sq 取出但还没有写入 cq 的请求数
+    u32 threads;            // 存活的内核线程数
+    bool exiting;
+    wait_queue_t work_wait; // 空闲的工作线程
+    wait_queue_t cq_wait;   // 等待完成项的任务
+    wait_queue_t sq_wait;   // 睡眠的轮询线程
+    wait_queue_t exit_wait; // 等待内核线程全部退出
+} uring_t;
+
+struct TCB_t;
+
+/* 进程退出或 exec 时调用，等待内核线程退出并释放 uring */
+void uring_release(struct TCB_t *leader);
+
+uring_ring_t *sys_uring_setup(u32 entries, u32 flags);
+int32 sys_uring_enter(u32 to_submit, u32 min_complete, u32 flags);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __VDSO_H__
+#define __VDSO_H__
+
+#include <common/type.h>
+#include <rdix/memory.h>
+
+/* 内核数据页映射在用户栈顶之上，独占一个页目录项
+ * 第一页为所有进程共享的全局数据，第二页为每个进程私有的数据
+ * 两页对用户态都是只读的，用户态读取时不需要陷入内核 */
+#define VDSO_START USER_STACK_TOP
+#define VDSO_DATA_ADDR VDSO_START
+#define VDSO_TASK_ADDR (VDSO_START + PAGE_SIZE)
+
+/* 数据页有效时 magic 为该值，否则用户态改用系统调用 */
+#define VDSO_MAGIC 0x6f736476
+
+/* 读者通过 seq 判断数据是否一致
+ * seq 为奇数表示内核正在更新，读前后 seq 不同表示读的过程中发生了更新，需要重读 */
+typedef struct vdso_data_t{
+    volatile u32 seq;
+    volatile u32 magic;
+    volatile time_t jiffies;        // 开机以来的时间片数
+    volatile time_t startup;        // 开机时的时间戳，单位秒
+    volatile time_t wall_sec;       // 当前时间戳，单位秒
+    volatile u32 tsc_per_jiffy;     // 一个时间片内 tsc 的增量，0 表示尚未标定
+    volatile u32 tsc_khz;           // tsc 频率，单位 KHz
+    volatile u64 tsc_stamp;         // 最近一次时钟中断时的 tsc
+} vdso_data_t;
+
+typedef struct vdso_task_t{
+    volatile u32 seq;
+    volatile u32 magic;             // vfork 的子进程运行期间父进程的数据页无效
+    volatile pid_t pid;
+    volatile pid_t ppid;
+} vdso_task_t;
+
+struct TCB_t;
+
+void vdso_init();
+void vdso_tick();
+void vdso_map(struct TCB_t *task);
+void vdso_unmap(struct TCB_t *task);
+void vdso_task_sync(struct TCB_t *task);
+void vdso_task_invalidate(struct TCB_t *task);
+u32 vdso_tsc_khz();
+time_t sys_time();
+u32 sys_uptime();
+
+#endif
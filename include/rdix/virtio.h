@@ -0,0 +1,211 @@
+#ifndef __VIRTIO_H__
+#define __VIRTIO_H__
+
+#include <common/type.h>
+#include <rdix/pci.h>
+#include <rdix/wait.h>
+#include <rdix/workqueue.h>
+
+/* virtio PCI 设备，legacy 和过渡设备的 device id 为 0x1000 + 设备类型
+ * 只支持 modern 接口的设备为 0x1040 + 设备类型 */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_ID_BLOCK 2
+#define VIRTIO_PCI_LEGACY_ID(type) (0x1000 + (type) - 1)
+#define VIRTIO_PCI_MODERN_ID(type) (0x1040 + (type))
+
+/* 设备状态 */
+#define VIRTIO_STATUS_ACK 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FEATURES_OK 8
+#define VIRTIO_STATUS_FAILED 0x80
+
+/* 与设备类型无关的特性位，VERSION_1 是第 32 位，在第二个 32 位中的第 0 位 */
+#define VIRTIO_F_VERSION_1_HI (1 << 0)
+
+/* legacy 接口的寄存器，在 BAR0 的 io 空间中 */
+#define VIRTIO_PCI_HOST_FEATURES 0x0
+#define VIRTIO_PCI_GUEST_FEATURES 0x4
+#define VIRTIO_PCI_QUEUE_PFN 0x8
+#define VIRTIO_PCI_QUEUE_NUM 0xc
+#define VIRTIO_PCI_QUEUE_SEL 0xe
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+#define VIRTIO_MSI_CONFIG_VECTOR 0x14
+#define VIRTIO_MSI_QUEUE_VECTOR 0x16
+/* 设备配置的位置取决于是否启用了 MSI-X */
+#define VIRTIO_PCI_CONFIG(msix) ((msix) ? 0x18 : 0x14)
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT 12
+#define VIRTIO_PCI_VRING_ALIGN PAGE_SIZE
+
+/* modern 接口的寄存器分散在几个 BAR 中，由 vendor 能力指出位置 */
+#define PCI_CAP_ID_VNDR 0x9
+#define VIRTIO_PCI_CAP_COMMON_CFG 1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG 2
+#define VIRTIO_PCI_CAP_ISR_CFG 3
+#define VIRTIO_PCI_CAP_DEVICE_CFG 4
+
+/* common 配置结构中的寄存器 */
+#define VIRTIO_PCI_COMMON_DFSELECT 0x0
+#define VIRTIO_PCI_COMMON_DF 0x4
+#define VIRTIO_PCI_COMMON_GFSELECT 0x8
+#define VIRTIO_PCI_COMMON_GF 0xc
+#define VIRTIO_PCI_COMMON_MSIX 0x10
+#define VIRTIO_PCI_COMMON_NUMQ 0x12
+#define VIRTIO_PCI_COMMON_STATUS 0x14
+#define VIRTIO_PCI_COMMON_CFGGENERATION 0x15
+#define VIRTIO_PCI_COMMON_Q_SELECT 0x16
+#define VIRTIO_PCI_COMMON_Q_SIZE 0x18
+#define VIRTIO_PCI_COMMON_Q_MSIX 0x1a
+#define VIRTIO_PCI_COMMON_Q_ENABLE 0x1c
+#define VIRTIO_PCI_COMMON_Q_NOFF 0x1e
+#define VIRTIO_PCI_COMMON_Q_DESCLO 0x20
+#define VIRTIO_PCI_COMMON_Q_DESCHI 0x24
+#define VIRTIO_PCI_COMMON_Q_AVAILLO 0x28
+#define VIRTIO_PCI_COMMON_Q_AVAILHI 0x2c
+#define VIRTIO_PCI_COMMON_Q_USEDLO 0x30
+#define VIRTIO_PCI_COMMON_Q_USEDHI 0x34
+
+/* 不使用 MSI-X 向量 */
+#define VIRTIO_MSI_NO_VECTOR 0xffff
+
+/* 一个队列最多使用的描述符数，设备给出的队列更大时 modern 接口可以缩小
+ * legacy 接口不能修改队列大小 */
+#define VIRTQ_SIZE_MAX 256
+
+/* 描述符标志 */
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2    // 设备写入的缓冲区
+/* 设备置位时不需要通知 */
+#define VRING_USED_F_NO_NOTIFY 1
+
+typedef struct vring_desc_t{
+    u64 addr;
+    u32 len;
+    u16 flags;
+    u16 next;
+} _packed vring_desc_t;
+
+typedef struct vring_avail_t{
+    u16 flags;
+    volatile u16 idx;
+    u16 ring[0];
+} _packed vring_avail_t;
+
+typedef struct vring_used_elem_t{
+    u32 id;     // 描述符链的第一个描述符
+    u32 len;    // 设备写入的字节数
+} _packed vring_used_elem_t;
+
+typedef struct vring_used_t{
+    volatile u16 flags;
+    volatile u16 idx;
+    vring_used_elem_t ring[0];
+} _packed vring_used_t;
+
+/* split virtqueue，描述符表、avail 环和 used 环放在一块连续的物理内存中
+ * 空闲的描述符通过 next 串成链表 */
+typedef struct virtqueue_t{
+    u16 index;
+    u16 size;
+    u16 num_free;
+    u16 free_head;
+    u16 last_used;      // 下一个要回收的 used 项
+    u16 notify_off;     // modern 接口中通知寄存器的偏移
+    vring_desc_t *desc;
+    vring_avail_t *avail;
+    vring_used_t *used;
+    void *mem;
+    u32 pages;
+} virtqueue_t;
+
+/* virtio PCI 设备 */
+typedef struct virtio_dev_t{
+    pci_device_t *pci;
+    bool modern;
+
+    /* legacy 接口的 io 端口基址 */
+    u16 io_base;
+
+    /* modern 接口各个结构映射后的地址 */
+    volatile u8 *common;
+    volatile u8 *notify;
+    u32 notify_mul;
+    volatile u8 *isr;
+    volatile u8 *device;
+
+    /* 中断方式，和 hba 相同，使用 MSI-X 时不需要读 ISR */
+    u8 int_mode;
+    bool int_enabled;
+    u32 int_count;
+} virtio_dev_t;
+
+enum VIRTIO_INT_MODE{
+    VIRTIO_INT_NONE,
+    VIRTIO_INT_MSIX,
+    VIRTIO_INT_INTX,
+};
+
+/* 传输层 */
+bool virtio_pci_init(virtio_dev_t *vdev, pci_device_t *pci);
+void virtio_set_status(virtio_dev_t *vdev, u8 status);
+u8 virtio_get_status(virtio_dev_t *vdev);
+bool virtio_negotiate(virtio_dev_t *vdev, u32 features, u32 *accepted);
+bool virtio_int_init(virtio_dev_t *vdev, u8 vector, handler_t handler);
+u8 virtio_isr(virtio_dev_t *vdev);
+u32 virtio_cfg_read32(virtio_dev_t *vdev, u32 offset);
+
+/* 队列 */
+virtqueue_t *virtqueue_setup(virtio_dev_t *vdev, u16 index);
+int virtqueue_alloc(virtqueue_t *vq, u16 count);
+void virtqueue_free(virtqueue_t *vq, u16 head);
+void virtqueue_submit(virtqueue_t *vq, u16 head);
+bool virtqueue_pop(virtqueue_t *vq, u16 *head, u32 *len);
+void virtqueue_kick(virtio_dev_t *vdev, virtqueue_t *vq);
+
+/* virtio-blk 特性位 */
+#define VIRTIO_BLK_F_SEG_MAX (1 << 2)
+
+/* virtio-blk 设备配置中的字段 */
+#define VIRTIO_BLK_CFG_CAPACITY 0x0
+#define VIRTIO_BLK_CFG_SEG_MAX 0xc
+
+/* 请求类型和状态 */
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+
+/* 请求头，设备只读 */
+typedef struct virtio_blk_outhdr_t{
+    u32 type;
+    u32 reserved;
+    u64 sector;
+} _packed virtio_blk_outhdr_t;
+
+/* 每个在执行的请求一项，用描述符链的第一个描述符索引
+ * 请求头和状态字节都要让设备访问，不能放在栈上 */
+typedef struct vblk_ctx_t{
+    virtio_blk_outhdr_t hdr;
+    volatile u8 status;
+    volatile bool done;
+    struct request_t *req;  // 异步请求，完成时由回收者结束请求并释放描述符
+    wait_queue_t wait;      // 同步请求的等待者，描述符由等待者释放
+} vblk_ctx_t;
+
+typedef struct virtio_blk_t{
+    virtio_dev_t vdev;
+    virtqueue_t *vq;
+    vblk_ctx_t *ctx;
+    u64 capacity;           // 扇区数，扇区固定为 512 字节
+    u32 seg_max;            // 一个请求最多的数据段数
+    u8 queue_depth;         // 交给块设备层的队列深度
+    wait_queue_t desc_wait; // 等待空闲描述符的任务
+    work_t work;            // 中断下半部
+} virtio_blk_t;
+
+void virtio_blk_init();
+u32 *virtio_blk_int_count(u32 idx);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __VMA_H__
+#define __VMA_H__
+
+#include <common/type.h>
+#include <common/list.h>
+#include <fs/fs.h>
+
+#define VMA_READ 0x1
+#define VMA_WRITE 0x2
+#define VMA_EXEC 0x4
+
+/* 用户地址空间中的一段映射，缺页时才装入内容
+ * [start, start + filesz) 的内容来自 inode 中从 offset 开始的数据，其余部分填 0
+ * 目前页表不区分读写权限，flags 只做记录 */
+typedef struct vma_t{
+    u32 start;      // 起始虚拟地址，页对齐
+    u32 end;        // 结束虚拟地址（不含），页对齐
+    u32 flags;
+    m_inode *inode; // 映射的文件，NULL 表示匿名映射
+    u32 offset;     // start 对应的文件偏移
+    u32 filesz;     // 来自文件的字节数
+    ListNode_t node;
+} vma_t;
+
+/* vma 链表跟随 vmap，同一地址空间中的线程以及 vfork 的子进程共享同一个链表 */
+List_t *vma_list_create();
+List_t *vma_list_copy(List_t *vmas);
+void vma_list_release(List_t *vmas);
+
+vma_t *vma_add(List_t *vmas, u32 start, u32 end, u32 flags, m_inode *inode, u32 offset, u32 filesz);
+vma_t *vma_find(List_t *vmas, u32 vaddr);
+
+/* 缺页中断中调用，vaddr 不属于任何 vma 时返回 false，读程序段出错时结束当前任务 */
+bool vma_fault(u32 vaddr);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __WAIT_H__
+#define __WAIT_H__
+
+#include <common/type.h>
+#include <common/list.h>
+#include <common/interrupt.h>
+
+/* 等待队列，节点为等待者内核栈上的 ListNode_t，owner 为任务节点
+ * 等待者本身睡眠在 block_list（不超时）或 sleep_list（超时）中
+ * 所以一个任务可以同时被唤醒和超时，二者以先到者为准 */
+typedef struct wait_queue_t{
+    List_t list;
+} wait_queue_t;
+
+void wait_queue_init(wait_queue_t *wq);
+
+/* 由超时时长（毫秒）得到截止的时间片，0 表示不超时 */
+time_t wait_deadline(time_t timeout);
+
+/* 调用前需要关中断，当前任务睡眠直到被唤醒或到达 deadline
+ * 超时返回 false，其他情况返回 true */
+bool wait_on_until(wait_queue_t *wq, time_t deadline);
+
+/* 按等待的先后顺序唤醒最多 nr 个任务，返回唤醒的个数，可以在中断中调用 */
+u32 wake_up(wait_queue_t *wq, u32 nr);
+
+#define wake_up_one(wq) wake_up(wq, 1)
+#define wake_up_all(wq) wake_up(wq, (u32)-1)
+
+/* 在关中断下检查 condition，不满足时睡眠，被唤醒后重新检查
+ * 返回最后一次检查的结果，超时时为 false；timeout 单位为毫秒，0 表示不超时 */
+#define wait_event_timeout(wq, condition, timeout) ({               \
+    bool __IF_stat = get_and_disable_IF();                          \
+    time_t __deadline = wait_deadline(timeout);                     \
+    bool __ret;                                                     \
+    while (!(__ret = (condition))){                                 \
+        if (!wait_on_until(wq, __deadline)){                        \
+            __ret = (condition);                                    \
+            break;                                                  \
+        }                                                           \
+    }                                                               \
+    set_IF(__IF_stat);                                              \
+    __ret; })
+
+#define wait_event(wq, condition) wait_event_timeout(wq, condition, 0)
+
+#endif
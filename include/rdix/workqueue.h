@@ -0,0 +1,34 @@
+#ifndef __WORKQUEUE_H__
+#define __WORKQUEUE_H__
+
+#include <common/type.h>
+#include <common/list.h>
+#include <rdix/wait.h>
+
+/* 中断下半部，中断处理函数只应答硬件，其余工作交给工作线程在开中断的情况下完成 */
+
+typedef void (*work_func_t)(void *data);
+
+typedef struct work_t{
+    ListNode_t node;        // 工作队列中的节点
+    work_func_t func;
+    void *data;
+} work_t;
+
+typedef struct workqueue_t{
+    const char *name;
+    List_t works;           // 待处理的工作，从头部压入，从尾部取出
+    wait_queue_t wait;      // 空闲的工作线程
+} workqueue_t;
+
+void workqueue_init();
+workqueue_t *workqueue_create(const char *name, u32 workers, u32 priority);
+void work_init(work_t *work, work_func_t func, void *data);
+
+/* 可以在中断中调用，work 已经在队列中时不会重复加入，返回 false */
+bool queue_work(workqueue_t *wq, work_t *work);
+
+/* 加入系统默认的工作队列 */
+bool schedule_work(work_t *work);
+
+#endif
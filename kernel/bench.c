@@ -0,0 +1,454 @@
+#ifdef RDIX_BENCH
+
+#include <rdix/bench.h>
+#include <rdix/task.h>
+#include <rdix/kernel.h>
+#include <rdix/hardware.h>
+#include <rdix/syscall.h>
+#include <rdix/vdso.h>
+#include <common/io.h>
+#include <common/interrupt.h>
+#include <common/assert.h>
+#include <common/string.h>
+#include <rdix/hba.h>
+#include <rdix/device.h>
+#include <rdix/virtio.h>
+
+#define BENCH_LOG_INFO __LOG("[bench]")
+
+extern hba_t *hba;
+
+static u32 bench_count;
+
+/* 每行一个结果，方便脚本解析 */
+static void bench_report(const char *test, const char *metric, u32 value){
+    printk("BENCH %s %s %u\n", test, metric, value);
+    ++bench_count;
+}
+
+static u32 cycles_to_us(u32 cycles){
+    u32 mhz = vdso_tsc_khz() / 1000;
+
+    return mhz ? cycles / mhz : 0;
+}
+
+/* 等待 bench_main 创建的所有内核线程退出 */
+static void bench_reap(){
+    ATOMIC_OPS(while (sys_waitpid(-1, NULL) != -1););
+}
+
+/* ===================== yield 乒乓 ===================== */
+
+/* 两个线程轮流主动调度，就绪队列中没有其他任务时每次 schedule 都是一次切换 */
+static void yield_thread(){
+    u32 loops;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(loops)
+    );
+
+    set_IF(true);
+
+    for (u32 i = 0; i < loops; ++i){
+        ATOMIC_OPS(schedule(););
+    }
+
+    kernel_thread_exit(NULL, 0);
+}
+
+static void bench_yield(){
+    u64 start = rdtsc();
+
+    ATOMIC_OPS(
+        task_create(yield_thread, (void *)BENCH_YIELD_LOOPS, "bench_yield", BENCH_PRIORITY, KERNEL_UID);
+        task_create(yield_thread, (void *)BENCH_YIELD_LOOPS, "bench_yield", BENCH_PRIORITY, KERNEL_UID);
+    );
+    bench_reap();
+
+    u32 cycles = (u32)(rdtsc() - start);
+    bench_report("yield", "cycles_per_switch", cycles / (2 * BENCH_YIELD_LOOPS));
+}
+
+/* ===================== block/unblock 链 ===================== */
+
+/* 令牌在 BENCH_CHAIN_LEN 个线程间传递
+ * 拿到令牌的线程把令牌交给下一个线程并唤醒它，然后阻塞自己 */
+static ListNode_t *chain_nodes[BENCH_CHAIN_LEN];
+static volatile u32 chain_token;
+
+static void chain_thread(){
+    u32 idx;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(idx)
+    );
+
+    bool IF_stat = get_and_disable_IF();
+
+    for (u32 i = 0; i < BENCH_CHAIN_LOOPS; ++i){
+        while (chain_token != idx)
+            block(NULL, NULL, TASK_BLOCKED);
+
+        chain_token = (idx + 1) % BENCH_CHAIN_LEN;
+
+        ListNode_t *next = chain_nodes[chain_token];
+        if (((TCB_t *)next->owner)->state == TASK_BLOCKED)
+            unblock(next);
+    }
+
+    set_IF(IF_stat);
+    kernel_thread_exit(NULL, 0);
+}
+
+static void bench_chain(){
+    u64 start = rdtsc();
+
+    /* 关中断创建，保证线程运行前 chain_nodes 已经填好 */
+    ATOMIC_OPS(
+        chain_token = 0;
+        for (u32 i = 0; i < BENCH_CHAIN_LEN; ++i)
+            chain_nodes[i] = task_create(chain_thread, (void *)i, "bench_chain", BENCH_PRIORITY, KERNEL_UID);
+    );
+    bench_reap();
+
+    u32 cycles = (u32)(rdtsc() - start);
+    bench_report("chain", "cycles_per_hop", cycles / (BENCH_CHAIN_LEN * BENCH_CHAIN_LOOPS));
+}
+
+/* ===================== sleep 唤醒精度 ===================== */
+
+static void bench_sleep(){
+    static const u32 sleep_ms[] = {10, 20, 50, 100};
+    char metric[16];
+
+    for (u32 i = 0; i < sizeof(sleep_ms) / sizeof(sleep_ms[0]); ++i){
+        u64 start = rdtsc();
+
+        ATOMIC_OPS(task_sleep(sleep_ms[i]););
+
+        u32 us = cycles_to_us((u32)(rdtsc() - start));
+
+        sprintf(metric, "actual_us_%u", sleep_ms[i]);
+        bench_report("sleep", metric, us);
+    }
+}
+
+/* ===================== fork/exit/waitpid ===================== */
+
+/* 用户进程和内核共享内核地址空间，结果直接写到这里 */
+static struct{
+    volatile bool done;
+    u32 fork;
+    u32 fork_exit_wait;
+    u32 waitpid;
+} fork_result;
+
+/* 在用户态运行 */
+static void fork_user(){
+    pid_t pids[BENCH_WAIT_CHILDREN];
+    u32 fork_cycles = 0;
+    u64 start;
+
+    /* fork 到父进程返回 + 子进程退出 + 回收的完整周期 */
+    start = rdtsc();
+    for (u32 i = 0; i < BENCH_FORK_LOOPS; ++i){
+        u64 t = rdtsc();
+        pid_t pid = fork();
+
+        if (pid == 0)
+            exit(0);
+        fork_cycles += (u32)(rdtsc() - t);
+        waitpid(pid, NULL);
+    }
+    fork_result.fork_exit_wait = (u32)(rdtsc() - start) / BENCH_FORK_LOOPS;
+    fork_result.fork = fork_cycles / BENCH_FORK_LOOPS;
+
+    /* 子进程全部退出后再回收，只测 waitpid 本身 */
+    for (u32 i = 0; i < BENCH_WAIT_CHILDREN; ++i){
+        pids[i] = fork();
+        if (pids[i] == 0)
+            exit(0);
+    }
+    sleep(100);
+
+    u32 wait_cycles = 0;
+    for (u32 i = 0; i < BENCH_WAIT_CHILDREN; ++i){
+        u64 t = rdtsc();
+        waitpid(pids[i], NULL);
+        wait_cycles += (u32)(rdtsc() - t);
+    }
+    fork_result.waitpid = wait_cycles / BENCH_WAIT_CHILDREN;
+
+    fork_result.done = true;
+    exit(0);
+}
+
+static void bench_fork(){
+    fork_result.done = false;
+
+    user_task_create(fork_user, "bench_fork", BENCH_PRIORITY);
+    bench_reap();
+
+    if (!fork_result.done){
+        printk(BENCH_LOG_INFO "fork test did not finish\n");
+        return;
+    }
+
+    bench_report("fork", "cycles", fork_result.fork);
+    bench_report("fork_exit_wait", "cycles", fork_result.fork_exit_wait);
+    bench_report("waitpid", "cycles", fork_result.waitpid);
+}
+
+/* ===================== 磁盘随机读 ===================== */
+
+/* 每个线程一个同步读请求，线程数即为磁盘上的队列深度 */
+typedef struct disk_job_t{
+    dev_t dev;
+    u32 ios;
+    u32 seed;
+    u32 span;           // 随机读的范围，单位为 BENCH_DISK_SECS 个扇区
+} disk_job_t;
+
+static disk_job_t disk_jobs[BENCH_DISK_QD];
+
+static void disk_thread(){
+    disk_job_t *job;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(job)
+    );
+
+    set_IF(true);
+
+    /* 不经过缓冲区，直接向设备发请求 */
+    void *data = alloc_kpage(1);
+    bio_t bio;
+
+    u32 seed = job->seed;
+
+    for (u32 i = 0; i < job->ios; ++i){
+        seed = seed * 1103515245 + 12345;
+        bio_init(&bio, job->dev, REQ_READ, ((seed >> 8) % job->span) * BENCH_DISK_SECS, BENCH_DISK_SECS, data);
+        submit_bio_wait(&bio);
+    }
+
+    free_kpage(data, 1);
+    kernel_thread_exit(NULL, 0);
+}
+
+/* test 区分磁盘种类以及是否开启了命令完成合并，int_count 为驱动的中断计数 */
+static void bench_disk_qd(const char *test, device_t *disk, u32 span, u32 qd, u32 *int_count){
+    char metric[16];
+    u32 irqs = *int_count;
+    u64 start = rdtsc();
+
+    ATOMIC_OPS(
+        for (u32 i = 0; i < qd; ++i){
+            disk_jobs[i].dev = disk->dev;
+            disk_jobs[i].ios = BENCH_DISK_IOS / qd;
+            disk_jobs[i].seed = i + 1;
+            disk_jobs[i].span = span;
+            task_create(disk_thread, &disk_jobs[i], "bench_disk", BENCH_PRIORITY, KERNEL_UID);
+        }
+    );
+    bench_reap();
+
+    u32 khz = vdso_tsc_khz() >> 10;
+    u32 ms = khz ? (u32)((rdtsc() - start) >> 10) / khz : 0;
+
+    sprintf(metric, "qd%u_iops", qd);
+    bench_report(test, metric, ms ? BENCH_DISK_IOS * 1000 / ms : 0);
+    sprintf(metric, "qd%u_ms", qd);
+    bench_report(test, metric, ms);
+    sprintf(metric, "qd%u_irqs", qd);
+    bench_report(test, metric, *int_count - irqs);
+}
+
+/* 直接调用驱动顺序读 BENCH_DISK_SEQ_KB，比较每条命令 4K 和 BENCH_DISK_LARGE_KB 的吞吐量 */
+static void bench_disk_seq(const char *test, device_t *disk, u32 kb, u32 *int_count){
+    u32 pages = BENCH_DISK_LARGE_KB * 1024 / PAGE_SIZE;
+    void *buf = alloc_kpage(pages);
+    u32 secs = kb * 1024 / SECTOR_SIZE;
+    char metric[16];
+
+    if (buf == NULL)
+        return;
+
+    u32 irqs = *int_count;
+    u64 idle;
+    ATOMIC_OPS(idle = task_idle_time(););
+    u64 start = rdtsc();
+
+    for (u32 lba = 0; lba < BENCH_DISK_SEQ_KB * 1024 / SECTOR_SIZE; lba += secs)
+        device_read(disk->dev, buf, secs, lba, 0);
+
+    u64 elapsed = rdtsc() - start;
+    ATOMIC_OPS(idle = task_idle_time() - idle;);
+
+    u32 khz = vdso_tsc_khz() >> 10;
+    u32 ms = khz ? (u32)(elapsed >> 10) / khz : 0;
+    u32 total = (u32)(elapsed >> 10) / 100;
+    u32 idle_pct = total ? (u32)(idle >> 10) / total : 100;
+
+    sprintf(metric, "seq%uk_kbps", kb);
+    bench_report(test, metric, ms ? BENCH_DISK_SEQ_KB * 1000 / ms : 0);
+
+    /* 等待磁盘期间 cpu 运行 idle 的时间不算作占用，轮询时 cpu 一直处于忙碌状态 */
+    sprintf(metric, "seq%uk_cpu_pct", kb);
+    bench_report(test, metric, idle_pct < 100 ? 100 - idle_pct : 0);
+    sprintf(metric, "seq%uk_irqs", kb);
+    bench_report(test, metric, *int_count - irqs);
+
+    free_kpage(buf, pages);
+}
+
+/* 每次异步提交 1K 的顺序读，比较蓄流与否时块设备层合并出的请求大小 */
+static void bench_disk_merge(const char *test, device_t *disk, bool plugged){
+    static buffer_t bfs[BENCH_DISK_MERGE_BLKS];
+    u32 pages = BENCH_DISK_MERGE_BLKS * BLOCK_SIZE / PAGE_SIZE;
+    char *data = (char *)alloc_kpage(pages);
+    blk_stat_t *stat = &disk->stat;
+    blk_plug_t plug;
+
+    if (data == NULL)
+        return;
+
+    blk_stat_reset(disk);
+
+    for (u32 i = 0; i < BENCH_DISK_MERGE_BLKS; ++i){
+        memset(&bfs[i], 0, sizeof(buffer_t));
+        bfs[i].b_dev = disk->dev;
+        bfs[i].b_blknr = i;
+        bfs[i].b_data = data + i * BLOCK_SIZE;
+        wait_queue_init(&bfs[i].b_wait);
+    }
+
+    if (plugged)
+        blk_start_plug(&plug);
+    for (u32 i = 0; i < BENCH_DISK_MERGE_BLKS; ++i)
+        ll_rw_block(REQ_READ, &bfs[i]);
+    if (plugged)
+        blk_finish_plug(&plug);
+
+    for (u32 i = 0; i < BENCH_DISK_MERGE_BLKS; ++i)
+        wait_on_buffer(&bfs[i]);
+
+    const char *prefix = plugged ? "plug" : "noplug";
+    char metric[24];
+
+    sprintf(metric, "%s_requests", prefix);
+    bench_report(test, metric, stat->requests);
+    sprintf(metric, "%s_merges", prefix);
+    bench_report(test, metric, stat->back_merges + stat->front_merges);
+    sprintf(metric, "%s_avg_secs", prefix);
+    bench_report(test, metric, stat->requests ? stat->sectors / stat->requests : 0);
+
+    free_kpage(data, pages);
+}
+
+/* 默认启动时不初始化 hba，这里需要时再初始化 */
+static void bench_disk(){
+    static bool hba_probed = false;
+
+    if (!hba_probed){
+        hba_probed = true;
+        hba_init();
+    }
+
+    device_t *disk = device_find(DEV_SATA_DISK, 0);
+    if (disk == NULL){
+        printk(BENCH_LOG_INFO "no sata disk, skip disk test\n");
+        return;
+    }
+
+    hba_dev_t *hdev = (hba_dev_t *)disk->ptr;
+    u32 span = hdev->max_lba < BENCH_DISK_SPAN ? (u32)hdev->max_lba : BENCH_DISK_SPAN;
+
+    span /= BENCH_DISK_SECS;
+    bench_report("disk", "queue_depth", disk->queue_depth);
+    bench_report("disk", "int_mode", hba->int_mode);
+    bench_disk_qd("disk", disk, span, 1, &hba->int_count);
+    bench_disk_qd("disk", disk, span, BENCH_DISK_QD, &hba->int_count);
+
+    /* 开启命令完成合并后重测一次，比较中断次数 */
+    if (device_ioctl(disk->dev, DEV_CMD_COALESCE, (void *)(BENCH_DISK_CCC_CC | BENCH_DISK_CCC_TV << 16), 0) != EOF){
+        bench_disk_qd("disk_ccc", disk, span, BENCH_DISK_QD, &hba->int_count);
+        device_ioctl(disk->dev, DEV_CMD_COALESCE, 0, 0);
+    }
+    bench_disk_seq("disk", disk, 4, &hba->int_count);
+    bench_disk_seq("disk", disk, BENCH_DISK_LARGE_KB, &hba->int_count);
+    bench_disk_merge("disk", disk, false);
+    bench_disk_merge("disk", disk, true);
+}
+
+/* virtio-blk 磁盘在启动时安装，用和 ahci 相同的测试对比两条路径 */
+static void bench_vdisk(){
+    device_t *disk = device_find(DEV_VIRTIO_DISK, 0);
+    if (disk == NULL){
+        printk(BENCH_LOG_INFO "no virtio disk, skip vdisk test\n");
+        return;
+    }
+
+    u32 *int_count = virtio_blk_int_count(0);
+    u32 span = device_ioctl(disk->dev, DEV_CMD_SECTOR_COUNT, NULL, 0);
+
+    span = (span < BENCH_DISK_SPAN ? span : BENCH_DISK_SPAN) / BENCH_DISK_SECS;
+    bench_report("vdisk", "queue_depth", disk->queue_depth);
+    bench_disk_qd("vdisk", disk, span, 1, int_count);
+    bench_disk_qd("vdisk", disk, span, BENCH_DISK_QD, int_count);
+    bench_disk_seq("vdisk", disk, 4, int_count);
+    bench_disk_seq("vdisk", disk, BENCH_DISK_LARGE_KB, int_count);
+}
+
+/* ramdisk 没有设备延迟，测得的是块设备层和缓冲区本身的开销 */
+static void bench_ramdisk(){
+    static u32 int_count = 0;   // ramdisk 没有中断
+    device_t *disk = device_find(DEV_RAMDISK, 0);
+    if (disk == NULL){
+        printk(BENCH_LOG_INFO "no ramdisk, skip ramdisk test\n");
+        return;
+    }
+
+    u32 span = device_ioctl(disk->dev, DEV_CMD_SECTOR_COUNT, NULL, 0) / BENCH_DISK_SECS;
+
+    bench_disk_qd("ramdisk", disk, span, 1, &int_count);
+    bench_disk_qd("ramdisk", disk, span, BENCH_DISK_QD, &int_count);
+    bench_disk_merge("ramdisk", disk, false);
+    bench_disk_merge("ramdisk", disk, true);
+}
+
+static void bench_main(){
+    set_IF(true);
+
+    ATOMIC_OPS(task_sleep(BENCH_SETTLE_MS););
+
+    bench_count = 0;
+    printk("BENCH-BEGIN\n");
+
+    bench_report("tsc", "khz", vdso_tsc_khz());
+    bench_yield();
+    bench_chain();
+    bench_sleep();
+    bench_fork();
+    bench_disk();
+    bench_vdisk();
+    bench_ramdisk();
+
+    /* 各个磁盘和分区的统计及延迟直方图 */
+    sys_iostat(NULL, IOSTAT_HIST);
+
+    printk("BENCH-END %u\n", bench_count);
+
+    /* 不在 qemu 中运行时写端口没有效果，线程直接退出 */
+    port_outb(BENCH_EXIT_PORT, BENCH_EXIT_PASS);
+    kernel_thread_exit(NULL, 0);
+}
+
+void bench_init(){
+    task_create(bench_main, NULL, "bench", BENCH_PRIORITY, KERNEL_UID);
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <common/assert.h>
 #include <rdix/kernel.h>
 #include <rdix/task.h>
+#include <rdix/vdso.h>
 
 static void pit_init(){
     port_outb(CONTROL_R, 0b00110100);
@@ -30,6 +31,7 @@ static void clock_handler(u32 int_num, u32 code){
     assert(current->magic == RDIX_MAGIC);
 
     current->jiffies = ++jiffies;
+    vdso_tick();
 
     weakup();
 
@@ -71,6 +71,12 @@ char *_color_proc(const char *fmt){
 
     *colorfmt_ptr = '\0';
 
+    /* CONSOLE_CLEAR 不是颜色，清屏后直接返回 */
+    if (strcmp(colorfmt, "2J", 3)){
+        console_clean();
+        return str;
+    }
+
     colorfmt_ptr = colorfmt;
 
     u8 gen_code = 0;
@@ -0,0 +1,155 @@
+#include <rdix/elevator.h>
+#include <rdix/device.h>
+#include <rdix/kernel.h>
+#include <rdix/wait.h>
+#include <common/rbtree.h>
+#include <common/assert.h>
+
+extern time_t jiffies;
+
+#define _REQ(node) ((request_t *)(node)->owner)
+#define _RB_REQ(rb) ((request_t *)(rb)->owner)
+
+/* 每个方向一棵按扇区排序的红黑树和一个按提交顺序排列的 fifo
+ * 平时按扇区顺序成批分发，读优先；fifo 中最早的请求到期后从它开始下一批
+ * 写请求连续 DEADLINE_WRITES_STARVED 批没有被选中时，下一批必须是写 */
+typedef struct deadline_data_t{
+    RBTree_t sort[2];
+    List_t fifo[2];         // 从头部压入，尾部为最早的请求
+    request_t *next_rq[2];  // 本批中按扇区顺序的下一个请求
+    u32 batching;           // 本批已经分发的请求数
+    u32 starved;            // 读优先而写没有被选中的批数
+} deadline_data_t;
+
+static const time_t fifo_expire[2] = {
+    DEADLINE_READ_EXPIRE,
+    DEADLINE_WRITE_EXPIRE,
+};
+
+static void *deadline_init(device_t *device){
+    deadline_data_t *dd = (deadline_data_t *)malloc(sizeof(deadline_data_t));
+
+    for (int dir = REQ_READ; dir <= REQ_WRITE; ++dir){
+        rbtree_init(&dd->sort[dir]);
+        list_init(&dd->fifo[dir]);
+        dd->next_rq[dir] = NULL;
+    }
+    dd->batching = 0;
+    dd->starved = 0;
+
+    return dd;
+}
+
+static void deadline_exit(device_t *device){
+    deadline_data_t *dd = (deadline_data_t *)device->elv_data;
+
+    assert(list_isempty(&dd->fifo[REQ_READ]) && list_isempty(&dd->fifo[REQ_WRITE]));
+    free(dd);
+}
+
+/* 在排序树中找扇区相邻的请求，前后各只需要检查一个 */
+static bool deadline_merge(device_t *device, request_t *req){
+    deadline_data_t *dd = (deadline_data_t *)device->elv_data;
+    RBTree_t *tree = &dd->sort[req->type];
+    RBNode_t *node = rb_lower_bound(tree, req->idx);
+    RBNode_t *prev = node ? rb_prev(node) : rb_last(tree);
+
+    /* 接在前一个请求之后 */
+    if (prev && blk_try_merge(_RB_REQ(prev), req) == ELV_BACK_MERGE)
+        return true;
+
+    /* 接在后一个请求之前，起始扇区改变后重新插入排序树 */
+    node = rb_lower_bound(tree, req->idx + req->count);
+    if (node && node->value == req->idx + req->count){
+        request_t *rq = _RB_REQ(node);
+
+        if (blk_try_merge(rq, req) == ELV_FRONT_MERGE){
+            rb_erase(tree, &rq->rb);
+            rq->rb.value = (u32)rq->idx;
+            rb_insert(tree, &rq->rb);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void deadline_add(device_t *device, request_t *req){
+    deadline_data_t *dd = (deadline_data_t *)device->elv_data;
+
+    rbnode_init(&req->rb, req, (u32)req->idx);
+    rb_insert(&dd->sort[req->type], &req->rb);
+
+    req->expire = wait_deadline(fifo_expire[req->type]);
+    list_push(&dd->fifo[req->type], &req->node);
+}
+
+/* fifo 中最早的请求是否已经到期 */
+static bool deadline_expired(deadline_data_t *dd, int dir){
+    List_t *fifo = &dd->fifo[dir];
+
+    if (list_isempty(fifo))
+        return false;
+    return jiffies >= _REQ(fifo->end.previous)->expire;
+}
+
+static request_t *deadline_move(deadline_data_t *dd, request_t *req){
+    int dir = req->type;
+    RBNode_t *next = rb_next(&req->rb);
+
+    dd->next_rq[REQ_READ] = NULL;
+    dd->next_rq[REQ_WRITE] = NULL;
+    dd->next_rq[dir] = next ? _RB_REQ(next) : NULL;
+
+    rb_erase(&dd->sort[dir], &req->rb);
+    remove_node(&req->node);
+    ++dd->batching;
+
+    return req;
+}
+
+static request_t *deadline_dispatch(device_t *device){
+    deadline_data_t *dd = (deadline_data_t *)device->elv_data;
+    bool reads = !list_isempty(&dd->fifo[REQ_READ]);
+    bool writes = !list_isempty(&dd->fifo[REQ_WRITE]);
+    request_t *req = dd->next_rq[REQ_WRITE];
+    int dir;
+
+    if (dd->next_rq[REQ_READ])
+        req = dd->next_rq[REQ_READ];
+
+    /* 继续本批 */
+    if (req && dd->batching < DEADLINE_FIFO_BATCH)
+        return deadline_move(dd, req);
+
+    /* 开始新的一批，先选方向 */
+    if (reads && (!writes || dd->starved++ < DEADLINE_WRITES_STARVED)){
+        dir = REQ_READ;
+    }
+    else if (writes){
+        dd->starved = 0;
+        dir = REQ_WRITE;
+    }
+    else{
+        return NULL;
+    }
+
+    /* 有请求到期时从 fifo 中最早的请求开始，否则沿扇区顺序继续 */
+    req = dd->next_rq[dir];
+    if (req == NULL || deadline_expired(dd, dir)){
+        req = _REQ(dd->fifo[dir].end.previous);
+    }
+
+    dd->batching = 0;
+
+    return deadline_move(dd, req);
+}
+
+elevator_t elevator_deadline = {
+    .name = "deadline",
+    .init = deadline_init,
+    .exit = deadline_exit,
+    .merge = deadline_merge,
+    .add = deadline_add,
+    .dispatch = deadline_dispatch,
+};
@@ -3,6 +3,12 @@
 #include <rdix/kernel.h>
 #include <common/assert.h>
 #include <common/interrupt.h>
+#include <rdix/memory.h>
+#include <rdix/hardware.h>
+#include <rdix/serial.h>
+#include <rdix/vdso.h>
+#include <common/stdarg.h>
+#include <common/stdio.h>
 
 #define DEVICE_LOG_INFO __LOG("[device log]")
 #define DEVICE_WARNING_INFO __WARNING("[device warning]")
@@ -42,13 +48,24 @@ dev_t device_install(
         dev->ioctl = ioctl;
         dev->read = read;
         dev->write = write;
-        dev->request_list = NULL;
-        dev->do_request = false;
-        dev->req_direct = DIRECT_FORE;
-
-        /* 是块设备并且是磁盘设备才初始化块设备请求链表 */
-        if (type == DEV_BLOCK && subtype == DEV_SATA_DISK)
-            dev->request_list = new_list();
+        dev->elevator = NULL;
+        dev->elv_data = NULL;
+        dev->request = NULL;
+        dev->do_request = 0;
+        dev->queue_depth = 1;
+        dev->dispatchers = 0;
+        wait_queue_init(&dev->dispatch_wait);
+        memset(&dev->stat, 0, sizeof(blk_stat_t));
+
+        /* 块设备中除了分区都是磁盘，分区的请求交给所在磁盘，只有磁盘才需要调度器 */
+        if (type == DEV_BLOCK && subtype != DEV_DISK_PART){
+            elevator_init(dev, ELEVATOR_DEFAULT);
+
+            /* 支持命令队列的磁盘可以同时执行多个请求 */
+            int depth = dev->ioctl ? dev->ioctl(ptr, DEV_CMD_QUEUE_DEPTH, NULL, 0) : 0;
+            if (depth > 1)
+                dev->queue_depth = depth;
+        }
 
         return dev->dev;
     }
@@ -68,6 +85,14 @@ device_t *device_find(int subtype, idx_t idx){
     return NULL;
 }
 
+device_t *device_find_name(char *name){
+    for (int i = 0; i < DEVICE_NR; ++i){
+        if (devices[i].type != DEV_NULL && strcmp(devices[i].name, name, NAMELEN))
+            return &devices[i];
+    }
+    return NULL;
+}
+
 device_t *device_get(dev_t dev){
     assert(dev < DEVICE_NR);
     return &devices[dev];
@@ -105,104 +130,462 @@ int device_write(dev_t dev, void *buf, size_t count, idx_t idx, int flags)
     return EOF;
 }
 
-static void do_request(request_t *req){
-    int status = 0;
+#define _REQ(node) ((request_t *)(node)->owner)
+
+/* 当前任务的蓄流，还没有任务运行时为 NULL */
+static blk_plug_t *current_plug(){
+    ListNode_t *node = current_task();
+
+    return node ? ((TCB_t *)node->owner)->plug : NULL;
+}
+
+static int blk_rw(request_t *req, void *buf, u32 count, idx_t idx){
     switch (req->type)
     {
     case REQ_READ:
-        status = device_read(req->dev, req->buf, req->count, req->idx, req->flags);
-        break;
+        return device_read(req->dev, buf, count, idx, req->flags);
     case REQ_WRITE:
-        status = device_write(req->dev, req->buf, req->count, req->idx, req->flags);
-        break;
-    
+        return device_write(req->dev, buf, count, idx, req->flags);
     default:
-        break;
+        return 0;
+    }
+}
+
+/* 没有请求处理函数的驱动只接受一块连续的缓冲区
+ * 多段的请求先拼接到临时页中，用一条命令完成，临时页分配失败时退化为逐段执行 */
+static int do_request(request_t *req){
+    bio_t *bio;
+    int status = 0;
+
+    if (req->nr_segs == 1)
+        return blk_rw(req, req->bio->buf, req->count, req->idx);
+
+    u32 pages = (req->count * SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+    u8 *buf = (u8 *)alloc_kpage(pages);
+
+    if (buf == NULL){
+        for (bio = req->bio; bio && status != EOF; bio = bio->next)
+            status = blk_rw(req, bio->buf, bio->count, bio->idx);
+        return status;
+    }
+
+    u8 *ptr = buf;
+
+    if (req->type == REQ_WRITE){
+        for (bio = req->bio; bio; bio = bio->next){
+            memcpy(ptr, bio->buf, bio->count * SECTOR_SIZE);
+            ptr += bio->count * SECTOR_SIZE;
+        }
+    }
+
+    status = blk_rw(req, buf, req->count, req->idx);
+
+    if (req->type == REQ_READ && status != EOF){
+        for (bio = req->bio; bio; bio = bio->next){
+            memcpy(bio->buf, ptr, bio->count * SECTOR_SIZE);
+            ptr += bio->count * SECTOR_SIZE;
+        }
     }
 
+    free_kpage(buf, pages);
+
+    return status;
+}
+
+/* 延迟所在的桶，即 cycles 最高位的位置 */
+static u32 blk_lat_bucket(u64 cycles){
+    u32 bit;
+
+    if (cycles >> 32)
+        return BLK_LAT_BUCKETS - 1;
+    if ((u32)cycles == 0)
+        return 0;
+
+    asm volatile("bsrl %1, %0" : "=r"(bit) : "rm"((u32)cycles));
+    return bit < BLK_LAT_BUCKETS ? bit : BLK_LAT_BUCKETS - 1;
+}
+
+/* bio 提交时计入设备，调用前需要关中断 */
+static void blk_account_start(device_t *device, u64 now){
+    if (device->stat.in_flight++ == 0)
+        device->stat.busy_start = now;
+}
+
+/* bio 完成时计入设备，调用前需要关中断 */
+static void blk_account_done(device_t *device, bio_t *bio, u64 now, int status){
+    blk_stat_t *stat = &device->stat;
+
     if (status == EOF){
+        ++stat->errors;
+    }
+    else{
+        ++stat->ios[bio->type];
+        stat->secs[bio->type] += bio->count;
+        ++stat->lat_hist[bio->type][blk_lat_bucket(now - bio->start)];
+    }
+
+    if (--stat->in_flight == 0)
+        stat->busy += now - stat->busy_start;
+}
+
+void blk_end_request(request_t *req, int status){
+    device_t *device = device_get(req->dev);
+    bio_t *bio = req->bio;
+    u64 now = rdtsc();
+
+    assert(!get_IF());
+
+    if (status == EOF)
         device_ioctl(req->dev, DEV_ERROR_REPORT, NULL, 0);
-        block(NULL, NULL, TASK_BLOCKED);
+
+    /* end_io 可能释放 bio，先取出下一段 */
+    while (bio){
+        bio_t *next = bio->next;
+
+        /* 提交到分区的 bio 同时计入分区和所在磁盘 */
+        blk_account_done(device, bio, now, status);
+        if (bio->dev != device->dev)
+            blk_account_done(device_get(bio->dev), bio, now, status);
+
+        bio->status = status;
+        bio->next = NULL;
+        if (bio->end_io)
+            bio->end_io(bio);
+        bio = next;
     }
-        
-    
+
+    free(req);
+
+    --device->do_request;
+    wake_up_one(&device->dispatch_wait);
 }
 
-static request_t * get_next_req(device_t *device, request_t *req){
-    List_t *list = req->node.container;
+int blk_try_merge(request_t *rq, request_t *req){
+    device_t *device = device_get(req->dev);
+    int ret = ELV_NO_MERGE;
+
+    if (rq->dev != req->dev || rq->type != req->type || rq->flags != req->flags)
+        return ELV_NO_MERGE;
+    if (rq->count + req->count > REQ_SECS_MAX)
+        return ELV_NO_MERGE;
+
+    if (rq->idx + rq->count == req->idx){
+        rq->biotail->next = req->bio;
+        rq->biotail = req->biotail;
+        ret = ELV_BACK_MERGE;
+        ++device->stat.back_merges;
+    }
+    else if (req->idx + req->count == rq->idx){
+        req->biotail->next = rq->bio;
+        rq->bio = req->bio;
+        rq->idx = req->idx;
+        ret = ELV_FRONT_MERGE;
+        ++device->stat.front_merges;
+    }
+    else{
+        return ELV_NO_MERGE;
+    }
+
+    rq->count += req->count;
+    rq->nr_segs += req->nr_segs;
+    free(req);
+
+    return ret;
+}
+
+bool blk_list_merge(List_t *list, request_t *req){
+    for (ListNode_t *iter = list->end.next; iter != &list->end; iter = iter->next){
+        request_t *rq = _REQ(iter);
+        int ret = blk_try_merge(rq, req);
+
+        if (ret == ELV_NO_MERGE)
+            continue;
+
+        /* 起始扇区变小，重新排序 */
+        if (ret == ELV_FRONT_MERGE){
+            remove_node(&rq->node);
+            rq->node.value = (u32)rq->idx;
+            list_insert(list, &rq->node, greater);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/* 先尝试合并，不能合并时交给调度器排队，调用前需要关中断 */
+static void elv_add_request(device_t *device, request_t *req){
+    if (!device->elevator->merge(device, req))
+        device->elevator->add(device, req);
+    wake_up_one(&device->dispatch_wait);
+}
+
+/* 分发线程，参数保存在 edi 中，设备上最多同时有 queue_depth 个请求
+ * 有请求处理函数的驱动异步完成请求，只需要一个分发线程
+ * 否则每个线程同一时刻执行一个请求，线程数等于 queue_depth */
+static void blk_dispatch_thread(){
+    device_t *device;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(device)
+    );
+
+    /* 内核线程在创建时需要手动开中断 */
+    set_IF(true);
 
-    assert(list == device->request_list);
+    while (true){
+        bool IF_stat = get_and_disable_IF();
+        request_t *req = NULL;
+
+        wait_event(&device->dispatch_wait, device->do_request < device->queue_depth &&
+                   (req = device->elevator->dispatch(device)) != NULL);
+
+        ++device->do_request;
+        ++device->stat.requests;
+        device->stat.sectors += req->count;
 
-    if (device->req_direct == DIRECT_FORE && req->node.next == &list->end)
-        device->req_direct = DIRECT_BACK;
-    else if (device->req_direct == DIRECT_BACK && req->node.previous == &list->end)
-        device->req_direct = DIRECT_FORE;
+        if (device->request){
+            if (device->request(device->ptr, req) == EOF)
+                blk_end_request(req, EOF);
+        }
+        else{
+            blk_end_request(req, do_request(req));
+        }
 
-    request_t *next = NULL;
+        set_IF(IF_stat);
+    }
+}
 
-    if (device->req_direct == DIRECT_FORE)
-        next = (request_t *)req->node.next->owner;
-    if (device->req_direct == DIRECT_BACK)
-        next = (request_t *)req->node.previous->owner;
+/* 调用前需要关中断 */
+static void blk_start_dispatch(device_t *device){
+    u8 count = device->request ? 1 : device->queue_depth;
 
-    return next;
+    for (; device->dispatchers < count; ++device->dispatchers)
+        task_create(blk_dispatch_thread, device, "kblockd", BLK_DISPATCH_PRIORITY, KERNEL_UID);
 }
 
-void device_request(buffer_t *bf, u8 count, idx_t idx, int flags, u32 type){
-    device_t * device = device_get(bf->b_dev);
+void device_set_request(dev_t dev, void *request){
+    device_t *device = device_get(dev);
+
+    assert(device->dispatchers == 0);
+    device->request = request;
+}
+
+void bio_init(bio_t *bio, dev_t dev, u32 type, idx_t idx, u32 count, void *buf){
+    bio->dev = dev;
+    bio->type = type;
+    bio->idx = idx;
+    bio->count = count;
+    bio->flags = 0;
+    bio->buf = (u8 *)buf;
+    bio->status = 0;
+    bio->end_io = NULL;
+    bio->private = NULL;
+    bio->next = NULL;
+    bio->start = 0;
+}
+
+void submit_bio(bio_t *bio){
+    device_t * device = device_get(bio->dev);
     assert(device->type == DEV_BLOCK);
 
-    idx_t offset = idx + device_ioctl(bf->b_dev, DEV_CMD_SECTOR_START, NULL, 0);
+    bio->idx += device_ioctl(bio->dev, DEV_CMD_SECTOR_START, NULL, 0);
+    bio->next = NULL;
 
     if (device->parent)
         device = device_get(device->parent);
     
-    assert(device->request_list);
+    assert(device->elevator);
 
     request_t *req = (request_t *)malloc(sizeof(request_t));
 
     req->dev = device->dev;
-    req->buf = bf->b_data;
-    req->count = count;
-    req->idx = offset;
-    req->flags = flags;
-    req->type = type;
-    req->task = current_task();
+    req->count = bio->count;
+    req->idx = bio->idx;
+    req->flags = bio->flags;
+    req->type = bio->type;
+    req->nr_segs = 1;
+    req->bio = bio;
+    req->biotail = bio;
     node_init(&req->node, req, (u32)req->idx);
 
     bool st = get_and_disable_IF();
 
-    ATOMIC_OPS(list_insert(device->request_list, &req->node, greater);)
+    bio->start = rdtsc();
+    blk_account_start(device, bio->start);
+    if (bio->dev != device->dev)
+        blk_account_start(device_get(bio->dev), bio->start);
 
-    while (true){
-        if (!device->do_request){   //这里为原子操作
-            ATOMIC_OPS(device->do_request = true;)
-            buffer_lock(bf);
+    ++device->stat.submitted;
+    if (device->dispatchers == 0)
+        blk_start_dispatch(device);
+
+    blk_plug_t *plug = current_plug();
+
+    if (plug){
+        if (!blk_list_merge(&plug->list, req))
+            list_insert(&plug->list, &req->node, greater);
+    }
+    else{
+        elv_add_request(device, req);
+    }
 
-            do_request(req);
+    set_IF(st);
+}
 
-            buffer_unlock(bf);
-            ATOMIC_OPS(device->do_request = false;)
-            
-            request_t *next = NULL;
+typedef struct bio_wait_t{
+    bool done;
+    wait_queue_t wait;
+} bio_wait_t;
 
-            ATOMIC_OPS(next = get_next_req(device, req);
-                        remove_node(&req->node);)
+static void bio_wait_end_io(bio_t *bio){
+    bio_wait_t *bw = (bio_wait_t *)bio->private;
 
-            if (next)
-                unblock(next->task);
+    bw->done = true;
+    wake_up_all(&bw->wait);
+}
 
-            break;
-        }
-        else{
-            //printk("------------in block\n");
-            block(NULL, NULL, TASK_BLOCKED);
-        }
+int submit_bio_wait(bio_t *bio){
+    bio_wait_t bw;
+
+    bw.done = false;
+    wait_queue_init(&bw.wait);
+    bio->end_io = bio_wait_end_io;
+    bio->private = &bw;
+
+    submit_bio(bio);
+
+    /* 请求可能还在自己的蓄流链表中 */
+    blk_flush_plug();
+    wait_event(&bw.wait, bw.done);
+
+    return bio->status;
+}
+
+void blk_start_plug(blk_plug_t *plug){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+
+    assert(task->plug == NULL);
+
+    list_init(&plug->list);
+    task->plug = plug;
+}
+
+void blk_flush_plug(){
+    blk_plug_t *plug = current_plug();
+    ListNode_t *node;
+
+    if (plug == NULL)
+        return;
+
+    bool st = get_and_disable_IF();
+
+    while ((node = list_pop(&plug->list)) != NULL){
+        request_t *req = _REQ(node);
+
+        elv_add_request(device_get(req->dev), req);
     }
 
     set_IF(st);
+}
 
-    free(req);
+void blk_finish_plug(blk_plug_t *plug){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+
+    assert(task->plug == plug);
+
+    blk_flush_plug();
+    task->plug = NULL;
+}
+
+void blk_stat_reset(device_t *device){
+    blk_stat_t *stat = &device->stat;
+    bool IF_stat = get_and_disable_IF();
+    u32 in_flight = stat->in_flight;
+
+    memset(stat, 0, sizeof(blk_stat_t));
+    stat->in_flight = in_flight;
+    stat->busy_start = rdtsc();
+
+    set_IF(IF_stat);
+}
+
+static bool iostat_serial;
+
+/* 输出到屏幕，需要时同时写到串口，基准测试中 printk 本身已经写了串口 */
+static void iostat_print(const char *fmt, ...){
+    static char buf[128];
+    va_list arg;
+
+    va_start(arg, fmt);
+    int n = vsprintf(buf, fmt, arg);
+    va_end(arg);
+
+    printk("%s", buf);
+#ifndef RDIX_BENCH
+    if (iostat_serial)
+        serial_write(buf, n);
+#endif
+}
+
+/* tsc 周期换算成毫秒，两边同时右移避免 64 位除法 */
+static u32 iostat_cycles_to_ms(u64 cycles){
+    u32 khz = vdso_tsc_khz() >> 10;
+
+    return khz ? (u32)(cycles >> 10) / khz : 0;
+}
+
+/* 调用前需要关中断 */
+static void iostat_device(device_t *device, u32 flags){
+    blk_stat_t *stat = &device->stat;
+    u64 busy = stat->busy;
+
+    if (stat->in_flight)
+        busy += rdtsc() - stat->busy_start;
+
+    iostat_print("%-8s %8u %8u %8u %8u %7u %5u %5u %8u\n", device->name,
+                 stat->ios[REQ_READ], stat->secs[REQ_READ],
+                 stat->ios[REQ_WRITE], stat->secs[REQ_WRITE],
+                 stat->back_merges + stat->front_merges, stat->errors,
+                 stat->in_flight, iostat_cycles_to_ms(busy));
+
+    if (flags & IOSTAT_HIST){
+        u32 mhz = vdso_tsc_khz() / 1000;
+
+        iostat_print("  %12s %8s %8s\n", ">= us", "reads", "writes");
+        for (int i = 0; i < BLK_LAT_BUCKETS; ++i){
+            if (stat->lat_hist[REQ_READ][i] || stat->lat_hist[REQ_WRITE][i])
+                iostat_print("  %12u %8u %8u\n", mhz ? (1u << i) / mhz : 0,
+                             stat->lat_hist[REQ_READ][i], stat->lat_hist[REQ_WRITE][i]);
+        }
+    }
+}
+
+int32 sys_iostat(char *devname, u32 flags){
+    device_t *device = NULL;
+
+    if (devname && ((device = device_find_name(devname)) == NULL || device->type != DEV_BLOCK))
+        return EOF;
+
+    bool IF_stat = get_and_disable_IF();
+
+    iostat_serial = flags & IOSTAT_SERIAL;
+    iostat_print("%-8s %8s %8s %8s %8s %7s %5s %5s %8s\n",
+                 "device", "rd_ios", "rd_secs", "wr_ios", "wr_secs",
+                 "merges", "errs", "inflt", "busy_ms");
+
+    for (int i = 0; i < DEVICE_NR; ++i){
+        if (devices[i].type != DEV_BLOCK || (device && device != &devices[i]))
+            continue;
+
+        iostat_device(&devices[i], flags);
+        if (flags & IOSTAT_RESET)
+            blk_stat_reset(&devices[i]);
+    }
+
+    set_IF(IF_stat);
+    return 0;
 }
 
 void device_init(){
@@ -219,7 +602,9 @@ void device_init(){
         dev->ioctl = NULL;
         dev->read = NULL;
         dev->write = NULL;
+        dev->request = NULL;
 
-        list_init(&dev->request_list);
+        dev->elevator = NULL;
+        dev->elv_data = NULL;
     }
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include <rdix/elevator.h>
+#include <rdix/device.h>
+#include <rdix/kernel.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define ELEVATOR_LOG_INFO __LOG("[elevator]")
+
+#define DIRECT_FORE 0
+#define DIRECT_BACK 1
+
+#define _REQ(node) ((request_t *)(node)->owner)
+
+static elevator_t *elevators[] = {
+    &elevator_sweep,
+    &elevator_deadline,
+};
+
+#define ELEVATOR_NR (sizeof(elevators) / sizeof(elevator_t *))
+
+/* ===================== sweep ===================== */
+
+/* 电梯算法，请求按扇区顺序排在链表中，沿当前方向依次分发，到头后换向 */
+typedef struct sweep_data_t{
+    List_t list;
+    u8 direct;      // 当前方向
+    idx_t pos;      // 最近一次分发的扇区位置
+} sweep_data_t;
+
+static void *sweep_init(device_t *device){
+    sweep_data_t *sd = (sweep_data_t *)malloc(sizeof(sweep_data_t));
+
+    list_init(&sd->list);
+    sd->direct = DIRECT_FORE;
+    sd->pos = 0;
+
+    return sd;
+}
+
+static void sweep_exit(device_t *device){
+    sweep_data_t *sd = (sweep_data_t *)device->elv_data;
+
+    assert(list_isempty(&sd->list));
+    free(sd);
+}
+
+static bool sweep_merge(device_t *device, request_t *req){
+    sweep_data_t *sd = (sweep_data_t *)device->elv_data;
+
+    return blk_list_merge(&sd->list, req);
+}
+
+static void sweep_add(device_t *device, request_t *req){
+    sweep_data_t *sd = (sweep_data_t *)device->elv_data;
+
+    list_insert(&sd->list, &req->node, greater);
+}
+
+static request_t *sweep_dispatch(device_t *device){
+    sweep_data_t *sd = (sweep_data_t *)device->elv_data;
+    List_t *list = &sd->list;
+    request_t *req = NULL;
+
+    for (int turn = 0; turn < 2 && req == NULL; ++turn){
+        if (sd->direct == DIRECT_FORE){
+            for (ListNode_t *iter = list->end.next; iter != &list->end; iter = iter->next){
+                if (_REQ(iter)->idx >= sd->pos){
+                    req = _REQ(iter);
+                    break;
+                }
+            }
+        }
+        else{
+            for (ListNode_t *iter = list->end.previous; iter != &list->end; iter = iter->previous){
+                if (_REQ(iter)->idx <= sd->pos){
+                    req = _REQ(iter);
+                    break;
+                }
+            }
+        }
+
+        if (req == NULL)
+            sd->direct = sd->direct == DIRECT_FORE ? DIRECT_BACK : DIRECT_FORE;
+    }
+
+    if (req){
+        remove_node(&req->node);
+        sd->pos = req->idx;
+    }
+
+    return req;
+}
+
+elevator_t elevator_sweep = {
+    .name = "sweep",
+    .init = sweep_init,
+    .exit = sweep_exit,
+    .merge = sweep_merge,
+    .add = sweep_add,
+    .dispatch = sweep_dispatch,
+};
+
+/* ===================== 调度器管理 ===================== */
+
+elevator_t *elevator_find(const char *name){
+    for (int i = 0; i < ELEVATOR_NR; ++i){
+        if (strcmp(elevators[i]->name, name, NAMELEN))
+            return elevators[i];
+    }
+    return NULL;
+}
+
+void elevator_init(device_t *device, elevator_t *elv){
+    device->elevator = elv;
+    device->elv_data = elv->init(device);
+}
+
+void elevator_switch(device_t *device, elevator_t *elv){
+    List_t pending;
+    ListNode_t *node;
+    request_t *req;
+
+    bool IF_stat = get_and_disable_IF();
+
+    if (device->elevator == elv){
+        set_IF(IF_stat);
+        return;
+    }
+
+    /* 取出的请求按旧调度器的分发顺序排列，交给新调度器时不再合并 */
+    list_init(&pending);
+    while ((req = device->elevator->dispatch(device)) != NULL)
+        list_pushback(&pending, &req->node);
+
+    device->elevator->exit(device);
+    elevator_init(device, elv);
+
+    while ((node = list_pop(&pending)) != NULL)
+        elv->add(device, _REQ(node));
+
+    printk(ELEVATOR_LOG_INFO "%s: switch to %s\n", device->name, elv->name);
+
+    set_IF(IF_stat);
+}
+
+int32 sys_elevator(char *devname, char *name){
+    device_t *device;
+
+    if (devname == NULL || (device = device_find_name(devname)) == NULL)
+        return EOF;
+    if (device->parent)
+        device = device_get(device->parent);
+    if (device->elevator == NULL)
+        return EOF;
+
+    if (name == NULL){
+        printk("%s:", device->name);
+        for (int i = 0; i < ELEVATOR_NR; ++i){
+            if (elevators[i] == device->elevator)
+                printk(" [%s]", elevators[i]->name);
+            else
+                printk(" %s", elevators[i]->name);
+        }
+        printk("\n");
+        return 0;
+    }
+
+    elevator_t *elv = elevator_find(name);
+
+    if (elv == NULL)
+        return EOF;
+
+    elevator_switch(device, elv);
+    return 0;
+}
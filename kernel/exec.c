@@ -0,0 +1,336 @@
+#include <rdix/elf.h>
+#include <rdix/vma.h>
+#include <rdix/shm.h>
+#include <rdix/uring.h>
+#include <rdix/task.h>
+#include <rdix/memory.h>
+#include <rdix/kernel.h>
+#include <rdix/vdso.h>
+#include <rdix/fpu.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+#include <fs/fs.h>
+
+#define EXEC_LOG_INFO __LOG("[exec]")
+
+extern bitmap_t v_bit_map;
+
+#define EXEC_ARG_MAX 32 // argv 最多的参数个数
+#define EXEC_PHDR_MAX 16 // 最多的程序头个数
+
+/* 程序段只能放在 brk 可以增长的区域，共享内存区域之下 */
+#define EXEC_LOW KERNEL_MEMERY_SIZE
+#define EXEC_HIGH SHM_AREA_BOTTOM
+
+#define PAGE_UP(addr) (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define PAGE_DOWN(addr) ((addr) & ~(PAGE_SIZE - 1))
+
+/* 从旧地址空间中取出的程序信息，替换地址空间之后才装入 */
+typedef struct exec_image_t{
+    m_inode *inode;
+    elf32_ehdr_t ehdr;
+    elf32_phdr_t *phdr;
+    char *args;     // 内核页，依次存放参数字符串
+    u32 args_size;
+    int argc;
+    char name[TASK_NAME_LEN];
+} exec_image_t;
+
+static bool elf_check(elf32_ehdr_t *ehdr){
+    if (ehdr->e_ident[0] != ELFMAG0 || ehdr->e_ident[1] != ELFMAG1 ||
+        ehdr->e_ident[2] != ELFMAG2 || ehdr->e_ident[3] != ELFMAG3)
+        return false;
+
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB)
+        return false;
+
+    if (ehdr->e_type != ET_EXEC || ehdr->e_machine != EM_386 || ehdr->e_version != EV_CURRENT)
+        return false;
+
+    if (ehdr->e_phentsize != sizeof(elf32_phdr_t) || ehdr->e_phnum == 0 || ehdr->e_phnum > EXEC_PHDR_MAX)
+        return false;
+
+    return true;
+}
+
+/* 段在文件中的偏移和虚拟地址在页内的偏移必须相同，才能按页从文件中装入 */
+static bool elf_check_segment(elf32_phdr_t *phdr){
+    if (phdr->p_type != PT_LOAD)
+        return true;
+
+    if (phdr->p_filesz > phdr->p_memsz)
+        return false;
+
+    if ((phdr->p_offset & 0xfff) != (phdr->p_vaddr & 0xfff))
+        return false;
+
+    if (phdr->p_vaddr < EXEC_LOW || phdr->p_memsz > EXEC_HIGH - phdr->p_vaddr)
+        return false;
+
+    return true;
+}
+
+/* 参数在旧的地址空间中，释放之前复制到内核页中
+ * 所有字符串依次存放，返回参数个数，超出限制时返回 EOF */
+static int copy_args(char *const argv[], char *buf, u32 *size){
+    int argc = 0;
+    u32 len = 0;
+
+    if (argv == NULL){
+        *size = 0;
+        return 0;
+    }
+
+    while (argv[argc] != NULL){
+        u32 n = length(argv[argc]) + 1;
+
+        if (argc == EXEC_ARG_MAX || len + n > PAGE_SIZE)
+            return EOF;
+
+        memcpy(buf + len, argv[argc], n);
+        len += n;
+        ++argc;
+    }
+
+    *size = len;
+    return argc;
+}
+
+/* 在新的用户栈上放入参数，返回用户栈顶
+ * 入口处的栈为 [返回地址 0][argc][argv]，argv 以 NULL 结尾 */
+static u32 setup_stack(char *args, u32 size, int argc){
+    u32 sp = USER_STACK_TOP - size;
+    char *str = (char *)sp;
+    u32 *argv;
+
+    memcpy(str, args, size);
+
+    sp &= ~0x3;
+    sp -= (argc + 1) * sizeof(u32);
+    argv = (u32 *)sp;
+
+    for (int i = 0; i < argc; ++i){
+        argv[i] = (u32)str;
+        str += length(str) + 1;
+    }
+    argv[argc] = 0;
+
+    u32 *stack = (u32 *)sp;
+    *--stack = (u32)argv;
+    *--stack = argc;
+    *--stack = 0;
+
+    return (u32)stack;
+}
+
+/* 释放当前的地址空间，换上只有内核映射和用户栈的新页目录
+ * vfork 的子进程借用的是父进程的地址空间，spawn 的任务还在使用内核页目录，都不能释放 */
+static void exec_mm(TCB_t *task){
+    page_entry_t *pde = alloc_pde();
+
+    if (task->vfork_parent == NULL && task->vmap != &v_bit_map){
+        vma_list_release(task->vmas);
+        free_kpage((void *)task->vmap->start, 1);
+        vdso_unmap(task);
+        free_pde();
+    }
+    else{
+        task->vmap = (bitmap_t *)malloc(sizeof(bitmap_t));
+    }
+
+    task->pde = pde;
+    set_cr3((u32)pde);
+
+    bitmap_init(task->vmap, alloc_kpage(1), PAGE_SIZE, PAGE_IDX(KERNEL_MEMERY_SIZE));
+    for (page_idx_t i = PAGE_IDX(USER_STACK_BOTTOM); i < PAGE_IDX(USER_STACK_TOP); ++i)
+        bitmap_set(task->vmap, i, true);
+
+    task->vmas = vma_list_create();
+    vdso_map(task);
+}
+
+static void exec_release(exec_image_t *img){
+    if (img->args)
+        free_kpage(img->args, 1);
+    if (img->phdr)
+        free(img->phdr);
+    iput(img->inode);
+}
+
+/* 在调用者的地址空间中读出 ELF 头、程序头以及参数，失败时返回 EOF 并释放已取得的资源 */
+static int exec_load(const char *path, char *const argv[], exec_image_t *img){
+    memset(img, 0, sizeof(exec_image_t));
+
+    img->inode = namei(path);
+    if (img->inode == NULL)
+        return EOF;
+
+    if (!ISFILE(img->inode->desc->mode))
+        goto rollback;
+
+    if (inode_read(img->inode, (char *)&img->ehdr, sizeof(elf32_ehdr_t), 0) != sizeof(elf32_ehdr_t) ||
+        !elf_check(&img->ehdr))
+        goto rollback;
+
+    u32 phsize = img->ehdr.e_phnum * sizeof(elf32_phdr_t);
+    img->phdr = (elf32_phdr_t *)malloc(phsize);
+    if (inode_read(img->inode, (char *)img->phdr, phsize, img->ehdr.e_phoff) != phsize)
+        goto rollback;
+
+    for (u32 i = 0; i < img->ehdr.e_phnum; ++i){
+        if (!elf_check_segment(&img->phdr[i]))
+            goto rollback;
+    }
+
+    img->args = (char *)alloc_kpage(1);
+    img->argc = copy_args(argv, img->args, &img->args_size);
+    if (img->argc == EOF)
+        goto rollback;
+
+    /* 任务名取文件名部分 */
+    const char *base = path;
+    for (const char *ptr = path; *ptr; ++ptr){
+        if (*ptr == '/' && ptr[1])
+            base = ptr + 1;
+    }
+    strncpy(img->name, base, TASK_NAME_LEN - 1);
+    img->name[TASK_NAME_LEN - 1] = 0;
+
+    return 0;
+
+rollback:
+    exec_release(img);
+    return EOF;
+}
+
+/* 给 task 换上新的地址空间，登记程序段并放好参数，返回用户栈顶 */
+static u32 exec_setup(TCB_t *task, exec_image_t *img){
+    u32 brk = EXEC_LOW;
+
+    exec_mm(task);
+
+    for (u32 i = 0; i < img->ehdr.e_phnum; ++i){
+        elf32_phdr_t *ph = &img->phdr[i];
+        u32 start = PAGE_DOWN(ph->p_vaddr);
+        u32 end = PAGE_UP(ph->p_vaddr + ph->p_memsz);
+        u32 flags = 0;
+
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+            continue;
+
+        flags |= ph->p_flags & PF_R ? VMA_READ : 0;
+        flags |= ph->p_flags & PF_W ? VMA_WRITE : 0;
+        flags |= ph->p_flags & PF_X ? VMA_EXEC : 0;
+
+        vma_add(task->vmas, start, end, flags, img->inode,
+                ph->p_offset - (ph->p_vaddr - start), ph->p_filesz + (ph->p_vaddr - start));
+
+        for (u32 vaddr = start; vaddr < end; vaddr += PAGE_SIZE)
+            bitmap_set(task->vmap, PAGE_IDX(vaddr), true);
+
+        if (end > brk)
+            brk = end;
+    }
+    task->brk = brk;
+
+    /* 新程序使用全新的 fpu 状态 */
+    fpu_release(task);
+
+    strcpy(task->name, img->name);
+
+    printk(EXEC_LOG_INFO "%s entry 0x%p brk 0x%p\n", task->name, img->ehdr.e_entry, brk);
+
+    return setup_stack(img->args, img->args_size, img->argc);
+}
+
+/* 用 path 指向的 ELF 文件替换当前进程，成功时不返回到原来的程序
+ * 程序段只登记为 vma，缺页时才从文件中读入，bss 在缺页时填 0 */
+int32 sys_execve(const char *path, char *const argv[]){
+    assert(!get_IF());
+
+    TCB_t *task = (TCB_t *)current_task()->owner;
+    exec_image_t img;
+
+    /* 系统调用的中断栈帧，返回用户态时从这里取 eip 和 esp */
+    u32 ebp;
+    asm volatile(
+        "movl %%ebp, %0":"=m"(ebp)
+    );
+    intr_frame_t *frame = (intr_frame_t *)(ebp + sizeof(u32) * 6);
+
+    /* 内核线程没有用户地址空间，多线程进程暂不支持 exec */
+    if (task->vmap == &v_bit_map || task->leader != task || task->group != NULL)
+        return EOF;
+
+    if (exec_load(path, argv, &img) == EOF)
+        return EOF;
+
+    /* 以下不再失败，开始替换地址空间，uring 的工作线程使用的是旧的地址空间 */
+    uring_release(task->leader);
+
+    frame->esp = exec_setup(task, &img);
+    frame->eip = img.ehdr.e_entry;
+    frame->edi = 0;
+    frame->esi = 0;
+    frame->ebp = 0;
+    frame->ebx = 0;
+    frame->ecx = 0;
+    frame->edx = 0;
+
+    /* vfork 的父进程可以继续运行了 */
+    task_vfork_release(task);
+
+    exec_release(&img);
+
+    return 0;
+}
+
+/* spawn 创建的任务从这里开始，exec_image_t 的指针放在 edi 中
+ * 和 kernel_to_user 一样，先在内核栈上建立地址空间，再进入用户态 */
+static void *exec_spawn_start(){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+    exec_image_t *img;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(img)
+    );
+
+    u32 sp = exec_setup(task, img);
+    u32 eip = img->ehdr.e_entry;
+
+    exec_release(img);
+    free(img);
+
+    task_to_user(eip, sp);
+}
+
+/* 不复制父进程，直接用 path 指向的 ELF 文件创建新进程，只继承目录和文件
+ * 程序在父进程中检查并取出参数，子进程第一次运行时才建立地址空间 */
+pid_t sys_spawn(const char *path, char *const argv[]){
+    assert(!get_IF());
+
+    TCB_t *leader = current_leader();
+
+    if (leader->vmap == &v_bit_map)
+        return EOF;
+
+    exec_image_t *img = (exec_image_t *)malloc(sizeof(exec_image_t));
+    if (exec_load(path, argv, img) == EOF){
+        free(img);
+        return EOF;
+    }
+
+    ListNode_t *node = task_create((task_program)exec_spawn_start, (void *)img,
+                                   img->name, leader->base_priority, USER_UID);
+    TCB_t *child = (TCB_t *)node->owner;
+
+    /* task_create 默认使用根目录 */
+    iput(child->i_root);
+    iput(child->i_pwd);
+    free(child->pwd);
+    task_inherit(leader, child);
+
+    return child->pid;
+}
@@ -0,0 +1,196 @@
+#include <rdix/fpu.h>
+#include <rdix/task.h>
+#include <rdix/kernel.h>
+#include <rdix/hardware.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define FPU_LOG_INFO __LOG("[fpu]")
+#define FPU_WARNING_INFO __WARNING("[fpu]")
+
+#define FPU_NM_VECTOR 7
+#define MXCSR_DEFAULT 0x1f80
+
+extern handler_t interrupt_func_table[];
+
+/* fpu 寄存器中保存的是哪个任务的状态，NULL 表示没有任务拥有 fpu
+ * 任务切换时并不保存 fpu，而是设置 CR0.TS
+ * 等到其他任务第一次使用 fpu 触发 #NM 时才把旧状态保存到 fpu_owner 中 */
+static TCB_t *fpu_owner;
+static bool fpu_present;
+static bool fxsr;
+
+/* 新任务第一次使用 fpu 时的初始状态 */
+static u8 fpu_init_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+static _inline u32 get_cr0(){
+    u32 cr0;
+    asm volatile("movl %%cr0, %0\n":"=r"(cr0));
+    return cr0;
+}
+
+static _inline void set_cr0(u32 cr0){
+    asm volatile("movl %0, %%cr0\n"::"r"(cr0));
+}
+
+static _inline u32 get_cr4(){
+    u32 cr4;
+    asm volatile("movl %%cr4, %0\n":"=r"(cr4));
+    return cr4;
+}
+
+static _inline void set_cr4(u32 cr4){
+    asm volatile("movl %0, %%cr4\n"::"r"(cr4));
+}
+
+static _inline void clts(){
+    asm volatile("clts\n");
+}
+
+/* 写 CR0 开销较大，已经置位时不再写 */
+static _inline void stts(){
+    u32 cr0 = get_cr0();
+    if (!(cr0 & CR0_TS))
+        set_cr0(cr0 | CR0_TS);
+}
+
+static void fpu_save(void *state){
+    if (fxsr)
+        asm volatile("fxsave (%0)\n"::"r"(state):"memory");
+    else
+        asm volatile("fnsave (%0)\n"::"r"(state):"memory");
+}
+
+static void fpu_restore(void *state){
+    if (fxsr)
+        asm volatile("fxrstor (%0)\n"::"r"(state):"memory");
+    else
+        asm volatile("frstor (%0)\n"::"r"(state):"memory");
+}
+
+/* #NM 处理函数，中断门进入，中断已关闭 */
+static void fpu_handler(u32 int_num, u32 code){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+
+    clts();
+
+    if (fpu_owner == task)
+        return;
+
+    if (fpu_owner)
+        fpu_save(fpu_owner->fpu);
+
+    /* fpu 状态在第一次使用时才分配 */
+    if (task->fpu == NULL){
+        task->fpu = malloc(FPU_STATE_SIZE);
+        memcpy(task->fpu, fpu_init_state, FPU_STATE_SIZE);
+    }
+
+    fpu_restore(task->fpu);
+    fpu_owner = task;
+}
+
+void fpu_init(){
+    u32 a, d;
+    u32 cr0 = get_cr0();
+
+    cpuid(1, &a, &d);
+
+    fpu_owner = NULL;
+    fpu_present = d & CPUID_FEAT_EDX_FPU;
+    fxsr = d & CPUID_FEAT_EDX_FXSR;
+
+    if (!fpu_present){
+        /* 没有 fpu 时所有浮点指令都会触发 #NM */
+        set_cr0(cr0 | CR0_EM);
+        printk(FPU_WARNING_INFO "no fpu\n");
+        return;
+    }
+
+    set_cr0((cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+
+    if (fxsr){
+        u32 cr4 = get_cr4() | CR4_OSFXSR;
+
+        if (d & CPUID_FEAT_EDX_SSE)
+            cr4 |= CR4_OSXMMEXCPT;
+        set_cr4(cr4);
+    }
+
+    /* 生成初始状态，fninit 不会复位 mxcsr */
+    asm volatile("fninit\n");
+    if (d & CPUID_FEAT_EDX_SSE){
+        u32 mxcsr = MXCSR_DEFAULT;
+        asm volatile("ldmxcsr %0\n"::"m"(mxcsr));
+    }
+    fpu_save(fpu_init_state);
+
+    interrupt_func_table[FPU_NM_VECTOR] = fpu_handler;
+
+    stts();
+
+    printk(FPU_LOG_INFO "lazy fpu switch enabled, %s\n", fxsr ? "fxsave" : "fnsave");
+}
+
+void fpu_switch(TCB_t *next){
+    if (!fpu_present)
+        return;
+
+    if (next == fpu_owner)
+        clts();
+    else
+        stts();
+}
+
+void fpu_fork(TCB_t *parent, TCB_t *child){
+    child->fpu = NULL;
+
+    if (parent->fpu == NULL)
+        return;
+
+    /* 父进程正在使用 fpu，先把最新的状态写回 */
+    if (fpu_owner == parent){
+        clts();
+        fpu_save(parent->fpu);
+        /* fnsave 会重新初始化 fpu，需要载回 */
+        if (!fxsr)
+            fpu_restore(parent->fpu);
+    }
+
+    child->fpu = malloc(FPU_STATE_SIZE);
+    memcpy(child->fpu, parent->fpu, FPU_STATE_SIZE);
+}
+
+void fpu_release(TCB_t *task){
+    bool IF_stat = get_and_disable_IF();
+
+    if (fpu_owner == task)
+        fpu_owner = NULL;
+
+    if (task->fpu){
+        free(task->fpu);
+        task->fpu = NULL;
+    }
+
+    set_IF(IF_stat);
+}
+
+bool kernel_fpu_begin(){
+    bool state = get_and_disable_IF();
+
+    clts();
+
+    /* 保存用户的 fpu 状态，之后由 #NM 重新载入 */
+    if (fpu_owner){
+        fpu_save(fpu_owner->fpu);
+        fpu_owner = NULL;
+    }
+
+    return state;
+}
+
+void kernel_fpu_end(bool state){
+    stts();
+    set_IF(state);
+}
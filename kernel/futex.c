@@ -0,0 +1,83 @@
+#include <rdix/futex.h>
+#include <rdix/task.h>
+#include <rdix/memory.h>
+#include <rdix/kernel.h>
+#include <common/list.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+/* futex 以物理地址为键，不同进程映射的同一物理页（如共享内存）上的 futex 也能互相唤醒
+ * 等待者的节点放在自己的内核栈上，value 为键，owner 为任务节点 */
+static List_t futex_queues[FUTEX_HASH_NR];
+
+#define futex_hash(key) (&futex_queues[(((key) >> 2) ^ ((key) >> 12)) & (FUTEX_HASH_NR - 1)])
+
+void futex_init(){
+    for (size_t i = 0; i < FUTEX_HASH_NR; ++i)
+        list_init(&futex_queues[i]);
+}
+
+/* 检查和入队都在关中断下完成，和 FUTEX_WAKE 之间不会丢失唤醒
+ * 等待时状态为 TASK_SLEEPING，线程组退出时可以被提前唤醒 */
+static int32 futex_wait(u32 *uaddr, u32 key, u32 val){
+    ListNode_t waiter;
+
+    if (*(volatile u32 *)uaddr != val)
+        return EOF;
+
+    node_init(&waiter, current_task(), key);
+    list_push(futex_hash(key), &waiter);
+
+    block(NULL, NULL, TASK_SLEEPING);
+
+    /* 不是被 FUTEX_WAKE 唤醒的，自己出队 */
+    if (waiter.container != NULL)
+        remove_node(&waiter);
+
+    return 0;
+}
+
+/* 按入队顺序唤醒 */
+static int32 futex_wake(u32 key, u32 count){
+    List_t *queue = futex_hash(key);
+    ListNode_t *iter = queue->end.previous;
+    u32 woken = 0;
+
+    while (iter != &queue->end && woken < count){
+        ListNode_t *prev = iter->previous;
+
+        if (iter->value == key){
+            remove_node(iter);
+            unblock((ListNode_t *)iter->owner);
+            ++woken;
+        }
+        iter = prev;
+    }
+
+    return woken;
+}
+
+int32 sys_futex(u32 *uaddr, int op, u32 val){
+    assert(!get_IF());
+
+    u32 vaddr = (u32)uaddr;
+    u32 key;
+
+    if (vaddr & 3 || vaddr < PAGE_SIZE || vaddr >= USER_STACK_TOP)
+        return EOF;
+
+    /* 内核内存是恒等映射且所有进程共享的，虚拟地址就是物理地址 */
+    if (vaddr < KERNEL_MEMERY_SIZE)
+        key = vaddr;
+    else
+        key = (u32)user_page_private(vaddr);
+
+    switch (op){
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, key, val);
+        case FUTEX_WAKE:
+            return futex_wake(key, val);
+        default:
+            return EOF;
+    }
+}
@@ -3,6 +3,8 @@
 
 global handler_table, interrupt_exit
 extern interrupt_func_table
+extern task_return_user
+extern task_enter_kernel
 
 %macro SYS_EXCEPTION 2
 SYS_INTERRUPT_%1:
@@ -20,6 +22,12 @@ interrupt_handler:
     push gs
     pusha
 
+    ;从用户态进入时记录用户态时间
+    test dword [esp + 15 * 4], 3
+    jz .kernel
+    call task_enter_kernel
+
+.kernel:
     mov eax, [ss:esp + 12 * 4]  ;向量号
     mov ebx, [ss:esp + 13 * 4]  ;错误码
 
@@ -28,6 +36,11 @@ interrupt_handler:
     call [interrupt_func_table + eax * 4]
     add esp,8
 
+    ;返回用户态之前检查线程组是否正在退出
+    test dword [esp + 15 * 4], 3
+    jz interrupt_exit
+    call task_return_user
+
 interrupt_exit:
     popa
     pop gs
@@ -197,6 +210,15 @@ syscall_handle:
     push gs  
     pusha
 
+    ;从用户态进入时记录用户态时间，调用会破坏 eax, ecx, edx，需要从栈中恢复
+    test dword [esp + 15 * 4], 3
+    jz .args
+    call task_enter_kernel
+    mov eax, [esp + 7 * 4]
+    mov ecx, [esp + 6 * 4]
+    mov edx, [esp + 5 * 4]
+
+.args:
     ;系统调用号 0x80
     push 0x80;第四个参数
     push edx;第三个参数
@@ -208,6 +230,12 @@ syscall_handle:
 
     mov [esp + 7 * 4], eax
 
+    ;内核线程也会通过 int 0x80 调用，只在返回用户态时检查
+    test dword [esp + 15 * 4], 3
+    jz .exit
+    call task_return_user
+
+.exit:
     popa
     pop gs
     pop fs
@@ -217,3 +245,97 @@ syscall_handle:
     add esp, 8
 
     iret
+
+
+global sysenter_handle
+
+USER_CODE_SELECTOR equ (3 << 3) | 3
+USER_DATA_SELECTOR equ (4 << 3) | 3
+
+;用户栈的合法范围由 syscall_gate.c 根据 memory.h 中的定义给出
+extern sysenter_stack_low, sysenter_stack_high
+extern sysenter_bad_stack
+
+;sysenter 快速系统调用入口，IA32_SYSENTER_EIP 指向这里
+;进入时 esp 为 IA32_SYSENTER_ESP，即 tss 的地址，中断已关闭
+;用户态调用约定（见 syscall.c）：
+;   eax 为系统调用号，ebx 为第一个参数
+;   ebp 指向用户栈，[ebp] 为返回地址，[ebp + 4] 为第三个参数，[ebp + 8] 为第二个参数
+;这里构造出与 int 0x80 完全相同的栈帧，fork 等依赖栈帧的调用无需区分入口
+sysenter_handle:
+    mov esp, [esp + 4]  ;切换到 tss.esp0，即当前任务的内核栈
+
+    ;下面的 cmp 会修改标志位，先把用户的 eflags 保存到 ecx 中，ecx 和 edx 在 sysexit 时都会被覆盖
+    pushf
+    pop ecx
+
+    ;ebp 由用户给出，[ebp] 到 [ebp + 8] 都必须在用户空间内，否则在内核中访问会出错
+    cmp ebp, [sysenter_stack_low]
+    jb .bad_stack
+    cmp ebp, [sysenter_stack_high]
+    ja .bad_stack
+
+    push USER_DATA_SELECTOR ;ss
+    push ebp                ;esp
+    push ecx                ;eflags
+    or dword [esp], 0x200   ;返回用户态后打开中断
+    push USER_CODE_SELECTOR ;cs
+    push dword [ebp]        ;eip
+
+    push eax
+    call syscall_check
+    add esp, 4
+
+    push 0x01011017 ;error
+    push 0x80       ;vector0
+
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov edx, [ebp + 4]
+    mov ecx, [ebp + 8]
+    pusha
+
+    call task_enter_kernel
+    mov eax, [esp + 7 * 4]
+    mov ecx, [esp + 6 * 4]
+    mov edx, [esp + 5 * 4]
+
+    push 0x80;第四个参数
+    push edx;第三个参数
+    push ecx;第二个参数
+    push ebx;第一个参数
+
+    call [syscall_table + eax * 4]
+    add esp, 4 * 4
+
+    mov [esp + 7 * 4], eax
+
+    call task_return_user
+
+    popa
+    pop gs
+    pop fs
+    pop es
+    pop ds
+
+    add esp, 8
+
+    ;sysexit 从 edx 取返回地址，从 ecx 取用户栈
+    mov edx, [esp]
+    mov ecx, [esp + 3 * 4]
+
+    ;sysexit 不恢复 eflags，这里恢复进入时保存的用户 eflags，IF 由下面的 sti 打开
+    add esp, 2 * 4
+    and dword [esp], ~0x200
+    popf
+
+    sti ;sti 的效果延迟到下一条指令之后，sysexit 执行前不会被中断
+    sysexit
+
+;用户栈不可用，取不到返回地址，只能结束当前任务，不会返回
+.bad_stack:
+    push ebp
+    call sysenter_bad_stack
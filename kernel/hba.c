@@ -9,6 +9,7 @@
 #include <common/interrupt.h>
 #include <rdix/syscall.h>
 #include <rdix/device.h>
+#include <common/clock.h>
 
 #define HBA_LOG_INFO __LOG("[hba]")
 #define HBA_WARNING_INFO __WARNING("[hba warning]")
@@ -24,9 +25,13 @@ const char* sata_spd[4] = {
     "SATA III",
 };
 
-slot_num load_ata_cmd(hba_dev_t *dev, u8 cmd, u64 startlba, u16 count);
+extern time_t jiffies;
+
+bool load_ata_cmd(hba_dev_t *dev, slot_num slot, u8 cmd, u64 startlba, u16 count, bio_t *bio);
 
 send_status_t try_send_cmd(hba_dev_t *dev, slot_num slot);
+static bool hba_polling(hba_dev_t *dev);
+static void sata_poll_wait(hba_port_t *port, hba_slot_t *hs);
 
 bool probe_hba(){
     hba = (hba_t *)malloc(sizeof(hba_t));
@@ -44,6 +49,13 @@ bool probe_hba(){
 
     hba->devices = new_list();
     hba->io_base = NULL;
+    hba->int_enabled = false;
+    hba->int_mode = HBA_INT_NONE;
+    hba->int_count = 0;
+    hba->port_map = 0;
+    hba->ccc_ports = 0;
+    hba->ccc_int = 0;
+    memset(hba->ports, 0, sizeof(hba->ports));
 
     u32 cmd = pci_dev_reg_read(hba->dev_info, PCI_CONFIG_SPACE_CMD);
 
@@ -88,6 +100,8 @@ void hba_GHC_init(){
     hba->per_port_slot_cnt = ((hba->io_base[REG_IDX(HBA_REG_CAP)] >> 8) & 0x1f) + 1;
 }
 
+static void hba_bottom_half(void *data);
+
 hba_port_t *new_port(int32 port_num){
     hba_port_t *port = (hba_port_t *)malloc(sizeof(hba_port_t));
 
@@ -129,16 +143,36 @@ hba_port_t *new_port(int32 port_num){
     /* FIS receive enable */
     port->reg_base[REG_IDX(HBA_PORT_PxCMD)] |= HBA_PORT_CMD_FRE;
 
-    /* 开中断 */
-    port->reg_base[REG_IDX(HBA_PORT_PxIE)] |= HBA_PORT_IE_DPE;
+    /* 开中断，命令完成和致命错误都产生中断 */
+    port->reg_base[REG_IDX(HBA_PORT_PxIE)] |= HBA_PORT_IE_DONE | HBA_PORT_IE_ERROR;
 
     /* 启动 hba 开始处理该端口对应命令链表 */
     port->reg_base[REG_IDX(HBA_PORT_PxCMD)] |= HBA_PORT_CMD_ST;
 
-    port->waiting_list = new_list();
-    port->sending = NULL;
+    /* 每个槽位一张命令表，一次分配，之后重复使用 */
+    u32 tab_pages = (HBA_CMD_TAB_SIZE * hba->per_port_slot_cnt + PAGE_SIZE - 1) / PAGE_SIZE;
+    u8 *tabs = (u8 *)alloc_kpage(tab_pages);
+
+    for (int slot = 0; slot < HBA_SLOT_NR; ++slot){
+        hba_slot_t *hs = &port->slots[slot];
+
+        hs->tab = slot < hba->per_port_slot_cnt ? (cmd_tab_t *)(tabs + slot * HBA_CMD_TAB_SIZE) : NULL;
+        hs->large = NULL;
+        hs->large_pages = 0;
+        hs->done = false;
+        hs->status = SUCCESSFUL;
+        hs->req = NULL;
+        wait_queue_init(&hs->wait);
+    }
+
+    wait_queue_init(&port->waiting);
+    work_init(&port->work, hba_bottom_half, port);
     port->last_status = -1;
-    port->timer = NULL;
+    port->slot_map = 0;
+    port->issue_map = 0;
+    port->inflight = 0;
+    port->exclusive = 0;
+    port->irq_stat = 0;
     
     return port;
 }
@@ -183,17 +217,106 @@ void prase_deviceinfo(hba_dev_t* dev, u16 *data){
 
         dev->flags |= SATA_LBA_48_ENABLE;
     }
+
+    /* 支持 NCQ，word 75 为设备的队列深度减一，具体参考 ACS-3/7.12.7.36
+     * 队列深度还受 hba 每个端口命令槽数的限制 */
+    dev->queue_depth = 1;
+    if ((*(data + 76) & 0x100) && (hba->io_base[REG_IDX(HBA_REG_CAP)] & HBA_CAP_SNCQ) &&
+        (dev->flags & SATA_LBA_48_ENABLE)){
+        dev->queue_depth = (*(data + 75) & 0x1f) + 1;
+        if (dev->queue_depth > hba->per_port_slot_cnt)
+            dev->queue_depth = hba->per_port_slot_cnt;
+        dev->flags |= SATA_NCQ_ENABLE;
+    }
+}
+
+static bool is_ncq_cmd(u8 cmd){
+    return cmd == ATA_CMD_READ_FPDMA_QUEUED || cmd == ATA_CMD_WRITE_FPDMA_QUEUED;
+}
+
+static bool is_write_cmd(u8 cmd){
+    return cmd == ATA_CMD_WRITE_DMA_EXT || cmd == ATA_CMD_WRITE_DMA || cmd == ATA_CMD_WRITE_FPDMA_QUEUED;
+}
+
+/* 是否有空闲的槽位可以发送命令，调用前需要关中断
+ * NCQ 命令最多同时发出 queue_depth 个，非队列命令必须等端口上的命令全部完成 */
+static bool slot_available(hba_dev_t *dev, bool ncq){
+    hba_port_t *port = dev->port;
+    u32 used = 0;
+
+    if (!ncq)
+        return port->slot_map == 0;
+    if (port->exclusive)
+        return false;
+
+    for (int slot = 0; slot < HBA_SLOT_NR; ++slot)
+        used += (port->slot_map >> slot) & 1;
+    return used < dev->queue_depth;
+}
+
+/* 分配一个槽位，没有空闲的槽位时睡眠等待，调用前需要关中断 */
+static slot_num slot_alloc(hba_dev_t *dev, bool ncq){
+    hba_port_t *port = dev->port;
+
+    assert(!get_IF());
+
+    if (!ncq)
+        ++port->exclusive;
+
+    wait_event(&port->waiting, slot_available(dev, ncq));
+
+    if (!ncq)
+        --port->exclusive;
+
+    for (int slot = 0; slot < hba->per_port_slot_cnt; ++slot){
+        if (!(port->slot_map & (1 << slot))){
+            port->slot_map |= 1 << slot;
+            port->slots[slot].done = false;
+            return slot;
+        }
+    }
+
+    PANIC("no free slot\n");
 }
 
-send_status_t sata_send_cmd(hba_dev_t *dev, SATA_CMD_TYPE cmd, u64 startlba, u16 count){
+static void slot_free(hba_port_t *port, slot_num slot){
+    hba_slot_t *hs = &port->slots[slot];
+
+    if (hs->large){
+        free_kpage(hs->large, hs->large_pages);
+        hs->large = NULL;
+        hs->large_pages = 0;
+    }
+
+    port->slot_map &= ~(1 << slot);
+    wake_up_all(&port->waiting);
+}
+
+/* 同一端口上可以有多个任务同时发送命令，每个命令占用一个槽位
+ * buf 为数据缓冲区，count 为扇区数 */
+send_status_t sata_send_cmd(hba_dev_t *dev, SATA_CMD_TYPE cmd, u64 startlba, u16 count, void *buf){
+    bool IF_stat = get_and_disable_IF();
+
+    slot_num slot = slot_alloc(dev, is_ncq_cmd(cmd));
+    send_status_t status = GENERAL_ERROR;
+    bio_t bio;
+
+    /* identify device 这类命令不设置 count，固定传输一个扇区 */
+    bio_init(&bio, 0, is_write_cmd(cmd) ? REQ_WRITE : REQ_READ, startlba, count ? count : 1, buf);
+
+    if (load_ata_cmd(dev, slot, cmd, startlba, count, &bio))
+        status = try_send_cmd(dev, slot);
+    slot_free(dev->port, slot);
+
+    set_IF(IF_stat);
 
-    slot_num slot = load_ata_cmd(dev, cmd, startlba, count);
-    return try_send_cmd(dev, slot);
+    return status;
 }
 
 hba_dev_t* new_hba_device(hba_port_t *port, u8 spd){
     hba_dev_t *dev = (hba_dev_t *)malloc(sizeof(hba_dev_t));
 
+    memset(dev, 0, sizeof(hba_dev_t));
     dev->spd = spd;
     dev->port = port;
 
@@ -203,7 +326,7 @@ hba_dev_t* new_hba_device(hba_port_t *port, u8 spd){
 
     /* 不知为何在 VM 中将内存调到 256M 就会造成读取错误。
      * 因为错误使用 sizeof */
-    sata_send_cmd(dev, ATA_CMD_IDENTIFY_DEVICE, 0, 0);
+    sata_send_cmd(dev, ATA_CMD_IDENTIFY_DEVICE, 0, 0, dev->data);
 
     prase_deviceinfo(dev, dev->data);
 
@@ -226,7 +349,9 @@ void hba_devices_init(){
             u8 spd = (pxssts >> 4) & 0xf;
             /* 检测端口对应 ssts 寄存器 */
             if ((pxssts & 0x3 == 3) && spd){
-                list_pushback(devices, new_listnode(new_hba_device(new_port(port), spd), 0));
+                hba->ports[port] = new_port(port);
+                hba->port_map |= 1 << port;
+                list_pushback(devices, new_listnode(new_hba_device(hba->ports[port], spd), 0));
             }
         }
     }
@@ -251,7 +376,7 @@ void bulid_cmd_tab_fis(FIS_REG_H2D *fis, u8 cmd, u64 startlba, u16 count){
     if (cmd == ATA_CMD_IDENTIFY_DEVICE)
         fis->device = 0;
     if (cmd == ATA_CMD_READ_DMA_EXT || cmd == ATA_CMD_READ_DMA || \
-        cmd == ATA_CMD_WRITE_DMA_EXT || cmd == ATA_CMD_WRITE_DMA)
+        cmd == ATA_CMD_WRITE_DMA_EXT || cmd == ATA_CMD_WRITE_DMA || is_ncq_cmd(cmd))
         fis->device = 1 << 6;
 
     fis->lba0 = (u8)startlba;
@@ -260,12 +385,22 @@ void bulid_cmd_tab_fis(FIS_REG_H2D *fis, u8 cmd, u64 startlba, u16 count){
     fis->lba3 = (u8)(startlba >> 24);
 
     fis->lba4 = (u8)(startlba >> 32);
-    fis->lba4 = (u8)(startlba >> 40);
+    fis->lba5 = (u8)(startlba >> 40);
 
     fis->countl = (u8)count;
     fis->counth = (u8)(count >> 8);
 }
 
+/* NCQ 命令的扇区数放在 feature 寄存器中，count 寄存器的 7:3 位为 tag */
+void bulid_ncq_fis(FIS_REG_H2D *fis, u8 cmd, u64 startlba, u16 count, slot_num tag){
+    bulid_cmd_tab_fis(fis, cmd, startlba, count);
+
+    fis->featurel = (u8)count;
+    fis->featureh = (u8)(count >> 8);
+    fis->countl = (u8)(tag << 3);
+    fis->counth = 0;
+}
+
 /* CFL 为 CFIS 长度，单位为 dw
  * PRDTL 为 PRDT 表中描述符个数，也就是 item 个数
  * base 为 cmmand table 基地址 */
@@ -293,184 +428,258 @@ void build_cmd_head(cmd_list_slot *cmd_head, u8 CFL, u16 PRDTL, u32 base, u8 cmd
         cmd_head->flag_rcbr = 0b0100; */
     
     /* 如果是写操作，那么 W 标志位需要置位 */
-    if (cmd == ATA_CMD_WRITE_DMA_EXT || cmd == ATA_CMD_WRITE_DMA)
+    if (is_write_cmd(cmd))
         cmd_head->flag_pwa = 0b010;
 }
 
-/* count 为传输扇区数
- * 在读取和写入磁盘时需要设置，像发送 identify device 命令这种并不需要设置 count */
-u16 *build_cmd_tab_item(cmd_tab_item *item, void *data, size_t count){
-    /* ===========================================
-     * bug 调试记录
-     * sizeof 最好跟类型名！不要跟变量，不然容易出错
-     * 就是因为 sizeof(item)，导致内存清除不完全！调试了一个星期
-     * 出错原因是 item 是一个指针变量 sizeof(item) == 4
-     * =========================================== */
-    memset(item, 0, sizeof(cmd_tab_item));
-
-    /* 一个扇区 512 字节 */
-    size_t size = count << 9;
+/* 按页遍历虚拟缓冲区，每段物理连续的内存生成一个 PRD，单个 PRD 不超过 4M
+ * item 为 NULL 时只计算需要的 PRD 个数，返回 PRD 个数 */
+static u32 build_prdt(cmd_tab_item *item, void *data, u32 bytes){
+    u32 vaddr = (u32)data;
+    u32 n = 0;
+    u32 last_addr = 0;  // 上一个 PRD 之后的物理地址
+    u32 last_len = 0;   // 上一个 PRD 的长度
 
     /* data 必须是字对齐 */
-    assert(!((u32)data & 1));
-    item->dba = get_phy_addr(data);
+    assert(!(vaddr & 1) && !(bytes & 1));
 
-    /* 最后一位必须是 1 */
-    item->dbc = size - 1;
+    while (bytes){
+        u32 chunk = PAGE_SIZE - (vaddr & 0xfff);
+        u32 paddr = (u32)get_phy_addr((vir_addr_t)vaddr);
 
-    /* 该条目传输完毕后产生中断 */
-    item->i = 1;
+        if (chunk > bytes)
+            chunk = bytes;
 
-    return data;
+        /* 和上一段物理连续时直接延长上一个 PRD */
+        if (n && paddr == last_addr && last_len + chunk <= HBA_PRD_BYTES_MAX){
+            last_len += chunk;
+            if (item)
+                item[n - 1].dbc = last_len - 1;
+        }
+        else {
+            if (item){
+                /* ===========================================
+                 * bug 调试记录
+                 * sizeof 最好跟类型名！不要跟变量，不然容易出错
+                 * 就是因为 sizeof(item)，导致内存清除不完全！调试了一个星期
+                 * 出错原因是 item 是一个指针变量 sizeof(item) == 4
+                 * =========================================== */
+                memset(&item[n], 0, sizeof(cmd_tab_item));
+                item[n].dba = paddr;
+                /* 最后一位必须是 1 */
+                item[n].dbc = chunk - 1;
+            }
+            last_len = chunk;
+            ++n;
+        }
+
+        last_addr = paddr + chunk;
+        vaddr += chunk;
+        bytes -= chunk;
+    }
+
+    return n;
 }
 
-/* count 为扇区数 */
-slot_num load_ata_cmd(hba_dev_t *dev, u8 cmd, u64 startlba, u16 count){
-    slot_num free_slot = 32;
+/* count 为扇区数，命令写入 slot 对应的命令头和命令表，bio 链表中的每段缓冲区依次生成 PRD
+ * PRD 放不进槽位自带的命令表时临时分配一个，PRD 超过 HBA_PRDT_MAX 时返回 false */
+bool load_ata_cmd(hba_dev_t *dev, slot_num slot, u8 cmd, u64 startlba, u16 count, bio_t *bio){
     hba_port_t *port = dev->port;
+    hba_slot_t *hs = &port->slots[slot];
+    u32 prdtl = 0;
 
-    for (int slot = 0; slot < 32; ++slot){
-        if (!((port->reg_base[REG_IDX(HBA_PORT_PxCI)] >> slot) & 0x1)){
-            free_slot = slot;
-            break;
-        }
-    }
+    assert(bio != NULL);
 
-    /* 没找到空闲的插槽 */
-    if (free_slot == 32)
-        return 32;
+    for (bio_t *iter = bio; iter; iter = iter->next)
+        prdtl += build_prdt(NULL, iter->buf, iter->count * SECTOR_SIZE);
 
-    assert(dev->data != NULL);
-    //***************************************
-    /* if (cmd == ATA_CMD_IDENTIFY_DEVICE) {
-        dev->data.ptr = malloc(1024);
-        dev->data.size = 2;
-    } */
+    if (prdtl > HBA_PRDT_MAX)
+        return false;
 
-    cmd_list_slot *cmd_head = &port->vPxCLB[free_slot];
-    cmd_tab_t *cmd_tab = (u32 *)malloc(sizeof(cmd_tab_t) + sizeof(cmd_tab_item));
+    cmd_list_slot *cmd_head = &port->vPxCLB[slot];
+    cmd_tab_t *cmd_tab = hs->tab;
+
+    if (prdtl > HBA_PRDT_NR){
+        hs->large_pages = (sizeof(cmd_tab_t) + prdtl * sizeof(cmd_tab_item) + PAGE_SIZE - 1) / PAGE_SIZE;
+        hs->large = (cmd_tab_t *)alloc_kpage(hs->large_pages);
+        if (hs->large == NULL){
+            hs->large_pages = 0;
+            return false;
+        }
+        cmd_tab = hs->large;
+    }
+    hs->cmd = cmd;
 
     /* ==================================================
      * bug 调试记录
      * 在构建命令头的时候，CFL 的单位是 DW，也就是 CFL == 1 代表四个字节长度
      * 由于传入的时候没有除以 sizeof(u32) 导致 PxTFD.ERR 置一（任务文件错误）
      * ================================================== */
-    build_cmd_head(cmd_head, sizeof(FIS_REG_H2D) / sizeof(u32), 1, (u32)get_phy_addr(cmd_tab), cmd);
-    bulid_cmd_tab_fis((FIS_REG_H2D *)cmd_tab, cmd, startlba, count);
-    build_cmd_tab_item(cmd_tab->item, dev->data, count);
+    build_cmd_head(cmd_head, sizeof(FIS_REG_H2D) / sizeof(u32), prdtl, (u32)get_phy_addr(cmd_tab), cmd);
+    if (is_ncq_cmd(cmd))
+        bulid_ncq_fis((FIS_REG_H2D *)cmd_tab, cmd, startlba, count, slot);
+    else
+        bulid_cmd_tab_fis((FIS_REG_H2D *)cmd_tab, cmd, startlba, count);
 
-    return free_slot;
-}
+    u32 n = 0;
 
-void sata_busy_wait(hba_port_t *port){
-    if (port->reg_base[REG_IDX(HBA_PORT_PxTFD)] & HBA_PORT_TFD_BSY){
-        /* 如果这里没通过，代表上一次发送出现问题后没有复位 */
-        assert(port->sending != NULL);
-        block(port->waiting_list, NULL, TASK_WAITING);
-    }
+    for (bio_t *iter = bio; iter; iter = iter->next)
+        n += build_prdt(&cmd_tab->item[n], iter->buf, iter->count * SECTOR_SIZE);
+
+    /* 最后一个条目传输完毕后产生中断 */
+    if (n)
+        cmd_tab->item[n - 1].i = 1;
+
+    return true;
 }
 
-void __timer(){
-    set_IF(true);
-    hba_port_t *port = NULL;
+/* 停止并重新启动端口，PxCI 和 PxSACT 随之清零，所有未完成的命令都失败 */
+static void hba_port_restart(hba_port_t *port){
+    port->reg_base[REG_IDX(HBA_PORT_PxCMD)] &= ~HBA_PORT_CMD_ST;
+    for (time_t limit = 0x100000; limit && (port->reg_base[REG_IDX(HBA_PORT_PxCMD)] & HBA_PORT_CMD_CR); --limit);
 
-    /* 参数指针保存在 edi 中 */
-    asm volatile(
-        "movl %%edi,%0\n"
-        :"=m"(port)
-    );
+    port->reg_base[REG_IDX(HBA_PORT_PxSERR)] = -1;
+    port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
 
-    /* 超时计时器时长 */
-    sleep(1000);
+    port->reg_base[REG_IDX(HBA_PORT_PxCMD)] |= HBA_PORT_CMD_ST;
+}
+
+/* 结束 mask 中的命令并唤醒等待者，调用前需要关中断 */
+static void hba_slot_complete(hba_port_t *port, u32 mask, send_status_t status){
+    for (int slot = 0; slot < HBA_SLOT_NR; ++slot){
+        if (!(mask & (1 << slot)))
+            continue;
 
-    bool st = get_and_disable_IF();
+        hba_slot_t *hs = &port->slots[slot];
 
-    /* 传输失败后要进行复位处理 */
-    port->sending = NULL;
+        hs->status = status;
+        hs->done = true;
+        port->issue_map &= ~(1 << slot);
+        --port->inflight;
 
-    /* kernel_thread_exit 不会去解除 waitpid 的阻塞，所里这里要关中断
-     * 防止父进程先一步 waitpid */
-    kernel_thread_exit(NULL, 1);
+        if (hs->req){
+            struct request_t *req = hs->req;
+
+            hs->req = NULL;
+            slot_free(port, slot);
+            blk_end_request(req, status == SUCCESSFUL ? 0 : EOF);
+            continue;
+        }
 
-    set_IF(st);
+        wake_up_all(&hs->wait);
+    }
 }
 
-static int sata_sending_wait(hba_port_t *port, slot_num slot){
-    assert(port->sending == NULL);
+/* 回收端口上已经完成的命令，返回回收的个数，调用前需要关中断
+ * 非队列命令完成时 PxCI 中的位清零，NCQ 命令完成时 PxSACT 中的位清零 */
+static u32 hba_port_reap(hba_port_t *port){
+    u32 is = port->reg_base[REG_IDX(HBA_PORT_PxIS)] | port->irq_stat;
+    u32 ci = port->reg_base[REG_IDX(HBA_PORT_PxCI)];
+    u32 sact = port->reg_base[REG_IDX(HBA_PORT_PxSACT)];
+    u32 done = port->issue_map & ~ci & ~sact;
+    u32 count = port->inflight;
+
+    port->irq_stat = 0;
+
+    /* 任务文件错误时无法知道是哪个 NCQ 命令出错，全部按失败处理 */
+    if (is & HBA_PORT_IS_ERROR){
+        printk(HBA_WARNING_INFO "port %d fatal error, PxIS %x, PxTFD %x\n",
+               port->port_num, is, port->reg_base[REG_IDX(HBA_PORT_PxTFD)]);
+        hba_slot_complete(port, done, SUCCESSFUL);
+        hba_slot_complete(port, port->issue_map, GENERAL_ERROR);
+        hba_port_restart(port);
+        return count;
+    }
 
-    bool IF_stat = get_IF();
-    set_IF(false);
-    
-    /* 清空中断状态寄存器 */
-    port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
+    hba_slot_complete(port, done, SUCCESSFUL);
+    return count - port->inflight;
+}
 
-    /* 发送 */
-    port->reg_base[REG_IDX(HBA_PORT_PxCI)] |= 1 << slot;
+/* 调度开始之前无法睡眠等待中断，中断安装之前也只能轮询 */
+static bool hba_polling(hba_dev_t *dev){
+    return current_task() == NULL || !hba->int_enabled;
+}
 
-    port->sending = current_task();
+/* 轮询命令完成，等待期间开中断并让出 cpu，其他任务可以继续向端口发送命令 */
+static void sata_poll_wait(hba_port_t *port, hba_slot_t *hs){
+    if (current_task() == NULL){
+        time_t limit = 0x100000;
 
-    /* 开启超时计时器 */
-    port->timer = task_create(__timer, port, "timer", 3, KERNEL_UID);
+        for (; !hs->done && limit; --limit)
+            hba_port_reap(port);
+        if (!hs->done)
+            hba_slot_complete(port, port->issue_map, GENERAL_ERROR);
+        return;
+    }
 
-    int32 *tmp;
+    time_t deadline = jiffies + HBA_CMD_TIMEOUT / JIFFY;
 
-    assert(sys_waitpid(((TCB_t*)port->timer->owner)->pid, &tmp) != -1);
+    while (!hs->done){
+        hba_port_reap(port);
+        if (hs->done)
+            break;
 
-    set_IF(IF_stat);
+        if (jiffies > deadline){
+            hba_slot_complete(port, port->issue_map, GENERAL_ERROR);
+            hba_port_restart(port);
+            break;
+        }
 
-    return tmp;
+        set_IF(true);
+        ATOMIC_OPS(schedule(););
+        set_IF(false);
+    }
+
+    /* 这里不做处理的话，开中断后会马上触发 hba 中断或其他错误 */
+    if (port->inflight == 0){
+        port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
+        hba->io_base[REG_IDX(HBA_REG_IS)] = -1;
+    }
 }
 
-send_status_t try_send_cmd(hba_dev_t *dev, slot_num slot){
+/* 把 slot 中的命令发给 hba，不等待完成，调用前需要关中断 */
+static send_status_t hba_issue(hba_dev_t *dev, slot_num slot){
     hba_port_t *port = dev->port;
+    u8 cmd = port->slots[slot].cmd;
 
     if (port->reg_base[REG_IDX(HBA_PORT_PxSIG)] != SATA_DEV_SIG){
         port->last_status = NOT_SATA;
         return NOT_SATA;
     }
-        
-    /* 判断是否已经开始进程调度 */
-    /* 这里 qemu 不知道为什么不会触发 ahci 的 msi 中断
-     * 所以如果是 qemu 的话就用 PIO 模式 */
-    if (current_task() && *(u32 *)dev->sata_serial != 0x30304D51){  // 'QM00'
-        sata_busy_wait(port);
-
-        if (sata_sending_wait(port, slot) == 0)
-            port->last_status = SUCCESSFUL;
-        else
-            port->last_status = GENERAL_ERROR;
 
-        return port->last_status;
-    }
-    else {
-        time_t limit = 0x100000;
-        for (; port->reg_base[REG_IDX(HBA_PORT_PxTFD)] & HBA_PORT_TFD_BSY; --limit);
+    port->issue_map |= 1 << slot;
+    ++port->inflight;
 
-        if (!limit){
-            port->last_status = _BUSY;
-            return _BUSY;
-        }
-        
-        /* 清空中断状态寄存器 */
-        port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
+    /* NCQ 命令要先在 PxSACT 中置位，再写 PxCI 发送，写 0 的位不受影响 */
+    if (is_ncq_cmd(cmd))
+        port->reg_base[REG_IDX(HBA_PORT_PxSACT)] = 1 << slot;
+    port->reg_base[REG_IDX(HBA_PORT_PxCI)] = 1 << slot;
 
-        port->reg_base[REG_IDX(HBA_PORT_PxCI)] |= 1 << slot;
+    return SUCCESSFUL;
+}
 
-        limit = 0x100000;
-        for(; (port->reg_base[REG_IDX(HBA_PORT_PxCI)] & (1 << slot)) && limit; --limit);
+/* 发送 slot 中的命令并等待完成，调用前需要关中断 */
+send_status_t try_send_cmd(hba_dev_t *dev, slot_num slot){
+    hba_port_t *port = dev->port;
+    hba_slot_t *hs = &port->slots[slot];
 
-        if (!limit){
-            port->reg_base[REG_IDX(HBA_PORT_PxCI)] &= ~(1 << slot);
-            port->last_status = GENERAL_ERROR;
-            return GENERAL_ERROR;
-        }
-        /* 这里不做处理的话，开中断后会马上触发 hba 中断或其他错误 */
-        port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
-        hba->io_base[REG_IDX(HBA_REG_IS)] = -1;
+    assert(!get_IF());
+
+    if (hba_issue(dev, slot) != SUCCESSFUL)
+        return NOT_SATA;
+
+    if (hba_polling(dev)){
+        sata_poll_wait(port, hs);
+    }
+    else if (!wait_event_timeout(&hs->wait, hs->done, HBA_CMD_TIMEOUT)){
+        /* 超时后复位端口，同时在执行的命令一起失败 */
+        printk(HBA_WARNING_INFO "port %d slot %d timeout\n", port->port_num, slot);
+        hba_slot_complete(port, port->issue_map, GENERAL_ERROR);
+        hba_port_restart(port);
     }
 
-    port->last_status = SUCCESSFUL;
-    return SUCCESSFUL;
+    port->last_status = hs->status;
+    return hs->status;
 }
 
 static void hba_error_proc(hba_dev_t *device){
@@ -478,49 +687,137 @@ static void hba_error_proc(hba_dev_t *device){
     printk(HBA_WARNING_INFO "PxTFD %x\n", device->port->reg_base[REG_IDX(HBA_PORT_PxTFD)]);
 }
 
+/* 下半部，回收完成的命令并唤醒对应槽位的等待者 */
+static void hba_bottom_half(void *data){
+    hba_port_t *port = (hba_port_t *)data;
+
+    bool IF_stat = get_and_disable_IF();
+
+    hba_port_reap(port);
+
+    set_IF(IF_stat);
+}
+
+/* 最低的置位位号，x 不能为 0 */
+static _inline u32 hba_ffs(u32 x){
+    u32 idx;
+
+    asm volatile("bsfl %1, %0" : "=r"(idx) : "rm"(x));
+    return idx;
+}
+
+/* 上半部只应答硬件，其余工作交给 hba_bottom_half
+ * IS 中每一位对应一个端口，按位直接找到端口，不需要遍历设备链表 */
 static void hba_handler(u32 int_num){
-    printk(HBA_LOG_INFO "in interrupt [0x%x]\n", int_num);
-    
-    List_t *devices = hba->devices;
-    hba_port_t *port = NULL;
+    u32 is = hba->io_base[REG_IDX(HBA_REG_IS)];
+    u32 pending = is & hba->port_map;
 
-    for (ListNode_t *node = devices->end.next;
-        node != &devices->end; node = node->next){
+    ++hba->int_count;
 
-        hba_dev_t *dev = (hba_dev_t *)node->owner;
-        
-        /* 检测是哪个 port 发出的中断 */
-        if (dev->port->reg_base[REG_IDX(HBA_PORT_PxIS)] & HBA_PORT_IS_DPS){
-            port = dev->port;
-            break;
+    /* 合并中断不对应具体端口，参与合并的端口都要检查 */
+    if (hba->ccc_ports && (is & (1 << hba->ccc_int)))
+        pending |= hba->ccc_ports;
+
+    for (; pending; pending &= pending - 1){
+        hba_port_t *port = hba->ports[hba_ffs(pending)];
+        u32 pxis = port->reg_base[REG_IDX(HBA_PORT_PxIS)];
+
+        /* 只清除读到的位，清除之后才到达的状态会再次产生中断，不会丢失
+         * 错误状态留给下半部处理 */
+        if (pxis){
+            port->reg_base[REG_IDX(HBA_PORT_PxIS)] = pxis;
+            port->irq_stat |= pxis & HBA_PORT_IS_ERROR;
         }
+
+        /* 下半部一次回收端口上所有已经完成的槽位 */
+        schedule_work(&port->work);
     }
 
-    if (!port)
-        PANIC("can not find a port which trigger the interrupt\n");
-    
-    assert(port->sending != NULL);
+    /* 先清端口再清 IS，否则 IS 中对应的位会被重新置上
+     * 同样只清除处理过的位，没有处理的端口会继续产生中断 */
+    if (is)
+        hba->io_base[REG_IDX(HBA_REG_IS)] = is;
 
-    /* 用于测试中断未到的情况 */
-    //goto hba_hander_END;
+    lapic_send_eoi();
+}
 
-    /* 必须要在这里清空，因为不知道是哪个任务先执行 */
-    port->sending = NULL;
+/* 端口上是否有超时的异步请求，调用前需要关中断 */
+static bool hba_port_expired(hba_port_t *port){
+    for (u32 map = port->issue_map; map; map &= map - 1){
+        hba_slot_t *hs = &port->slots[hba_ffs(map)];
 
-    if (!list_isempty(port->waiting_list))
-        unblock(port->waiting_list->end.next);
+        if (hs->req && jiffies > hs->deadline)
+            return true;
+    }
+    return false;
+}
 
-    if (port->timer)
-        kernel_thread_exit(port->timer, 0);
+/* 中断完成的异步请求没有等待者计时，完成中断丢失时请求会一直挂起
+ * 这个线程定期检查，超时后和 try_send_cmd 一样让端口上的命令全部失败并复位端口 */
+static void hba_watchdog(){
+    /* 内核线程在创建时需要手动开中断 */
+    set_IF(true);
 
-hba_hander_END:
-    /* 清空端口中断状态寄存器，如果不清空，推出中断后 hba 会立马发出一个一模一样的中断，
-     * 会造成二次中断的情况 */
-    port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
-    /* 清空 hba 中断暂挂，不清空的话 hba 不会再发送已暂挂端口的中断 */
-    hba->io_base[REG_IDX(HBA_REG_IS)] = -1;
+    while (true){
+        ATOMIC_OPS(task_sleep(HBA_WATCHDOG_INTERVAL););
 
-    lapic_send_eoi();
+        bool IF_stat = get_and_disable_IF();
+
+        for (u32 map = hba->port_map; map; map &= map - 1){
+            hba_port_t *port = hba->ports[hba_ffs(map)];
+
+            if (port == NULL || !hba_port_expired(port))
+                continue;
+
+            /* 可能只是中断丢失，先回收已经完成的命令 */
+            hba_port_reap(port);
+            if (!hba_port_expired(port))
+                continue;
+
+            printk(HBA_WARNING_INFO "port %d request timeout\n", port->port_num);
+            hba_slot_complete(port, port->issue_map, GENERAL_ERROR);
+            hba_port_restart(port);
+        }
+
+        set_IF(IF_stat);
+    }
+}
+
+/* 设置命令完成合并，completions 为 0 时关闭
+ * 参与合并的端口不再为每个命令完成产生中断，只保留错误中断
+ * hba 不支持时返回 false */
+bool hba_set_ccc(u8 completions, u16 timeout){
+    if (hba == NULL || !(hba->io_base[REG_IDX(HBA_REG_CAP)] & HBA_CAP_CCCS))
+        return false;
+
+    bool IF_stat = get_and_disable_IF();
+
+    u32 ctl = hba->io_base[REG_IDX(HBA_REG_CCC_CTL)];
+
+    /* 修改 CC 和 TV 之前要先关闭合并 */
+    hba->io_base[REG_IDX(HBA_REG_CCC_CTL)] = ctl & ~HBA_CCC_EN;
+    hba->ccc_ports = completions ? hba->port_map : 0;
+    hba->ccc_int = HBA_CCC_INT(ctl);
+
+    for (u32 map = hba->port_map; map; map &= map - 1){
+        hba_port_t *port = hba->ports[hba_ffs(map)];
+
+        if (completions)
+            port->reg_base[REG_IDX(HBA_PORT_PxIE)] &= ~HBA_PORT_IE_DONE;
+        else
+            port->reg_base[REG_IDX(HBA_PORT_PxIE)] |= HBA_PORT_IE_DONE;
+    }
+
+    if (completions){
+        hba->io_base[REG_IDX(HBA_REG_CCC_PORTS)] = hba->ccc_ports;
+        hba->io_base[REG_IDX(HBA_REG_CCC_CTL)] = HBA_CCC_CC(completions) | HBA_CCC_TV(timeout) | HBA_CCC_EN;
+    }
+
+    set_IF(IF_stat);
+
+    printk(HBA_LOG_INFO "command completion coalescing %s, cc %d tv %dms int %d\n",
+           completions ? "on" : "off", completions, timeout, hba->ccc_int);
+    return true;
 }
 
 /* RorW == true 时为读操作
@@ -531,22 +828,32 @@ int __sata_io(hba_dev_t *dev, void *buffer, u64 startlba, size_t size, bool RorW
 
     u8 cmd;
 
-    /* 28lba 和 48lba 使用的是不同的指令 */
-    if (dev->flags & SATA_LBA_48_ENABLE){
+    /* 28lba 和 48lba 使用的是不同的指令，支持 NCQ 时使用队列命令 */
+    if (dev->flags & SATA_NCQ_ENABLE){
+        cmd = RorW ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_WRITE_FPDMA_QUEUED;
+    }
+    else if (dev->flags & SATA_LBA_48_ENABLE){
         cmd = RorW ? ATA_CMD_READ_DMA_EXT : ATA_CMD_WRITE_DMA_EXT;
     }
     else {
         cmd = RorW ? ATA_CMD_READ_DMA : ATA_CMD_WRITE_DMA;
     } 
 
-    dev->data = buffer;
+    /* 28lba 的 count 只有 8 位，超过一条命令上限的传输拆成多条命令 */
+    size_t secs_max = dev->flags & SATA_LBA_48_ENABLE ? HBA_SECS_MAX : 0xff;
 
-    sata_send_cmd(dev, cmd, startlba, size);
+    while (size){
+        size_t count = size < secs_max ? size : secs_max;
 
-    if (dev->port->last_status == SUCCESSFUL)
-        return 0;
-    
-    return EOF;
+        if (sata_send_cmd(dev, cmd, startlba, count, buffer) != SUCCESSFUL)
+            return EOF;
+
+        buffer = (u8 *)buffer + count * SECTOR_SIZE;
+        startlba += count;
+        size -= count;
+    }
+
+    return 0;
 }
 
 /* size 单位为扇区 */
@@ -558,9 +865,59 @@ static int __sata_write_secs(hba_dev_t *dev, void *buffer, size_t count, u64 sta
     return __sata_io(dev, buffer, startlba, count, false);
 }
 
+/* 块设备层的请求处理函数，请求中的各段 bio 直接生成 PRD，一条命令完成整个请求
+ * 开启中断时发出命令后立即返回，由中断下半部回收命令并结束请求
+ * 轮询时在这里等待命令完成 */
+static int __sata_request(hba_dev_t *dev, request_t *req){
+    bool read = req->type == REQ_READ;
+    size_t secs_max = dev->flags & SATA_LBA_48_ENABLE ? HBA_SECS_MAX : 0xff;
+    u8 cmd;
+
+    /* 超过一条命令上限的请求逐段同步完成 */
+    if (req->count > secs_max){
+        int status = 0;
+
+        for (bio_t *bio = req->bio; bio && status != EOF; bio = bio->next)
+            status = __sata_io(dev, bio->buf, bio->idx, bio->count, read);
+        blk_end_request(req, status);
+        return 0;
+    }
+
+    if (dev->flags & SATA_NCQ_ENABLE)
+        cmd = read ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_WRITE_FPDMA_QUEUED;
+    else if (dev->flags & SATA_LBA_48_ENABLE)
+        cmd = read ? ATA_CMD_READ_DMA_EXT : ATA_CMD_WRITE_DMA_EXT;
+    else
+        cmd = read ? ATA_CMD_READ_DMA : ATA_CMD_WRITE_DMA;
+
+    bool IF_stat = get_and_disable_IF();
+
+    hba_port_t *port = dev->port;
+    slot_num slot = slot_alloc(dev, is_ncq_cmd(cmd));
+    hba_slot_t *hs = &port->slots[slot];
+
+    hs->req = req;
+    hs->deadline = jiffies + HBA_CMD_TIMEOUT / JIFFY;
+
+    if (!load_ata_cmd(dev, slot, cmd, req->idx, req->count, req->bio) || hba_issue(dev, slot) != SUCCESSFUL){
+        hs->req = NULL;
+        slot_free(port, slot);
+        set_IF(IF_stat);
+        return EOF;
+    }
+
+    if (hba_polling(dev))
+        sata_poll_wait(port, hs);
+
+    set_IF(IF_stat);
+    return 0;
+}
+
 static int __sata_ioctl(hba_dev_t *dev, int cmd, void *args, int flags){
     switch(cmd){
         case DEV_CMD_SECTOR_START: return 0;
+        case DEV_CMD_QUEUE_DEPTH: return dev->queue_depth;
+        case DEV_CMD_COALESCE: return hba_set_ccc((u32)args & 0xffff, (u32)args >> 16) ? 0 : EOF;
         case DEV_ERROR_REPORT: hba_error_proc(dev); break;
         default: printk(HBA_WARNING_INFO "sata ioctl hasn't been implemented\n");
                 break;
@@ -603,11 +960,14 @@ static void sata_install(){
                 printk (HBA_LOG_INFO "(device %d) support 48 LBA\n", dev_num);
             else
                 printk(HBA_LOG_INFO "(device %d) do not support 48 LBA\n", dev_num);
+            if (dev->flags & SATA_NCQ_ENABLE)
+                printk(HBA_LOG_INFO "(device %d) NCQ queue depth %d\n", dev_num, dev->queue_depth);
 
             char name[4];
             get_disk_name(name);
             dev_t dev_idx = device_install(DEV_BLOCK, DEV_SATA_DISK, dev, name, 0,
                         __sata_ioctl, __sata_read_secs, __sata_write_secs);
+            device_set_request(dev_idx, __sata_request);
             
             disk_part_install(dev_idx);
         }
@@ -628,5 +988,34 @@ void hba_init(){
     /* bug 调试记录 */
     /* 使用 MSI 中断的设备不需要再使用 install_int 在 ioapic 中配置中断!!! */
     /* 中断向量已经在 pci配置空间中写好了！直接由 lapic 收集！ */
-    install_MSI_int(hba->dev_info, HBA_MSI_VECTOR, hba_handler);
-}
\ No newline at end of file
+    if (install_MSI_int(hba->dev_info, HBA_MSI_VECTOR, hba_handler) != EOF){
+        hba->int_mode = HBA_INT_MSI;
+    }
+    /* 不支持 MSI 时退回到传统中断引脚，经过 ioapic 转发
+     * PCI 中断是电平触发的，qemu 的 PCI 中断线为高电平有效 */
+    else if (install_INTx_int(hba->dev_info, 0, __IOREDTBL_TRIGGER_MODE, hba_handler) != EOF){
+        hba->int_mode = HBA_INT_INTX;
+    }
+    else{
+        printk(HBA_WARNING_INFO "no interrupt available, polling\n");
+        return;
+    }
+
+    /* 磁盘初始化期间产生的中断状态全部丢弃，之后才打开 hba 全局中断 */
+    bool IF_stat = get_and_disable_IF();
+
+    for (ListNode_t *node = hba->devices->end.next; node != &hba->devices->end; node = node->next)
+        ((hba_dev_t *)node->owner)->port->reg_base[REG_IDX(HBA_PORT_PxIS)] = -1;
+    hba->io_base[REG_IDX(HBA_REG_IS)] = -1;
+    hba->io_base[REG_IDX(HBA_REG_GHC)] |= HBA_GHC_IE;
+    hba->int_enabled = true;
+
+    set_IF(IF_stat);
+
+    printk(HBA_LOG_INFO "interrupt mode %s\n", hba->int_mode == HBA_INT_MSI ? "MSI" : "INTx");
+
+    ATOMIC_OPS(task_create(hba_watchdog, NULL, "hba_watchdog", BLK_DISPATCH_PRIORITY, KERNEL_UID););
+
+    if (HBA_CCC_COMPLETIONS && !hba_set_ccc(HBA_CCC_COMPLETIONS, HBA_CCC_TIMEOUT))
+        printk(HBA_WARNING_INFO "command completion coalescing is not supported\n");
+}
@@ -200,11 +200,28 @@ int install_MSI_int(pci_device_t *pci_dev, u8 vector, handler_t handler){
     return __device_MSI_init(pci_dev, vector);
 }
 
-void install_MSI_X_int(pci_device_t *dev, u8 used_bar,
+/* 使用 PCI 设备的传统中断引脚，中断线由 BIOS 分配，需要在 ioapic 中配置
+ * 返回中断线，设备没有连接中断引脚时返回 EOF */
+int install_INTx_int(pci_device_t *pci_dev, u8 dest, u32 flag, handler_t handler){
+    int line = __device_INTx_init(pci_dev);
+
+    if (line == EOF || line >= IOAPIC_IRQ_NUM)
+        return EOF;
+
+    install_int(line, dest, flag, handler);
+    return line;
+}
+
+/* MSI-X 中每个表项一个向量，vec_array[i] 对应表项 i，由 handler_array[i] 处理
+ * 设备不支持 MSI-X 时返回 EOF */
+int install_MSI_X_int(pci_device_t *dev, u8 used_bar,
                         void *mapped_addr, u8 *vec_array,
-                        size_t arr_sizec, handler_t *handler_array)
+                        size_t arr_size, handler_t *handler_array)
 {
+    for (size_t i = 0; i < arr_size; ++i)
+        interrupt_func_table[vec_array[i]] = handler_array[i];
 
+    return __device_MSI_X_init(dev, used_bar, mapped_addr, vec_array, arr_size) ? 0 : EOF;
 }
 
 void set_int_mask(u32 irq, bool enable){
@@ -9,6 +9,8 @@
 #include <common/assert.h>
 #include <common/console.h>
 #include <rdix/device.h>
+#include <rdix/wait.h>
+#include <rdix/workqueue.h>
 
 #define KEYBOARD_DATA_POAT 0x60
 #define KETBOARD_CTRL_POAT 0x64
@@ -19,10 +21,14 @@
 
 #define KEY_BUF_SIZE 256
 
-List_t *waiter;
+wait_queue_t key_wait;
 que_char_t *key_buf;
 mutex_t *lock;
 
+/* 中断中只读取扫描码，解码放到下半部 */
+static que_char_t *scan_buf;
+static work_t keyboard_work;
+
 //扫描码
 typedef enum
 {
@@ -241,15 +247,13 @@ static char keymap[][4] = {
 static bool capslock_state; //大写锁定
 static bool extcode_state; //扩展码状态
 
-void keyboard_hander(u32 int_num, u32 code){
-    //printk("in int [%x]\n", int_num);
-    u32 scancode = port_inb(KEYBOARD_DATA_POAT);
+static void keyboard_decode(u8 scancode){
     /* ext 表示按下的是否为扩展的扫描码 */
     u8 ext = 2;
     
     if (scancode == 0xe0){
         extcode_state = true;
-        goto End;
+        return;
     }
 
     if (extcode_state){
@@ -258,13 +262,13 @@ void keyboard_hander(u32 int_num, u32 code){
     }
 
     if ((scancode & 0x7f) > KEY_PRINT_SCREEN){
-        goto End;
+        return;
     }
 
     /* 断码，第 8 位必为 1 */
     if ((scancode & 0x80) != 0){
         keymap[scancode & 0x7f][ext] = false;
-        goto End;
+        return;
     }
 
     keymap[scancode][ext] = true;
@@ -279,7 +283,7 @@ void keyboard_hander(u32 int_num, u32 code){
 
             default: break;
         }
-        goto End;
+        return;
     }
 
     if (scancode == KEY_CAPSLOCK){
@@ -291,15 +295,44 @@ void keyboard_hander(u32 int_num, u32 code){
 
     char ch = keymap[scancode][shift];
 
-    if (ch == INV)  goto End;
+    if (ch == INV)  return;
+
+    /* keyboard_read 在关中断下出队 */
+    bool IF_stat = get_and_disable_IF();
+
+    if (!que_isfull(key_buf))
+        que_push(key_buf, ch);
+
+    set_IF(IF_stat);
+
+    wake_up_one(&key_wait);
+}
+
+/* 下半部，在工作线程中开中断执行 */
+static void keyboard_bottom_half(void *data){
+    while (true){
+        bool IF_stat = get_and_disable_IF();
+        bool empty = que_isempty(scan_buf);
+        u8 scancode = empty ? 0 : que_pop(scan_buf);
+
+        set_IF(IF_stat);
+
+        if (empty)
+            break;
+
+        keyboard_decode(scancode);
+    }
+}
+
+void keyboard_hander(u32 int_num, u32 code){
+    u8 scancode = port_inb(KEYBOARD_DATA_POAT);
+
+    /* 缓冲区满时丢弃，解码线程跟不上时不能阻塞中断 */
+    if (!que_isfull(scan_buf))
+        que_push(scan_buf, scancode);
 
-    assert(!que_isfull(key_buf));
-    que_push(key_buf, ch);
+    schedule_work(&keyboard_work);
 
-    /* 不能放在 End 之后 */
-    if (!list_isempty(waiter))
-        unblock(waiter->end.next);
-End:
     lapic_send_eoi();
 }
 
@@ -308,8 +341,7 @@ static size_t keyboard_read(void *dev, char *buf, size_t count){
     mutex_lock(lock);
     
     for (int i = 0; i < count; ++i){
-        if (que_isempty(key_buf))
-            block(waiter, NULL, TASK_BLOCKED);
+        wait_event(&key_wait, !que_isempty(key_buf));
 
         /* 在 que_pop 的过程中操作了 key_buf
         * 而在键盘中断函数中也可能操作该全局变量
@@ -332,8 +364,11 @@ void keyboard_init(){
     extcode_state = false;
 
     key_buf = new_char_que(KEY_BUF_SIZE);
-    waiter = new_list();
+    scan_buf = new_char_que(KEY_BUF_SIZE);
+    wait_queue_init(&key_wait);
+    work_init(&keyboard_work, keyboard_bottom_half, NULL);
     lock = new_mutex();
+    mutex_set_name(lock, "keyboard");
     
     device_install(DEV_CHAR, DEV_KEYBOARD, NULL, "keyboard", 0,
                 NULL, keyboard_read, NULL);
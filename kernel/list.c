@@ -125,6 +125,7 @@ ListNode_t *search_node(List_t * list, u32 value){
     while (ans != &list->end){
         if (ans->value == value)
             return ans;
+        ans = ans->next;
     }
 
     return NULL;
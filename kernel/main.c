@@ -13,8 +13,16 @@
 #include <common/stdio.h>
 #include <rdix/pci.h>
 #include <rdix/hba.h>
+#include <rdix/virtio.h>
+#include <rdix/ramdisk.h>
 #include <rdix/hardware.h>
 #include <rdix/device.h>
+#include <rdix/vdso.h>
+#include <rdix/fpu.h>
+#include <rdix/futex.h>
+#include <rdix/workqueue.h>
+#include <rdix/serial.h>
+#include <rdix/shm.h>
 #include <fs/fs.h>
 
 //#define SYS_LOG_INFO "\033[1;35;40][system info]\033[0]\t"
@@ -29,6 +37,7 @@ void xhc_init();
 void kernel_init(u32 magic, u32 info){
     device_init();
     console_init();
+    serial_init();
     /* printk("%x\n", *(u32*)info);
     while(true); */
     if (magic == RDIX_MAGIC)
@@ -42,22 +51,29 @@ void kernel_init(u32 magic, u32 info){
      * 结构体很有可能存在于后 2G 的物理地址。
      * acpi_init 只要记录需要用到的寄存器物理地址就行了 */
     acpi_init();
+    /* grub 载入的模块可能会被物理内存管理表覆盖，需要在内存初始化之前复制到 ramdisk 中 */
+    ramdisk_boot(magic, info);
     mem_pg_init(magic,info);
+    vdso_init();
     interrupt_init();
+    fpu_init();
+    futex_init();
+    shm_init();
     
     task_init();
+    workqueue_init();
     PCI_init();
     syscall_init();
 
     /* pci 设备的初始化可以做一个统一 */
     //hba_init();
     xhc_init();
+    virtio_blk_init();
+    ramdisk_init();
 
     //buffer_init();
     //minix_init();
-    /* 初始化完成后再启用 PCI 设备的总中断，开启总中断后就会积累中断 */
-    //hba->io_base[REG_IDX(HBA_REG_GHC)] |= HBA_GHC_IE;
-    // todo: 如果不存在 hba 设备，这里就会发生错误
+    /* hba 的总中断在 hba_init 安装好中断之后由它自己开启 */
     /* 开启外中断后才会进行调度 */
     set_IF(true);
 
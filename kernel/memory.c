@@ -6,6 +6,8 @@
 #include <common/assert.h>
 #include <rdix/task.h>
 #include <common/interrupt.h>
+#include <rdix/vma.h>
+#include <rdix/shm.h>
 
 #define MEMORY_LOG_INFO __LOG("[memory info]")
 
@@ -74,6 +76,30 @@ static void free_p_page(page_idx_t idx){
     assert(free_pages > 0 && free_pages < total_pages);
 }
 
+MTAG_t *multiboot2_find_tag(u32 info, u32 type){
+    /* multiboot 提供的 boot infomation */
+    MFI_t *boot_info = (MFI_t *)info;
+
+    /*=======================================================
+     * bug 调试记录
+     * (boot_info + 8) 得到的地址并不是 boot_info 的值加上 8
+     * 而是 (boot_info + 8 * sizeof(typeof(boot_info)))
+     *=======================================================*/
+    /* 跳过 boot infomation 前面的固定选项部分，选择 tag */
+    MTAG_t *tag = (MTAG_t *)(info + sizeof(MFI_t));
+
+    while ((u32)tag < info + boot_info->total_size && tag->type != MULTIBOOT_INFO_TYPE_END){
+        if (tag->type == type)
+            return tag;
+        /* 这里 tag.size 不是 8 字节对齐的，比如可能值是 12，具体参考手册
+         * 但是 tag 结构体都是 8 字节对齐的，所以 tag.size 应当是 8 的倍数
+         * 所以做了对齐处理 */
+        tag = (MTAG_t *)((u32)tag + ((tag->size + 7) & ~7));
+    }
+
+    return NULL;
+}
+
 /* info 为指向 int 0x15 返回的内存检测结果的指针 */
 static void memory_init(u32 magic, u32 info){
     /* 初始值为 0 的全局变量和未初始化的全局变量是一样的，都是放在 bss 段。值都是随机的
@@ -119,26 +145,11 @@ static void memory_init(u32 magic, u32 info){
     else if (magic == MULTIBOOT_OS_MAGIC){
         printk(MEMORY_LOG_INFO "Meminfo from MULTIBOOT\n");
 
-        /* multiboot 提供的 boot infomation */
-        MFI_t *boot_info = (MFI_t *)info;
-        
-        /*=======================================================
-         * bug 调试记录
-         * (boot_info + 8) 得到的地址并不是 boot_info 的值加上 8
-         * 而是 (boot_info + 8 * sizeof(typeof(boot_info)))
-         *=======================================================*/
-        /* 跳过 boot infomation 前面的固定选项部分，选择 tag */
-        MAP_TAG_t *map_tag = (MAP_TAG_t *)(info + sizeof(MFI_t));
-
         /* 在整个 boot infomation 中寻找 memory map 类型的 tag */
-        while (map_tag->general.type != MEM_MAP_TYPE && map_tag->general.type != 0)
-            /* 这里 tag.size 不是 8 字节对齐的，比如可能值是 12，具体参考手册
-             * 但是 tag 结构体都是 8 字节对齐的，所以 tag.size 应当是 8 的倍数
-             * 所以做了对齐处理 */
-            map_tag = (MAP_TAG_t *)((u32)map_tag + ((map_tag->general.size + 7) & ~7));
-        
+        MAP_TAG_t *map_tag = (MAP_TAG_t *)multiboot2_find_tag(info, MEM_MAP_TYPE);
+
         /* 没找到 */
-        if ((u32)map_tag >= (u32)boot_info + boot_info->total_size || map_tag->general.type == 0){
+        if (map_tag == NULL){
             PANIC("Boot infomation error\n");
         }
 
@@ -390,6 +401,49 @@ void link_page(u32 vaddr){
     DEBUGK("link:paddr = 0x%p, vaddr = 0x%p\n", paddr, vaddr);
 }
 
+phy_addr_t alloc_zero_page(){
+    phy_addr_t paddr = get_p_page();
+    page_entry_t *entry = PTE_L_ADDR(0);
+
+    /* 和 copy_phy_page 一样临时借用 0 地址访问这一物理页 */
+    entry_init(entry, PAGE_IDX((u32)paddr));
+    flush_tlb(0);
+    memset((void *)0, 0, PAGE_SIZE);
+
+    entry->present = false;
+    flush_tlb(0);
+
+    return paddr;
+}
+
+void page_ref(page_idx_t idx){
+    assert(idx >= start_available_p_page_idx && idx < total_pages);
+
+    bool state = get_and_disable_IF();
+
+    assert(p_bit_map[idx] > 0 && p_bit_map[idx] < 255);
+    ++p_bit_map[idx];
+
+    set_IF(state);
+}
+
+void page_unref(page_idx_t idx){
+    free_p_page(idx);
+}
+
+void link_shared_page(u32 vaddr, page_idx_t idx, u32 bits){
+    page_entry_t *pte = get_pte(vaddr, false);
+    page_entry_t *entry = &pte[TIDX(vaddr)];
+
+    assert(!entry->present);
+
+    page_ref(idx);
+    entry_init(entry, idx);
+    entry->ignored = bits;
+
+    flush_tlb(vaddr);
+}
+
 void unlink_page(u32 vaddr){
     page_entry_t *pte = get_pte(vaddr, true);
     page_entry_t *entry = &pte[TIDX(vaddr)];
@@ -408,6 +462,23 @@ void unlink_page(u32 vaddr){
     DEBUGK("unlink:paddr = 0x%p, vaddr = 0x%p\n", PAGE_ADDR(pidx), vaddr);
 }
 
+/* 释放当前任务从 vaddr 开始 count 页的虚拟内存
+ * 已经建立映射的页一并解除映射，还没有页表的区域直接跳过 */
+void free_user_range(u32 vaddr, u32 count){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+    page_entry_t *pde = PDE_L_ADDR;
+
+    for (u32 i = 0; i < count; ++i, vaddr += PAGE_SIZE){
+        bitmap_set(task->vmap, PAGE_IDX(vaddr), false);
+
+        if (!pde[DIDX(vaddr)].present)
+            continue;
+
+        if (PTE_L_ADDR(vaddr)[TIDX(vaddr)].present)
+            unlink_page(vaddr);
+    }
+}
+
 phy_addr_t get_phy_addr(vir_addr_t vaddr){
     page_entry_t *pte = get_pte(vaddr, true);
     page_entry_t *entry = &pte[TIDX((u32)vaddr)];
@@ -441,6 +512,16 @@ phy_addr_t copy_phy_page(vir_addr_t page){
 }
 
 /* pde 实在内核内存中申请的，所以获得的 pde 虚拟地址等于其物理地址 */
+/* 新建只有内核映射的页目录，exec 用它替换原来的地址空间 */
+page_entry_t *alloc_pde(){
+    page_entry_t *pde = (page_entry_t *)alloc_kpage(1);
+    memcpy((void *)pde, (void *)kernel_page_dir, PAGE_SIZE);
+
+    entry_init(&pde[1023], PAGE_IDX((u32)pde));
+
+    return pde;
+}
+
 page_entry_t *copy_pde(){
     TCB_t *task = (TCB_t *)current_task()->owner;
     page_entry_t *pde = (page_entry_t *)alloc_kpage(1);
@@ -453,6 +534,12 @@ page_entry_t *copy_pde(){
         page_entry_t *dentry = &pde[didx];
         if (!dentry->present)
             continue;
+
+        /* 内核数据页由 vdso_map 为子进程单独建立 */
+        if (didx == DIDX(VDSO_START)){
+            dentry->present = false;
+            continue;
+        }
         
         /* 页目录中第 didx 项对应的页表地址 */
         page_entry_t *pte = (page_entry_t *)(0xffc00000 | (didx << 12));
@@ -464,7 +551,12 @@ page_entry_t *copy_pde(){
                 continue;
 
             assert(0 < p_bit_map[entry->index] < 255);
-            entry->write = false;
+
+            /* 共享内存页在父子进程间继续共享，其余的页写时复制 */
+            if (entry->ignored & PTE_SHARED)
+                shm_page_dup(entry);
+            else
+                entry->write = false;
             ++p_bit_map[entry->index];
         }
 
@@ -497,6 +589,12 @@ void free_pde(){
             continue;
         }
 
+        /* 内核数据页由 vdso_unmap 释放 */
+        if (didx == DIDX(VDSO_START))
+        {
+            continue;
+        }
+
         page_entry_t *pte = (page_entry_t *)(0xffc00000 | (didx << 12));
 
         for (size_t tidx = 0; tidx < 1024; tidx++)
@@ -508,6 +606,8 @@ void free_pde(){
             }
 
             assert(p_bit_map[entry->index] > 0);
+            if (entry->ignored & PTE_SHARED)
+                shm_page_release(entry);
             free_p_page(entry->index);
         }
 
@@ -521,7 +621,7 @@ void free_pde(){
 }
 
 int32 sys_brk(vir_addr_t vaddr){
-    TCB_t *task = (TCB_t *)current_task()->owner;
+    TCB_t *task = current_leader();
     u32 brk = (u32)vaddr;
 
     assert(KERNEL_MEMERY_SIZE < brk < (USER_STACK_BOTTOM - PAGE_SIZE));
@@ -543,6 +643,44 @@ int32 sys_brk(vir_addr_t vaddr){
 #define PAGE_LOG_INFO __LOG("[page info]")
 #define PAGE_ERROR_INFO __ERROR("[page error]")
 
+/* 写时复制，vaddr 所在页已经映射但只读 */
+static void copy_on_write(u32 vaddr){
+    page_entry_t *pte = get_pte(vaddr, true);
+    page_entry_t *entry = &pte[TIDX(vaddr)];
+
+    assert(p_bit_map[entry->index] > 0);
+    if (p_bit_map[entry->index] == 1){
+        entry->write = true;
+        flush_tlb(vaddr);
+        printk(PAGE_LOG_INFO "WRITE page for 0x%p\n", vaddr);
+    }
+    else{
+        --p_bit_map[entry->index];
+
+        phy_addr_t paddr = copy_phy_page(vaddr & 0xfffff000);
+        entry_init(entry, PAGE_IDX((u32)paddr));
+        flush_tlb(vaddr);
+
+        printk(PAGE_LOG_INFO "COPY page for 0x%p, phy page 0x%p\n", vaddr, paddr);
+    }
+}
+
+/* 内核没有开启 CR0.WP，内核写只读的用户页不会触发写时复制
+ * 需要按物理地址区分用户内存的地方（如 futex）先调用这里
+ * 保证 vaddr 所在页已经映射，并且不再与其他进程写时共享，返回 vaddr 的物理地址 */
+phy_addr_t user_page_private(u32 vaddr){
+    page_entry_t *entry;
+
+    /* 读一次，还没有映射时由缺页中断建立映射 */
+    (void)*(volatile u8 *)vaddr;
+
+    entry = &get_pte(vaddr, true)[TIDX(vaddr)];
+    if (!entry->write)
+        copy_on_write(vaddr);
+
+    return (phy_addr_t)(PAGE_ADDR(entry->index) + (vaddr & 0xfff));
+}
+
 void page_fault(
     u32 int_num, u32 code,
     u32 edi, u32 esi, u32 ebp, u32 esp,
@@ -560,6 +698,8 @@ void page_fault(
         */  
         u32 vaddr = get_cr2();
 
+        ++((TCB_t *)current_task()->owner)->page_faults;
+
         printk(PAGE_LOG_INFO "in page fault : vaddr = 0x%p\n", vaddr);
 
         if (vaddr < 0x1000){
@@ -578,34 +718,21 @@ void page_fault(
             goto ERROR;
         }
 
-        if(vaddr >= ((TCB_t *)current_task()->owner)->brk && vaddr < USER_STACK_BOTTOM){
+        /* brk 之上只有线程栈是合法的，线程栈在 vmap 中已经申请 */
+        if(vaddr >= current_leader()->brk && vaddr < USER_STACK_BOTTOM &&
+            !bitmap_test(((TCB_t *)current_task()->owner)->vmap, PAGE_IDX(vaddr))){
             printk(PAGE_ERROR_INFO "out of brk\n");
             goto ERROR;
         }
         
         if (!error.present){
-            link_page(vaddr);
+            /* exec 装入的程序段从文件中读取，其余的页直接分配 */
+            if (!vma_fault(vaddr))
+                link_page(vaddr);
             return;
         }
         else if(error.write){
-            page_entry_t *pte = get_pte(vaddr, true);
-            page_entry_t *entry = &pte[TIDX(vaddr)];
-
-            assert(p_bit_map[entry->index] > 0);
-            if (p_bit_map[entry->index] == 1){
-                entry->write = true;
-                printk(PAGE_LOG_INFO "WRITE page for 0x%p\n", vaddr);
-            }
-            else{
-                --p_bit_map[entry->index];
-
-                phy_addr_t paddr = copy_phy_page(vaddr & 0xfffff000);
-                entry_init(entry, PAGE_IDX((u32)paddr));
-                flush_tlb(vaddr);
-
-                printk(PAGE_LOG_INFO "COPY page for 0x%p, phy page 0x%p\n", vaddr, paddr);
-            }
-
+            copy_on_write(vaddr);
             return;
         }
 ERROR:
@@ -2,11 +2,36 @@
 #include <common/assert.h>
 #include <rdix/kernel.h>
 #include <rdix/task.h>
+#include <rdix/hardware.h>
 #include <common/interrupt.h>
+#include <common/string.h>
+
+extern List_t *ready_list;
+
+#ifdef MUTEX_STAT
+/* 所有锁的链表，只用于输出统计信息 */
+static List_t mutex_all;
+#endif
 
 void mutex_init(mutex_t *mutex){
     mutex->value = 1;
     mutex->waiter = new_list();
+    mutex->owner = NULL;
+    node_init(&mutex->held, mutex, 0);
+
+#ifdef MUTEX_STAT
+    bool IF_stat = get_and_disable_IF();
+
+    if (mutex_all.end.container == NULL)
+        list_init(&mutex_all);
+
+    mutex->name = NULL;
+    memset(&mutex->stat, 0, sizeof(mutex_stat_t));
+    node_init(&mutex->all, mutex, 0);
+    list_push(&mutex_all, &mutex->all);
+
+    set_IF(IF_stat);
+#endif
 }
 
 mutex_t *new_mutex(){
@@ -17,30 +42,199 @@ mutex_t *new_mutex(){
     return mutex;
 }
 
+void mutex_set_name(mutex_t *mutex, const char *name){
+#ifdef MUTEX_STAT
+    mutex->name = name;
+#endif
+}
+
 /* 上锁时返回 true */
 bool test_lock(mutex_t *mutex){
     return !(mutex->value);
 }
 
+/* 等待者中的最高优先级 */
+static u32 waiter_priority(mutex_t *mutex){
+    List_t *list = mutex->waiter;
+    u32 prio = 0;
+
+    for (ListNode_t *iter = list->end.next; iter != &list->end; iter = iter->next){
+        TCB_t *task = (TCB_t *)iter->owner;
+
+        if (task->priority > prio)
+            prio = task->priority;
+    }
+    return prio;
+}
+
+/* 任务的优先级为基础优先级与它持有的所有锁上等待者优先级中的最大值 */
+static void task_update_priority(TCB_t *task){
+    u32 prio = task->base_priority;
+
+    for (ListNode_t *iter = task->mutexes.end.next; iter != &task->mutexes.end; iter = iter->next){
+        u32 wprio = waiter_priority((mutex_t *)iter->owner);
+
+        if (wprio > prio)
+            prio = wprio;
+    }
+    task->priority = prio;
+}
+
+/* 优先级继承，沿着等待链把 prio 传给每一个持有者
+ * 调度器按就绪队列排队，优先级只决定时间片长度
+ * 所以除了提升优先级，还把就绪的持有者移到就绪队列尾部，下一次调度时立即运行 */
+static void priority_inherit(mutex_t *mutex, u32 prio){
+    while (mutex != NULL && mutex->owner != NULL){
+        ListNode_t *node = mutex->owner;
+        TCB_t *owner = (TCB_t *)node->owner;
+
+        if (owner->priority >= prio)
+            break;
+
+        owner->priority = prio;
+        if (owner->ticks < prio)
+            owner->ticks = prio;
+
+        if (owner->state == TASK_READY){
+            remove_node(node);
+            list_pushback(ready_list, node);
+        }
+
+        mutex = owner->blocked_on;
+    }
+}
+
+/* 持有者被抢占时让出 cpu 等它释放锁，单处理器上自旋没有意义
+ * 持有者阻塞或睡眠时让出也等不到，直接返回 */
+static bool mutex_yield_wait(mutex_t *mutex){
+    for (int i = 0; i < MUTEX_YIELD_MAX; ++i){
+        ListNode_t *node = mutex->owner;
+
+        if (node == NULL || ((TCB_t *)node->owner)->state != TASK_READY)
+            break;
+
+        remove_node(node);
+        list_pushback(ready_list, node);
+        schedule();
+
+        if (mutex->value && !mutex->waiter->number_of_node)
+            return true;
+    }
+    return false;
+}
+
 void mutex_lock(mutex_t *mutex){
     assert(mutex);
 
-    ATOMIC_OPS(
-        if (mutex->value && !mutex->waiter->number_of_node) \
-            mutex->value = 0; \
-        else \
-            block(mutex->waiter, NULL, TASK_BLOCKED);
-    );
+    bool IF_stat = get_and_disable_IF();
+    ListNode_t *current = current_task();
+    TCB_t *task = (TCB_t *)current->owner;
+
+    if (!mutex->value || mutex->waiter->number_of_node){
+#ifdef MUTEX_STAT
+        ++mutex->stat.contended;
+#endif
+        if (mutex_yield_wait(mutex)){
+#ifdef MUTEX_STAT
+            ++mutex->stat.yielded;
+#endif
+            goto TAKE;
+        }
+
+        task->blocked_on = mutex;
+        priority_inherit(mutex, task->priority);
+        block(mutex->waiter, NULL, TASK_BLOCKED);
+        task->blocked_on = NULL;
+
+        /* 解锁时直接把锁交给了被唤醒的任务 */
+        assert(mutex->owner == current);
+        goto ACQUIRED;
+    }
+
+TAKE:
+    mutex->value = 0;
+    mutex->owner = current;
+    list_push(&task->mutexes, &mutex->held);
+
+ACQUIRED:
+#ifdef MUTEX_STAT
+    ++mutex->stat.acquired;
+    mutex->stat.stamp = rdtsc();
+#endif
+    set_IF(IF_stat);
 }
 
 void mutex_unlock(mutex_t *mutex){
     assert(mutex);
 
-    ATOMIC_OPS(
-        if (!mutex->waiter->number_of_node) \
-            mutex->value = 1; \
-        else{ \
-            unblock(mutex->waiter->end.previous); \
+    bool IF_stat = get_and_disable_IF();
+    ListNode_t *node = mutex->owner;
+
+    assert(node != NULL);
+
+#ifdef MUTEX_STAT
+    u32 hold = (u32)(rdtsc() - mutex->stat.stamp);
+
+    if (hold > mutex->stat.max_hold)
+        mutex->stat.max_hold = hold;
+#endif
+
+    remove_node(&mutex->held);
+
+    if (!mutex->waiter->number_of_node){
+        mutex->value = 1;
+        mutex->owner = NULL;
+    }
+    else{
+        /* 唤醒优先级最高的等待者，同优先级时唤醒等待最久的 */
+        List_t *list = mutex->waiter;
+        ListNode_t *next = list->end.previous;
+
+        for (ListNode_t *iter = next->previous; iter != &list->end; iter = iter->previous){
+            if (((TCB_t *)iter->owner)->priority > ((TCB_t *)next->owner)->priority)
+                next = iter;
         }
-    );
-}
\ No newline at end of file
+
+        mutex->owner = next;
+        list_push(&((TCB_t *)next->owner)->mutexes, &mutex->held);
+        unblock(next);
+
+        /* 新的持有者继承剩余等待者的优先级 */
+        priority_inherit(mutex, waiter_priority(mutex));
+    }
+
+    /* 可能不是持有者本身解锁，恢复的是原持有者的优先级 */
+    task_update_priority((TCB_t *)node->owner);
+
+    set_IF(IF_stat);
+}
+
+void sys_lockstat(bool reset){
+#ifdef MUTEX_STAT
+    bool IF_stat = get_and_disable_IF();
+
+    printk("%-12s %-10s %10s %10s %10s %10s\n",
+            "name", "addr", "acquired", "contended", "yielded", "max hold");
+
+    for (ListNode_t *iter = mutex_all.end.next; iter != &mutex_all.end; iter = iter->next){
+        mutex_t *mutex = (mutex_t *)iter->owner;
+        mutex_stat_t *stat = &mutex->stat;
+
+        if (stat->acquired)
+            printk("%-12s 0x%p %10u %10u %10u %10u\n",
+                mutex->name ? mutex->name : "-", mutex,
+                stat->acquired, stat->contended, stat->yielded, stat->max_hold);
+
+        if (reset){
+            stat->acquired = 0;
+            stat->contended = 0;
+            stat->yielded = 0;
+            stat->max_hold = 0;
+        }
+    }
+
+    set_IF(IF_stat);
+#else
+    printk("lock statistics disabled\n");
+#endif
+}
@@ -207,64 +207,77 @@ pci_device_t *get_device_info(u32 dev_cc){
     return NULL;
 }
 
+/* 按厂商号和设备号查找第 idx 个设备 */
+pci_device_t *get_device_by_id(u16 vendor, u16 device_id, u32 idx){
+    for (PCI_bus_t *bus_ptr = bus_list; bus_ptr != NULL; bus_ptr = bus_ptr->next){
+
+        for (ListNode_t *node = bus_ptr->dev_list->end.next; node != &bus_ptr->dev_list->end; node = node->next){
+
+            pci_device_t *device = (pci_device_t *)node->owner;
+
+            if (device->vectorID == vendor && device->deviceID == device_id && idx-- == 0)
+                return device;
+        }
+    }
+
+    return NULL;
+}
+
 /* 返回能力链表指针 */
 cap_p_t capability_search(pci_device_t *dev, u8 cap_id){
-    u8 capabilities = read_register(dev->bus, dev->dev_num, dev->function, PCI_CONFIG_SPACE_CAP_PTR) & 0xff;
+    return capability_search_next(dev, PCI_CAP_END_PTR, cap_id);
+}
+
+/* 从 prev 之后继续查找，prev 为 PCI_CAP_END_PTR 时从头开始，用于同一种能力出现多次的情况 */
+cap_p_t capability_search_next(pci_device_t *dev, cap_p_t prev, u8 cap_id){
+    cap_p_t cap_ptr;
 
-    if (capabilities == PCI_CAP_END_PTR)
-        return PCI_CAP_END_PTR;
+    if (prev == PCI_CAP_END_PTR)
+        cap_ptr = read_register(dev->bus, dev->dev_num, dev->function, PCI_CONFIG_SPACE_CAP_PTR) & 0xff;
+    else
+        cap_ptr = (read_register(dev->bus, dev->dev_num, dev->function, prev) >> 8) & 0xff;
 
-    cap_p_t cap_ptr = capabilities;
-    u32 cap_reg = read_register(dev->bus, dev->dev_num, dev->function, cap_ptr);
+    while (cap_ptr != PCI_CAP_END_PTR){
+        u32 cap_reg = read_register(dev->bus, dev->dev_num, dev->function, cap_ptr);
 
-    while (true){
         if ((cap_reg & 0xff) == cap_id)
             return cap_ptr;
         
         cap_ptr = (cap_reg >> 8) & 0xff;
-
-        if (cap_ptr == PCI_CAP_END_PTR)
-            break;
-        
-        cap_reg = read_register(dev->bus, dev->dev_num, dev->function, cap_ptr);
     }
 
     return PCI_CAP_END_PTR;
 }
 
-/* 初始化 PCI 设备配置空间能力链表中的 MSI 能力 */
+/* 初始化 PCI 设备配置空间能力链表中的 MSI 能力
+ * 设备不支持 MSI 时返回 EOF，此时传统中断引脚保持不变 */
 int __device_MSI_init(pci_device_t *dev, u8 vector){
+    cap_p_t cap_p = capability_search(dev, PCI_CAP_ID_MSI);
+
+    if (cap_p == PCI_CAP_END_PTR)
+        return EOF;
+
     u32 cmd = pci_dev_reg_read(dev, PCI_CONFIG_SPACE_CMD);
     
     /* 要使用 MSI，首先要屏蔽传统中断引脚 */
     cmd |= __PCI_CS_CMD_BUS_INT_DISABLE;
 
     pci_dev_reg_write(dev, PCI_CONFIG_SPACE_CMD, cmd);
-    
-    cap_p_t cap_p = capability_search(dev, PCI_CAP_ID_MSI);
-
-    if (cap_p == PCI_CAP_END_PTR)
-        return EOF;
 
     u32 reg = pci_dev_reg_read(dev, cap_p);
 
     assert((reg & 0xff) == PCI_CAP_ID_MSI);
-    /* 启用 MSI */
-    reg |= (1 << 16);
-    pci_dev_reg_write(dev, cap_p, reg);
-    
-    //printk(PCI_LOG_INFO "reg %x\n", reg);
 
     u8 msg_data_p = cap_p;
     u8 msg_addr_p = cap_p + 0x4;
     u8 mask_bit_map = cap_p + 0xc;
     /* 检测是否支持 64 位 */
     if (reg & (1 << 23)){
-        /* 支持 64位 */
+        /* 支持 64位，高 32 位地址紧跟在低 32 位之后 */
         msg_data_p += 0xc;
         mask_bit_map += 0x4;
 
-        pci_dev_reg_write(dev, 0x8, 0);
+        pci_dev_reg_write(dev, msg_addr_p + 0x4, 0);
     }
     else{
         msg_data_p += 0x8;
@@ -273,25 +286,44 @@ int __device_MSI_init(pci_device_t *dev, u8 vector){
     /* 支持 mask */
     if ((reg >> 24) & 1)
         pci_dev_reg_write(dev, mask_bit_map, 0);
-    
+
+    /* edge, fixed，message data 只占低 16 位，高 16 位保留 */
     u32 msg_data = pci_dev_reg_read(dev, msg_data_p);
-    
-    //printk(PCI_LOG_INFO "msg_data %x\n", msg_data);
 
-    /* edge, fixed */
-    msg_data = vector;
+    msg_data = (msg_data & 0xffff0000) | vector;
 
     u32 msg_addr = 0xfee00000;
 
+    pci_dev_reg_write(dev, msg_addr_p, msg_addr);
     pci_dev_reg_write(dev, msg_data_p, msg_data);
 
-    pci_dev_reg_write(dev, msg_addr_p, msg_addr);
+    /* 地址和数据都写好之后才能启用 MSI，否则设备可能向错误的地址发送消息
+     * 只使用一个向量，multiple message enable 置 0 */
+    reg &= ~(0x7 << 20);
+    reg |= (1 << 16);
+    pci_dev_reg_write(dev, cap_p, reg);
 
     printk(PCI_LOG_INFO "MSI init success\n");
     return 0;
 }
 
-u64 *debug_pba = 1;
+/* 使用传统中断引脚（INTx），返回 BIOS 分配的中断线，没有分配时返回 EOF */
+int __device_INTx_init(pci_device_t *dev){
+    u8 line = pci_dev_reg_read(dev, PCI_CONFIG_SPACE_INT) & 0xff;
+    u8 pin = (pci_dev_reg_read(dev, PCI_CONFIG_SPACE_INT) >> 8) & 0xff;
+
+    /* pin 为 0 表示设备不使用中断引脚，line 为 0xff 表示没有连接 */
+    if (pin == 0 || line == 0xff)
+        return EOF;
+
+    u32 cmd = pci_dev_reg_read(dev, PCI_CONFIG_SPACE_CMD);
+
+    cmd &= ~__PCI_CS_CMD_BUS_INT_DISABLE;
+    pci_dev_reg_write(dev, PCI_CONFIG_SPACE_CMD, cmd);
+
+    printk(PCI_LOG_INFO "INTx init success, line %d\n", line);
+    return line;
+}
 
 /* 配置 MSI-X capability，used_bar 代表已经映射过的 bar，防止重复映射
  * mapped addr 对应used_bar映射到的虚拟地址
@@ -313,14 +345,9 @@ MSI_X_TABLE_ENTRY *__device_MSI_X_init(pci_device_t *dev, u8 used_bar, void *map
 
     u32 reg1 = pci_dev_reg_read(dev, cap_p);
     u32 reg2 = pci_dev_reg_read(dev, cap_p + 4);
-    u32 reg3 = pci_dev_reg_read(dev, cap_p + 8);
-
-    printk(PCI_LOG_INFO "MSI-X reg1_%x\n", reg1);
 
     u8 table_bar = reg2 & 7;
-    u8 PBA_bar = reg3 & 7;
     MSI_X_TABLE_ENTRY *table_base = NULL;
-    u64 *PBA_base = NULL;
 
     if (table_bar != used_bar)
         table_base = (MSI_X_TABLE_ENTRY *)link_nppage(dev->BAR[table_bar].base_addr,
@@ -332,17 +359,6 @@ MSI_X_TABLE_ENTRY *__device_MSI_X_init(pci_device_t *dev, u8 used_bar, void *map
     /* 指针不能直接加整型，因为指针指向的数据类型长度会影响相加后的值 */
     table_base = (MSI_X_TABLE_ENTRY *)((u32)table_base + (reg2 & 0xfffffff8));
 
-    if (PBA_bar != used_bar)
-        PBA_base = (u64 *)link_nppage(dev->BAR[PBA_bar].base_addr,
-                                                        dev->BAR[PBA_bar].size);
-    else
-        PBA_base = (u64 *)mapped_addr;
-
-    PBA_base = (u64 *)((u32)PBA_base + (reg3 & 0xfffffff8));
-    printk(PCI_LOG_INFO "PBA_%x\n", *PBA_base);
-    debug_pba = PBA_base;
-    printk(PCI_LOG_INFO "debug_pbab_%x\n", debug_pba);
-
     for (int i = 0; i < arr_size; ++i){
         table_base[i].Msg_Addr = 0xfee00000;
         table_base[i].Msg_Upper_Addr = 0;
@@ -354,10 +370,6 @@ MSI_X_TABLE_ENTRY *__device_MSI_X_init(pci_device_t *dev, u8 used_bar, void *map
     reg1 |= 0x80000000;
     pci_dev_reg_write(dev, cap_p, reg1);
 
-    reg1 = pci_dev_reg_read(dev, cap_p);
-
-    printk(PCI_LOG_INFO "MSI-X reg1b_%x; reg2_%x; reg3_%x\n", reg1, reg2, reg3);
-
     printk(PCI_LOG_INFO "MSI-X initial success\n");
 
     return table_base;
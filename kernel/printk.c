@@ -6,6 +6,7 @@
 #include <rdix/device.h>
 #include <common/string.h>
 #include <common/assert.h>
+#include <rdix/serial.h>
 
 static char buf[1024];
 
@@ -21,6 +22,11 @@ void printk(const char *fmt, ...){
     device_t *dev = device_find(DEV_CONSOLE, 0);
     assert(dev);
     device_write(dev->dev, buf, n, 0, 0);
+
+#ifdef RDIX_BENCH
+    /* 基准测试在没有显示器的 qemu 中运行，输出同时写到串口 */
+    serial_write(buf, n);
+#endif
 }
 
 /* 将模式串输出到指定字符串 dest */
@@ -0,0 +1,181 @@
+#include <rdix/ramdisk.h>
+#include <rdix/multiboot2.h>
+#include <rdix/memory.h>
+#include <rdix/device.h>
+#include <rdix/part.h>
+#include <rdix/kernel.h>
+#include <common/string.h>
+#include <common/assert.h>
+
+#define RAMDISK_LOG_INFO __LOG("[ramdisk]")
+#define RAMDISK_WARNING_INFO __WARNING("[ramdisk warning]")
+
+#define RAMDISK_MAX_SIZE (RAMDISK_M_END - RAMDISK_M_START)
+#define RAMDISK_MAX_KB ((u32)RAMDISK_MAX_SIZE / 1024)
+
+static ramdisk_t ramdisk;
+
+/* 把 ramdisk=<KB> 的值按无符号数解析到 kb 中，太大时饱和为 0xffffffff
+ * 值必须全部是数字，否则返回 EOF */
+static int ramdisk_parse_kb(const char *str, u32 *kb){
+    u32 val = 0;
+
+    if (*str < '0' || *str > '9')
+        return EOF;
+
+    for (; *str >= '0' && *str <= '9'; ++str){
+        if (val > (0xffffffff - 9) / 10)
+            val = 0xffffffff;
+        else
+            val = val * 10 + (*str - '0');
+    }
+
+    if (*str && *str != ' ')
+        return EOF;
+
+    *kb = val;
+    return 0;
+}
+
+/* 从内核命令行中取出 ramdisk=<KB>，单位 KB，没有该参数或者值不合法时返回 EOF */
+static int ramdisk_cmdline_kb(const char *cmdline, u32 *kb){
+    int len = length(RAMDISK_CMDLINE_ARG);
+
+    for (const char *ptr = cmdline; *ptr; ++ptr){
+        if ((ptr == cmdline || ptr[-1] == ' ') && strcmp(ptr, RAMDISK_CMDLINE_ARG, len)){
+            if (ramdisk_parse_kb(ptr + len, kb) == EOF){
+                ramdisk.bad_arg = true;
+                return EOF;
+            }
+            return 0;
+        }
+    }
+    return EOF;
+}
+
+/* grub 可能把模块放在 ramdisk 内存块前面并与之重叠，这时需要从后往前复制 */
+static void ramdisk_move(u8 *dest, const u8 *src, u32 n){
+    if (src >= dest){
+        memcpy(dest, src, n);
+        return;
+    }
+    while (n--)
+        dest[n] = src[n];
+}
+
+void ramdisk_boot(u32 magic, u32 info){
+    u32 size = RAMDISK_MAX_SIZE;
+
+    ramdisk.start = (u8 *)RAMDISK_M_START;
+    ramdisk.loaded = 0;
+    ramdisk.mod_size = 0;
+    ramdisk.requested = 0;
+    ramdisk.bad_arg = false;
+
+    if (magic == MULTIBOOT_OS_MAGIC){
+        STR_TAG_t *cmd = (STR_TAG_t *)multiboot2_find_tag(info, MULTIBOOT_TAG_TYPE_CMDLINE);
+        MOD_TAG_t *mod = (MOD_TAG_t *)multiboot2_find_tag(info, MULTIBOOT_TAG_TYPE_MODULE);
+        u32 kb;
+
+        /* 先按 KB 截断再换算成字节，避免乘法溢出 */
+        if (cmd && ramdisk_cmdline_kb(cmd->string, &kb) != EOF){
+            ramdisk.requested = kb;
+            size = (kb < RAMDISK_MAX_KB ? kb : RAMDISK_MAX_KB) * 1024;
+        }
+
+        /* 明确设置为 0 时不安装 ramdisk，也不载入模块 */
+        if (size == 0){
+            ramdisk.sectors = 0;
+            return;
+        }
+
+        /* 物理内存管理表会放在 1M 位置，grub 往往也把模块放在那里，因此要在 memory_init 之前复制
+         * 模块比命令行要求的大小更大时以模块为准 */
+        if (mod){
+            ramdisk.mod_size = mod->mod_end - mod->mod_start;
+            if (ramdisk.mod_size <= RAMDISK_MAX_SIZE){
+                ramdisk_move(ramdisk.start, (u8 *)mod->mod_start, ramdisk.mod_size);
+                ramdisk.loaded = ramdisk.mod_size;
+                if (size < ramdisk.loaded)
+                    size = ramdisk.loaded;
+            }
+        }
+    }
+
+    ramdisk.sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+static int ramdisk_rw(ramdisk_t *rd, u32 type, void *buf, size_t count, idx_t idx){
+    if (idx >= rd->sectors || count > rd->sectors - idx)
+        return EOF;
+
+    u8 *addr = rd->start + idx * SECTOR_SIZE;
+
+    if (type == REQ_READ)
+        memcpy(buf, addr, count * SECTOR_SIZE);
+    else
+        memcpy(addr, buf, count * SECTOR_SIZE);
+
+    return 0;
+}
+
+static int __ramdisk_read_secs(ramdisk_t *rd, void *buf, size_t count, idx_t idx){
+    return ramdisk_rw(rd, REQ_READ, buf, count, idx);
+}
+
+static int __ramdisk_write_secs(ramdisk_t *rd, void *buf, size_t count, idx_t idx){
+    return ramdisk_rw(rd, REQ_WRITE, buf, count, idx);
+}
+
+/* 块设备层的请求处理函数，调用时中断是关闭的
+ * 每段直接和 ramdisk 内存交换数据，不需要先拼接到临时页中，返回前请求已经结束 */
+static int __ramdisk_request(ramdisk_t *rd, request_t *req){
+    int status = 0;
+
+    for (bio_t *bio = req->bio; bio && status != EOF; bio = bio->next)
+        status = ramdisk_rw(rd, req->type, bio->buf, bio->count, bio->idx);
+    blk_end_request(req, status);
+    return 0;
+}
+
+static int __ramdisk_ioctl(ramdisk_t *rd, int cmd, void *args, int flags){
+    switch (cmd){
+        case DEV_CMD_SECTOR_START: return 0;
+        case DEV_CMD_SECTOR_COUNT: return rd->sectors;
+        case DEV_CMD_QUEUE_DEPTH: return 1;
+        case DEV_ERROR_REPORT:
+            printk(RAMDISK_WARNING_INFO "request out of %d sectors\n", rd->sectors);
+            break;
+        default: printk(RAMDISK_WARNING_INFO "ioctl %d hasn't been implemented\n", cmd);
+                return EOF;
+    }
+
+    return 0;
+}
+
+void ramdisk_init(){
+    if (ramdisk.bad_arg)
+        printk(RAMDISK_WARNING_INFO "invalid " RAMDISK_CMDLINE_ARG " value, using default size\n");
+    if (ramdisk.requested > RAMDISK_MAX_KB)
+        printk(RAMDISK_WARNING_INFO "%u KB requested, limited to %u KB\n",
+               ramdisk.requested, RAMDISK_MAX_KB);
+    if (ramdisk.mod_size > RAMDISK_MAX_SIZE)
+        printk(RAMDISK_WARNING_INFO "module of %d KB is too large, not loaded\n", ramdisk.mod_size / 1024);
+
+    if (ramdisk.sectors == 0)
+        return;
+
+    /* 模块之外的部分清零，没有模块时是一块空盘 */
+    u32 bytes = ramdisk.sectors * SECTOR_SIZE;
+    if (ramdisk.loaded < bytes)
+        memset(ramdisk.start + ramdisk.loaded, 0, bytes - ramdisk.loaded);
+
+    printk(RAMDISK_LOG_INFO "%d KB at %#p, %d bytes from module\n",
+           bytes / 1024, ramdisk.start, ramdisk.loaded);
+
+    dev_t dev_idx = device_install(DEV_BLOCK, DEV_RAMDISK, &ramdisk, RAMDISK_NAME, 0,
+                __ramdisk_ioctl, __ramdisk_read_secs, __ramdisk_write_secs);
+    device_set_request(dev_idx, __ramdisk_request);
+
+    disk_part_install(dev_idx);
+}
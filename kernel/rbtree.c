@@ -0,0 +1,292 @@
+#include <common/rbtree.h>
+#include <common/assert.h>
+
+void rbtree_init(RBTree_t *tree){
+    tree->number_of_node = 0;
+    tree->root = NULL;
+}
+
+void rbnode_init(RBNode_t *node, void *owner, u32 value){
+    node->value = value;
+    node->color = RB_RED;
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+    node->owner = owner;
+}
+
+/* 用 v 替换 u 在父节点中的位置 */
+static void rb_replace(RBTree_t *tree, RBNode_t *u, RBNode_t *v){
+    if (u->parent == NULL)
+        tree->root = v;
+    else if (u == u->parent->left)
+        u->parent->left = v;
+    else
+        u->parent->right = v;
+
+    if (v)
+        v->parent = u->parent;
+}
+
+static void rb_rotate_left(RBTree_t *tree, RBNode_t *x){
+    RBNode_t *y = x->right;
+
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+
+    rb_replace(tree, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void rb_rotate_right(RBTree_t *tree, RBNode_t *x){
+    RBNode_t *y = x->left;
+
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+
+    rb_replace(tree, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+#define IS_RED(node) ((node) && (node)->color == RB_RED)
+
+void rb_insert(RBTree_t *tree, RBNode_t *node){
+    RBNode_t *parent = NULL;
+    RBNode_t **link = &tree->root;
+
+    while (*link){
+        parent = *link;
+        link = node->value < parent->value ? &parent->left : &parent->right;
+    }
+
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+    ++tree->number_of_node;
+
+    /* 父节点为红色时，父节点一定不是根，祖父节点存在 */
+    while (IS_RED(node->parent)){
+        parent = node->parent;
+        RBNode_t *gparent = parent->parent;
+
+        if (parent == gparent->left){
+            RBNode_t *uncle = gparent->right;
+
+            if (IS_RED(uncle)){
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right){
+                rb_rotate_left(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(tree, gparent);
+        }
+        else{
+            RBNode_t *uncle = gparent->left;
+
+            if (IS_RED(uncle)){
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left){
+                rb_rotate_right(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(tree, gparent);
+        }
+    }
+
+    tree->root->color = RB_BLACK;
+}
+
+/* 删除黑色节点后，从 node（可能为 NULL）开始修复少了一个黑色的路径 */
+static void rb_erase_fixup(RBTree_t *tree, RBNode_t *node, RBNode_t *parent){
+    while (node != tree->root && !IS_RED(node)){
+        if (node == parent->left){
+            RBNode_t *sibling = parent->right;
+
+            if (IS_RED(sibling)){
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(tree, parent);
+                sibling = parent->right;
+            }
+            if (!IS_RED(sibling->left) && !IS_RED(sibling->right)){
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!IS_RED(sibling->right)){
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(tree, sibling);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(tree, parent);
+            node = tree->root;
+        }
+        else{
+            RBNode_t *sibling = parent->left;
+
+            if (IS_RED(sibling)){
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(tree, parent);
+                sibling = parent->left;
+            }
+            if (!IS_RED(sibling->left) && !IS_RED(sibling->right)){
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!IS_RED(sibling->left)){
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(tree, sibling);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(tree, parent);
+            node = tree->root;
+        }
+    }
+
+    if (node)
+        node->color = RB_BLACK;
+}
+
+void rb_erase(RBTree_t *tree, RBNode_t *node){
+    RBNode_t *child, *parent;
+    u8 color = node->color;
+
+    assert(tree->number_of_node);
+
+    if (node->left == NULL){
+        child = node->right;
+        parent = node->parent;
+        rb_replace(tree, node, child);
+    }
+    else if (node->right == NULL){
+        child = node->left;
+        parent = node->parent;
+        rb_replace(tree, node, child);
+    }
+    else{
+        /* 用右子树中最小的节点顶替 node */
+        RBNode_t *next = node->right;
+
+        while (next->left)
+            next = next->left;
+
+        color = next->color;
+        child = next->right;
+
+        if (next->parent == node){
+            parent = next;
+        }
+        else{
+            parent = next->parent;
+            rb_replace(tree, next, child);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+
+        rb_replace(tree, node, next);
+        next->left = node->left;
+        next->left->parent = next;
+        next->color = node->color;
+    }
+
+    if (color == RB_BLACK)
+        rb_erase_fixup(tree, child, parent);
+
+    --tree->number_of_node;
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+RBNode_t *rb_first(RBTree_t *tree){
+    RBNode_t *node = tree->root;
+
+    while (node && node->left)
+        node = node->left;
+    return node;
+}
+
+RBNode_t *rb_last(RBTree_t *tree){
+    RBNode_t *node = tree->root;
+
+    while (node && node->right)
+        node = node->right;
+    return node;
+}
+
+RBNode_t *rb_next(RBNode_t *node){
+    if (node->right){
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
+
+RBNode_t *rb_prev(RBNode_t *node){
+    if (node->left){
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->left)
+        node = node->parent;
+    return node->parent;
+}
+
+RBNode_t *rb_lower_bound(RBTree_t *tree, u32 value){
+    RBNode_t *node = tree->root;
+    RBNode_t *ret = NULL;
+
+    while (node){
+        if (node->value >= value){
+            ret = node;
+            node = node->left;
+        }
+        else{
+            node = node->right;
+        }
+    }
+
+    return ret;
+}
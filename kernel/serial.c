@@ -0,0 +1,74 @@
+#include <rdix/serial.h>
+#include <rdix/kernel.h>
+#include <rdix/device.h>
+#include <common/io.h>
+#include <common/interrupt.h>
+
+#define SERIAL_LOG_INFO __LOG("[serial]")
+
+/* 发送保持寄存器一直不空时最多等待的次数，防止没有接线时卡死 */
+#define SERIAL_WAIT_MAX 100000
+
+static bool present;
+
+static void serial_putc(char ch){
+    for (u32 i = 0; i < SERIAL_WAIT_MAX; ++i){
+        if (port_inb(COM1_PORT + UART_LSR) & UART_LSR_THRE)
+            break;
+    }
+    port_outb(COM1_PORT + UART_THR, ch);
+}
+
+void serial_write(const char *buf, u32 count){
+    if (!present)
+        return;
+
+    bool IF_stat = get_and_disable_IF();
+
+    for (u32 i = 0; i < count; ++i){
+        /* 终端需要 \r\n 才会回到行首 */
+        if (buf[i] == '\n')
+            serial_putc('\r');
+        serial_putc(buf[i]);
+    }
+
+    set_IF(IF_stat);
+}
+
+bool serial_present(){
+    return present;
+}
+
+static int serial_dev_write(void *dev, void *buf, size_t count, idx_t idx, int flags){
+    serial_write((const char *)buf, count);
+    return count;
+}
+
+void serial_init(){
+    u16 divisor = SERIAL_BAUD_BASE / SERIAL_BAUD;
+
+    port_outb(COM1_PORT + UART_IER, 0);
+    port_outb(COM1_PORT + UART_LCR, UART_LCR_DLAB);
+    port_outb(COM1_PORT + UART_DLL, divisor & 0xff);
+    port_outb(COM1_PORT + UART_DLH, divisor >> 8);
+    port_outb(COM1_PORT + UART_LCR, UART_LCR_8N1);
+    port_outb(COM1_PORT + UART_FCR, UART_FCR_ENABLE);
+
+    /* 回环模式下写入的数据能读回来说明串口存在 */
+    port_outb(COM1_PORT + UART_MCR, UART_MCR_LOOP);
+    port_outb(COM1_PORT + UART_THR, 0xae);
+    present = port_inb(COM1_PORT + UART_THR) == 0xae;
+
+    port_outb(COM1_PORT + UART_MCR, UART_MCR_NORMAL);
+
+    if (!present){
+        printk(SERIAL_LOG_INFO "com1 not present\n");
+        return;
+    }
+
+    device_install(DEV_CHAR, DEV_SERIAL,
+                NULL, "com1", 0,
+                NULL, NULL, serial_dev_write);
+
+    printk(SERIAL_LOG_INFO "com1 at %d baud\n", SERIAL_BAUD);
+}
@@ -0,0 +1,219 @@
+#include <rdix/shm.h>
+#include <rdix/kernel.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define SHM_LOG_INFO __LOG("[shm]")
+
+extern bitmap_t v_bit_map;
+
+static shm_t shm_table[SHM_NR];
+
+void shm_init(){
+    memset(shm_table, 0, sizeof(shm_table));
+}
+
+static shm_t *shm_get(int32 id){
+    if (id < 0 || id >= SHM_NR || !shm_table[id].used || shm_table[id].destroyed)
+        return NULL;
+    return &shm_table[id];
+}
+
+/* 根据段最后一页的物理页找到共享内存段 */
+static shm_t *shm_find_last(page_idx_t idx){
+    for (int i = 0; i < SHM_NR; ++i){
+        shm_t *shm = &shm_table[i];
+
+        if (shm->used && shm->frames[shm->pages - 1] == idx)
+            return shm;
+    }
+    return NULL;
+}
+
+/* 已经销毁并且没有映射时释放段的描述信息，物理页此时已经全部释放 */
+static void shm_put(shm_t *shm){
+    assert(shm->nattach > 0);
+
+    if (--shm->nattach || !shm->destroyed)
+        return;
+
+    free(shm->frames);
+    memset(shm, 0, sizeof(shm_t));
+}
+
+void shm_page_dup(page_entry_t *entry){
+    if (!(entry->ignored & PTE_SHM_LAST))
+        return;
+
+    shm_t *shm = shm_find_last(entry->index);
+    assert(shm);
+    ++shm->nattach;
+}
+
+void shm_page_release(page_entry_t *entry){
+    if (!(entry->ignored & PTE_SHM_LAST))
+        return;
+
+    shm_t *shm = shm_find_last(entry->index);
+    assert(shm);
+    shm_put(shm);
+}
+
+/* key 相同的段已经存在时直接返回，否则新建 size 字节的段，内容清零 */
+int32 sys_shmget(u32 key, u32 size){
+    u32 pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    int32 id = EOF;
+
+    if (key != SHM_PRIVATE){
+        for (int i = 0; i < SHM_NR; ++i){
+            shm_t *shm = &shm_table[i];
+
+            if (shm->used && !shm->destroyed && shm->key == key)
+                return shm->pages >= pages ? i : EOF;
+        }
+    }
+
+    if (pages == 0 || pages > SHM_PAGES_MAX)
+        return EOF;
+
+    for (int i = 0; i < SHM_NR; ++i){
+        if (!shm_table[i].used){
+            id = i;
+            break;
+        }
+    }
+    if (id == EOF)
+        return EOF;
+
+    shm_t *shm = &shm_table[id];
+
+    shm->used = true;
+    shm->destroyed = false;
+    shm->key = key;
+    shm->pages = pages;
+    shm->nattach = 0;
+    shm->frames = (page_idx_t *)malloc(pages * sizeof(page_idx_t));
+
+    for (u32 i = 0; i < pages; ++i)
+        shm->frames[i] = PAGE_IDX((u32)alloc_zero_page());
+
+    printk(SHM_LOG_INFO "create id %d key %d, %d pages\n", id, key, pages);
+
+    return id;
+}
+
+/* 在共享内存区域中找 pages 个连续的空闲虚拟页 */
+static u32 shm_find_area(bitmap_t *vmap, u32 pages){
+    u32 count = 0;
+
+    for (u32 vaddr = SHM_AREA_BOTTOM; vaddr < SHM_AREA_TOP; vaddr += PAGE_SIZE){
+        if (bitmap_test(vmap, PAGE_IDX(vaddr))){
+            count = 0;
+            continue;
+        }
+        if (++count == pages)
+            return vaddr - (pages - 1) * PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+/* 把 pages 个物理页映射到当前地址空间的共享内存区域中，返回起始地址，失败返回 0
+ * 最后一页的页表项额外带上 last_bits，所有页立即映射，之后的访问不会产生缺页 */
+u32 shm_map(page_idx_t *frames, u32 pages, u32 last_bits){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+
+    if (task->vmap == &v_bit_map)
+        return 0;
+
+    u32 start = shm_find_area(task->vmap, pages);
+    if (start == 0)
+        return 0;
+
+    for (u32 i = 0; i < pages; ++i){
+        u32 vaddr = start + i * PAGE_SIZE;
+        u32 bits = PTE_SHARED;
+
+        if (i == pages - 1)
+            bits |= last_bits;
+
+        bitmap_set(task->vmap, PAGE_IDX(vaddr), true);
+        link_shared_page(vaddr, frames[i], bits);
+    }
+
+    return start;
+}
+
+/* 把共享内存段映射到当前地址空间，返回起始地址，失败返回 NULL */
+void *sys_shmat(int32 id){
+    shm_t *shm = shm_get(id);
+
+    if (shm == NULL)
+        return NULL;
+
+    u32 start = shm_map(shm->frames, shm->pages, PTE_SHM_LAST);
+    if (start == 0)
+        return NULL;
+    ++shm->nattach;
+
+    return (void *)start;
+}
+
+/* addr 必须是 shmat 返回的地址，一直解除映射到段的最后一页 */
+int32 sys_shmdt(void *addr){
+    TCB_t *task = (TCB_t *)current_task()->owner;
+    u32 vaddr = (u32)addr;
+    page_entry_t *pde = PDE_L_ADDR;
+    page_entry_t *entry;
+    shm_t *shm = NULL;
+
+    if ((vaddr & 0xfff) || vaddr < SHM_AREA_BOTTOM || vaddr >= SHM_AREA_TOP || !pde[DIDX(vaddr)].present)
+        return EOF;
+
+    entry = &PTE_L_ADDR(vaddr)[TIDX(vaddr)];
+    if (!entry->present || !(entry->ignored & PTE_SHARED))
+        return EOF;
+
+    /* 起始页必须是某个段的第一页 */
+    for (int i = 0; i < SHM_NR; ++i){
+        if (shm_table[i].used && shm_table[i].frames[0] == entry->index){
+            shm = &shm_table[i];
+            break;
+        }
+    }
+    if (shm == NULL)
+        return EOF;
+
+    for (u32 i = 0; i < shm->pages; ++i, vaddr += PAGE_SIZE){
+        entry = &PTE_L_ADDR(vaddr)[TIDX(vaddr)];
+        assert(entry->present && (entry->ignored & PTE_SHARED));
+
+        unlink_page(vaddr);
+        bitmap_set(task->vmap, PAGE_IDX(vaddr), false);
+    }
+    shm_put(shm);
+
+    return 0;
+}
+
+/* 销毁后 key 可以被重新使用，已有的映射不受影响 */
+int32 sys_shmrm(int32 id){
+    shm_t *shm = shm_get(id);
+
+    if (shm == NULL)
+        return EOF;
+
+    shm->destroyed = true;
+    for (u32 i = 0; i < shm->pages; ++i)
+        page_unref(shm->frames[i]);
+
+    if (shm->nattach == 0){
+        free(shm->frames);
+        memset(shm, 0, sizeof(shm_t));
+    }
+
+    printk(SHM_LOG_INFO "destroy id %d\n", id);
+
+    return 0;
+}
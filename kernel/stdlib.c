@@ -2,6 +2,20 @@
 #include <rdix/kernel.h>
 #include <common/assert.h>
 
+int atoi(const char *str){
+    int sign = 1, ret = 0;
+
+    if (*str == '-'){
+        sign = -1;
+        ++str;
+    }
+    while (*str >= '0' && *str <= '9'){
+        ret = ret * 10 + (*str - '0');
+        ++str;
+    }
+    return sign * ret;
+}
+
 u8 bcd2bin(u8 bcd){
     return (bcd & 0xf) + (bcd >> 4) * 10;
 }
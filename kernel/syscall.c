@@ -1,4 +1,54 @@
 #include <rdix/syscall.h>
+#include <rdix/hardware.h>
+#include <rdix/vdso.h>
+#include <common/global.h>
+#include <common/clock.h>
+
+#define barrier() asm volatile("": : :"memory")
+
+/* cpu 是否支持 sysenter，-1 表示还未检测 */
+static int sysenter_state = -1;
+
+/* 内核线程没有映射内核数据页，也不能使用 sysenter */
+static _inline bool in_user(){
+    u16 cs;
+
+    asm volatile("movw %%cs, %0\n":"=r"(cs));
+    return (cs & 3) == DPL_USER;
+}
+
+/* 只有 3 特权级才能走 sysenter，sysexit 总是返回到 3 特权级
+ * 内核线程仍然使用 int 0x80 */
+static bool use_sysenter(){
+    if (sysenter_state < 0)
+        sysenter_state = cpu_has_sep();
+
+    return sysenter_state && in_user();
+}
+
+/* sysenter 不保存返回地址和用户栈，sysexit 时由 edx 和 ecx 给出
+ * 所以先把 ebp, ecx, edx 和返回地址压入用户栈，ebp 指向栈顶交给内核
+ * 内核从 [ebp + 8] 和 [ebp + 4] 取出第二、三个参数 */
+static _inline u32 _sysenter(u32 nr, u32 arg1, u32 arg2, u32 arg3){
+    u32 ret;
+    asm volatile(
+        "pushl %%ebp\n"
+        "pushl %%ecx\n"
+        "pushl %%edx\n"
+        "pushl $1f\n"
+        "movl %%esp, %%ebp\n"
+        "sysenter\n"
+        "1:\n"
+        "addl $4, %%esp\n"
+        "popl %%edx\n"
+        "popl %%ecx\n"
+        "popl %%ebp\n"
+        :"=a"(ret)
+        :"a"(nr),"b"(arg1),"c"(arg2),"d"(arg3)
+        :"memory"
+    );
+    return ret;
+}
 
 /* eax 指明调用 0x80 中第几个系统调用函数
  * ebx 为第一个参数
@@ -6,6 +56,8 @@
  * edx 为第三个参数 */
 static _inline u32 _syscall0(u32 nr){
     u32 ret;
+    if (use_sysenter())
+        return _sysenter(nr, 0, 0, 0);
     asm volatile(
         "int $0x80\n"
         :"=a"(ret)
@@ -16,6 +68,8 @@ static _inline u32 _syscall0(u32 nr){
 
 static _inline u32 _syscall1(u32 nr, u32 arg1){
     u32 ret;
+    if (use_sysenter())
+        return _sysenter(nr, arg1, 0, 0);
     asm volatile(
         "int $0x80\n"
         :"=a"(ret)
@@ -26,6 +80,8 @@ static _inline u32 _syscall1(u32 nr, u32 arg1){
 
 static _inline u32 _syscall2(u32 nr, u32 arg1, u32 arg2){
     u32 ret;
+    if (use_sysenter())
+        return _sysenter(nr, arg1, arg2, 0);
     asm volatile(
         "int $0x80\n"
         :"=a"(ret)
@@ -36,6 +92,8 @@ static _inline u32 _syscall2(u32 nr, u32 arg1, u32 arg2){
 
 static _inline u32 _syscall3(u32 nr, u32 arg1, u32 arg2, u32 arg3){
     u32 ret;
+    if (use_sysenter())
+        return _sysenter(nr, arg1, arg2, arg3);
     asm volatile(
         "int $0x80\n"
         :"=a"(ret)
@@ -45,6 +103,24 @@ static _inline u32 _syscall3(u32 nr, u32 arg1, u32 arg2, u32 arg3){
 }
 
 
+u32 syscall_int80(u32 nr, u32 arg1, u32 arg2, u32 arg3){
+    u32 ret;
+    asm volatile(
+        "int $0x80\n"
+        :"=a"(ret)
+        :"a"(nr),"b"(arg1),"c"(arg2),"d"(arg3)
+    );
+    return ret;
+}
+
+u32 syscall_sysenter(u32 nr, u32 arg1, u32 arg2, u32 arg3){
+    return _sysenter(nr, arg1, arg2, arg3);
+}
+
+bool sysenter_supported(){
+    return use_sysenter();
+}
+
 u32 test(){
     return _syscall0(SYS_NR_TEST);
 }
@@ -61,12 +137,94 @@ pid_t fork(){
     return _syscall0(SYS_NR_FORK);
 }
 
+/* 以下函数直接从内核数据页读取，不需要陷入内核
+ * 内核线程没有映射数据页，数据页无效（magic 不对）时也改用系统调用 */
+/* pid 和 ppid 在进程私有的数据页中 */
 pid_t getpid(){
-    return _syscall0(SYS_NR_GETPID);
+    vdso_task_t *vt = (vdso_task_t *)VDSO_TASK_ADDR;
+    u32 seq, magic;
+    pid_t pid;
+
+    if (!in_user())
+        return _syscall0(SYS_NR_GETPID);
+
+    do{
+        seq = vt->seq;
+        barrier();
+        magic = vt->magic;
+        pid = vt->pid;
+        barrier();
+    } while ((seq & 1) || seq != vt->seq);
+
+    if (magic != VDSO_MAGIC)
+        return _syscall0(SYS_NR_GETPID);
+    return pid;
 }
 
 pid_t getppid(){
-    return _syscall0(SYS_NR_GETPPID);
+    vdso_task_t *vt = (vdso_task_t *)VDSO_TASK_ADDR;
+    u32 seq, magic;
+    pid_t ppid;
+
+    if (!in_user())
+        return _syscall0(SYS_NR_GETPPID);
+
+    do{
+        seq = vt->seq;
+        barrier();
+        magic = vt->magic;
+        ppid = vt->ppid;
+        barrier();
+    } while ((seq & 1) || seq != vt->seq);
+
+    if (magic != VDSO_MAGIC)
+        return _syscall0(SYS_NR_GETPPID);
+    return ppid;
+}
+
+/* 当前时间戳，单位秒 */
+time_t time(){
+    vdso_data_t *vd = (vdso_data_t *)VDSO_DATA_ADDR;
+    u32 seq;
+    time_t sec;
+
+    if (!in_user() || vd->magic != VDSO_MAGIC)
+        return _syscall0(SYS_NR_TIME);
+
+    do{
+        seq = vd->seq;
+        barrier();
+        sec = vd->wall_sec;
+        barrier();
+    } while ((seq & 1) || seq != vd->seq);
+
+    return sec;
+}
+
+/* 开机以来的毫秒数，时间片内的部分由 tsc 插值得到 */
+u32 uptime(){
+    vdso_data_t *vd = (vdso_data_t *)VDSO_DATA_ADDR;
+    u32 seq, ms, khz, delta;
+    u64 stamp;
+
+    if (!in_user() || vd->magic != VDSO_MAGIC)
+        return _syscall0(SYS_NR_UPTIME);
+
+    do{
+        seq = vd->seq;
+        barrier();
+        ms = vd->jiffies * JIFFY;
+        khz = vd->tsc_khz;
+        stamp = vd->tsc_stamp;
+        barrier();
+    } while ((seq & 1) || seq != vd->seq);
+
+    if (khz){
+        delta = (u32)(rdtsc() - stamp) / khz;
+        ms += delta < JIFFY ? delta : JIFFY;
+    }
+
+    return ms;
 }
 
 pid_t exit(int status){
@@ -131,4 +289,96 @@ int link(char *oldname, char *newname){
 
 int unlink(char *pathname){
     return _syscall1(SYS_NR_UNLINK, pathname);
-}
\ No newline at end of file
+}
+
+/* 新线程从这里开始执行，栈上是内核放好的 fn 和 arg */
+static void thread_start(thread_fn_t fn, void *arg){
+    thread_exit((int)fn(arg));
+}
+
+pid_t clone(thread_fn_t fn, void *arg){
+    return _syscall3(SYS_NR_CLONE, thread_start, fn, arg);
+}
+
+void thread_exit(int status){
+    _syscall1(SYS_NR_THREAD_EXIT, status);
+}
+
+pid_t gettid(){
+    return _syscall0(SYS_NR_GETTID);
+}
+
+int32 futex(u32 *uaddr, int op, u32 val){
+    return (int32)_syscall3(SYS_NR_FUTEX, uaddr, op, val);
+}
+
+void lockstat(bool reset){
+    _syscall1(SYS_NR_LOCKSTAT, reset);
+}
+
+int32 task_info(struct task_info_t *info, u32 count){
+    return (int32)_syscall2(SYS_NR_TASK_INFO, info, count);
+}
+
+/* 子进程和父进程共用用户栈，返回地址不能留在栈上
+ * 先把返回地址弹到 ecx 中，子进程返回时压栈写入的是同一个值，不会破坏父进程的栈
+ * sysenter 返回时会用到 ecx 和 edx，所以固定使用 int 0x80 */
+__attribute__((naked)) pid_t vfork(){
+    asm volatile(
+        "popl %%ecx\n"
+        "movl %0, %%eax\n"
+        "int $0x80\n"
+        "pushl %%ecx\n"
+        "ret\n"
+        ::"i"(SYS_NR_VFORK)
+    );
+}
+
+pid_t spawn(const char *path, char *const argv[]){
+    return _syscall2(SYS_NR_SPAWN, path, argv);
+}
+
+/* 成功时用户栈被替换，sysenter 返回后的出栈会出错，固定使用 int 0x80 */
+int32 execve(const char *path, char *const argv[]){
+    return (int32)syscall_int80(SYS_NR_EXECVE, (u32)path, (u32)argv, 0);
+}
+
+int32 pipe(fd_t fds[2]){
+    return (int32)_syscall1(SYS_NR_PIPE, fds);
+}
+
+int32 splice(fd_t fd_in, fd_t fd_out, u32 count){
+    return (int32)_syscall3(SYS_NR_SPLICE, fd_in, fd_out, count);
+}
+
+int32 shmget(u32 key, u32 size){
+    return (int32)_syscall2(SYS_NR_SHMGET, key, size);
+}
+
+void *shmat(int32 id){
+    return (void *)_syscall1(SYS_NR_SHMAT, id);
+}
+
+int32 shmdt(void *addr){
+    return (int32)_syscall1(SYS_NR_SHMDT, addr);
+}
+
+int32 shmrm(int32 id){
+    return (int32)_syscall1(SYS_NR_SHMRM, id);
+}
+
+struct uring_ring_t *uring_setup(u32 entries, u32 flags){
+    return (struct uring_ring_t *)_syscall2(SYS_NR_URING_SETUP, entries, flags);
+}
+
+int32 uring_enter(u32 to_submit, u32 min_complete, u32 flags){
+    return (int32)_syscall3(SYS_NR_URING_ENTER, to_submit, min_complete, flags);
+}
+
+int32 elevator(char *devname, char *name){
+    return (int32)_syscall2(SYS_NR_ELEVATOR, devname, name);
+}
+
+int32 iostat(char *devname, u32 flags){
+    return (int32)_syscall2(SYS_NR_IOSTAT, devname, flags);
+}
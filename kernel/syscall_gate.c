@@ -5,6 +5,10 @@
 #include <common/console.h>
 #include <rdix/memory.h>
 #include <rdix/device.h>
+#include <rdix/hardware.h>
+#include <common/global.h>
+#include <rdix/futex.h>
+#include <rdix/mutex.h>
 
 #define SYSCALL_NUM 64
 
@@ -18,6 +22,16 @@ void syscall_check(u32 sys_vector){
         PANIC("syscall error: no such func\n");
 }
 
+/* sysenter_handle 检查用户栈指针的范围，[ebp] 到 [ebp + 8] 都要在用户空间内 */
+const u32 sysenter_stack_low = KERNEL_MEMERY_SIZE;
+const u32 sysenter_stack_high = USER_STACK_TOP - 3 * sizeof(u32);
+
+/* sysenter 时用户给出的栈指针不在用户空间，取不到返回地址，只能结束该任务 */
+void sysenter_bad_stack(u32 ebp){
+    printk("[syscall] sysenter with bad user stack 0x%p\n", ebp);
+    sys_exit(EOF);
+}
+
 static u32 syscall_default_handle(){
     printk("syscall not implemented\n");
     return 0;
@@ -55,6 +69,40 @@ extern int sys_chdir(char *pathname);
 void sys_getpwd(char *buf, size_t len);
 int sys_link(char *oldname, char *newname);
 int sys_unlink(char *pathname);
+extern pid_t sys_clone(user_target_t entry, void *fn, void *arg);
+extern void sys_thread_exit(int status);
+extern pid_t sys_gettid();
+extern int32 sys_task_info(task_info_t *info, u32 count);
+extern pid_t sys_vfork();
+extern pid_t sys_spawn(const char *path, char *const argv[]);
+extern int32 sys_execve(const char *path, char *const argv[]);
+extern int32 sys_pipe(fd_t fds[2]);
+extern int32 sys_splice(fd_t fd_in, fd_t fd_out, u32 count);
+extern int32 sys_shmget(u32 key, u32 size);
+extern void *sys_shmat(int32 id);
+extern int32 sys_shmdt(void *addr);
+extern int32 sys_shmrm(int32 id);
+extern struct uring_ring_t *sys_uring_setup(u32 entries, u32 flags);
+extern int32 sys_uring_enter(u32 to_submit, u32 min_complete, u32 flags);
+extern int32 sys_elevator(char *devname, char *name);
+extern int32 sys_iostat(char *devname, u32 flags);
+
+extern void sysenter_handle();
+extern tss_t tss;
+
+/* 设置 sysenter 所需的 MSR，每个 cpu 都需要调用一次
+ * SYSENTER_ESP 指向 tss，入口处从 tss.esp0 取当前任务的内核栈
+ * 这样任务切换时只需要更新 tss.esp0，不必重写 MSR */
+void sysenter_init(){
+    if (!cpu_has_sep()){
+        printk("[syscall] sysenter not supported, use int 0x80\n");
+        return;
+    }
+
+    cpuSetMSR(IA32_SYSENTER_CS, KERNEL_CODE_SEG << 3, 0);
+    cpuSetMSR(IA32_SYSENTER_ESP, (u32)&tss, 0);
+    cpuSetMSR(IA32_SYSENTER_EIP, (u32)sysenter_handle, 0);
+}
 
 void syscall_init(){
 
@@ -84,4 +132,27 @@ void syscall_init(){
     syscall_table[SYS_NR_GETPWD] = (syscall_gate_t)sys_getpwd;
     syscall_table[SYS_NR_LINK] = (syscall_gate_t)sys_link;
     syscall_table[SYS_NR_UNLINK] = (syscall_gate_t)sys_unlink;
+    syscall_table[SYS_NR_CLONE] = (syscall_gate_t)sys_clone;
+    syscall_table[SYS_NR_THREAD_EXIT] = (syscall_gate_t)sys_thread_exit;
+    syscall_table[SYS_NR_GETTID] = (syscall_gate_t)sys_gettid;
+    syscall_table[SYS_NR_FUTEX] = (syscall_gate_t)sys_futex;
+    syscall_table[SYS_NR_LOCKSTAT] = (syscall_gate_t)sys_lockstat;
+    syscall_table[SYS_NR_TASK_INFO] = (syscall_gate_t)sys_task_info;
+    syscall_table[SYS_NR_VFORK] = (syscall_gate_t)sys_vfork;
+    syscall_table[SYS_NR_SPAWN] = (syscall_gate_t)sys_spawn;
+    syscall_table[SYS_NR_EXECVE] = (syscall_gate_t)sys_execve;
+    syscall_table[SYS_NR_PIPE] = (syscall_gate_t)sys_pipe;
+    syscall_table[SYS_NR_SPLICE] = (syscall_gate_t)sys_splice;
+    syscall_table[SYS_NR_SHMGET] = (syscall_gate_t)sys_shmget;
+    syscall_table[SYS_NR_SHMAT] = (syscall_gate_t)sys_shmat;
+    syscall_table[SYS_NR_SHMDT] = (syscall_gate_t)sys_shmdt;
+    syscall_table[SYS_NR_SHMRM] = (syscall_gate_t)sys_shmrm;
+    syscall_table[SYS_NR_URING_SETUP] = (syscall_gate_t)sys_uring_setup;
+    syscall_table[SYS_NR_URING_ENTER] = (syscall_gate_t)sys_uring_enter;
+    syscall_table[SYS_NR_ELEVATOR] = (syscall_gate_t)sys_elevator;
+    syscall_table[SYS_NR_IOSTAT] = (syscall_gate_t)sys_iostat;
+    syscall_table[SYS_NR_TIME] = (syscall_gate_t)sys_time;
+    syscall_table[SYS_NR_UPTIME] = (syscall_gate_t)sys_uptime;
+
+    sysenter_init();
 }
\ No newline at end of file
@@ -7,21 +7,33 @@
 #include <common/clock.h>
 #include <common/global.h>
 #include <common/interrupt.h>
+#include <rdix/fpu.h>
+#include <rdix/hardware.h>
+#include <rdix/bench.h>
+#include <rdix/vma.h>
+#include <rdix/uring.h>
 
 #define TASK_LOG_INFO __LOG("[task]")
 
-#define TASK_NUM 64
-
 extern bitmap_t v_bit_map;
 extern time_t jiffies;
 extern tss_t tss;
 
-static u32 task_cnt;
-static ListNode_t *task_bucket[TASK_NUM];
+/* pid 分配位图，next_pid 为下一次开始查找的位置，避免 pid 被立即复用 */
+static u8 pid_map_buf[TASK_NR_MAX / 8];
+static bitmap_t pid_map;
+static pid_t next_pid;
+
+/* pid 到任务的哈希表，节点为 TCB 中的 hash_node */
+static List_t pid_hash_table[PID_HASH_NR];
+
+#define pid_hash(pid) (&pid_hash_table[(pid) & (PID_HASH_NR - 1)])
 
 List_t *block_list;
 List_t *sleep_list;
 List_t *ready_list;
+/* idle 任务单独保存，不进入 ready_list */
+static ListNode_t *idle_task;
 List_t *died_list;
 
 static ListNode_t *running_task;
@@ -59,38 +71,120 @@ _ofp void task_switch(TCB_t *current_task_src, TCB_t *next_task_src){
     );
 }
 
-ListNode_t *get_task(){
-    pid_t pid = 0;
-    for (; pid < TASK_NUM; ++pid){
-        if(!task_bucket[pid])
-            break;
-    }
+/* 调用前需要关中断 */
+static pid_t pid_alloc(){
+    for (u32 i = 0; i < TASK_NR_MAX; ++i){
+        pid_t pid = (next_pid + i) % TASK_NR_MAX;
 
-    if (pid >= TASK_NUM){
-        PANIC("no more task\n");
+        /* 整个字节都被占用时直接跳过 */
+        if (pid_map.start[pid / 8] == 0xff){
+            i += 7 - pid % 8;
+            continue;
+        }
+        if (bitmap_test(&pid_map, pid))
+            continue;
+
+        bitmap_set(&pid_map, pid, true);
+        next_pid = (pid + 1) % TASK_NR_MAX;
+        return pid;
     }
+    return EOF;
+}
 
-    TCB_t *task = (TCB_t *)alloc_kpage(1);
-    ListNode_t *task_node = new_listnode(task, 0);
+ListNode_t *task_lookup(pid_t pid){
+    if (pid < 0 || pid >= TASK_NR_MAX)
+        return NULL;
+
+    ListNode_t *hnode = search_node(pid_hash(pid), pid);
+
+    return hnode ? ((TCB_t *)hnode->owner)->node : NULL;
+}
 
+/* 分配 pid 和 TCB，返回任务节点，pid 用完或内存不足时返回 NULL
+ * 此时任务还没有加入哈希表和父进程的 children 链表，需要调用 task_attach */
+ListNode_t *get_task(){
     /* 防竞态 */
-    bool state = get_IF();
-    set_IF(false);
+    bool state = get_and_disable_IF();
+    pid_t pid = pid_alloc();
+
+    set_IF(state);
 
-    task_bucket[pid] = task_node;
+    if (pid == EOF)
+        return NULL;
+
+    TCB_t *task = (TCB_t *)alloc_kpage(1);
+    if (task == NULL){
+        ATOMIC_OPS(bitmap_set(&pid_map, pid, false);)
+        return NULL;
+    }
+
+    ListNode_t *task_node = new_listnode(task, 0);
 
     task->pid = pid;
-    task->ppid = running_task == NULL ? 0 : ((TCB_t*)running_task->owner)->pid;
+    task->ppid = running_task == NULL ? 0 : current_leader()->pid;
+    task->node = task_node;
+
+    return task_node;
+}
+
+/* 将任务加入 pid 哈希表以及父进程的 children 链表 */
+static void task_attach(TCB_t *task){
+    bool state = get_and_disable_IF();
+
+    node_init(&task->hash_node, task, task->pid);
+    node_init(&task->sibling, task, task->pid);
+    list_init(&task->children);
+
+    list_push(pid_hash(task->pid), &task->hash_node);
+
+    /* 第一个任务（idle）没有父进程，线程不是任何进程的子进程 */
+    ListNode_t *parent = task_lookup(task->ppid);
+    if (parent != NULL && parent != task->node && task->leader == task)
+        list_push(&((TCB_t *)parent->owner)->children, &task->sibling);
 
     set_IF(state);
+}
 
-    return task_node;
+/* 将 task 的子进程全部交给它的父进程，调用前需要关中断 */
+static void task_reparent(TCB_t *task){
+    ListNode_t *pnode = task_lookup(task->ppid);
+    TCB_t *parent = pnode && pnode != task->node ? (TCB_t *)pnode->owner : NULL;
+    ListNode_t *iter;
+
+    while ((iter = list_pop(&task->children)) != NULL){
+        TCB_t *child = (TCB_t *)iter->owner;
+
+        child->ppid = task->ppid;
+        vdso_task_sync(child);
+
+        if (parent)
+            list_push(&parent->children, iter);
+    }
+}
+
+/* 唤醒正在等待 task 的父进程 */
+static void task_notify_parent(TCB_t *task){
+    ListNode_t *pnode = task_lookup(task->ppid);
+
+    if (pnode == NULL || pnode == task->node)
+        return;
+
+    TCB_t *parent = (TCB_t *)pnode->owner;
+    if (parent->state == TASK_WAITING &&
+        (parent->waitpid == -1 || parent->waitpid == task->pid)){
+        unblock(pnode);
+    }
 }
 
 ListNode_t *current_task(){
     return running_task;
 }
 
+/* 当前任务所属线程组的 leader，文件、目录、brk 等进程资源都保存在 leader 中 */
+TCB_t *current_leader(){
+    return ((TCB_t *)running_task->owner)->leader;
+}
+
 char *task_name(){
     return ((TCB_t *)running_task->owner)->name;
 }
@@ -101,18 +195,13 @@ void kernel_thread_exit(ListNode_t *th, u32 status){
     TCB_t *task = (TCB_t *)th->owner;
     task->status = status;
 
+    fpu_release(task);
+
     /* 防竞态 */
     bool IF_stat = get_IF();
     set_IF(false);
     /* 将该进程的子进程指向它的爷爷 */
-    for (size_t i = 0; i < TASK_NUM; ++i){
-        if (!task_bucket[i])
-            continue;
-
-        TCB_t *child = (TCB_t *)task_bucket[i]->owner;
-        if (child->ppid == task->pid)
-            child->ppid = task->ppid;
-    }
+    task_reparent(task);
 
     if (th != running_task)
         remove_node(th);
@@ -121,11 +210,7 @@ void kernel_thread_exit(ListNode_t *th, u32 status){
     task->state = TASK_DIED;
 
     /* 唤醒父进程 */
-    TCB_t *parent = (TCB_t *)task_bucket[task->ppid]->owner;
-    if (parent->state == TASK_WAITING &&
-        (parent->waitpid == -1 || parent->waitpid == task->pid)){
-        unblock(task_bucket[task->ppid]);
-    }
+    task_notify_parent(task);
 
     if (th == running_task)
         schedule();
@@ -135,6 +220,9 @@ void kernel_thread_exit(ListNode_t *th, u32 status){
 
 ListNode_t *task_create(task_program handle, void *param, const char *name, u32 priority, u32 uid){
     ListNode_t *node = get_task();
+    if (node == NULL)
+        PANIC("no more task\n");
+
     TCB_t *tcb = (TCB_t *)node->owner;
     task_stack_t *stack = (task_stack_t *)((u32)tcb + PAGE_SIZE - sizeof(task_stack_t));
 
@@ -150,6 +238,18 @@ ListNode_t *task_create(task_program handle, void *param, const char *name, u32
     tcb->stack = stack;
     tcb->state = TASK_READY;
     tcb->priority = priority;
+    tcb->base_priority = priority;
+    list_init(&tcb->mutexes);
+    tcb->blocked_on = NULL;
+    tcb->utime = 0;
+    tcb->stime = 0;
+    tcb->acct_stamp = rdtsc();
+    tcb->nvcsw = 0;
+    tcb->nivcsw = 0;
+    tcb->page_faults = 0;
+    tcb->vfork_parent = NULL;
+    tcb->uring = NULL;
+    tcb->plug = NULL;
     tcb->ticks = tcb->priority;
     tcb->jiffies = 0;
     strcpy((char *)tcb->name, name);
@@ -157,10 +257,15 @@ ListNode_t *task_create(task_program handle, void *param, const char *name, u32
     tcb->gid = 0;
     tcb->pde = (page_entry_t *)0x1000; //内核页目录，修改过memory.c后要注意这里可能出问题
     tcb->vmap = &v_bit_map; //内核虚拟内存位图，同上
+    tcb->vmas = NULL;
     tcb->brk = KERNEL_MEMERY_SIZE;
     tcb->magic = RDIX_MAGIC;
     tcb->waitpid = 0;
     tcb->umask = 0022;
+    tcb->vdso = NULL;
+    tcb->fpu = NULL;
+    tcb->leader = tcb;
+    tcb->group = NULL;
     tcb->i_root = get_root();
     tcb->i_root->count++;
     tcb->i_pwd = get_root();
@@ -170,6 +275,8 @@ ListNode_t *task_create(task_program handle, void *param, const char *name, u32
 
     memset(tcb->files, 0, sizeof(tcb->files));
 
+    task_attach(tcb);
+
     /* 防竞态 */
     ATOMIC_OPS(list_push(ready_list, node);)
 
@@ -186,10 +293,10 @@ void schedule(){
     /* bug 调试记录
      * 必须要验证 next 不为 NULL 后，在能进行下一步操作 */
     if (next == NULL){
-        assert(running_task != NULL);
-        /* 如果当前 task 的状态不为 TASK_RUNNING, 代表已经没有进程可以运行了 */
-        assert(((TCB_t *)running_task->owner)->state == TASK_RUNNING);
-        return;
+        /* 当前任务还能继续运行就不切换，否则只能运行 idle */
+        if (running_task != NULL && ((TCB_t *)running_task->owner)->state == TASK_RUNNING)
+            return;
+        next = idle_task;
     }
 
     TCB_t *next_tcb = (TCB_t *)next->owner;
@@ -208,7 +315,8 @@ void schedule(){
      * 因此这里就不能再把它加入到 ready链表 中 */
     if (running_task->container == NULL){
         current_tcb->state = TASK_READY;
-        list_push(ready_list, running_task);
+        if (running_task != idle_task)
+            list_push(ready_list, running_task);
     }
 
     if (next_tcb->pde != get_cr3()){
@@ -225,19 +333,58 @@ void schedule(){
         tss.esp0 = ((u32)next_tcb->stack & 0xfffff000) + PAGE_SIZE;
     }
 
+    fpu_switch(next_tcb);
+
+    /* 切换前的时间都算作内核态时间 */
+    u64 now = rdtsc();
+
+    current_tcb->stime += now - current_tcb->acct_stamp;
+    if (current_tcb->state == TASK_READY)
+        ++current_tcb->nivcsw;
+    else
+        ++current_tcb->nvcsw;
+    next_tcb->acct_stamp = now;
+
 __SWITCH:
     running_task = next;
     task_switch(current_tcb, next_tcb);
 }
 
+/* 在当前内核栈上构造中断栈帧，从 eip 进入用户态，不再返回
+ * 用户进程的创建不需要开中断，因为当通过 iret 进入用户态时，会从栈中恢复 flags
+ * 而这里在配置 flags 时就已经将 IF 位置一，所以在进入用户态后会自动开中断 */
+void task_to_user(u32 eip, u32 esp){
+    intr_frame_t iframe;
+    void *kernel_stack = &iframe;
+
+    iframe.gs = 0;
+    iframe.ds = (USER_DATA_SEG << 3) | DPL_USER;
+    iframe.es = (USER_DATA_SEG << 3) | DPL_USER;
+    iframe.fs = (USER_DATA_SEG << 3) | DPL_USER;
+    iframe.ss = (USER_DATA_SEG << 3) | DPL_USER;
+    iframe.cs = (USER_CODE_SEG << 3) | DPL_USER;
+
+    iframe.error = RDIX_MAGIC;
+    iframe.eip = eip;
+
+    /* flage 中 IOPL 是控制所有 IO 权限的开关
+     * 只有当 CPL <= IOPL 时，任务才允许访问所有 IO 端口，否则只能根据 tss 中的 io 位图来访问io */
+    iframe.eflags = (0 << 12 | 0b10 | 1 << 9);  // IF 位置位
+    iframe.esp = esp;
+
+    /* 修改内核栈指针 */
+    asm volatile(
+        "movl %0, %%esp\n"
+        "jmp interrupt_exit\n"
+        :
+        :"m"(kernel_stack)
+    );
+}
+
 /* 参数存放在 edi 中 */
 static void *kernel_to_user(){
-    /* 用户进程的创建不需要开中断，因为当通过 iret 进入用户态时，会从栈中恢复 flags
-     * 而该函数在配置 flags 时就已经将 IF 位置一，所以在进入用户态后会自动开中断 */
-    intr_frame_t iframe;
     /* target 为用户程序入口地址 */
     user_target_t *target;
-    void *kernel_stack = &iframe;
     TCB_t *current = (TCB_t *)current_task()->owner;
 
     /* 参数指针保存在 edi 中 */
@@ -259,34 +406,17 @@ static void *kernel_to_user(){
         assert(bitmap_set(current->vmap, i, true) != EOF);
     }
 
+    current->vmas = vma_list_create();
     current->pde = (page_entry_t *)copy_pde();
+    vdso_map(current);
     set_cr3(current->pde);
 
-    iframe.gs = 0;
-    iframe.ds = (USER_DATA_SEG << 3) | DPL_USER;
-    iframe.es = (USER_DATA_SEG << 3) | DPL_USER;
-    iframe.fs = (USER_DATA_SEG << 3) | DPL_USER;
-    iframe.ss = (USER_DATA_SEG << 3) | DPL_USER;
-    iframe.cs = (USER_CODE_SEG << 3) | DPL_USER;
-
-    iframe.error = RDIX_MAGIC;
-    iframe.eip = (u32)*target;
+    u32 eip = (u32)*target;
 
     /* edi 所指向的空间是 malloc 出来的，需要释放 */
     free(target);
 
-    /* flage 中 IOPL 是控制所有 IO 权限的开关
-     * 只有当 CPL <= IOPL 时，任务才允许访问所有 IO 端口，否则只能根据 tss 中的 io 位图来访问io */
-    iframe.eflags = (0 << 12 | 0b10 | 1 << 9);  // IF 位置位
-    iframe.esp = USER_STACK_TOP;
-
-    /* 修改内核栈指针 */
-    asm volatile(
-        "movl %0, %%esp\n"
-        "jmp interrupt_exit\n"
-        :
-        :"m"(kernel_stack)
-    );
+    task_to_user(eip, USER_STACK_TOP);
 }
 
 void user_task_create(user_target_t target, const char *name, u32 priority){
@@ -307,12 +437,86 @@ ListNode_t *kernel_task_create(user_target_t target, const char *name, u32 prior
     return task_create(target, NULL, name, priority, USER_UID);
 }
 
+/* 线程组内所有线程的 pid 都是 leader 的 pid，线程自己的 pid 由 gettid 返回 */
 pid_t sys_getpid(){
-    return ((TCB_t*)running_task->owner)->pid;
+    return current_leader()->pid;
 }
 
 pid_t sys_getppid(){
-    return ((TCB_t*)running_task->owner)->ppid;
+    return current_leader()->ppid;
+}
+
+pid_t sys_gettid(){
+    return ((TCB_t*)running_task->owner)->pid;
+}
+
+/* 复制当前任务的 TCB 以及内核栈，子任务从 interrupt_exit 返回用户态
+ * ebp 为系统调用函数的栈帧，返回子任务内核栈中的中断栈帧 */
+static intr_frame_t *task_copy(TCB_t *task, TCB_t *child, u32 ebp){
+    /* 一共要向上走 ebp 和 eip 和 int0x80 传入的四个参数长度 */
+    intr_frame_t *child_frame = (intr_frame_t *)(ebp + sizeof(u32) * 6 - (u32)task + (u32)child);
+
+    pid_t pid = child->pid;
+    pid_t ppid = child->ppid;
+    ListNode_t *child_node = child->node;
+
+    /* 复制 TCB 以及内核栈 */
+    memcpy((void *)child, (void *)task, PAGE_SIZE);
+
+    child->pid = pid;
+    child->ppid = ppid;
+    child->node = child_node;
+    child->priority = child->base_priority;
+    child->ticks = child->priority;
+    list_init(&child->mutexes);
+    child->blocked_on = NULL;
+    child->utime = 0;
+    child->stime = 0;
+    child->nvcsw = 0;
+    child->nivcsw = 0;
+    child->page_faults = 0;
+    child->vfork_parent = NULL;
+    child->uring = NULL;
+    child->plug = NULL;
+    child->state = TASK_READY;
+    child->fpu = NULL;
+    child->leader = child;
+    child->group = NULL;
+
+    /* 子任务返回值为 0 */
+    child_frame->eax = 0;
+    task_stack_t *child_stack = (task_stack_t *)((u32)child_frame - sizeof(task_stack_t));
+
+    child_stack->ebp = RDIX_MAGIC;
+    child_stack->ebx = RDIX_MAGIC;
+    child_stack->edi = RDIX_MAGIC;
+    child_stack->esi = RDIX_MAGIC;
+
+    child_stack->eip = interrupt_exit;
+
+    child->stack = child_stack;
+
+    return child_frame;
+}
+
+/* 子进程继承 leader 的根目录、当前目录、文件以及 brk
+ * 线程调用 fork 时，进程资源要从 leader 中复制 */
+void task_inherit(TCB_t *leader, TCB_t *child){
+    child->i_root = leader->i_root;
+    child->i_pwd = leader->i_pwd;
+    child->brk = leader->brk;
+    child->umask = leader->umask;
+    memcpy(child->files, leader->files, sizeof(child->files));
+    for (fd_t fd = 0; fd < TASK_FILE_NR; ++fd){
+        if (child->files[fd])
+            child->files[fd]->count++;
+    }
+
+    child->i_root->count++;
+    child->i_pwd->count++;
+
+    child->pwd = malloc(TASK_PWD_LEN);
+    strcpy(child->pwd, leader->pwd);
 }
 
 /* fork 是用户进程的系统调用，使用的是中断门
@@ -323,7 +527,11 @@ pid_t sys_fork(){
     assert(!get_IF());
 
     TCB_t *task = (TCB_t *)running_task->owner;
+    TCB_t *leader = task->leader;
     ListNode_t *child_node = get_task();
+    if (child_node == NULL)
+        return EOF;
+
     TCB_t *child = (TCB_t *)child_node->owner;
     
     u32 ebp;
@@ -331,23 +539,9 @@ pid_t sys_fork(){
         "movl %%ebp, %0":"=m"(ebp)
     );
 
-    /* 一共要向上走 ebp 和 eip 和 int0x80 传入的四个参数长度 */
-    intr_frame_t *child_frame = (intr_frame_t *)(ebp + sizeof(u32) * 6 - (u32)task + (u32)child);
-
-    pid_t pid = child->pid;
-    pid_t ppid = child->ppid;
-
-    /* 复制 TCB 以及内核栈 */
-    memcpy((void *)child, (void *)task, PAGE_SIZE);
-    child->i_root->count++;
-    child->i_pwd->count++;
-
-    child->pid = pid;
-    child->ppid = ppid;
-    child->ticks = child->priority;
-    child->state = TASK_READY;
-    child->pwd = malloc(TASK_PWD_LEN);
-    strcpy(child->pwd, task->pwd);
+    task_copy(task, child, ebp);
+    task_inherit(leader, child);
+    task_attach(child);
 
     child->vmap = malloc(sizeof(bitmap_t));
     memcpy(child->vmap, task->vmap, sizeof(bitmap_t));
@@ -355,32 +549,344 @@ pid_t sys_fork(){
     void *buf = (void *)alloc_kpage(1);
     memcpy(buf, task->vmap->start, PAGE_SIZE);
     child->vmap->start = buf;
+    child->vmas = vma_list_copy(task->vmas);
 
     child->pde = (page_entry_t *)copy_pde();
+    vdso_map(child);
+    fpu_fork(task, child);
 
-    /* 子进程返回值为 0 */
-    child_frame->eax = 0;
-    task_stack_t *child_stack = (task_stack_t *)((u32)child_frame - sizeof(task_stack_t));
+    /* 将 child 进程加入 ready 队列 */
+    list_push(ready_list, child_node);
 
-    child_stack->ebp = RDIX_MAGIC;
-    child_stack->ebx = RDIX_MAGIC;
-    child_stack->edi = RDIX_MAGIC;
-    child_stack->esi = RDIX_MAGIC;
+    return child->pid;
+}
 
-    child_stack->eip = interrupt_exit;
+/* vfork 不复制页目录和 vmap，子进程直接在父进程的地址空间上运行
+ * 父进程阻塞到子进程 exec 或 exit 为止，所以两者不会同时使用用户栈
+ * 用户库中的 vfork 把返回地址保存在 ecx 中，子进程的压栈不会破坏父进程的返回地址
+ * 子进程没有自己的内核数据页，运行期间父进程的数据页置为无效，getpid 等改用系统调用 */
+pid_t sys_vfork(){
+    assert(!get_IF());
 
-    child->stack = child_stack;
+    TCB_t *task = (TCB_t *)running_task->owner;
+    TCB_t *leader = task->leader;
+
+    if (task->vmap == &v_bit_map)
+        return EOF;
+
+    ListNode_t *child_node = get_task();
+    if (child_node == NULL)
+        return EOF;
+
+    TCB_t *child = (TCB_t *)child_node->owner;
+
+    u32 ebp;
+    asm volatile(
+        "movl %%ebp, %0":"=m"(ebp)
+    );
+
+    task_copy(task, child, ebp);
+    task_inherit(leader, child);
+    task_attach(child);
+
+    child->pde = task->pde;
+    child->vmap = task->vmap;
+    child->vdso = NULL;
+    child->vfork_parent = task;
+    fpu_fork(task, child);
+    vdso_task_invalidate(task);
+
+    list_push(ready_list, child_node);
+
+    pid_t pid = child->pid;
+
+    /* 子进程退出后 TCB 要等父进程 waitpid 才释放，这里访问 child 是安全的 */
+    while (child->vfork_parent == task)
+        block(block_list, NULL, TASK_BLOCKED);
+
+    return pid;
+}
+
+/* 子进程 exec 或 exit 时不再使用父进程的地址空间，唤醒父进程 */
+void task_vfork_release(TCB_t *task){
+    TCB_t *parent = task->vfork_parent;
+
+    if (parent == NULL)
+        return;
+
+    task->vfork_parent = NULL;
+    vdso_task_sync(parent);
+    if (parent->state == TASK_BLOCKED)
+        unblock(parent->node);
+}
+
+/* 创建一个与当前进程共享地址空间、打开的文件以及当前目录的线程
+ * 新线程在自己的栈槽位上从用户态的 entry 开始执行，栈上依次为返回地址 0、fn、arg
+ * 由用户库中的 entry 调用 fn(arg)，并在 fn 返回后调用 thread_exit */
+pid_t sys_clone(user_target_t entry, void *fn, void *arg){
+    assert(!get_IF());
+
+    TCB_t *task = (TCB_t *)running_task->owner;
+    TCB_t *leader = task->leader;
+    thread_group_t *group = leader->group;
+    u32 slot;
+
+    /* 内核线程使用内核页目录，没有用户栈 */
+    if (task->vmap == &v_bit_map)
+        return EOF;
+
+    task_reap();
+
+    if (group == NULL){
+        group = (thread_group_t *)malloc(sizeof(thread_group_t));
+        memset(group, 0, sizeof(thread_group_t));
+        group->count = 1;
+        list_init(&group->threads);
+        leader->group = group;
+    }
+
+    if (group->exiting)
+        return EOF;
+
+    for (slot = 0; slot < THREAD_NR_MAX; ++slot){
+        if (!(group->stack_map & (1 << slot)))
+            break;
+    }
+    if (slot == THREAD_NR_MAX)
+        return EOF;
+
+    /* 线程栈的区域可能已经被 brk 或共享内存占用，不能覆盖 */
+    for (u32 vaddr = THREAD_STACK_BOTTOM(slot); vaddr < THREAD_STACK_TOP(slot); vaddr += PAGE_SIZE){
+        if (bitmap_test(task->vmap, PAGE_IDX(vaddr)))
+            return EOF;
+    }
+
+    ListNode_t *child_node = get_task();
+    if (child_node == NULL)
+        return EOF;
+
+    TCB_t *child = (TCB_t *)child_node->owner;
+
+    u32 ebp;
+    asm volatile(
+        "movl %%ebp, %0":"=m"(ebp)
+    );
+
+    intr_frame_t *child_frame = task_copy(task, child, ebp);
+
+    /* 页目录和 vmap 与 leader 共享，文件和目录通过 leader 访问 */
+    child->ppid = leader->ppid;
+    child->leader = leader;
+    child->vdso = NULL;
+    child->pwd = NULL;
+    child->stack_slot = slot;
+    task_attach(child);
+
+    node_init(&child->thread_node, child, child->pid);
+    list_push(&group->threads, &child->thread_node);
+    group->stack_map |= 1 << slot;
+    ++group->count;
+
+    /* 线程栈的物理页在缺页时才分配 */
+    for (u32 vaddr = THREAD_STACK_BOTTOM(slot); vaddr < THREAD_STACK_TOP(slot); vaddr += PAGE_SIZE)
+        bitmap_set(task->vmap, PAGE_IDX(vaddr), true);
+
+    u32 *sp = (u32 *)THREAD_STACK_TOP(slot);
+    *--sp = (u32)arg;
+    *--sp = (u32)fn;
+    *--sp = 0;
+
+    child_frame->eip = (u32)entry;
+    child_frame->esp = (u32)sp;
 
-    /* 将 child 进程加入 ready 队列 */
     list_push(ready_list, child_node);
 
     return child->pid;
 }
 
+/* 非 leader 线程退出，只释放线程自己的栈和 fpu 状态
+ * 线程没有父进程为它调用 waitpid，TCB 由 task_reap 回收 */
+static void thread_exit(TCB_t *task, int status){
+    TCB_t *leader = task->leader;
+    thread_group_t *group = leader->group;
+
+    free_user_range(THREAD_STACK_BOTTOM(task->stack_slot), THREAD_STACK_SIZE / PAGE_SIZE);
+    group->stack_map &= ~(1 << task->stack_slot);
+    remove_node(&task->thread_node);
+    --group->count;
+
+    fpu_release(task);
+
+    task->status = status;
+    task->state = TASK_DIED;
+    list_push(died_list, running_task);
+
+    if (group->leader_waiting && group->count == 1)
+        unblock(leader->node);
+
+    schedule();
+}
+
+/* 线程组退出时唤醒正在睡眠或等待子进程的线程，让它们尽快返回用户态并退出 */
+static void thread_wake(TCB_t *task){
+    if (task->state == TASK_SLEEPING || task->state == TASK_WAITING)
+        unblock(task->node);
+}
+
+static void thread_group_wake(TCB_t *leader){
+    List_t *threads = &leader->group->threads;
+
+    thread_wake(leader);
+    for (ListNode_t *iter = threads->end.next; iter != &threads->end; iter = iter->next)
+        thread_wake((TCB_t *)iter->owner);
+}
+
+/* 回收已经退出的线程，调用前需要关中断 */
+void task_reap(){
+    ListNode_t *iter = died_list->end.next;
+
+    while (iter != &died_list->end){
+        ListNode_t *next = iter->next;
+        TCB_t *task = (TCB_t *)iter->owner;
+
+        if (task->leader != task && iter != running_task){
+            remove_node(&task->hash_node);
+            bitmap_set(&pid_map, task->pid, false);
+            remove_node(iter);
+            free_kpage(task, 1);
+            free(iter);
+        }
+        iter = next;
+    }
+}
+
+/* 从用户态进入内核时调用，上一次记账以来的时间都在用户态 */
+void task_enter_kernel(){
+    if (running_task == NULL)
+        return;
+
+    TCB_t *task = (TCB_t *)running_task->owner;
+    u64 now = rdtsc();
+
+    task->utime += now - task->acct_stamp;
+    task->acct_stamp = now;
+}
+
+/* 每次返回用户态之前调用，线程组正在退出时当前线程随之退出 */
+void task_return_user(){
+    if (running_task == NULL)
+        return;
+
+    thread_group_t *group = current_leader()->group;
+
+    if (group != NULL && group->exiting)
+        sys_exit(group->status);
+
+    TCB_t *task = (TCB_t *)running_task->owner;
+    u64 now = rdtsc();
+
+    task->stime += now - task->acct_stamp;
+    task->acct_stamp = now;
+}
+
+/* idle 任务累计运行的 tsc 周期数，用来估计 cpu 的空闲时间，调用前需要关中断
+ * idle 的时间在切换出去时才记上，调用者不是 idle，所以读到的是最新的 */
+u64 task_idle_time(){
+    assert(!get_IF());
+
+    return ((TCB_t *)idle_task->owner)->stime;
+}
+
+/* 将所有任务的信息写入 info，最多 count 个，返回写入的个数 */
+int32 sys_task_info(task_info_t *info, u32 count){
+    assert(!get_IF());
+
+    TCB_t *current = (TCB_t *)running_task->owner;
+    u64 now = rdtsc();
+    u32 n = 0;
+
+    /* 当前任务正在内核中运行，先把这一段时间记上 */
+    current->stime += now - current->acct_stamp;
+    current->acct_stamp = now;
+
+    for (size_t i = 0; i < PID_HASH_NR && n < count; ++i){
+        List_t *bucket = &pid_hash_table[i];
+
+        for (ListNode_t *iter = bucket->end.next; iter != &bucket->end && n < count; iter = iter->next){
+            TCB_t *task = (TCB_t *)iter->owner;
+            task_info_t *ti = &info[n++];
+
+            ti->pid = task->pid;
+            ti->ppid = task->ppid;
+            ti->state = task->state;
+            ti->priority = task->priority;
+            strcpy(ti->name, task->name);
+            ti->utime = task->utime;
+            ti->stime = task->stime;
+            ti->nvcsw = task->nvcsw;
+            ti->nivcsw = task->nivcsw;
+            ti->page_faults = task->page_faults;
+        }
+    }
+
+    return n;
+}
+
+/* leader 调用 thread_exit 等同于 exit，整个线程组退出 */
+void sys_thread_exit(int status){
+    assert(!get_IF());
+
+    TCB_t *task = (TCB_t *)running_task->owner;
+
+    if (task == task->leader)
+        sys_exit(status);
+    else
+        thread_exit(task, status);
+}
+
+/* 任意线程调用 exit 都会使整个线程组退出
+ * 其他线程在返回用户态时退出，leader 等它们全部退出后再释放进程资源 */
 void sys_exit(int status){
     assert(!get_IF());
 
     TCB_t *task = (TCB_t *)running_task->owner;
+    thread_group_t *group = task->leader->group;
+
+    if (group != NULL){
+        if (!group->exiting){
+            group->exiting = true;
+            group->status = status;
+            thread_group_wake(task->leader);
+        }
+
+        if (task != task->leader)
+            thread_exit(task, group->status);
+
+        while (group->count > 1){
+            group->leader_waiting = true;
+            block(block_list, NULL, TASK_BLOCKED);
+        }
+
+        status = group->status;
+        task->group = NULL;
+        free(group);
+    }
+
+    /* uring 的工作线程还在使用文件和地址空间，先等它们退出
+     * 等待时会阻塞，必须在任务进入 died_list 之前进行 */
+    uring_release(task);
+
+    /* 关闭所有文件，管道的另一端由此得知这一端已经关闭
+     * 写回脏的 inode 时可能阻塞，和目录的释放一起放在进入 died_list 之前 */
+    for (fd_t fd = 0; fd < TASK_FILE_NR; ++fd){
+        if (task->files[fd]){
+            file_put(task->files[fd]);
+            task->files[fd] = NULL;
+        }
+    }
+
+    iput(task->i_pwd);
+    iput(task->i_root);
 
     /* 主动调用 exit 的肯定是当前任务，不属于任何状态链表，所以可以直接压入 */
     list_push(died_list, running_task);
@@ -388,32 +894,29 @@ void sys_exit(int status){
     task->state = TASK_DIED;
     task->status = status;
 
-    free_kpage((void *)task->vmap->start, 1);
-    free(task->vmap);
-    task->vmap = NULL;
-
-    iput(task->i_pwd);
-    iput(task->i_root);
     free(task->pwd);
     task->pwd = NULL;
 
-    free_pde();//*************
+    fpu_release(task);
 
-    /* 将该进程的子进程指向它的爷爷 */
-    for (size_t i = 0; i < TASK_NUM; ++i){
-        if (!task_bucket[i])
-            continue;
-
-        TCB_t *child = (TCB_t *)task_bucket[i]->owner;
-        if (child->ppid == task->pid)
-            child->ppid = task->ppid;
+    /* vfork 的子进程借用的是父进程的地址空间，不能释放 */
+    if (task->vfork_parent){
+        task_vfork_release(task);
     }
+    else{
+        free_kpage((void *)task->vmap->start, 1);
+        free(task->vmap);
+        vma_list_release(task->vmas);
 
-    TCB_t *parent = (TCB_t *)task_bucket[task->ppid]->owner;
-    if (parent->state == TASK_WAITING && 
-        (parent->waitpid == -1 || parent->waitpid == task->pid)){
-        unblock(task_bucket[task->ppid]);
+        vdso_unmap(task);
+        free_pde();//*************
     }
+    task->vmap = NULL;
+    task->vmas = NULL;
+
+    /* 将该进程的子进程指向它的爷爷 */
+    task_reparent(task);
+    task_notify_parent(task);
 
     printk(TASK_LOG_INFO "task %p exit\n", task);
 
@@ -427,43 +930,46 @@ pid_t sys_waitpid(pid_t pid, int32 *status)
 
     TCB_t *task = (TCB_t *)current_task()->owner;
     TCB_t *child = NULL;
-    ListNode_t *child_node = NULL;
-    bool has_child = false;
+    bool has_child;
 
-    for (pid_t i = 0; i < TASK_NUM; ++i){
-        child_node = task_bucket[i];
-        
-        if (child_node == NULL)
-            continue;
+    /* 子进程属于 leader，唤醒时也只唤醒 leader，其他线程不能等待子进程 */
+    if (task != task->leader)
+        return -1;
 
-        child = (TCB_t *)child_node->owner;
+    /* 只需要遍历自己的子进程链表
+     * 被唤醒后重新查找，因为唤醒者不一定是上一次找到的子进程 */
+    while (true){
+        has_child = false;
 
-        if (child->ppid != task->pid)
-            continue;
-        if (pid != child->pid && pid != -1)
-            continue;
+        for (ListNode_t *iter = task->children.end.next; iter != &task->children.end; iter = iter->next){
+            child = (TCB_t *)iter->owner;
 
-        if (child->state == TASK_DIED)
-            goto freeTask;
+            if (pid != child->pid && pid != -1)
+                continue;
 
-        has_child = true;
-        break;
-    }
+            if (child->state == TASK_DIED)
+                goto freeTask;
+
+            has_child = true;
+        }
+
+        /* 释放失败，线程组正在退出时也直接返回 */
+        if (!has_child || (task->group && task->group->exiting))
+            return -1;
 
-    if (has_child){
         task->waitpid = pid;
         block(block_list, NULL, TASK_WAITING);
-        goto freeTask;
     }
 
-    /* 释放失败 */
-    return -1;
-
 freeTask:
-    task_bucket[child->pid] = NULL;
+    remove_node(&child->hash_node);
+    remove_node(&child->sibling);
+    bitmap_set(&pid_map, child->pid, false);
 
-    *status = child->status;
+    if (status)
+        *status = child->status;
     u32 ret = child->pid;
+    ListNode_t *child_node = child->node;
 
     /* 释放 TCB */
     free_kpage(child, 1);
@@ -534,14 +1040,19 @@ void task_sleep(time_t time){
     schedule();
 }
 
+/* sleep_list 按唤醒时间从小到大排列，同一时间片内到期的任务要全部唤醒 */
 void weakup(){
     assert(!get_IF());
     
     ListNode_t *iter = sleep_list->end.next;
-    if (iter->owner != NULL && jiffies >= iter->value){   
+    while (iter->owner != NULL && jiffies >= iter->value){   
+        ListNode_t *next = iter->next;
+
         remove_node(iter);
         ((TCB_t*)iter->owner)->state = TASK_READY;
         list_push(ready_list, iter);
+
+        iter = next;
     }
 }
 
@@ -559,7 +1070,11 @@ void usb_device_enumeration();
 
 extern ListNode_t *dev_enum_task;
 void task_init(){
-    memset(task_bucket, 0, sizeof(task_bucket));
+    bitmap_init(&pid_map, pid_map_buf, sizeof(pid_map_buf), 0);
+    next_pid = 0;
+
+    for (size_t i = 0; i < PID_HASH_NR; ++i)
+        list_init(&pid_hash_table[i]);
 
     block_list = new_list();
     sleep_list = new_list();
@@ -570,11 +1085,18 @@ void task_init(){
 
     /* 内核线程在开启时要手动开中断！手动开中断！手动开中断！重要的事情说三遍 */
     /* 不然容易产生全局 bug */
-    kernel_task_create(__idle, "idle", 1);
+    /* idle 不在就绪队列中，只有没有其他就绪任务时才会被调度
+     * 否则每轮调度都要在 idle 的 hlt 上等一个时钟中断 */
+    idle_task = kernel_task_create(__idle, "idle", 1);
+    remove_node(idle_task);
     //kernel_task_create(__usb_test, "test", 3);
     user_task_create(__init, "init", 3);
     dev_enum_task = kernel_task_create(usb_device_enumeration, "usb_enum", 3);
     //kernel_task_create(__keyboard, "keyboard", 2);
     //kernel_task_create(__disk_test, "test", 2);
     //kernel_task_create(__disk_test2, "test", 2);
+
+#ifdef RDIX_BENCH
+    bench_init();
+#endif
 }
\ No newline at end of file
@@ -16,6 +16,7 @@ void __idle(){
             "hlt\n" // 关闭 CPU，进入暂停状态，等待外中断的到来
         );
         set_IF(false);
+        task_reap();
         schedule();
         set_IF(true);
     }
@@ -63,7 +64,6 @@ void __init(){
 
 #include <rdix/xhci.h>
 extern xhc_t* xhc;
-extern u64 *debug_pba;
 extern general_usb_dev_t *test_dev;
 void get_report(general_usb_dev_t *dev, void *buf, u32 bsize);
 void __usb_test(){
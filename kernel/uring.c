@@ -0,0 +1,369 @@
+#include <rdix/uring.h>
+#include <rdix/task.h>
+#include <rdix/shm.h>
+#include <rdix/kernel.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/clock.h>
+#include <common/interrupt.h>
+
+#define URING_LOG_INFO __LOG("[uring]")
+
+#define barrier() asm volatile("": : :"memory")
+
+extern bitmap_t v_bit_map;
+extern time_t jiffies;
+
+extern fd_t sys_open(char *filename, int flags, int mode);
+extern int sys_read(fd_t fd, char *buf, int count);
+extern int sys_write(fd_t fd, char *buf, int count);
+
+/* 从 sq 中取出的请求，sqe 复制到内核中，用户可以立即复用该 sq 项 */
+typedef struct uring_req_t{
+    ListNode_t node;
+    uring_sqe_t sqe;
+} uring_req_t;
+
+/* 在工作线程中执行一个请求，调用前需要关中断，和系统调用的环境相同
+ * 工作线程的 leader 就是提交请求的进程，文件和目录都通过 leader 访问 */
+static int32 uring_do(uring_sqe_t *sqe){
+    TCB_t *leader = current_leader();
+    char *buf = (char *)sqe->addr;
+    file_t *file;
+
+    switch (sqe->opcode){
+    case URING_OP_NOP:
+        return 0;
+    case URING_OP_OPEN:
+        return sys_open((char *)sqe->addr, sqe->len, sqe->off);
+    default:
+        break;
+    }
+
+    if (sqe->fd < 0 || sqe->fd >= TASK_FILE_NR)
+        return EOF;
+    file = leader->files[sqe->fd];
+
+    switch (sqe->opcode){
+    case URING_OP_READ:
+        if (file == NULL)
+            return sqe->fd == stdin ? sys_read(sqe->fd, buf, sqe->len) : EOF;
+        if (sqe->off == URING_OFF_CUR || file->pipe)
+            return sys_read(sqe->fd, buf, sqe->len);
+        if ((file->flags & O_ACCMODE) == O_WRONLY)
+            return EOF;
+        return inode_read(file->inode, buf, sqe->len, sqe->off);
+    case URING_OP_WRITE:
+        if (file == NULL)
+            return sqe->fd == stdout || sqe->fd == stderr ? sys_write(sqe->fd, buf, sqe->len) : EOF;
+        if (sqe->off == URING_OFF_CUR || file->pipe)
+            return sys_write(sqe->fd, buf, sqe->len);
+        if ((file->flags & O_ACCMODE) == O_RDONLY)
+            return EOF;
+        return inode_write(file->inode, buf, sqe->len, sqe->off);
+    case URING_OP_FSYNC:
+        if (file == NULL || file->pipe)
+            return EOF;
+        sync_dev(file->inode->dev);
+        return 0;
+    default:
+        return EOF;
+    }
+}
+
+/* 从 sq 中最多取出 count 个请求交给工作线程，返回取出的个数，调用前需要关中断
+ * cq 中必须为每个执行中的请求留有位置，cq 满时不再取出 */
+static u32 uring_submit(uring_t *ur, u32 count){
+    uring_ring_t *ring = ur->ring;
+    u32 submitted = 0;
+
+    assert(!get_IF());
+
+    while (submitted < count && ring->sq_head != ring->sq_tail &&
+           ur->inflight + (ring->cq_tail - ring->cq_head) < ur->cq_entries){
+        uring_req_t *req = (uring_req_t *)malloc(sizeof(uring_req_t));
+
+        barrier();
+        memcpy(&req->sqe, &ur->sqes[ring->sq_head & ur->sq_mask], sizeof(uring_sqe_t));
+        barrier();
+        ++ring->sq_head;
+
+        node_init(&req->node, req, 0);
+        list_push(&ur->pending, &req->node);
+        ++ur->inflight;
+        ++submitted;
+
+        wake_up_one(&ur->work_wait);
+    }
+
+    return submitted;
+}
+
+/* 写入一个完成项并唤醒等待者，调用前需要关中断 */
+static void uring_complete(uring_t *ur, u32 user_data, int32 res){
+    uring_ring_t *ring = ur->ring;
+    uring_cqe_t *cqe = &ur->cqes[ring->cq_tail & ur->cq_mask];
+
+    assert(!get_IF());
+
+    cqe->user_data = user_data;
+    cqe->res = res;
+    barrier();
+    ++ring->cq_tail;
+    --ur->inflight;
+
+    wake_up_all(&ur->cq_wait);
+}
+
+/* 内核线程退出，TCB 由 task_reap 回收 */
+static void uring_thread_exit(uring_t *ur){
+    set_IF(false);
+
+    --ur->threads;
+    wake_up_all(&ur->exit_wait);
+
+    kernel_thread_exit(NULL, 0);
+}
+
+/* 工作线程，参数保存在 edi 中 */
+static void uring_worker(){
+    uring_t *ur;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(ur)
+    );
+
+    /* 内核线程在创建时需要手动开中断 */
+    set_IF(true);
+
+    while (true){
+        bool IF_stat = get_and_disable_IF();
+
+        wait_event(&ur->work_wait, ur->exiting || !list_isempty(&ur->pending));
+        if (ur->exiting){
+            set_IF(IF_stat);
+            break;
+        }
+
+        uring_req_t *req = (uring_req_t *)list_popback(&ur->pending)->owner;
+
+        uring_complete(ur, req->sqe.user_data, uring_do(&req->sqe));
+        free(req);
+
+        set_IF(IF_stat);
+    }
+
+    uring_thread_exit(ur);
+}
+
+/* 轮询线程，不断把 sq 中的新请求交给工作线程
+ * 空闲超过 URING_SQPOLL_IDLE 后设置 URING_SQ_NEED_WAKEUP 并睡眠 */
+static void uring_sqpoll(){
+    uring_t *ur;
+    time_t idle;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(ur)
+    );
+
+    set_IF(true);
+
+    uring_ring_t *ring = ur->ring;
+    idle = jiffies;
+
+    while (true){
+        bool IF_stat = get_and_disable_IF();
+
+        if (ur->exiting){
+            set_IF(IF_stat);
+            break;
+        }
+
+        if (uring_submit(ur, ur->sq_entries)){
+            idle = jiffies;
+        }
+        else if (jiffies - idle >= URING_SQPOLL_IDLE / JIFFY){
+            ring->sq_flags |= URING_SQ_NEED_WAKEUP;
+            barrier();
+            wait_event(&ur->sq_wait, ur->exiting || ring->sq_head != ring->sq_tail);
+            ring->sq_flags &= ~URING_SQ_NEED_WAKEUP;
+            idle = jiffies;
+        }
+        else{
+            /* 让出 cpu，没有其他就绪任务时会立即回到这里 */
+            schedule();
+        }
+
+        set_IF(IF_stat);
+    }
+
+    uring_thread_exit(ur);
+}
+
+/* 创建与 leader 共享地址空间和文件的内核线程，调用前需要关中断
+ * 和 clone 出的线程一样不是任何进程的子进程 */
+static void uring_thread_create(uring_t *ur, TCB_t *leader, task_program handle, const char *name){
+    ListNode_t *node = task_create(handle, ur, name, leader->base_priority, KERNEL_UID);
+    TCB_t *th = (TCB_t *)node->owner;
+
+    assert(!get_IF());
+
+    if (th->sibling.container)
+        remove_node(&th->sibling);
+
+    th->ppid = leader->ppid;
+    th->leader = leader;
+    th->pde = leader->pde;
+    th->vmap = leader->vmap;
+
+    /* 路径查找使用 leader 的目录，task_create 取得的目录引用用不到 */
+    iput(th->i_root);
+    iput(th->i_pwd);
+    free(th->pwd);
+    th->i_root = NULL;
+    th->i_pwd = NULL;
+    th->pwd = NULL;
+
+    ++ur->threads;
+}
+
+/* 建立一对 sq/cq，映射到用户的共享内存区域中，返回共享区域的地址，失败返回 NULL
+ * entries 会向上取为 2 的幂，每个进程只能有一个 uring */
+uring_ring_t *sys_uring_setup(u32 entries, u32 flags){
+    assert(!get_IF());
+
+    TCB_t *leader = current_leader();
+    u32 sq_entries = 1;
+
+    if (leader->vmap == &v_bit_map || leader->uring != NULL)
+        return NULL;
+    if (entries == 0 || entries > URING_ENTRIES_MAX)
+        return NULL;
+
+    while (sq_entries < entries)
+        sq_entries <<= 1;
+
+    u32 sqes_off = (sizeof(uring_ring_t) + 31) & ~31;
+    u32 cqes_off = sqes_off + sq_entries * sizeof(uring_sqe_t);
+    u32 size = cqes_off + sq_entries * 2 * sizeof(uring_cqe_t);
+    u32 pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uring_t *ur = (uring_t *)malloc(sizeof(uring_t));
+
+    memset(ur, 0, sizeof(uring_t));
+    ur->pages = pages;
+    ur->flags = flags;
+    ur->frames = (page_idx_t *)malloc(pages * sizeof(page_idx_t));
+    for (u32 i = 0; i < pages; ++i)
+        ur->frames[i] = PAGE_IDX((u32)alloc_zero_page());
+
+    u32 vaddr = shm_map(ur->frames, pages, 0);
+    if (vaddr == 0){
+        for (u32 i = 0; i < pages; ++i)
+            page_unref(ur->frames[i]);
+        free(ur->frames);
+        free(ur);
+        return NULL;
+    }
+
+    uring_ring_t *ring = (uring_ring_t *)vaddr;
+
+    ring->sq_mask = sq_entries - 1;
+    ring->sq_entries = sq_entries;
+    ring->cq_mask = sq_entries * 2 - 1;
+    ring->cq_entries = sq_entries * 2;
+    ring->sqes_off = sqes_off;
+    ring->cqes_off = cqes_off;
+
+    ur->ring = ring;
+    ur->sqes = (uring_sqe_t *)(vaddr + sqes_off);
+    ur->cqes = (uring_cqe_t *)(vaddr + cqes_off);
+    ur->sq_mask = sq_entries - 1;
+    ur->cq_mask = sq_entries * 2 - 1;
+    ur->sq_entries = sq_entries;
+    ur->cq_entries = sq_entries * 2;
+    list_init(&ur->pending);
+    wait_queue_init(&ur->work_wait);
+    wait_queue_init(&ur->cq_wait);
+    wait_queue_init(&ur->sq_wait);
+    wait_queue_init(&ur->exit_wait);
+
+    /* 回收之前退出的 uring 线程 */
+    task_reap();
+
+    for (u32 i = 0; i < URING_WORKERS; ++i)
+        uring_thread_create(ur, leader, uring_worker, "uring");
+    if (flags & URING_SETUP_SQPOLL)
+        uring_thread_create(ur, leader, uring_sqpoll, "uring-sqpoll");
+
+    leader->uring = ur;
+
+    printk(URING_LOG_INFO "setup %d entries at 0x%p%s\n", sq_entries, vaddr,
+           flags & URING_SETUP_SQPOLL ? ", sqpoll" : "");
+
+    return ring;
+}
+
+/* 提交最多 to_submit 个请求，返回提交的个数，SQPOLL 模式下由轮询线程提交
+ * 带 URING_ENTER_GETEVENTS 时等待 cq 中至少有 min_complete 个完成项
+ * 已经没有执行中和待提交的请求时不再等待 */
+int32 sys_uring_enter(u32 to_submit, u32 min_complete, u32 flags){
+    assert(!get_IF());
+
+    uring_t *ur = current_leader()->uring;
+    u32 submitted = 0;
+
+    if (ur == NULL || ur->exiting)
+        return EOF;
+
+    uring_ring_t *ring = ur->ring;
+
+    if (ur->flags & URING_SETUP_SQPOLL){
+        if (flags & URING_ENTER_SQ_WAKEUP)
+            wake_up_one(&ur->sq_wait);
+    }
+    else{
+        submitted = uring_submit(ur, to_submit);
+    }
+
+    if (flags & URING_ENTER_GETEVENTS){
+        wait_event(&ur->cq_wait, ur->exiting ||
+                   ring->cq_tail - ring->cq_head >= min_complete ||
+                   (ur->inflight == 0 && ring->sq_head == ring->sq_tail));
+    }
+
+    return submitted;
+}
+
+void uring_release(TCB_t *leader){
+    uring_t *ur = leader->uring;
+    ListNode_t *node;
+
+    if (ur == NULL)
+        return;
+
+    bool IF_stat = get_and_disable_IF();
+
+    ur->exiting = true;
+    wake_up_all(&ur->work_wait);
+    wake_up_all(&ur->sq_wait);
+    wake_up_all(&ur->cq_wait);
+
+    set_IF(IF_stat);
+
+    /* 工作线程执行完手中的请求后退出，还没有执行的请求直接丢弃 */
+    wait_event(&ur->exit_wait, ur->threads == 0);
+
+    while ((node = list_pop(&ur->pending)) != NULL)
+        free(node->owner);
+
+    /* 映射仍然保留到地址空间释放时，那时物理页的最后一次引用被释放 */
+    for (u32 i = 0; i < ur->pages; ++i)
+        page_unref(ur->frames[i]);
+    free(ur->frames);
+    free(ur);
+
+    leader->uring = NULL;
+}
@@ -0,0 +1,139 @@
+#include <rdix/vdso.h>
+#include <rdix/task.h>
+#include <rdix/memory.h>
+#include <rdix/kernel.h>
+#include <rdix/hardware.h>
+#include <common/clock.h>
+#include <common/time.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define VDSO_LOG_INFO __LOG("[vdso]")
+
+#define barrier() asm volatile("": : :"memory")
+
+extern time_t jiffies;
+
+/* 所有进程共享的只读数据页，内核通过其内核地址写入 */
+static vdso_data_t *vdata;
+
+void vdso_init(){
+    time_b tm;
+
+    vdata = (vdso_data_t *)alloc_kpage(1);
+    memset((void *)vdata, 0, PAGE_SIZE);
+
+    time_read(&tm);
+    vdata->startup = mktime(&tm);
+    vdata->wall_sec = vdata->startup;
+    vdata->magic = VDSO_MAGIC;
+
+    printk(VDSO_LOG_INFO "vdso data page at 0x%p\n", vdata);
+}
+
+/* 在时钟中断中调用，此时中断是关闭的，只有一个写者 */
+void vdso_tick(){
+    u64 now = rdtsc();
+
+    ++vdata->seq;
+    barrier();
+
+    vdata->jiffies = jiffies;
+    vdata->wall_sec = vdata->startup + jiffies / TIME_SLICE;
+
+    /* 用相邻两次时钟中断间 tsc 的增量标定 tsc 频率，取滑动平均 */
+    if (vdata->tsc_stamp){
+        u32 delta = (u32)(now - vdata->tsc_stamp);
+
+        if (vdata->tsc_per_jiffy)
+            vdata->tsc_per_jiffy = (vdata->tsc_per_jiffy / 8) * 7 + delta / 8;
+        else
+            vdata->tsc_per_jiffy = delta;
+        vdata->tsc_khz = vdata->tsc_per_jiffy / JIFFY;
+    }
+    vdata->tsc_stamp = now;
+
+    barrier();
+    ++vdata->seq;
+}
+
+/* 内核中使用的 tsc 频率，尚未标定时为 0 */
+u32 vdso_tsc_khz(){
+    return vdata->tsc_khz;
+}
+
+/* 内核线程以及数据页无效时，用户库通过以下两个系统调用取时间 */
+time_t sys_time(){
+    return vdata->startup + jiffies / TIME_SLICE;
+}
+
+u32 sys_uptime(){
+    return jiffies * JIFFY;
+}
+
+void vdso_task_sync(TCB_t *task){
+    vdso_task_t *vt = task->vdso;
+
+    if (vt == NULL)
+        return;
+
+    ++vt->seq;
+    barrier();
+    vt->pid = task->pid;
+    vt->ppid = task->ppid;
+    vt->magic = VDSO_MAGIC;
+    barrier();
+    ++vt->seq;
+}
+
+/* vfork 的子进程和父进程共用数据页，子进程运行期间让读者改用系统调用
+ * 子进程 exec 或 exit 后由 vdso_task_sync 恢复 */
+void vdso_task_invalidate(TCB_t *task){
+    vdso_task_t *vt = task->vdso;
+
+    if (vt == NULL)
+        return;
+
+    ++vt->seq;
+    barrier();
+    vt->magic = 0;
+    barrier();
+    ++vt->seq;
+}
+
+/* 在 task 的页目录中建立内核数据页的映射
+ * 页目录、页表以及数据页都是内核内存，虚拟地址等于物理地址
+ * 所以不要求 task 的页目录是当前页目录 */
+void vdso_map(TCB_t *task){
+    page_entry_t *pde = task->pde;
+    page_entry_t *pte = (page_entry_t *)alloc_kpage(1);
+
+    task->vdso = (vdso_task_t *)alloc_kpage(1);
+    memset((void *)task->vdso, 0, PAGE_SIZE);
+    memset((void *)pte, 0, PAGE_SIZE);
+
+    entry_init(&pte[TIDX(VDSO_DATA_ADDR)], PAGE_IDX((u32)vdata));
+    pte[TIDX(VDSO_DATA_ADDR)].write = false;
+    entry_init(&pte[TIDX(VDSO_TASK_ADDR)], PAGE_IDX((u32)task->vdso));
+    pte[TIDX(VDSO_TASK_ADDR)].write = false;
+
+    entry_init(&pde[DIDX(VDSO_START)], PAGE_IDX((u32)pte));
+
+    vdso_task_sync(task);
+}
+
+/* 在释放页目录之前调用，数据页和页表都是内核页，不经过 p_bit_map */
+void vdso_unmap(TCB_t *task){
+    page_entry_t *dentry = &task->pde[DIDX(VDSO_START)];
+
+    if (task->vdso == NULL)
+        return;
+
+    assert(dentry->present);
+    free_kpage((void *)PAGE_ADDR(dentry->index), 1);
+    free_kpage((void *)task->vdso, 1);
+
+    dentry->present = false;
+    task->vdso = NULL;
+}
@@ -0,0 +1,348 @@
+#include <rdix/virtio.h>
+#include <rdix/pci.h>
+#include <rdix/kernel.h>
+#include <rdix/memory.h>
+#include <common/io.h>
+#include <common/assert.h>
+#include <common/string.h>
+#include <common/interrupt.h>
+
+#define VIRTIO_LOG_INFO __LOG("[virtio]")
+#define VIRTIO_WARNING_INFO __WARNING("[virtio warning]")
+
+#define barrier() asm volatile("": : :"memory")
+
+/* modern 接口的寄存器访问，off 为相对于 common 配置结构的偏移 */
+#define COMMON8(vdev, off) (*(volatile u8 *)((vdev)->common + (off)))
+#define COMMON16(vdev, off) (*(volatile u16 *)((vdev)->common + (off)))
+#define COMMON32(vdev, off) (*(volatile u32 *)((vdev)->common + (off)))
+
+/* 映射 modern 接口用到的 BAR，同一个 BAR 只映射一次
+ * 只能使用 4G 以下的地址 */
+static volatile u8 *virtio_map_bar(pci_device_t *pci, u8 bar, vir_addr_t *mapped){
+    bar_entry *entry = &pci->BAR[bar];
+
+    /* io 空间或者高 32 位不为 0 的 64 位 BAR 无法映射 */
+    if (entry->base_addr == 0 || (entry->type & 1))
+        return NULL;
+    if ((entry->type & 0x6) == 0x4 && (bar == 5 || pci_dev_reg_read(pci, 0x10 + (bar + 1) * 4)))
+        return NULL;
+
+    if (mapped[bar] == NULL)
+        mapped[bar] = link_nppage((phy_addr_t)entry->base_addr, entry->size);
+
+    return (volatile u8 *)mapped[bar];
+}
+
+/* 查找 modern 接口的 vendor 能力，找齐 common、notify、isr 和 device 配置结构才使用 modern 接口 */
+static bool virtio_modern_probe(virtio_dev_t *vdev){
+    pci_device_t *pci = vdev->pci;
+    vir_addr_t mapped[6] = {NULL};
+    cap_p_t cap = PCI_CAP_END_PTR;
+
+    while ((cap = capability_search_next(pci, cap, PCI_CAP_ID_VNDR)) != PCI_CAP_END_PTR){
+        u32 reg = pci_dev_reg_read(pci, cap);
+        u8 type = (reg >> 24) & 0xff;
+        u8 bar = pci_dev_reg_read(pci, cap + 4) & 0xff;
+        u32 offset = pci_dev_reg_read(pci, cap + 8);
+        volatile u8 *base;
+
+        if (bar > 5 || type < VIRTIO_PCI_CAP_COMMON_CFG || type > VIRTIO_PCI_CAP_DEVICE_CFG)
+            continue;
+        if ((base = virtio_map_bar(pci, bar, mapped)) == NULL)
+            return false;
+
+        base += offset;
+
+        switch (type){
+        case VIRTIO_PCI_CAP_COMMON_CFG:
+            if (!vdev->common) vdev->common = base;
+            break;
+        case VIRTIO_PCI_CAP_NOTIFY_CFG:
+            if (!vdev->notify){
+                vdev->notify = base;
+                vdev->notify_mul = pci_dev_reg_read(pci, cap + 16);
+            }
+            break;
+        case VIRTIO_PCI_CAP_ISR_CFG:
+            if (!vdev->isr) vdev->isr = base;
+            break;
+        case VIRTIO_PCI_CAP_DEVICE_CFG:
+            if (!vdev->device) vdev->device = base;
+            break;
+        }
+    }
+
+    return vdev->common && vdev->notify && vdev->isr && vdev->device;
+}
+
+/* 选择接口并复位设备，之后设置 ACK 和 DRIVER 状态
+ * 有 modern 能力时优先使用 modern 接口，否则使用 BAR0 中的 legacy 接口 */
+bool virtio_pci_init(virtio_dev_t *vdev, pci_device_t *pci){
+    memset(vdev, 0, sizeof(virtio_dev_t));
+    vdev->pci = pci;
+
+    u32 cmd = pci_dev_reg_read(pci, PCI_CONFIG_SPACE_CMD);
+
+    cmd |= __PCI_CS_CMD_IO_ENABLE | __PCI_CS_CMD_MMIO_ENABLE | __PCI_CS_CMD_BUS_MASTER_ENABLE;
+    pci_dev_reg_write(pci, PCI_CONFIG_SPACE_CMD, cmd);
+
+    if (virtio_modern_probe(vdev)){
+        vdev->modern = true;
+    }
+    else if (pci->BAR[0].type & 1){
+        vdev->io_base = pci->BAR[0].base_addr;
+    }
+    else{
+        printk(VIRTIO_WARNING_INFO "no usable virtio interface\n");
+        return false;
+    }
+
+    /* 复位，写 0 之后要等读回 0 才算复位完成 */
+    virtio_set_status(vdev, 0);
+    for (time_t limit = 0x100000; limit && virtio_get_status(vdev); --limit);
+
+    virtio_set_status(vdev, VIRTIO_STATUS_ACK);
+    virtio_set_status(vdev, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    printk(VIRTIO_LOG_INFO "device %x use %s interface\n", pci->deviceID, vdev->modern ? "modern" : "legacy");
+    return true;
+}
+
+void virtio_set_status(virtio_dev_t *vdev, u8 status){
+    if (vdev->modern)
+        COMMON8(vdev, VIRTIO_PCI_COMMON_STATUS) = status;
+    else
+        port_outb(vdev->io_base + VIRTIO_PCI_STATUS, status);
+}
+
+u8 virtio_get_status(virtio_dev_t *vdev){
+    if (vdev->modern)
+        return COMMON8(vdev, VIRTIO_PCI_COMMON_STATUS);
+    return port_inb(vdev->io_base + VIRTIO_PCI_STATUS);
+}
+
+/* 协商低 32 位特性，accepted 返回双方都支持的特性
+ * modern 接口还要协商 VERSION_1，并检查设备是否接受 (FEATURES_OK) */
+bool virtio_negotiate(virtio_dev_t *vdev, u32 features, u32 *accepted){
+    u8 status = virtio_get_status(vdev);
+
+    if (!vdev->modern){
+        features &= port_ind(vdev->io_base + VIRTIO_PCI_HOST_FEATURES);
+        port_outd(vdev->io_base + VIRTIO_PCI_GUEST_FEATURES, features);
+        *accepted = features;
+        return true;
+    }
+
+    COMMON32(vdev, VIRTIO_PCI_COMMON_DFSELECT) = 0;
+    features &= COMMON32(vdev, VIRTIO_PCI_COMMON_DF);
+    COMMON32(vdev, VIRTIO_PCI_COMMON_DFSELECT) = 1;
+    if (!(COMMON32(vdev, VIRTIO_PCI_COMMON_DF) & VIRTIO_F_VERSION_1_HI))
+        return false;
+
+    COMMON32(vdev, VIRTIO_PCI_COMMON_GFSELECT) = 0;
+    COMMON32(vdev, VIRTIO_PCI_COMMON_GF) = features;
+    COMMON32(vdev, VIRTIO_PCI_COMMON_GFSELECT) = 1;
+    COMMON32(vdev, VIRTIO_PCI_COMMON_GF) = VIRTIO_F_VERSION_1_HI;
+
+    virtio_set_status(vdev, status | VIRTIO_STATUS_FEATURES_OK);
+    if (!(virtio_get_status(vdev) & VIRTIO_STATUS_FEATURES_OK))
+        return false;
+
+    *accepted = features;
+    return true;
+}
+
+/* 优先使用 MSI-X，表项 0 给队列使用，配置变化不产生中断
+ * 不支持时退回到传统中断引脚，此时处理函数需要读 ISR 应答 */
+bool virtio_int_init(virtio_dev_t *vdev, u8 vector, handler_t handler){
+    if (install_MSI_X_int(vdev->pci, 6, NULL, &vector, 1, &handler) != EOF){
+        vdev->int_mode = VIRTIO_INT_MSIX;
+    }
+    else if (install_INTx_int(vdev->pci, 0, __IOREDTBL_TRIGGER_MODE, handler) != EOF){
+        vdev->int_mode = VIRTIO_INT_INTX;
+    }
+    else{
+        vdev->int_mode = VIRTIO_INT_NONE;
+        return false;
+    }
+
+    /* legacy 接口启用 MSI-X 后才能写向量寄存器，同时设备配置后移 */
+    if (vdev->int_mode == VIRTIO_INT_MSIX){
+        if (vdev->modern)
+            COMMON16(vdev, VIRTIO_PCI_COMMON_MSIX) = VIRTIO_MSI_NO_VECTOR;
+        else
+            port_outw(vdev->io_base + VIRTIO_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+    }
+
+    return true;
+}
+
+/* 读 ISR 同时清除，第 0 位表示队列有更新 */
+u8 virtio_isr(virtio_dev_t *vdev){
+    if (vdev->modern)
+        return *vdev->isr;
+    return port_inb(vdev->io_base + VIRTIO_PCI_ISR);
+}
+
+u32 virtio_cfg_read32(virtio_dev_t *vdev, u32 offset){
+    if (vdev->modern)
+        return *(volatile u32 *)(vdev->device + offset);
+    return port_ind(vdev->io_base + VIRTIO_PCI_CONFIG(vdev->int_mode == VIRTIO_INT_MSIX) + offset);
+}
+
+/* 建立第 index 个队列，使用 MSI-X 时队列的中断使用表项 0
+ * 设备不存在该队列或者不接受中断向量时返回 NULL */
+virtqueue_t *virtqueue_setup(virtio_dev_t *vdev, u16 index){
+    u16 size;
+
+    if (vdev->modern){
+        COMMON16(vdev, VIRTIO_PCI_COMMON_Q_SELECT) = index;
+        size = COMMON16(vdev, VIRTIO_PCI_COMMON_Q_SIZE);
+        if (size > VIRTQ_SIZE_MAX)
+            size = VIRTQ_SIZE_MAX;
+    }
+    else{
+        port_outw(vdev->io_base + VIRTIO_PCI_QUEUE_SEL, index);
+        size = port_inw(vdev->io_base + VIRTIO_PCI_QUEUE_NUM);
+    }
+
+    if (size == 0)
+        return NULL;
+
+    /* legacy 接口要求 used 环从下一个 VIRTIO_PCI_VRING_ALIGN 边界开始 */
+    u32 avail_off = size * sizeof(vring_desc_t);
+    u32 used_off = (avail_off + sizeof(vring_avail_t) + (size + 1) * sizeof(u16) + VIRTIO_PCI_VRING_ALIGN - 1)
+                   & ~(VIRTIO_PCI_VRING_ALIGN - 1);
+    u32 bytes = used_off + sizeof(vring_used_t) + size * sizeof(vring_used_elem_t) + sizeof(u16);
+
+    virtqueue_t *vq = (virtqueue_t *)malloc(sizeof(virtqueue_t));
+
+    vq->index = index;
+    vq->size = size;
+    vq->pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    vq->mem = alloc_kpage(vq->pages);
+    memset(vq->mem, 0, vq->pages * PAGE_SIZE);
+
+    vq->desc = (vring_desc_t *)vq->mem;
+    vq->avail = (vring_avail_t *)((u32)vq->mem + avail_off);
+    vq->used = (vring_used_t *)((u32)vq->mem + used_off);
+
+    /* 所有描述符串成空闲链表 */
+    for (u16 i = 0; i < size; ++i)
+        vq->desc[i].next = i + 1;
+    vq->free_head = 0;
+    vq->num_free = size;
+    vq->last_used = 0;
+    vq->notify_off = 0;
+
+    u32 paddr = (u32)get_phy_addr((vir_addr_t)vq->mem);
+    u16 vector = vdev->int_mode == VIRTIO_INT_MSIX ? 0 : VIRTIO_MSI_NO_VECTOR;
+    u16 readback = vector;
+
+    if (vdev->modern){
+        COMMON16(vdev, VIRTIO_PCI_COMMON_Q_SIZE) = size;
+        COMMON32(vdev, VIRTIO_PCI_COMMON_Q_DESCLO) = paddr;
+        COMMON32(vdev, VIRTIO_PCI_COMMON_Q_DESCHI) = 0;
+        COMMON32(vdev, VIRTIO_PCI_COMMON_Q_AVAILLO) = paddr + avail_off;
+        COMMON32(vdev, VIRTIO_PCI_COMMON_Q_AVAILHI) = 0;
+        COMMON32(vdev, VIRTIO_PCI_COMMON_Q_USEDLO) = paddr + used_off;
+        COMMON32(vdev, VIRTIO_PCI_COMMON_Q_USEDHI) = 0;
+        COMMON16(vdev, VIRTIO_PCI_COMMON_Q_MSIX) = vector;
+        readback = COMMON16(vdev, VIRTIO_PCI_COMMON_Q_MSIX);
+        vq->notify_off = COMMON16(vdev, VIRTIO_PCI_COMMON_Q_NOFF);
+        COMMON16(vdev, VIRTIO_PCI_COMMON_Q_ENABLE) = 1;
+    }
+    else{
+        if (vdev->int_mode == VIRTIO_INT_MSIX){
+            port_outw(vdev->io_base + VIRTIO_MSI_QUEUE_VECTOR, vector);
+            readback = port_inw(vdev->io_base + VIRTIO_MSI_QUEUE_VECTOR);
+        }
+        port_outd(vdev->io_base + VIRTIO_PCI_QUEUE_PFN, paddr >> VIRTIO_PCI_QUEUE_ADDR_SHIFT);
+    }
+
+    /* 设备没有资源时向量读回为 NO_VECTOR，队列收不到中断 */
+    if (readback != vector){
+        printk(VIRTIO_WARNING_INFO "queue %d msi-x vector rejected\n", index);
+        free_kpage(vq->mem, vq->pages);
+        free(vq);
+        return NULL;
+    }
+
+    printk(VIRTIO_LOG_INFO "queue %d size %d at 0x%p\n", index, size, paddr);
+    return vq;
+}
+
+/* 从空闲链表取 count 个描述符组成一条链，返回第一个描述符，不够时返回 EOF
+ * 链中除了最后一个都带 NEXT 标志，调用者只需要填地址、长度和 WRITE 标志 */
+int virtqueue_alloc(virtqueue_t *vq, u16 count){
+    if (count == 0 || vq->num_free < count)
+        return EOF;
+
+    u16 head = vq->free_head;
+    u16 idx = head;
+
+    for (u16 i = 1; i < count; ++i){
+        vq->desc[idx].flags = VRING_DESC_F_NEXT;
+        idx = vq->desc[idx].next;
+    }
+
+    vq->free_head = vq->desc[idx].next;
+    vq->desc[idx].flags = 0;
+    vq->num_free -= count;
+
+    return head;
+}
+
+/* 把以 head 开始的描述符链放回空闲链表 */
+void virtqueue_free(virtqueue_t *vq, u16 head){
+    u16 idx = head;
+
+    ++vq->num_free;
+    while (vq->desc[idx].flags & VRING_DESC_F_NEXT){
+        idx = vq->desc[idx].next;
+        ++vq->num_free;
+    }
+
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+}
+
+/* 把描述符链放入 avail 环，之后还需要 virtqueue_kick 通知设备
+ * 描述符内容必须先于 idx 对设备可见，x86 上保证写入顺序即可 */
+void virtqueue_submit(virtqueue_t *vq, u16 head){
+    vq->avail->ring[vq->avail->idx % vq->size] = head;
+    barrier();
+    ++vq->avail->idx;
+    barrier();
+}
+
+/* 取出一个设备已经完成的描述符链，没有时返回 false */
+bool virtqueue_pop(virtqueue_t *vq, u16 *head, u32 *len){
+    if (vq->last_used == vq->used->idx)
+        return false;
+
+    barrier();
+
+    vring_used_elem_t *elem = &vq->used->ring[vq->last_used % vq->size];
+
+    *head = elem->id;
+    if (len)
+        *len = elem->len;
+    ++vq->last_used;
+
+    return true;
+}
+
+/* 通知设备 avail 环有更新，设备要求不通知时跳过
+ * x86 上后面的读可以越过前面的写，avail->idx 写入之后读 used->flags 之前需要完整的内存屏障 */
+void virtqueue_kick(virtio_dev_t *vdev, virtqueue_t *vq){
+    asm volatile("mfence" : : : "memory");
+    if (vq->used->flags & VRING_USED_F_NO_NOTIFY)
+        return;
+
+    if (vdev->modern)
+        *(volatile u16 *)(vdev->notify + vq->notify_off * vdev->notify_mul) = vq->index;
+    else
+        port_outw(vdev->io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+}
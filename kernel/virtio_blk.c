@@ -0,0 +1,397 @@
+#include <rdix/virtio.h>
+#include <rdix/device.h>
+#include <rdix/part.h>
+#include <rdix/hba.h>
+#include <rdix/kernel.h>
+#include <rdix/memory.h>
+#include <rdix/task.h>
+#include <common/assert.h>
+#include <common/string.h>
+#include <common/interrupt.h>
+
+#define VBLK_LOG_INFO __LOG("[virtio-blk]")
+#define VBLK_WARNING_INFO __WARNING("[virtio-blk warning]")
+
+#define VBLK_MSI_VECTOR (VIRTIO_BLK_INT_NUM + MSI_INT_START)
+
+/* 最多支持的 virtio-blk 设备数 */
+#define VBLK_NR 4
+/* 交给块设备层的队列深度，每个请求至少占用 3 个描述符 */
+#define VBLK_QUEUE_DEPTH 32
+
+static virtio_blk_t *vblks[VBLK_NR];
+static u32 vblk_cnt;
+
+/* 调度开始之前无法睡眠等待中断，中断安装失败时也只能轮询 */
+static bool vblk_polling(virtio_blk_t *vblk){
+    return current_task() == NULL || !vblk->vdev.int_enabled;
+}
+
+/* 回收设备已经完成的请求，调用前需要关中断
+ * 异步请求在这里结束并释放描述符，同步请求只唤醒等待者
+ * 已经超时结束的请求，设备最终完成时只需要释放描述符 */
+static void vblk_reap(virtio_blk_t *vblk){
+    virtqueue_t *vq = vblk->vq;
+    u16 head;
+
+    while (virtqueue_pop(vq, &head, NULL)){
+        vblk_ctx_t *ctx = &vblk->ctx[head];
+        int status = ctx->status == VIRTIO_BLK_S_OK ? 0 : EOF;
+
+        if (ctx->done){
+            virtqueue_free(vq, head);
+            wake_up_all(&vblk->desc_wait);
+            continue;
+        }
+
+        ctx->done = true;
+
+        if (ctx->req){
+            request_t *req = ctx->req;
+
+            ctx->req = NULL;
+            virtqueue_free(vq, head);
+            wake_up_all(&vblk->desc_wait);
+            blk_end_request(req, status);
+            continue;
+        }
+
+        wake_up_all(&ctx->wait);
+    }
+}
+
+/* 轮询直到 ctx 完成，等待期间开中断并让出 cpu
+ * 超时返回 false，请求以出错结束，描述符仍归设备所有，等设备完成时由 vblk_reap 释放 */
+static bool vblk_poll_wait(virtio_blk_t *vblk, vblk_ctx_t *ctx){
+    time_t limit = 0x1000000;
+
+    while (!ctx->done && limit--){
+        vblk_reap(vblk);
+        if (ctx->done || current_task() == NULL)
+            continue;
+
+        set_IF(true);
+        ATOMIC_OPS(schedule(););
+        set_IF(false);
+    }
+
+    if (ctx->done)
+        return true;
+
+    printk(VBLK_WARNING_INFO "request timeout, sector %d\n", (u32)ctx->hdr.sector);
+
+    ctx->status = VIRTIO_BLK_S_IOERR;
+    ctx->done = true;
+
+    if (ctx->req){
+        request_t *req = ctx->req;
+
+        ctx->req = NULL;
+        blk_end_request(req, EOF);
+    }
+    return false;
+}
+
+/* 把 bytes 字节的缓冲区按物理页拆成描述符，物理连续的页合并到一个描述符中
+ * vq 为 NULL 时只计算需要的描述符数，*idx 为下一个要填写的描述符 */
+static u32 vblk_map(virtqueue_t *vq, u16 *idx, void *data, u32 bytes, u16 flags){
+    u32 vaddr = (u32)data;
+    u32 n = 0;
+    u32 last_addr = 0;
+    vring_desc_t *last = NULL;
+
+    while (bytes){
+        u32 chunk = PAGE_SIZE - (vaddr & 0xfff);
+        u32 paddr = (u32)get_phy_addr((vir_addr_t)vaddr);
+
+        if (chunk > bytes)
+            chunk = bytes;
+
+        if (n && paddr == last_addr){
+            if (last)
+                last->len += chunk;
+        }
+        else{
+            if (vq){
+                last = &vq->desc[*idx];
+                last->addr = paddr;
+                last->len = chunk;
+                last->flags = VRING_DESC_F_NEXT | flags;
+                *idx = last->next;
+            }
+            ++n;
+        }
+
+        last_addr = paddr + chunk;
+        vaddr += chunk;
+        bytes -= chunk;
+    }
+
+    return n;
+}
+
+/* 发送一个请求，数据为 bio 链，req 不为 NULL 时为异步请求，完成后由 vblk_reap 结束
+ * 同步请求等待完成后返回结果，数据段太多放不进队列时返回 EOF，调用前需要关中断 */
+static int vblk_submit(virtio_blk_t *vblk, u32 type, u64 sector, bio_t *bio, request_t *req){
+    virtqueue_t *vq = vblk->vq;
+    u16 flags = type == VIRTIO_BLK_T_IN ? VRING_DESC_F_WRITE : 0;
+    u32 segs = 0;
+    int head;
+
+    assert(!get_IF());
+
+    for (bio_t *b = bio; b; b = b->next)
+        segs += vblk_map(NULL, NULL, b->buf, b->count * SECTOR_SIZE, 0);
+
+    if (segs > vblk->seg_max || segs + 2 > vq->size)
+        return EOF;
+
+    /* 请求头和状态各占一个描述符 */
+    while ((head = virtqueue_alloc(vq, segs + 2)) == EOF){
+        if (vblk_polling(vblk)){
+            vblk_reap(vblk);
+            if (current_task()){
+                set_IF(true);
+                ATOMIC_OPS(schedule(););
+                set_IF(false);
+            }
+        }
+        else{
+            wait_event(&vblk->desc_wait, vq->num_free >= segs + 2);
+        }
+    }
+
+    vblk_ctx_t *ctx = &vblk->ctx[head];
+    u16 idx = head;
+
+    ctx->hdr.type = type;
+    ctx->hdr.reserved = 0;
+    ctx->hdr.sector = sector;
+    ctx->status = 0xff;
+    ctx->done = false;
+    ctx->req = req;
+
+    vq->desc[idx].addr = (u32)get_phy_addr((vir_addr_t)&ctx->hdr);
+    vq->desc[idx].len = sizeof(virtio_blk_outhdr_t);
+    idx = vq->desc[idx].next;
+
+    for (bio_t *b = bio; b; b = b->next)
+        vblk_map(vq, &idx, b->buf, b->count * SECTOR_SIZE, flags);
+
+    /* 状态字节由设备写入，是链中最后一个描述符 */
+    vq->desc[idx].addr = (u32)get_phy_addr((vir_addr_t)&ctx->status);
+    vq->desc[idx].len = 1;
+    vq->desc[idx].flags = VRING_DESC_F_WRITE;
+
+    virtqueue_submit(vq, head);
+    virtqueue_kick(&vblk->vdev, vq);
+
+    if (req){
+        if (vblk_polling(vblk))
+            vblk_poll_wait(vblk, ctx);
+        return 0;
+    }
+
+    if (vblk_polling(vblk)){
+        if (!vblk_poll_wait(vblk, ctx))
+            return EOF;
+    }
+    else
+        wait_event(&ctx->wait, ctx->done);
+
+    int status = ctx->status == VIRTIO_BLK_S_OK ? 0 : EOF;
+
+    virtqueue_free(vq, head);
+    wake_up_all(&vblk->desc_wait);
+
+    return status;
+}
+
+/* 同步读写，按一个请求最多能放下的扇区数拆分
+ * 最坏情况下缓冲区不对齐，每页都要单独一个描述符，还要多出一个 */
+static int vblk_io(virtio_blk_t *vblk, u32 type, void *buf, size_t count, u64 sector){
+    u32 segs = vblk->seg_max < vblk->vq->size - 2 ? vblk->seg_max : vblk->vq->size - 2;
+    u32 secs_max = (segs - 1) * PAGE_SIZE / SECTOR_SIZE;
+    bio_t bio;
+    int status = 0;
+
+    if (sector + count > vblk->capacity)
+        return EOF;
+
+    bool IF_stat = get_and_disable_IF();
+
+    while (count && status != EOF){
+        u32 n = count < secs_max ? count : secs_max;
+
+        bio.buf = buf;
+        bio.count = n;
+        bio.next = NULL;
+        status = vblk_submit(vblk, type, sector, &bio, NULL);
+
+        buf = (void *)((u32)buf + n * SECTOR_SIZE);
+        sector += n;
+        count -= n;
+    }
+
+    set_IF(IF_stat);
+    return status;
+}
+
+static int __vblk_read_secs(virtio_blk_t *vblk, void *buf, size_t count, idx_t idx){
+    return vblk_io(vblk, VIRTIO_BLK_T_IN, buf, count, idx);
+}
+
+static int __vblk_write_secs(virtio_blk_t *vblk, void *buf, size_t count, idx_t idx){
+    return vblk_io(vblk, VIRTIO_BLK_T_OUT, buf, count, idx);
+}
+
+/* 块设备层的请求处理函数，调用时中断是关闭的
+ * 整个 bio 链作为一个请求发出，放不进队列时逐段同步完成 */
+static int __vblk_request(virtio_blk_t *vblk, request_t *req){
+    u32 type = req->type == REQ_READ ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+
+    if (req->idx + req->count > vblk->capacity)
+        return EOF;
+
+    if (vblk_submit(vblk, type, req->idx, req->bio, req) != EOF)
+        return 0;
+
+    int status = 0;
+
+    for (bio_t *bio = req->bio; bio && status != EOF; bio = bio->next)
+        status = vblk_io(vblk, type, bio->buf, bio->count, bio->idx);
+    blk_end_request(req, status);
+    return 0;
+}
+
+static int __vblk_ioctl(virtio_blk_t *vblk, int cmd, void *args, int flags){
+    switch (cmd){
+        case DEV_CMD_SECTOR_START: return 0;
+        case DEV_CMD_SECTOR_COUNT: return (u32)vblk->capacity;
+        case DEV_CMD_QUEUE_DEPTH: return vblk->queue_depth;
+        case DEV_ERROR_REPORT:
+            printk(VBLK_WARNING_INFO "request failed, device status %x\n", virtio_get_status(&vblk->vdev));
+            break;
+        default: printk(VBLK_WARNING_INFO "ioctl %d hasn't been implemented\n", cmd);
+                return EOF;
+    }
+
+    return 0;
+}
+
+/* 下半部，回收完成的请求 */
+static void vblk_bottom_half(void *data){
+    virtio_blk_t *vblk = (virtio_blk_t *)data;
+
+    bool IF_stat = get_and_disable_IF();
+
+    vblk_reap(vblk);
+
+    set_IF(IF_stat);
+}
+
+/* 所有 virtio-blk 设备共用一个向量，上半部只检查哪些设备有完成的请求 */
+static void vblk_handler(u32 int_num){
+    for (u32 i = 0; i < vblk_cnt; ++i){
+        virtio_blk_t *vblk = vblks[i];
+        virtio_dev_t *vdev = &vblk->vdev;
+
+        /* INTx 电平中断必须读 ISR 才会撤销 */
+        if (vdev->int_mode == VIRTIO_INT_INTX && !(virtio_isr(vdev) & 1))
+            continue;
+        if (vblk->vq->last_used == vblk->vq->used->idx)
+            continue;
+
+        ++vdev->int_count;
+        schedule_work(&vblk->work);
+    }
+
+    lapic_send_eoi();
+}
+
+static virtio_blk_t *vblk_probe(pci_device_t *pci){
+    virtio_blk_t *vblk = (virtio_blk_t *)malloc(sizeof(virtio_blk_t));
+    virtio_dev_t *vdev = &vblk->vdev;
+    u32 features;
+
+    if (!virtio_pci_init(vdev, pci))
+        goto __FAIL;
+
+    if (!virtio_negotiate(vdev, VIRTIO_BLK_F_SEG_MAX, &features)){
+        printk(VBLK_WARNING_INFO "feature negotiation failed\n");
+        goto __FAIL;
+    }
+
+    /* legacy 接口中设备配置的位置和是否启用 MSI-X 有关，先安装中断再读配置 */
+    if (!virtio_int_init(vdev, VBLK_MSI_VECTOR, vblk_handler))
+        printk(VBLK_WARNING_INFO "no interrupt available, polling\n");
+
+    if ((vblk->vq = virtqueue_setup(vdev, 0)) == NULL)
+        goto __FAIL;
+
+    vblk->capacity = virtio_cfg_read32(vdev, VIRTIO_BLK_CFG_CAPACITY) |
+                     ((u64)virtio_cfg_read32(vdev, VIRTIO_BLK_CFG_CAPACITY + 4) << 32);
+    vblk->seg_max = features & VIRTIO_BLK_F_SEG_MAX ? virtio_cfg_read32(vdev, VIRTIO_BLK_CFG_SEG_MAX) : 1;
+    if (vblk->seg_max < 2)
+        vblk->seg_max = 2;
+
+    vblk->ctx = (vblk_ctx_t *)malloc(sizeof(vblk_ctx_t) * vblk->vq->size);
+    for (u16 i = 0; i < vblk->vq->size; ++i){
+        vblk->ctx[i].done = false;
+        vblk->ctx[i].req = NULL;
+        wait_queue_init(&vblk->ctx[i].wait);
+    }
+
+    vblk->queue_depth = vblk->vq->size / 3 < VBLK_QUEUE_DEPTH ? vblk->vq->size / 3 : VBLK_QUEUE_DEPTH;
+    wait_queue_init(&vblk->desc_wait);
+    work_init(&vblk->work, vblk_bottom_half, vblk);
+
+    virtio_set_status(vdev, virtio_get_status(vdev) | VIRTIO_STATUS_DRIVER_OK);
+    vdev->int_enabled = vdev->int_mode != VIRTIO_INT_NONE;
+
+    return vblk;
+
+__FAIL:
+    virtio_set_status(vdev, VIRTIO_STATUS_FAILED);
+    free(vblk);
+    return NULL;
+}
+
+static void vblk_install(virtio_blk_t *vblk){
+    char name[4];
+
+    vblks[vblk_cnt++] = vblk;
+
+    printk(VBLK_LOG_INFO "capacity %d sectors, seg_max %d, queue depth %d, %s\n",
+           (u32)vblk->capacity, vblk->seg_max, vblk->queue_depth,
+           vblk->vdev.int_mode == VIRTIO_INT_MSIX ? "MSI-X" :
+           vblk->vdev.int_mode == VIRTIO_INT_INTX ? "INTx" : "polling");
+
+    get_disk_name(name);
+    dev_t dev_idx = device_install(DEV_BLOCK, DEV_VIRTIO_DISK, vblk, name, 0,
+                __vblk_ioctl, __vblk_read_secs, __vblk_write_secs);
+    device_set_request(dev_idx, __vblk_request);
+
+    disk_part_install(dev_idx);
+}
+
+/* 安装所有 virtio-blk 设备，先找过渡设备再找只有 modern 接口的设备 */
+void virtio_blk_init(){
+    u16 ids[2] = {VIRTIO_PCI_LEGACY_ID(VIRTIO_ID_BLOCK), VIRTIO_PCI_MODERN_ID(VIRTIO_ID_BLOCK)};
+
+    for (int i = 0; i < 2; ++i){
+        pci_device_t *pci;
+
+        for (u32 idx = 0; vblk_cnt < VBLK_NR && (pci = get_device_by_id(VIRTIO_VENDOR_ID, ids[i], idx)) != NULL; ++idx){
+            virtio_blk_t *vblk = vblk_probe(pci);
+
+            if (vblk)
+                vblk_install(vblk);
+        }
+    }
+}
+
+/* 第 idx 个 virtio-blk 设备的中断次数，用于测试 */
+u32 *virtio_blk_int_count(u32 idx){
+    return idx < vblk_cnt ? &vblks[idx]->vdev.int_count : NULL;
+}
@@ -0,0 +1,133 @@
+#include <rdix/vma.h>
+#include <rdix/task.h>
+#include <rdix/memory.h>
+#include <rdix/kernel.h>
+#include <common/string.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define VMA_LOG_INFO __LOG("[vma]")
+#define VMA_WARNING_INFO __WARNING("[vma warning]")
+
+List_t *vma_list_create(){
+    return new_list();
+}
+
+vma_t *vma_add(List_t *vmas, u32 start, u32 end, u32 flags, m_inode *inode, u32 offset, u32 filesz){
+    assert(!(start & 0xfff) && !(end & 0xfff) && start < end);
+
+    vma_t *vma = (vma_t *)malloc(sizeof(vma_t));
+
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->inode = inode;
+    vma->offset = offset;
+    vma->filesz = filesz;
+    node_init(&vma->node, vma, start);
+
+    if (inode)
+        inode->count++;
+
+    list_push(vmas, &vma->node);
+
+    return vma;
+}
+
+/* fork 时复制 vma，已经装入的页由 copy_pde 写时共享，其余的页子进程自己装入 */
+List_t *vma_list_copy(List_t *vmas){
+    List_t *copy = vma_list_create();
+
+    if (vmas == NULL)
+        return copy;
+
+    /* list_push 压入头部，从尾部开始复制以保持顺序 */
+    for (ListNode_t *iter = vmas->end.previous; iter != &vmas->end; iter = iter->previous){
+        vma_t *vma = (vma_t *)iter->owner;
+        vma_add(copy, vma->start, vma->end, vma->flags, vma->inode, vma->offset, vma->filesz);
+    }
+
+    return copy;
+}
+
+void vma_list_release(List_t *vmas){
+    ListNode_t *node;
+
+    if (vmas == NULL)
+        return;
+
+    while ((node = list_pop(vmas)) != NULL){
+        vma_t *vma = (vma_t *)node->owner;
+
+        if (vma->inode)
+            iput(vma->inode);
+        free(vma);
+    }
+
+    free(vmas);
+}
+
+vma_t *vma_find(List_t *vmas, u32 vaddr){
+    for (ListNode_t *iter = vmas->end.next; iter != &vmas->end; iter = iter->next){
+        vma_t *vma = (vma_t *)iter->owner;
+
+        if (vaddr >= vma->start && vaddr < vma->end)
+            return vma;
+    }
+
+    return NULL;
+}
+
+/* 把 page 所在页中属于 vma 文件部分的内容读到 buf 中，读文件出错时返回 false
+ * 相邻两个段可能落在同一页中，所以要检查所有与该页相交的 vma */
+static bool vma_fill(List_t *vmas, u32 page, u8 *buf){
+    for (ListNode_t *iter = vmas->end.next; iter != &vmas->end; iter = iter->next){
+        vma_t *vma = (vma_t *)iter->owner;
+        u32 lo = vma->start > page ? vma->start : page;
+        u32 hi = vma->start + vma->filesz;
+
+        if (vma->inode == NULL || page + PAGE_SIZE <= vma->start || page >= vma->end)
+            continue;
+
+        if (hi > page + PAGE_SIZE)
+            hi = page + PAGE_SIZE;
+        if (lo >= hi)
+            continue;
+
+        if (inode_read(vma->inode, (char *)buf + (lo - page), hi - lo, vma->offset + (lo - vma->start)) != hi - lo)
+            return false;
+    }
+    return true;
+}
+
+/* vma 只保存在线程组的 leader 中，clone 的线程和 uring 工作线程共享 leader 的地址空间 */
+bool vma_fault(u32 vaddr){
+    List_t *vmas = current_leader()->vmas;
+    u32 page = vaddr & ~0xfff;
+
+    if (vmas == NULL || vma_find(vmas, page) == NULL)
+        return false;
+
+    /* 先读到内核页中，读文件时可能睡眠
+     * 如果先建立映射，同一地址空间的其他线程会看到还没有填好的页 */
+    u8 *buf = (u8 *)alloc_kpage(1);
+    memset(buf, 0, PAGE_SIZE);
+
+    /* 程序段读不出来时没有办法继续执行，结束当前任务 */
+    if (!vma_fill(vmas, page, buf)){
+        free_kpage(buf, 1);
+        printk(VMA_WARNING_INFO "can't load page 0x%p, killing %s\n", page, current_leader()->name);
+        sys_exit(EOF);
+    }
+
+    /* 睡眠期间其他线程可能已经装入了这一页 */
+    page_entry_t *entry = &get_pte(page, false)[TIDX(page)];
+    if (!entry->present){
+        link_page(page);
+        memcpy((void *)page, buf, PAGE_SIZE);
+    }
+
+    free_kpage(buf, 1);
+
+    return true;
+}
@@ -179,6 +179,9 @@ int vsprintf(char *buf, const char *fmt, va_list arg){
             }
             str = number(str, va_arg(arg, u32), 16, field_width, precision, flags);
             break;
+        case 'u':
+            str = number(str, va_arg(arg, u32), 10, field_width, precision, flags);
+            break;
         case 'o':
             str = number(str, va_arg(arg, u32), 8, field_width, precision, flags);
             break;
@@ -189,11 +192,22 @@ int vsprintf(char *buf, const char *fmt, va_list arg){
             break;
         case 's':
             s = va_arg(arg, char *);
-            while (*s) *str++ = *s++;
+            /* 支持 %-12s 这样的宽度对齐 */
+            {
+                int len = 0;
+                while (s[len]) ++len;
+                if (!(flags & LEFT))
+                    while (len < field_width--) *str++ = ' ';
+                while (*s) *str++ = *s++;
+                while (len < field_width--) *str++ = ' ';
+            }
             break;
         case 'c':
             *str++ = va_arg(arg, char);
             break;
+        case '%':
+            *str++ = '%';
+            break;
         default:
             break;
         }
@@ -0,0 +1,73 @@
+#include <rdix/wait.h>
+#include <rdix/task.h>
+#include <rdix/kernel.h>
+#include <common/assert.h>
+#include <common/clock.h>
+
+extern List_t *sleep_list;
+extern time_t jiffies;
+
+void wait_queue_init(wait_queue_t *wq){
+    list_init(&wq->list);
+}
+
+time_t wait_deadline(time_t timeout){
+    if (timeout == 0)
+        return 0;
+
+    return jiffies + (timeout + JIFFY - 1) / JIFFY;
+}
+
+bool wait_on_until(wait_queue_t *wq, time_t deadline){
+    assert(!get_IF());
+
+    ListNode_t *current = current_task();
+    ListNode_t entry;
+
+    if (deadline && jiffies >= deadline)
+        return false;
+
+    /* 唤醒从尾部开始，先等待的先被唤醒 */
+    node_init(&entry, current, 0);
+    list_push(&wq->list, &entry);
+
+    if (deadline){
+        current->value = deadline;
+        ((TCB_t *)current->owner)->state = TASK_SLEEPING;
+        list_insert(sleep_list, current, greater);
+        schedule();
+    }
+    else
+        block(NULL, NULL, TASK_BLOCKED);
+
+    /* 被 wake_up 唤醒时节点已经出队 */
+    if (entry.container == NULL)
+        return true;
+
+    remove_node(&entry);
+    return !(deadline && jiffies >= deadline);
+}
+
+u32 wake_up(wait_queue_t *wq, u32 nr){
+    bool IF_stat = get_and_disable_IF();
+    u32 woken = 0;
+
+    while (woken < nr){
+        ListNode_t *entry = list_popback(&wq->list);
+
+        if (entry == NULL)
+            break;
+
+        ListNode_t *task = (ListNode_t *)entry->owner;
+        task_state_t state = ((TCB_t *)task->owner)->state;
+
+        /* 已经超时的任务只需要出队 */
+        if (state == TASK_BLOCKED || state == TASK_SLEEPING){
+            unblock(task);
+            ++woken;
+        }
+    }
+
+    set_IF(IF_stat);
+    return woken;
+}
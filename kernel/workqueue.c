@@ -0,0 +1,85 @@
+#include <rdix/workqueue.h>
+#include <rdix/task.h>
+#include <rdix/kernel.h>
+#include <common/assert.h>
+#include <common/interrupt.h>
+
+#define WORKQUEUE_LOG_INFO __LOG("[workqueue]")
+
+#define SYSTEM_WORKERS 1
+#define SYSTEM_WORKER_PRIORITY 5
+
+static workqueue_t *system_wq;
+
+/* 工作线程，参数保存在 edi 中 */
+static void worker_thread(){
+    workqueue_t *wq;
+
+    asm volatile(
+        "movl %%edi,%0\n"
+        :"=m"(wq)
+    );
+
+    /* 内核线程在创建时需要手动开中断 */
+    set_IF(true);
+
+    while (true){
+        bool IF_stat = get_and_disable_IF();
+
+        wait_event(&wq->wait, !list_isempty(&wq->works));
+
+        /* 出队后 work 可以被再次加入，func 执行期间新来的中断不会丢失 */
+        work_t *work = (work_t *)list_popback(&wq->works)->owner;
+
+        set_IF(IF_stat);
+
+        work->func(work->data);
+    }
+}
+
+workqueue_t *workqueue_create(const char *name, u32 workers, u32 priority){
+    workqueue_t *wq = (workqueue_t *)malloc(sizeof(workqueue_t));
+
+    wq->name = name;
+    list_init(&wq->works);
+    wait_queue_init(&wq->wait);
+
+    for (u32 i = 0; i < workers; ++i)
+        task_create(worker_thread, wq, name, priority, KERNEL_UID);
+
+    return wq;
+}
+
+void work_init(work_t *work, work_func_t func, void *data){
+    node_init(&work->node, work, 0);
+    work->func = func;
+    work->data = data;
+}
+
+bool queue_work(workqueue_t *wq, work_t *work){
+    bool IF_stat = get_and_disable_IF();
+
+    if (work->node.container != NULL){
+        set_IF(IF_stat);
+        return false;
+    }
+
+    list_push(&wq->works, &work->node);
+    wake_up_one(&wq->wait);
+
+    set_IF(IF_stat);
+    return true;
+}
+
+/* 系统工作队列建立之前产生的中断只能丢弃下半部 */
+bool schedule_work(work_t *work){
+    if (system_wq == NULL)
+        return false;
+    return queue_work(system_wq, work);
+}
+
+/* 需要在 task_init 之后调用 */
+void workqueue_init(){
+    system_wq = workqueue_create("events", SYSTEM_WORKERS, SYSTEM_WORKER_PRIORITY);
+    printk(WORKQUEUE_LOG_INFO "system workqueue with %d worker\n", SYSTEM_WORKERS);
+}